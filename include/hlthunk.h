@@ -16,6 +16,8 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
 
 #define hlthunk_public  __attribute__((visibility("default")))
 
@@ -52,6 +54,386 @@ struct hlthunk_cs_out {
 	uint32_t status;
 };
 
+struct hlthunk_cb_cache_stats {
+	uint64_t lookups;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t bytes_avoided;
+	uint64_t evictions;
+	uint32_t num_entries;
+};
+
+struct hlthunk_cs_window_stats {
+	uint64_t submitted;
+	uint64_t completed;
+	/* Submissions that waited for a credit, and that found none */
+	uint64_t blocked;
+	uint64_t rejected;
+	uint32_t inflight;
+	uint32_t peak_inflight;
+	uint32_t max_inflight;
+};
+
+struct hlthunk_cs_submitter_stats {
+	/* Pushed items that were submitted, and the CSs they were packed in */
+	uint64_t items;
+	uint64_t cs;
+	/* CSs submitted because they were full and because of the deadline */
+	uint64_t full_flushes;
+	uint64_t deadline_flushes;
+	uint64_t failed_cs;
+};
+
+struct hlthunk_ctx_restore_stats {
+	uint64_t cs;
+	/* CSs that carried the restore CBs, and how many they carried */
+	uint64_t restore_cs;
+	uint64_t restore_chunks;
+	/* Restore chunks that weren't attached because they were clean */
+	uint64_t skipped_chunks;
+};
+
+struct hlthunk_host_map_entry {
+	void *host_virt_addr;
+	uint64_t size;
+	uint64_t hint_addr;
+	/* Returned device VA, 0 if the mapping failed */
+	uint64_t device_virt_addr;
+	/* Returned result of the mapping */
+	int rc;
+};
+
+/* Flags of hlthunk_host_alloc */
+#define HLTHUNK_HOST_ALLOC_NO_1GB	(1 << 0)
+#define HLTHUNK_HOST_ALLOC_NO_2MB	(1 << 1)
+#define HLTHUNK_HOST_ALLOC_NO_THP	(1 << 2)
+/* Fail instead of falling back to regular pages */
+#define HLTHUNK_HOST_ALLOC_HUGE_ONLY	(1 << 3)
+
+struct hlthunk_host_buf {
+	void *host_ptr;
+	uint64_t device_virt_addr;
+	/* Allocated size, rounded up to the page size */
+	uint64_t size;
+	uint64_t page_size;
+	/*
+	 * The memory is backed by transparent huge pages, which the kernel
+	 * may still back partially with regular pages
+	 */
+	bool transparent;
+};
+
+struct hlthunk_reg_field {
+	/* Name of the field, e.g. PQF_EN */
+	const char *name;
+	uint32_t shift;
+	uint32_t width;
+	/* Value of the field, shifted down to bit 0 */
+	uint32_t value;
+};
+
+struct hlthunk_reg_snapshot_block {
+	/* Name of the block in the register database, e.g. TPC0_QM */
+	const char *name;
+	/*
+	 * Addresses of the registers to read, or NULL to read all the
+	 * registers of the block
+	 */
+	const uint64_t *addrs;
+	uint32_t num_regs;
+};
+
+struct hlthunk_reg_diff {
+	/* Offset of the register in the configuration space */
+	uint64_t addr;
+	uint32_t old_val;
+	uint32_t new_val;
+};
+
+#define HLTHUNK_CS_PROFILE_MAX_QUEUES	16
+
+struct hlthunk_cs_profile_queue {
+	uint32_t queue_index;
+	/* From the submission until the queue started its first chunk */
+	int64_t queue_delay_ns;
+	/* From the start of the first chunk until the end of the last one */
+	uint64_t exec_ns;
+	/* From the end of the last chunk until the host saw the completion */
+	int64_t notify_ns;
+};
+
+struct hlthunk_cs_profile {
+	uint64_t seq;
+	/* CLOCK_MONOTONIC times of the submission and of its completion */
+	uint64_t submit_ns;
+	uint64_t complete_ns;
+	uint32_t num_queues;
+	struct hlthunk_cs_profile_queue queues[HLTHUNK_CS_PROFILE_MAX_QUEUES];
+};
+
+/* The trace ID of an STM is this ID plus its index, e.g. GOYA_STM_TPC0_EML */
+#define HLTHUNK_TRACE_STM_FIRST_ID	0x10
+/* The trace ID of a BMON is this ID plus its index, e.g. GOYA_BMON_MMU_0 */
+#define HLTHUNK_TRACE_BMON_FIRST_ID	0x30
+
+enum hlthunk_trace_profile {
+	/* The DMA channels and the DMA macro */
+	HLTHUNK_TRACE_PROFILE_DMA,
+	/* The EMLs of the TPC engines */
+	HLTHUNK_TRACE_PROFILE_TPC_EML,
+	HLTHUNK_TRACE_PROFILE_MMU,
+	HLTHUNK_TRACE_PROFILE_MAX
+};
+
+struct hlthunk_trace_params {
+	enum hlthunk_trace_profile profile;
+	/* File the trace is written to, which is truncated */
+	const char *path;
+	/* Size of the ETR buffer in DRAM, 0 for the default */
+	uint64_t buffer_size;
+	/* Interval between drains of the ETR buffer, 0 for the default */
+	uint32_t poll_interval_us;
+};
+
+struct hlthunk_trace_stats {
+	/* Bytes of trace written to the file */
+	uint64_t bytes;
+	uint32_t num_drains;
+	/*
+	 * The write pointer of the ETR couldn't be read while tracing, so the
+	 * buffer was only drained when the trace was stopped
+	 */
+	bool drained_at_stop_only;
+};
+
+struct hlthunk_trace_decode_params {
+	/* Trace captured by hlthunk_trace_start */
+	const char *trace_path;
+	/* File the engine timelines are written to, in Chrome trace format */
+	const char *json_path;
+	/* Frequency of the timestamps in Hz, 0 to take it from the trace */
+	uint64_t ts_freq;
+	/* The hardware events that mark the engine of an STM busy and idle */
+	uint32_t busy_event;
+	uint32_t idle_event;
+	/* Number of decoding threads, 0 for one per online CPU */
+	uint32_t num_threads;
+};
+
+struct hlthunk_trace_decode_stats {
+	/* STMs that had events */
+	uint32_t num_sources;
+	/* Parts of the trace between sync packets, decoded in parallel */
+	uint32_t num_segments;
+	uint64_t num_events;
+	uint64_t num_intervals;
+	/* Segments whose decoding stopped at an invalid packet */
+	uint32_t num_errors;
+};
+
+/* Counters of an SPMU, which are shared by the events of an engine */
+#define HLTHUNK_SPMU_MAX_COUNTERS	6
+#define HLTHUNK_SPMU_MAX_EVENTS		32
+
+struct hlthunk_spmu_engine {
+	/* Index of the SPMU, e.g. GOYA_SPMU_TPC0_EML */
+	uint32_t spmu;
+	/*
+	 * Events beyond the number of counters are multiplexed in groups that
+	 * take turns, a group per sampling interval
+	 */
+	uint32_t num_events;
+	uint64_t events[HLTHUNK_SPMU_MAX_EVENTS];
+};
+
+struct hlthunk_spmu_sampler_params {
+	const struct hlthunk_spmu_engine *engines;
+	uint32_t num_engines;
+	/* 0 for the default of 1ms */
+	uint32_t interval_us;
+	/* Samples kept until they are read, 0 for the default */
+	uint32_t ring_size;
+	/* CSV file every sample is also written to. May be NULL */
+	const char *dump_path;
+};
+
+/* The counts of the event group that was active on an engine */
+struct hlthunk_spmu_sample {
+	/* CLOCK_MONOTONIC time of the end of the interval */
+	uint64_t timestamp_ns;
+	uint64_t interval_ns;
+	uint64_t cycles;
+	uint64_t events[HLTHUNK_SPMU_MAX_COUNTERS];
+	uint64_t deltas[HLTHUNK_SPMU_MAX_COUNTERS];
+	/* Events per second during the interval */
+	uint64_t rates[HLTHUNK_SPMU_MAX_COUNTERS];
+	/* Index of the engine in the parameters of the sampler */
+	uint32_t engine;
+	uint32_t num_events;
+	/* Mask of the counters that overflowed */
+	uint32_t overflow;
+};
+
+struct hlthunk_spmu_total {
+	/* Events counted while the group of the event was active */
+	uint64_t count;
+	uint64_t active_ns;
+	uint64_t elapsed_ns;
+	/* The count scaled from the active time to the elapsed time */
+	uint64_t estimate;
+	/* Events per second while the group of the event was active */
+	uint64_t rate;
+};
+
+/* Address ranges that a BMON counts the bytes of */
+#define HLTHUNK_BW_MONITOR_RANGES	2
+
+/*
+ * An access is in the range when its address, masked with the mask, is the
+ * start of the range
+ */
+struct hlthunk_bw_monitor_range {
+	uint64_t start;
+	uint64_t mask;
+};
+
+struct hlthunk_bw_monitor_params {
+	/*
+	 * BMONs to attach, e.g. GOYA_BMON_DMA_CH_1_0. BMONs of the DMA, TPC
+	 * EML and MMU trace profiles are supported
+	 */
+	const uint32_t *bmons;
+	uint32_t num_bmons;
+	/* Ranges that every BMON counts */
+	struct hlthunk_bw_monitor_range ranges[HLTHUNK_BW_MONITOR_RANGES];
+	/* Length of a capture window in cycles, 0 for the default */
+	uint32_t window_cycles;
+	/* File the trace of the BMONs is kept in, NULL for a temporary one */
+	const char *trace_path;
+	/* Size of the ETR buffer in DRAM, 0 for the default */
+	uint64_t buffer_size;
+};
+
+struct hlthunk_bw_monitor_result {
+	uint32_t bmon;
+	/* Capture windows that the BMON reported */
+	uint32_t num_windows;
+	uint64_t bytes[HLTHUNK_BW_MONITOR_RANGES];
+	/* The most bytes of a single capture window */
+	uint64_t max_window_bytes[HLTHUNK_BW_MONITOR_RANGES];
+	/* Bytes per second over the time the BMON was attached */
+	uint64_t bandwidth[HLTHUNK_BW_MONITOR_RANGES];
+	/* Reports that couldn't be decoded */
+	uint32_t num_errors;
+};
+
+/* Engines of the busy engines mask, e.g. GOYA_ENGINE_ID_TPC_0 */
+#define HLTHUNK_ENGINE_UTIL_MAX_ENGINES		32
+#define HLTHUNK_ENGINE_UTIL_MAX_WINDOWS		4
+#define HLTHUNK_ENGINE_UTIL_MAX_RATE_HZ		10000
+/* Longest sliding window, whose samples are all kept in memory */
+#define HLTHUNK_ENGINE_UTIL_MAX_WINDOW_MS	60000
+
+struct hlthunk_engine_util_params {
+	/* Samples of the busy engines per second, 0 for the maximum */
+	uint32_t rate_hz;
+	/*
+	 * Lengths of the sliding windows, up to
+	 * HLTHUNK_ENGINE_UTIL_MAX_WINDOW_MS each. None for a single one of
+	 * 100ms
+	 */
+	uint32_t windows_ms[HLTHUNK_ENGINE_UTIL_MAX_WINDOWS];
+	uint32_t num_windows;
+};
+
+struct hlthunk_engine_util {
+	/* CLOCK_MONOTONIC time of the last sample of the window */
+	uint64_t timestamp_ns;
+	/* Samples in the window, fewer than its length right after the start */
+	uint32_t num_samples;
+	/* Ticks that were skipped because a sample took too long */
+	uint32_t num_missed;
+	uint32_t busy_samples[HLTHUNK_ENGINE_UTIL_MAX_ENGINES];
+	/* Part of the samples of the window in which the engine was busy */
+	float busy[HLTHUNK_ENGINE_UTIL_MAX_ENGINES];
+};
+
+#define HLTHUNK_HW_EVENTS_SHM_MAGIC	0x48574556
+
+/*
+ * The layout of the shared memory segment that the hardware event counters
+ * are published in. The header is followed by the counters as the driver
+ * returns them and then by their deltas in the last update, num_events
+ * uint32_t each
+ */
+struct hlthunk_hw_events_shm {
+	uint32_t magic;
+	uint32_t num_events;
+	/* Odd while the counters are updated */
+	uint32_t seq;
+	uint32_t pad;
+	/* CLOCK_MONOTONIC time of the last update */
+	uint64_t timestamp_ns;
+};
+
+struct hlthunk_host_prefetch_stats {
+	uint64_t prepared;
+	/* Lookups that found the range mapped, or waited for it to be mapped */
+	uint64_t hits;
+	uint64_t waits;
+	/* Lookups of ranges that weren't prepared */
+	uint64_t misses;
+	uint64_t pinned_bytes;
+	uint64_t peak_pinned_bytes;
+	/* Times the prefetch thread waited for room in the budget */
+	uint64_t budget_waits;
+};
+
+/*
+ * Operations through which the library talks to the driver. The default
+ * backend calls the kernel driver, and the "model" backend is an in-process
+ * device model that doesn't require any hardware.
+ */
+struct hlthunk_backend_ops {
+	const char *name;
+	int (*open)(const char *path, int flags);
+	int (*close)(int fd);
+	int (*ioctl)(int fd, unsigned long request, void *arg);
+	void *(*mmap)(void *addr, size_t len, int prot, int flags, int fd,
+			off_t offset);
+	int (*munmap)(void *addr, size_t len);
+};
+
+/*
+ * Parameters of the device model's performance estimates. Bandwidths are in
+ * bytes per second and costs are in nanoseconds.
+ */
+struct hlthunk_model_perf_params {
+	uint64_t pcie_h2d_bw;
+	uint64_t pcie_d2h_bw;
+	uint64_t sram_bw;
+	uint64_t dram_bw;
+	uint64_t dma_channel_bw;
+	uint32_t dma_channels;
+	uint32_t dma_setup_ns;
+	uint32_t pkt_fetch_ns;
+	uint32_t pkt_exec_ns;
+	uint32_t cs_submit_ns;
+	uint32_t signal_ns;
+};
+
+/* Estimated times of a CS, in ns from the opening of the device */
+struct hlthunk_model_cs_times {
+	uint64_t submit_ns;
+	uint64_t start_ns;
+	uint64_t done_ns;
+};
+
+struct hlthunk_model_engine_util {
+	uint64_t elapsed_ns;
+	uint64_t busy_ns[GOYA_ENGINE_ID_SIZE];
+};
+
 enum hlthunk_device_name {
 	HLTHUNK_DEVICE_GOYA,
 	HLTHUNK_DEVICE_PLACEHOLDER1,
@@ -80,6 +462,9 @@ hlthunk_public int hlthunk_request_command_buffer(int fd, uint32_t cb_size,
 
 hlthunk_public int hlthunk_destroy_command_buffer(int fd, uint64_t cb_handle);
 
+hlthunk_public void *hlthunk_cb_mmap(int fd, size_t len, uint64_t cb_handle);
+hlthunk_public int hlthunk_cb_munmap(void *addr, size_t len);
+
 hlthunk_public int hlthunk_command_submission(int fd, struct hlthunk_cs_in *in,
 						struct hlthunk_cs_out *out);
 
@@ -98,11 +483,38 @@ hlthunk_public uint64_t hlthunk_host_memory_map(int fd, void *host_virt_addr,
 						uint64_t host_size);
 
 hlthunk_public int hlthunk_memory_unmap(int fd, uint64_t device_virt_addr);
+
+hlthunk_public int hlthunk_host_memory_map_batch(int fd,
+					struct hlthunk_host_map_entry *entries,
+					uint32_t num, uint32_t num_threads);
+
+hlthunk_public int hlthunk_host_memory_unmap_batch(int fd,
+					struct hlthunk_host_map_entry *entries,
+					uint32_t num);
+
 hlthunk_public int hlthunk_debug(int fd, struct hl_debug_args *debug);
 
 hlthunk_public void *hlthunk_malloc(int size);
 hlthunk_public void hlthunk_free(void *pt);
 
+/* Functions for selecting the driver backend */
+
+hlthunk_public int hlthunk_set_backend(const struct hlthunk_backend_ops *ops);
+hlthunk_public const struct hlthunk_backend_ops *hlthunk_get_backend(void);
+hlthunk_public const struct hlthunk_backend_ops *hlthunk_get_backend_by_name(
+							const char *name);
+
+/* Functions for the performance estimates of the device model */
+
+hlthunk_public void hlthunk_model_get_perf_params(
+				struct hlthunk_model_perf_params *params);
+hlthunk_public int hlthunk_model_set_perf_params(
+				const struct hlthunk_model_perf_params *params);
+hlthunk_public int hlthunk_model_get_cs_times(int fd, uint64_t seq,
+				struct hlthunk_model_cs_times *times);
+hlthunk_public int hlthunk_model_get_engine_util(int fd,
+				struct hlthunk_model_engine_util *util);
+
 /* Functions for random number generation */
 
 hlthunk_public void *hlthunk_random_create(unsigned long seed);
@@ -122,6 +534,209 @@ hlthunk_public int hlthunk_hash_next(void *t, unsigned long *key, void **value);
 hlthunk_public int hlthunk_hash_first(void *t, unsigned long *key,
 					void **value);
 
+/* Functions for recording command submissions */
+
+hlthunk_public int hlthunk_record_start(int fd, const char *path);
+hlthunk_public int hlthunk_record_stop(void);
+
+/* Functions for content-addressed command buffers cache */
+
+hlthunk_public void *hlthunk_cb_cache_create(int fd, uint32_t max_entries);
+hlthunk_public void hlthunk_cb_cache_destroy(void *cache);
+hlthunk_public int hlthunk_cb_cache_get(void *cache, const void *pkts,
+					uint32_t size, bool external,
+					uint64_t *cb_handle);
+hlthunk_public int hlthunk_cb_cache_put(void *cache, uint64_t cb_handle,
+					uint64_t seq);
+hlthunk_public int hlthunk_cb_cache_get_stats(void *cache,
+					struct hlthunk_cb_cache_stats *stats);
+
+/* Functions for bounding the number of in-flight command submissions */
+
+hlthunk_public void *hlthunk_cs_window_create(int fd, uint32_t max_inflight);
+hlthunk_public void hlthunk_cs_window_destroy(void *window);
+hlthunk_public int hlthunk_cs_window_set_depth(void *window,
+					uint32_t queue_index,
+					uint32_t max_inflight);
+hlthunk_public int hlthunk_cs_window_submit(void *window,
+					struct hlthunk_cs_in *in,
+					struct hlthunk_cs_out *out, bool block);
+hlthunk_public int hlthunk_cs_window_get_stats(void *window,
+					uint32_t queue_index,
+					struct hlthunk_cs_window_stats *stats);
+
+/* Functions for asynchronous submission of command buffers */
+
+hlthunk_public void *hlthunk_cs_submitter_create(int fd, uint32_t ring_size,
+						uint32_t max_chunks,
+						uint32_t flush_timeout_us);
+hlthunk_public void hlthunk_cs_submitter_destroy(void *submitter);
+hlthunk_public int hlthunk_cs_submitter_push(void *submitter,
+						uint64_t cb_handle,
+						uint32_t cb_size,
+						uint32_t queue_index,
+						void **future);
+hlthunk_public int hlthunk_cs_submitter_get_stats(void *submitter,
+				struct hlthunk_cs_submitter_stats *stats);
+hlthunk_public int hlthunk_cs_future_wait(void *future, uint64_t timeout_us,
+						uint32_t *status);
+hlthunk_public int hlthunk_cs_future_get_seq(void *future, uint64_t *seq);
+hlthunk_public void hlthunk_cs_future_release(void *future);
+
+/* Functions for managing the context-restore phase of command submissions */
+
+hlthunk_public void *hlthunk_ctx_restore_create(int fd);
+hlthunk_public void hlthunk_ctx_restore_destroy(void *ctx);
+hlthunk_public int hlthunk_ctx_restore_set(void *ctx, uint32_t queue_index,
+						uint64_t cb_handle,
+						uint32_t cb_size);
+hlthunk_public int hlthunk_ctx_restore_mark_dirty(void *ctx,
+						uint32_t queue_index);
+hlthunk_public int hlthunk_ctx_restore_submit(void *ctx,
+						struct hlthunk_cs_in *in,
+						struct hlthunk_cs_out *out);
+hlthunk_public int hlthunk_ctx_restore_get_stats(void *ctx,
+				struct hlthunk_ctx_restore_stats *stats);
+
+/* Functions for translating addresses inside mapped host memory */
+
+hlthunk_public int hlthunk_host_ptr_to_device_va(int fd,
+						const void *host_virt_addr,
+						uint64_t *device_virt_addr);
+hlthunk_public int hlthunk_device_va_to_host_ptr(int fd,
+						uint64_t device_virt_addr,
+						void **host_virt_addr);
+
+/* Functions for accessing device registers through debugfs */
+
+hlthunk_public void *hlthunk_reg_open(int fd);
+hlthunk_public void hlthunk_reg_close(void *regs);
+hlthunk_public int hlthunk_reg_read(void *regs, uint64_t addr, uint32_t *val);
+hlthunk_public int hlthunk_reg_write(void *regs, uint64_t addr, uint32_t val);
+hlthunk_public int hlthunk_reg_read_range(void *regs, uint64_t addr,
+						uint32_t *vals, uint32_t num);
+hlthunk_public int hlthunk_reg_write_range(void *regs, uint64_t addr,
+						const uint32_t *vals,
+						uint32_t num);
+hlthunk_public int hlthunk_reg_read_list(void *regs, const uint64_t *addrs,
+						uint32_t *vals, uint32_t num);
+
+/* Functions for looking up registers in the register database */
+
+hlthunk_public int hlthunk_regdb_get_name(enum hlthunk_device_name device,
+						uint64_t addr, char *name,
+						size_t len);
+hlthunk_public int hlthunk_regdb_get_addr(enum hlthunk_device_name device,
+						const char *name,
+						uint64_t *addr);
+hlthunk_public int hlthunk_regdb_decode(enum hlthunk_device_name device,
+					uint64_t addr, uint32_t val,
+					struct hlthunk_reg_field *fields,
+					uint32_t max_fields);
+
+/* Functions for taking and comparing snapshots of the engine registers */
+
+hlthunk_public void *hlthunk_reg_snapshot_take(int fd,
+			const struct hlthunk_reg_snapshot_block *blocks,
+			uint32_t num_blocks);
+hlthunk_public void hlthunk_reg_snapshot_free(void *snap);
+hlthunk_public int hlthunk_reg_snapshot_save(void *snap, const char *path);
+hlthunk_public void *hlthunk_reg_snapshot_load(const char *path);
+hlthunk_public int hlthunk_reg_snapshot_get(void *snap, uint64_t addr,
+						uint32_t *val);
+hlthunk_public int hlthunk_reg_snapshot_diff(void *old_snap, void *new_snap,
+					struct hlthunk_reg_diff *diffs,
+					uint32_t max_diffs);
+
+/* Functions for profiling command submissions with device timestamps */
+
+hlthunk_public int hlthunk_get_timestamp_freq(int fd, uint64_t *freq_hz);
+hlthunk_public void *hlthunk_cs_profiler_create(int fd, uint32_t max_cs);
+hlthunk_public void hlthunk_cs_profiler_destroy(void *prof);
+hlthunk_public int hlthunk_cs_profiler_submit(void *prof,
+						struct hlthunk_cs_in *in,
+						struct hlthunk_cs_out *out);
+hlthunk_public int hlthunk_cs_profiler_wait(void *prof, uint64_t seq,
+					uint64_t timeout_us, uint32_t *status,
+					struct hlthunk_cs_profile *profile);
+
+/* Functions for capturing CoreSight traces */
+hlthunk_public int hlthunk_trace_find_profile(const char *name);
+hlthunk_public const char *hlthunk_trace_get_profile_name(
+					enum hlthunk_trace_profile profile);
+hlthunk_public void *hlthunk_trace_start(int fd,
+				const struct hlthunk_trace_params *params);
+hlthunk_public int hlthunk_trace_stop(void *trace,
+					struct hlthunk_trace_stats *stats);
+hlthunk_public int hlthunk_trace_decode(
+			const struct hlthunk_trace_decode_params *params,
+			struct hlthunk_trace_decode_stats *stats);
+
+/* Functions for sampling the SPMU performance counters */
+hlthunk_public void *hlthunk_spmu_sampler_create(int fd,
+			const struct hlthunk_spmu_sampler_params *params);
+hlthunk_public int hlthunk_spmu_sampler_stop(void *sampler);
+hlthunk_public void hlthunk_spmu_sampler_destroy(void *sampler);
+hlthunk_public int hlthunk_spmu_sampler_read(void *sampler,
+					struct hlthunk_spmu_sample *samples,
+					uint32_t max_samples);
+hlthunk_public int hlthunk_spmu_sampler_get_total(void *sampler,
+					uint32_t engine, uint32_t event,
+					struct hlthunk_spmu_total *total);
+hlthunk_public uint64_t hlthunk_spmu_sampler_get_dropped(void *sampler);
+
+/* Functions for measuring the bus bandwidth with the BMONs */
+hlthunk_public void *hlthunk_bw_monitor_start(int fd,
+			const struct hlthunk_bw_monitor_params *params);
+hlthunk_public int hlthunk_bw_monitor_stop(void *monitor,
+				struct hlthunk_bw_monitor_result *results,
+				uint32_t num_results);
+
+/* Functions for sampling the utilization of the engines */
+hlthunk_public void *hlthunk_engine_util_create(int fd,
+			const struct hlthunk_engine_util_params *params);
+hlthunk_public void hlthunk_engine_util_destroy(void *sampler);
+hlthunk_public int hlthunk_engine_util_get(void *sampler, uint32_t window,
+					struct hlthunk_engine_util *util);
+
+/* Functions for reading the hardware event counters */
+hlthunk_public void *hlthunk_hw_events_open(int fd, const char *shm_name);
+hlthunk_public void hlthunk_hw_events_close(void *events);
+hlthunk_public int hlthunk_hw_events_update(void *events,
+						const uint32_t **deltas,
+						uint32_t *num_events);
+hlthunk_public int hlthunk_hw_events_get_total(void *events, uint32_t event,
+						uint64_t *total);
+hlthunk_public const char *hlthunk_hw_events_get_name(
+					enum hlthunk_device_name device,
+					uint32_t event);
+
+/* Functions for placing host memory and threads near the device */
+
+hlthunk_public int hlthunk_get_numa_node(int fd, int *node);
+hlthunk_public int hlthunk_numa_bind_memory(void *ptr, uint64_t size,
+						int node);
+hlthunk_public int hlthunk_bind_thread_to_device(int fd);
+
+/* Functions for allocating host memory with huge pages */
+
+hlthunk_public int hlthunk_host_alloc(int fd, uint64_t size, uint32_t flags,
+					struct hlthunk_host_buf *buf);
+hlthunk_public int hlthunk_host_free(int fd, struct hlthunk_host_buf *buf);
+
+/* Functions for mapping host memory in the background ahead of its use */
+
+hlthunk_public void *hlthunk_host_prefetch_create(int fd, uint64_t budget);
+hlthunk_public void hlthunk_host_prefetch_destroy(void *pf);
+hlthunk_public int hlthunk_host_prefetch_prepare(void *pf, void *ptr,
+							uint64_t size);
+hlthunk_public int hlthunk_host_prefetch_get_va(void *pf, void *ptr,
+						bool wait,
+						uint64_t *device_virt_addr);
+hlthunk_public int hlthunk_host_prefetch_release(void *pf, void *ptr);
+hlthunk_public int hlthunk_host_prefetch_get_stats(void *pf,
+				struct hlthunk_host_prefetch_stats *stats);
+
 #ifdef __cplusplus
 }   //extern "C"
 #endif
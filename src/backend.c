@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+static int kernel_open(const char *path, int flags)
+{
+	return open(path, flags, 0);
+}
+
+static int kernel_ioctl(int fd, unsigned long request, void *arg)
+{
+	return ioctl(fd, request, arg);
+}
+
+const struct hlthunk_backend_ops hlthunk_kernel_backend = {
+	.name = "kernel",
+	.open = kernel_open,
+	.close = close,
+	.ioctl = kernel_ioctl,
+	.mmap = mmap,
+	.munmap = munmap
+};
+
+static const struct hlthunk_backend_ops *builtin_backends[] = {
+	&hlthunk_kernel_backend,
+	&hlthunk_model_backend
+};
+
+static const struct hlthunk_backend_ops *backend;
+static int backend_users;
+
+/*
+ * The backend is chosen on first use, so the HLTHUNK_BACKEND environment
+ * variable works for applications that never call hlthunk_set_backend
+ */
+const struct hlthunk_backend_ops *hlthunk_backend(void)
+{
+	const struct hlthunk_backend_ops *ops, *expected = NULL;
+	const char *name;
+
+	ops = __atomic_load_n(&backend, __ATOMIC_ACQUIRE);
+	if (ops)
+		return ops;
+
+	name = getenv("HLTHUNK_BACKEND");
+	ops = name ? hlthunk_get_backend_by_name(name) : NULL;
+	if (!ops) {
+		if (name)
+			pr_warn("Unknown backend %s, using kernel\n", name);
+		ops = &hlthunk_kernel_backend;
+	}
+
+	if (!__atomic_compare_exchange_n(&backend, &expected, ops, false,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		ops = expected;
+
+	return ops;
+}
+
+void hlthunk_backend_get(void)
+{
+	__atomic_add_fetch(&backend_users, 1, __ATOMIC_RELAXED);
+}
+
+void hlthunk_backend_put(void)
+{
+	__atomic_sub_fetch(&backend_users, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * This function replaces the backend that the library uses to talk to the
+ * driver. It must be called while no device is open
+ * @param ops the backend operations, or NULL for the kernel driver backend
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_set_backend(const struct hlthunk_backend_ops *ops)
+{
+	if (ops && (!ops->open || !ops->close || !ops->ioctl || !ops->mmap ||
+			!ops->munmap))
+		return -EINVAL;
+
+	if (__atomic_load_n(&backend_users, __ATOMIC_RELAXED))
+		return -EBUSY;
+
+	__atomic_store_n(&backend, ops ? ops : &hlthunk_kernel_backend,
+				__ATOMIC_RELEASE);
+
+	return 0;
+}
+
+hlthunk_public const struct hlthunk_backend_ops *hlthunk_get_backend(void)
+{
+	return hlthunk_backend();
+}
+
+/**
+ * This function returns one of the backends that are built into the library
+ * @param name "kernel" or "model"
+ * @return the backend operations, or NULL if there is no such backend
+ */
+hlthunk_public const struct hlthunk_backend_ops *hlthunk_get_backend_by_name(
+							const char *name)
+{
+	size_t i;
+
+	for (i = 0 ; i < sizeof(builtin_backends) /
+				sizeof(builtin_backends[0]) ; i++)
+		if (!strcmp(builtin_backends[i]->name, name))
+			return builtin_backends[i];
+
+	return NULL;
+}
@@ -0,0 +1,1219 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+/*
+ * In-process device model backend. It implements the INFO, CB, CS, WAIT_CS
+ * and MEMORY ioctls with the same bookkeeping and error codes as the driver,
+ * so the library, the tests and the benchmarks can run without a device.
+ * The jobs of a command submission are executed by the packet interpreter in
+ * model_goya.c, and the CS completes when all of its jobs are done.
+ */
+
+#include "model.h"
+#include "specs/pci_ids.h"
+#include "specs/goya/goya.h"
+#include "specs/goya/goya_coresight.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+KHASH_MAP_INIT_INT(model_dev, struct model_dev *)
+KHASH_MAP_INIT_INT64(model_cb_addr, struct model_cb *)
+
+static pthread_mutex_t model_lock = PTHREAD_MUTEX_INITIALIZER;
+static khash_t(model_dev) *model_devs;
+/* Mapped CBs by user address, for munmap which doesn't get an fd */
+static khash_t(model_cb_addr) *model_cb_addrs;
+static bool model_minor_open[MODEL_NUM_DEVICES];
+
+static int model_err(int err)
+{
+	errno = err;
+	return -1;
+}
+
+static uint64_t model_page_size(void)
+{
+	return sysconf(_SC_PAGESIZE);
+}
+
+struct model_dev *model_get_dev(int fd)
+{
+	struct model_dev *dev = NULL;
+	khint_t k;
+
+	pthread_mutex_lock(&model_lock);
+	if (model_devs) {
+		k = kh_get(model_dev, model_devs, fd);
+		if (k != kh_end(model_devs))
+			dev = kh_val(model_devs, k);
+	}
+	pthread_mutex_unlock(&model_lock);
+
+	return dev;
+}
+
+static void model_cb_free(struct model_cb *cb)
+{
+	munmap(cb->ptr, cb->size);
+	hlthunk_free(cb);
+}
+
+/* Must be called with model_lock held */
+static void model_cb_put(struct model_cb *cb)
+{
+	if (--cb->refcnt)
+		return;
+
+	model_cb_free(cb);
+}
+
+static int model_open(const char *path, int flags)
+{
+	struct model_dev *dev;
+	int minor, fd, ret, err = ENOMEM;
+	khint_t k;
+
+	if (sscanf(path, HLTHUNK_DEV_NAME_PRIMARY, &minor) != 1 ||
+			minor < 0 || minor >= MODEL_NUM_DEVICES)
+		return model_err(ENOENT);
+
+	dev = hlthunk_malloc(sizeof(*dev));
+	if (!dev)
+		return model_err(ENOMEM);
+
+	pthread_mutex_init(&dev->lock, NULL);
+	pthread_cond_init(&dev->cs_done, NULL);
+	dev->cbs = kh_init(model_cb);
+	dev->mems = kh_init(model_mem);
+	dev->maps = kh_init(model_map);
+	dev->inflight = kh_init(model_seq);
+	if (!dev->cbs || !dev->mems || !dev->maps || !dev->inflight)
+		goto free_dev;
+
+	dev->minor = minor;
+	dev->next_cb_id = 1;
+	dev->next_mem_handle = 1;
+	dev->next_dram_va = MODEL_VA_DRAM_START;
+	dev->next_host_va = MODEL_VA_HOST_START;
+	dev->next_dram_phys = MODEL_DRAM_USER_BASE;
+	dev->ts_freq = hlthunk_pll_freq(MODEL_PCI_PLL_NR, MODEL_PCI_PLL_NF,
+					MODEL_PCI_PLL_OD,
+					MODEL_PCI_PLL_DIV_FACTOR);
+
+	model_perf_init(dev);
+	if (model_goya_init(dev))
+		goto fini_perf;
+
+	/* Hold a real descriptor so the number can't clash with other files */
+	fd = open("/dev/null", O_RDWR | (flags & O_CLOEXEC));
+	if (fd < 0) {
+		err = errno;
+		goto fini_goya;
+	}
+	dev->fd = fd;
+
+	pthread_mutex_lock(&model_lock);
+
+	if (model_minor_open[minor]) {
+		pthread_mutex_unlock(&model_lock);
+		close(fd);
+		err = EBUSY;
+		goto fini_goya;
+	}
+
+	if (!model_devs)
+		model_devs = kh_init(model_dev);
+	if (!model_cb_addrs)
+		model_cb_addrs = kh_init(model_cb_addr);
+	if (!model_devs || !model_cb_addrs) {
+		pthread_mutex_unlock(&model_lock);
+		close(fd);
+		goto fini_goya;
+	}
+
+	k = kh_put(model_dev, model_devs, fd, &ret);
+	if (ret < 0) {
+		pthread_mutex_unlock(&model_lock);
+		close(fd);
+		goto fini_goya;
+	}
+	kh_val(model_devs, k) = dev;
+	model_minor_open[minor] = true;
+
+	pthread_mutex_unlock(&model_lock);
+
+	return fd;
+
+fini_goya:
+	model_goya_fini(dev);
+fini_perf:
+	model_perf_fini(dev);
+free_dev:
+	if (dev->inflight)
+		kh_destroy(model_seq, dev->inflight);
+	if (dev->maps)
+		kh_destroy(model_map, dev->maps);
+	if (dev->mems)
+		kh_destroy(model_mem, dev->mems);
+	if (dev->cbs)
+		kh_destroy(model_cb, dev->cbs);
+	pthread_cond_destroy(&dev->cs_done);
+	pthread_mutex_destroy(&dev->lock);
+	hlthunk_free(dev);
+	return model_err(err);
+}
+
+static int model_close(int fd)
+{
+	struct model_dev *dev;
+	struct model_mem *mem;
+	struct model_map *map;
+	struct model_cb *cb;
+	khint_t k;
+
+	pthread_mutex_lock(&model_lock);
+
+	k = model_devs ? kh_get(model_dev, model_devs, fd) : 0;
+	if (!model_devs || k == kh_end(model_devs)) {
+		pthread_mutex_unlock(&model_lock);
+		return close(fd);
+	}
+
+	dev = kh_val(model_devs, k);
+	kh_del(model_dev, model_devs, k);
+	model_minor_open[dev->minor] = false;
+
+	pthread_mutex_unlock(&model_lock);
+
+	/* Stop the queues first, the jobs they drop release their CBs */
+	model_goya_fini(dev);
+	model_perf_fini(dev);
+
+	pthread_mutex_lock(&model_lock);
+
+	/* Like the driver, CBs that are still mapped outlive the device fd */
+	kh_foreach_value(dev->cbs, cb, {
+		cb->destroyed = true;
+		model_cb_put(cb);
+	});
+
+	pthread_mutex_unlock(&model_lock);
+
+	kh_foreach_value(dev->mems, mem, hlthunk_free(mem));
+	kh_foreach_value(dev->maps, map, hlthunk_free(map));
+
+	kh_destroy(model_cb, dev->cbs);
+	kh_destroy(model_mem, dev->mems);
+	kh_destroy(model_map, dev->maps);
+	kh_destroy(model_seq, dev->inflight);
+	pthread_cond_destroy(&dev->cs_done);
+	pthread_mutex_destroy(&dev->lock);
+	hlthunk_free(dev);
+
+	return close(fd);
+}
+
+static int model_info(struct model_dev *dev, struct hl_info_args *args)
+{
+	union {
+		struct hl_info_hw_ip_info hw_ip;
+		struct hl_info_dram_usage dram_usage;
+		struct hl_info_hw_idle hw_idle;
+		struct hl_info_device_status dev_status;
+		uint32_t events[MODEL_NUM_EVENTS];
+	} info;
+	uint32_t size;
+
+	if (!args->return_pointer || !args->return_size)
+		return model_err(EINVAL);
+
+	memset(&info, 0, sizeof(info));
+
+	pthread_mutex_lock(&dev->lock);
+
+	switch (args->op) {
+	case HL_INFO_HW_IP_INFO:
+		info.hw_ip.device_id = PCI_IDS_GOYA;
+		info.hw_ip.sram_base_address = SRAM_BASE_ADDR +
+					GOYA_KMD_SRAM_RESERVED_SIZE_FROM_START;
+		info.hw_ip.sram_size = SRAM_SIZE -
+					GOYA_KMD_SRAM_RESERVED_SIZE_FROM_START;
+		info.hw_ip.dram_base_address = MODEL_DRAM_USER_BASE;
+		info.hw_ip.dram_size = MODEL_DRAM_SIZE - MODEL_DRAM_USER_BASE;
+		info.hw_ip.dram_enabled = 1;
+		info.hw_ip.num_of_events = MODEL_NUM_EVENTS;
+		info.hw_ip.tpc_enabled_mask = (1 << TPC_MAX_NUM) - 1;
+		info.hw_ip.psoc_pci_pll_nr = MODEL_PCI_PLL_NR;
+		info.hw_ip.psoc_pci_pll_nf = MODEL_PCI_PLL_NF;
+		info.hw_ip.psoc_pci_pll_od = MODEL_PCI_PLL_OD;
+		info.hw_ip.psoc_pci_pll_div_factor = MODEL_PCI_PLL_DIV_FACTOR;
+		snprintf((char *) info.hw_ip.armcp_version,
+			HL_INFO_VERSION_MAX_LEN, "hl-thunk device model");
+		size = sizeof(info.hw_ip);
+		break;
+	case HL_INFO_HW_EVENTS:
+		memcpy(info.events, dev->events, sizeof(dev->events));
+		size = sizeof(info.events);
+		break;
+	case HL_INFO_DRAM_USAGE:
+		info.dram_usage.dram_free_mem = MODEL_DRAM_SIZE -
+					MODEL_DRAM_USER_BASE - dev->dram_used;
+		info.dram_usage.ctx_dram_mem = dev->dram_used;
+		size = sizeof(info.dram_usage);
+		break;
+	case HL_INFO_HW_IDLE:
+		info.hw_idle.busy_engines_mask = model_goya_busy_engines(dev);
+		info.hw_idle.is_idle = !info.hw_idle.busy_engines_mask;
+		size = sizeof(info.hw_idle);
+		break;
+	case HL_INFO_DEVICE_STATUS:
+		info.dev_status.status = HL_DEVICE_STATUS_OPERATIONAL;
+		size = sizeof(info.dev_status);
+		break;
+	default:
+		pthread_mutex_unlock(&dev->lock);
+		return model_err(ENOTTY);
+	}
+
+	pthread_mutex_unlock(&dev->lock);
+
+	if (size > args->return_size)
+		size = args->return_size;
+	memcpy((void *) (uintptr_t) args->return_pointer, &info, size);
+
+	return 0;
+}
+
+static int model_cb_create(struct model_dev *dev, union hl_cb_args *args)
+{
+	struct model_cb *cb;
+	uint64_t page_size = model_page_size();
+	khint_t k;
+	int ret;
+
+	if (args->in.cb_size > MODEL_MAX_CB_SIZE)
+		return model_err(EINVAL);
+
+	cb = hlthunk_malloc(sizeof(*cb));
+	if (!cb)
+		return model_err(ENOMEM);
+
+	cb->size = (args->in.cb_size + page_size - 1) & ~(page_size - 1);
+	if (!cb->size)
+		cb->size = page_size;
+
+	cb->ptr = mmap(NULL, cb->size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (cb->ptr == MAP_FAILED) {
+		hlthunk_free(cb);
+		return model_err(ENOMEM);
+	}
+	cb->refcnt = 1;
+
+	pthread_mutex_lock(&dev->lock);
+
+	cb->handle = dev->next_cb_id++ * page_size;
+	k = kh_put(model_cb, dev->cbs, cb->handle, &ret);
+	if (ret < 0) {
+		pthread_mutex_unlock(&dev->lock);
+		model_cb_free(cb);
+		return model_err(ENOMEM);
+	}
+	kh_val(dev->cbs, k) = cb;
+
+	pthread_mutex_unlock(&dev->lock);
+
+	args->out.cb_handle = cb->handle;
+
+	return 0;
+}
+
+static int model_cb_destroy(struct model_dev *dev, union hl_cb_args *args)
+{
+	struct model_cb *cb;
+	khint_t k;
+
+	pthread_mutex_lock(&model_lock);
+	pthread_mutex_lock(&dev->lock);
+
+	k = kh_get(model_cb, dev->cbs, args->in.cb_handle);
+	if (k == kh_end(dev->cbs)) {
+		pthread_mutex_unlock(&dev->lock);
+		pthread_mutex_unlock(&model_lock);
+		return model_err(EINVAL);
+	}
+
+	cb = kh_val(dev->cbs, k);
+	kh_del(model_cb, dev->cbs, k);
+	cb->destroyed = true;
+	model_cb_put(cb);
+
+	pthread_mutex_unlock(&dev->lock);
+	pthread_mutex_unlock(&model_lock);
+
+	return 0;
+}
+
+static int model_cb(struct model_dev *dev, union hl_cb_args *args)
+{
+	switch (args->in.op) {
+	case HL_CB_OP_CREATE:
+		return model_cb_create(dev, args);
+	case HL_CB_OP_DESTROY:
+		return model_cb_destroy(dev, args);
+	default:
+		return model_err(ENOTTY);
+	}
+}
+
+/* Must be called with the device lock held */
+static struct model_map *model_find_map(struct model_dev *dev, uint64_t va,
+					uint64_t size)
+{
+	struct model_map *map;
+
+	kh_foreach_value(dev->maps, map, {
+		if (va < map->va + map->size && map->va < va + size)
+			return map;
+	});
+
+	return NULL;
+}
+
+/*
+ * Allocate a device VA range. The allocator is a bump pointer that falls back
+ * to a first-fit search once the range is exhausted, and it gives back the
+ * tail when the last range is unmapped, which covers map/unmap loops.
+ * Must be called with the device lock held
+ */
+static uint64_t model_alloc_va(struct model_dev *dev, uint64_t hint,
+				uint64_t size, uint64_t align, bool host)
+{
+	uint64_t *next = host ? &dev->next_host_va : &dev->next_dram_va;
+	uint64_t start = host ? MODEL_VA_HOST_START : MODEL_VA_DRAM_START;
+	uint64_t end = host ? MODEL_VA_HOST_END : MODEL_VA_DRAM_END;
+	struct model_map *map;
+	uint64_t va;
+
+	size = (size + align - 1) & ~(align - 1);
+
+	if (hint && !(hint & (align - 1)) && hint >= start &&
+			hint + size <= end && !model_find_map(dev, hint, size))
+		return hint;
+
+	va = *next;
+	if (va + size > end || model_find_map(dev, va, size)) {
+		va = start;
+		while ((map = model_find_map(dev, va, size)))
+			va = (map->va + map->size + align - 1) & ~(align - 1);
+		if (va + size > end)
+			return 0;
+	}
+
+	if (va + size > *next)
+		*next = va + size;
+
+	return va;
+}
+
+static void model_free_va(struct model_dev *dev, struct model_map *map,
+				uint64_t align, bool host)
+{
+	uint64_t *next = host ? &dev->next_host_va : &dev->next_dram_va;
+	uint64_t va = map->va & ~(align - 1);
+	uint64_t end = (map->va + map->size + align - 1) & ~(align - 1);
+
+	if (end == *next)
+		*next = va;
+}
+
+/* Must be called with the device lock held */
+static struct model_mem *model_find_mem(struct model_dev *dev, uint64_t phys,
+					uint64_t size)
+{
+	struct model_mem *mem;
+
+	kh_foreach_value(dev->mems, mem, {
+		if (phys < mem->phys + mem->size && mem->phys < phys + size)
+			return mem;
+	});
+
+	return NULL;
+}
+
+/*
+ * Allocate the DRAM backing of a memory allocation, the same way model_alloc_va
+ * allocates device VAs. Must be called with the device lock held
+ */
+static uint64_t model_alloc_phys(struct model_dev *dev, uint64_t size)
+{
+	struct model_mem *mem;
+	uint64_t phys;
+
+	if (dev->dram_used + size > MODEL_DRAM_SIZE - MODEL_DRAM_USER_BASE)
+		return 0;
+
+	phys = dev->next_dram_phys;
+	if (phys + size > MODEL_DRAM_SIZE || model_find_mem(dev, phys, size)) {
+		phys = MODEL_DRAM_USER_BASE;
+		while ((mem = model_find_mem(dev, phys, size)))
+			phys = mem->phys + mem->size;
+		if (phys + size > MODEL_DRAM_SIZE)
+			return 0;
+	}
+
+	if (phys + size > dev->next_dram_phys)
+		dev->next_dram_phys = phys + size;
+
+	return phys;
+}
+
+/**
+ * This function translates a device address that a CB accesses to the host
+ * address that backs it in the model
+ * @param dev the device
+ * @param addr SRAM, DRAM or mapped device virtual address
+ * @param size number of bytes that are accessed
+ * @param kind if not NULL, filled with where the address resides
+ * @return pointer to the backing memory, NULL if the range is not backed
+ */
+void *model_translate(struct model_dev *dev, uint64_t addr, uint64_t size,
+			enum model_mem_kind *kind)
+{
+	enum model_mem_kind mem_kind = MODEL_MEM_NONE;
+	struct model_map *map;
+	void *ptr = NULL;
+
+	if (addr + size < addr)
+		return NULL;
+
+	if (addr >= SRAM_BASE_ADDR &&
+			addr + size <= SRAM_BASE_ADDR + SRAM_SIZE) {
+		ptr = dev->sram + (addr - SRAM_BASE_ADDR);
+		mem_kind = MODEL_MEM_SRAM;
+	} else if (addr + size <= MODEL_DRAM_SIZE) {
+		ptr = dev->dram + addr;
+		mem_kind = MODEL_MEM_DRAM;
+	} else {
+		pthread_mutex_lock(&dev->lock);
+
+		map = model_find_map(dev, addr, size);
+		if (map && addr >= map->va &&
+				addr + size <= map->va + map->size) {
+			if (map->host_ptr) {
+				ptr = (uint8_t *) map->host_ptr +
+							(addr - map->va);
+				mem_kind = MODEL_MEM_HOST;
+			} else {
+				ptr = dev->dram + map->phys + (addr - map->va);
+				mem_kind = MODEL_MEM_DRAM;
+			}
+		}
+
+		pthread_mutex_unlock(&dev->lock);
+	}
+
+	if (kind)
+		*kind = mem_kind;
+
+	return ptr;
+}
+
+static int model_mem_alloc(struct model_dev *dev, union hl_mem_args *args)
+{
+	struct model_mem *mem;
+	uint64_t size;
+	khint_t k;
+	int ret;
+
+	size = (args->in.alloc.mem_size + MODEL_DRAM_PAGE_SIZE - 1) &
+			~(MODEL_DRAM_PAGE_SIZE - 1);
+	if (!size)
+		return model_err(EINVAL);
+
+	mem = hlthunk_malloc(sizeof(*mem));
+	if (!mem)
+		return model_err(ENOMEM);
+
+	mem->size = size;
+	mem->flags = args->in.flags;
+
+	pthread_mutex_lock(&dev->lock);
+
+	mem->phys = model_alloc_phys(dev, size);
+	if (!mem->phys) {
+		pthread_mutex_unlock(&dev->lock);
+		hlthunk_free(mem);
+		return model_err(ENOMEM);
+	}
+
+	mem->handle = dev->next_mem_handle++;
+	k = kh_put(model_mem, dev->mems, mem->handle, &ret);
+	if (ret < 0) {
+		pthread_mutex_unlock(&dev->lock);
+		hlthunk_free(mem);
+		return model_err(ENOMEM);
+	}
+	kh_val(dev->mems, k) = mem;
+	dev->dram_used += size;
+
+	pthread_mutex_unlock(&dev->lock);
+
+	args->out.handle = mem->handle;
+
+	return 0;
+}
+
+static int model_mem_free(struct model_dev *dev, union hl_mem_args *args)
+{
+	struct model_mem *mem;
+	khint_t k;
+
+	pthread_mutex_lock(&dev->lock);
+
+	k = kh_get(model_mem, dev->mems, args->in.free.handle);
+	if (k == kh_end(dev->mems) || kh_val(dev->mems, k)->map_cnt) {
+		pthread_mutex_unlock(&dev->lock);
+		return model_err(EINVAL);
+	}
+
+	mem = kh_val(dev->mems, k);
+	kh_del(model_mem, dev->mems, k);
+	dev->dram_used -= mem->size;
+	if (mem->phys + mem->size == dev->next_dram_phys)
+		dev->next_dram_phys = mem->phys;
+
+	pthread_mutex_unlock(&dev->lock);
+
+	hlthunk_free(mem);
+
+	return 0;
+}
+
+static int model_mem_map(struct model_dev *dev, union hl_mem_args *args)
+{
+	bool host = !!(args->in.flags & HL_MEM_USERPTR);
+	uint64_t page_size, offset, size, hint, va;
+	struct model_mem *mem = NULL;
+	struct model_map *map;
+	khint_t k;
+	int ret;
+
+	map = hlthunk_malloc(sizeof(*map));
+	if (!map)
+		return model_err(ENOMEM);
+
+	pthread_mutex_lock(&dev->lock);
+
+	if (host) {
+		if (!args->in.map_host.host_virt_addr ||
+				!args->in.map_host.mem_size)
+			goto err_inval;
+
+		page_size = model_page_size();
+		offset = args->in.map_host.host_virt_addr & (page_size - 1);
+		size = args->in.map_host.mem_size + offset;
+		hint = args->in.map_host.hint_addr & ~(page_size - 1);
+		map->host_ptr = (void *) (uintptr_t)
+					args->in.map_host.host_virt_addr;
+	} else {
+		k = kh_get(model_mem, dev->mems, args->in.map_device.handle);
+		if (k == kh_end(dev->mems))
+			goto err_inval;
+
+		mem = kh_val(dev->mems, k);
+		page_size = MODEL_DRAM_PAGE_SIZE;
+		offset = 0;
+		size = mem->size;
+		hint = args->in.map_device.hint_addr;
+		map->mem_handle = mem->handle;
+		map->phys = mem->phys;
+	}
+
+	va = model_alloc_va(dev, hint, size, page_size, host);
+	if (!va) {
+		pthread_mutex_unlock(&dev->lock);
+		hlthunk_free(map);
+		return model_err(ENOMEM);
+	}
+
+	map->va = va + offset;
+	map->size = size - offset;
+
+	k = kh_put(model_map, dev->maps, map->va, &ret);
+	if (ret < 0) {
+		pthread_mutex_unlock(&dev->lock);
+		hlthunk_free(map);
+		return model_err(ENOMEM);
+	}
+	kh_val(dev->maps, k) = map;
+	if (mem)
+		mem->map_cnt++;
+
+	pthread_mutex_unlock(&dev->lock);
+
+	args->out.device_virt_addr = map->va;
+
+	return 0;
+
+err_inval:
+	pthread_mutex_unlock(&dev->lock);
+	hlthunk_free(map);
+	return model_err(EINVAL);
+}
+
+static int model_mem_unmap(struct model_dev *dev, union hl_mem_args *args)
+{
+	struct model_map *map;
+	khint_t k;
+	bool host;
+
+	pthread_mutex_lock(&dev->lock);
+
+	k = kh_get(model_map, dev->maps, args->in.unmap.device_virt_addr);
+	if (k == kh_end(dev->maps)) {
+		pthread_mutex_unlock(&dev->lock);
+		return model_err(EINVAL);
+	}
+
+	map = kh_val(dev->maps, k);
+	kh_del(model_map, dev->maps, k);
+
+	host = !!map->host_ptr;
+	model_free_va(dev, map, host ? model_page_size() : MODEL_DRAM_PAGE_SIZE,
+			host);
+
+	if (!host) {
+		k = kh_get(model_mem, dev->mems, map->mem_handle);
+		if (k != kh_end(dev->mems))
+			kh_val(dev->mems, k)->map_cnt--;
+	}
+
+	pthread_mutex_unlock(&dev->lock);
+
+	hlthunk_free(map);
+
+	return 0;
+}
+
+static int model_memory(struct model_dev *dev, union hl_mem_args *args)
+{
+	switch (args->in.op) {
+	case HL_MEM_OP_ALLOC:
+		return model_mem_alloc(dev, args);
+	case HL_MEM_OP_FREE:
+		return model_mem_free(dev, args);
+	case HL_MEM_OP_MAP:
+		return model_mem_map(dev, args);
+	case HL_MEM_OP_UNMAP:
+		return model_mem_unmap(dev, args);
+	default:
+		return model_err(ENOTTY);
+	}
+}
+
+/* Must be called with the device lock held */
+static int model_validate_chunks(struct model_dev *dev,
+				const struct hl_cs_chunk *chunks, uint32_t num)
+{
+	struct model_cb *cb;
+	uint32_t i;
+	khint_t k;
+
+	for (i = 0 ; i < num ; i++) {
+		if (chunks[i].queue_index >= GOYA_QUEUE_ID_SIZE ||
+				chunks[i].queue_index == GOYA_QUEUE_ID_CPU_PQ)
+			return -EINVAL;
+
+		/* Internal queues get a device address, there is no CB */
+		if (chunks[i].queue_index > GOYA_QUEUE_ID_CPU_PQ)
+			continue;
+
+		k = kh_get(model_cb, dev->cbs, chunks[i].cb_handle);
+		if (k == kh_end(dev->cbs))
+			return -EINVAL;
+
+		cb = kh_val(dev->cbs, k);
+		if (chunks[i].cb_size > cb->size)
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Must be called with model_lock and the device lock held */
+static int model_create_jobs(struct model_dev *dev, struct model_cs *cs,
+				const struct hl_cs_chunk *chunks, uint32_t num,
+				bool restore, struct model_job ***tail)
+{
+	struct model_job *job;
+	uint32_t i;
+	khint_t k;
+
+	for (i = 0 ; i < num ; i++) {
+		job = hlthunk_malloc(sizeof(*job));
+		if (!job)
+			return -ENOMEM;
+
+		job->cs = cs;
+		job->restore = restore;
+		job->queue = chunks[i].queue_index;
+		job->cb_size = chunks[i].cb_size;
+		if (job->queue < GOYA_QUEUE_ID_CPU_PQ) {
+			k = kh_get(model_cb, dev->cbs, chunks[i].cb_handle);
+			job->cb = kh_val(dev->cbs, k);
+			job->cb->refcnt++;
+		} else {
+			job->cb_addr = chunks[i].cb_handle;
+		}
+
+		**tail = job;
+		*tail = &job->next;
+		cs->pending_jobs++;
+		if (restore)
+			cs->pending_restore++;
+	}
+
+	return 0;
+}
+
+static void model_free_jobs(struct model_job *jobs)
+{
+	struct model_job *job;
+
+	while ((job = jobs)) {
+		jobs = job->next;
+		if (job->cb)
+			model_cb_put(job->cb);
+		hlthunk_free(job);
+	}
+}
+
+static int model_cs(struct model_dev *dev, union hl_cs_args *args)
+{
+	const struct hl_cs_chunk *restore, *execute;
+	struct model_job *jobs = NULL, **tail = &jobs;
+	uint32_t num_restore, num_execute;
+	struct model_cs *cs;
+	uint64_t seq;
+	int rc, ret;
+
+	restore = (const struct hl_cs_chunk *) (uintptr_t)
+						args->in.chunks_restore;
+	execute = (const struct hl_cs_chunk *) (uintptr_t)
+						args->in.chunks_execute;
+	num_restore = args->in.num_chunks_restore;
+	num_execute = args->in.num_chunks_execute;
+
+	if ((!num_restore && !num_execute) ||
+			num_restore > MODEL_MAX_JOBS_PER_CS ||
+			num_execute > MODEL_MAX_JOBS_PER_CS ||
+			(num_restore && !restore) || (num_execute && !execute))
+		return model_err(EINVAL);
+
+	cs = hlthunk_malloc(sizeof(*cs));
+	if (!cs)
+		return model_err(ENOMEM);
+
+	pthread_mutex_lock(&model_lock);
+	pthread_mutex_lock(&dev->lock);
+
+	rc = model_validate_chunks(dev, restore, num_restore);
+	if (!rc)
+		rc = model_validate_chunks(dev, execute, num_execute);
+	if (rc)
+		goto err;
+
+	/* The execute jobs start when all the restore jobs are done */
+	rc = model_create_jobs(dev, cs, restore, num_restore, true, &tail);
+	if (!rc)
+		rc = model_create_jobs(dev, cs, execute, num_execute, false,
+					&tail);
+	if (rc)
+		goto err;
+
+	/* The CS may complete and be freed as soon as the jobs are submitted */
+	seq = cs->seq = dev->seq + 1;
+	kh_put(model_seq, dev->inflight, seq, &ret);
+	if (ret < 0) {
+		rc = -ENOMEM;
+		goto err;
+	}
+	dev->seq++;
+	model_perf_cs_submit(dev, cs);
+
+	pthread_mutex_unlock(&model_lock);
+
+	model_goya_submit(dev, jobs);
+
+	pthread_mutex_unlock(&dev->lock);
+
+	memset(&args->out, 0, sizeof(args->out));
+	args->out.seq = seq;
+	args->out.status = HL_CS_STATUS_SUCCESS;
+
+	return 0;
+
+err:
+	model_free_jobs(jobs);
+	pthread_mutex_unlock(&dev->lock);
+	pthread_mutex_unlock(&model_lock);
+	hlthunk_free(cs);
+	return model_err(-rc);
+}
+
+/**
+ * This function is called by the queues when they are done with a job, and
+ * completes its CS when it was the last one
+ * @param dev the device
+ * @param job the job, which is freed
+ */
+void model_job_done(struct model_dev *dev, struct model_job *job)
+{
+	uint64_t start_time = job->start_time, end_time = job->end_time;
+	struct model_cs *cs = job->cs;
+	khint_t k;
+
+	job->next = NULL;
+	pthread_mutex_lock(&model_lock);
+	model_free_jobs(job);
+	pthread_mutex_unlock(&model_lock);
+
+	pthread_mutex_lock(&dev->lock);
+
+	if (start_time < cs->start_time)
+		cs->start_time = start_time;
+	if (end_time > cs->done_time)
+		cs->done_time = end_time;
+
+	if (!--cs->pending_jobs) {
+		k = kh_get(model_seq, dev->inflight, cs->seq);
+		if (k != kh_end(dev->inflight))
+			kh_del(model_seq, dev->inflight, k);
+		model_perf_cs_done(dev, cs);
+		hlthunk_free(cs);
+		pthread_cond_broadcast(&dev->cs_done);
+	}
+
+	pthread_mutex_unlock(&dev->lock);
+}
+
+static int model_wait_cs(struct model_dev *dev, union hl_wait_cs_args *args)
+{
+	uint64_t seq = args->in.seq, timeout_us = args->in.timeout_us;
+	struct timespec deadline;
+	uint32_t status;
+	int rc = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_us / 1000000;
+	deadline.tv_nsec += (timeout_us % 1000000) * 1000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&dev->lock);
+
+	if (!seq || seq > dev->seq) {
+		pthread_mutex_unlock(&dev->lock);
+		return model_err(EINVAL);
+	}
+
+	while (kh_get(model_seq, dev->inflight, seq) != kh_end(dev->inflight)) {
+		if (!timeout_us || rc) {
+			status = HL_WAIT_CS_STATUS_BUSY;
+			goto out;
+		}
+		rc = pthread_cond_timedwait(&dev->cs_done, &dev->lock,
+						&deadline);
+	}
+
+	status = HL_WAIT_CS_STATUS_COMPLETED;
+	model_perf_cs_waited(dev, seq);
+out:
+	pthread_mutex_unlock(&dev->lock);
+
+	memset(&args->out, 0, sizeof(args->out));
+	args->out.status = status;
+
+	return 0;
+}
+
+static uint32_t model_debug_num_regs(uint32_t op)
+{
+	switch (op) {
+	case HL_DEBUG_OP_ETR:
+		return 1;
+	case HL_DEBUG_OP_ETF:
+		return GOYA_ETF_LAST + 1;
+	case HL_DEBUG_OP_STM:
+		return GOYA_STM_LAST + 1;
+	case HL_DEBUG_OP_FUNNEL:
+		return GOYA_FUNNEL_LAST + 1;
+	case HL_DEBUG_OP_BMON:
+		return GOYA_BMON_LAST + 1;
+	case HL_DEBUG_OP_SPMU:
+		return GOYA_SPMU_LAST + 1;
+	default:
+		return 0;
+	}
+}
+
+/* Must be called with the device lock held */
+static int model_debug_trace(struct model_dev *dev, struct hl_debug_args *args)
+{
+	struct hl_debug_params_etr etr;
+	struct model_map *map;
+	uint32_t input_size;
+	uint64_t *rwp;
+
+	if (args->reg_idx >= model_debug_num_regs(args->op))
+		return -EINVAL;
+
+	switch (args->op) {
+	case HL_DEBUG_OP_ETR:
+		input_size = sizeof(struct hl_debug_params_etr);
+		break;
+	case HL_DEBUG_OP_ETF:
+		input_size = sizeof(struct hl_debug_params_etf);
+		break;
+	case HL_DEBUG_OP_STM:
+		input_size = sizeof(struct hl_debug_params_stm);
+		break;
+	case HL_DEBUG_OP_BMON:
+		input_size = sizeof(struct hl_debug_params_bmon);
+		break;
+	default:
+		input_size = 0;
+		break;
+	}
+
+	if (args->enable && input_size &&
+			(!args->input_ptr || args->input_size < input_size))
+		return -EINVAL;
+
+	if (args->op != HL_DEBUG_OP_ETR)
+		return 0;
+
+	if (!args->enable) {
+		/* Nothing was written, so the write pointer is at the start */
+		rwp = (uint64_t *) (uintptr_t) args->output_ptr;
+		if (rwp && args->output_size >= sizeof(*rwp))
+			*rwp = dev->etr_addr;
+		dev->etr_enabled = false;
+		return 0;
+	}
+
+	memcpy(&etr, (void *) (uintptr_t) args->input_ptr, sizeof(etr));
+
+	/* The buffer must be in the DRAM VA range */
+	map = model_find_map(dev, etr.buffer_address, etr.buffer_size);
+	if (!etr.buffer_size || !map || map->host_ptr ||
+			etr.buffer_address < map->va ||
+			etr.buffer_address + etr.buffer_size >
+						map->va + map->size)
+		return -EINVAL;
+
+	dev->etr_addr = etr.buffer_address;
+	dev->etr_enabled = true;
+
+	return 0;
+}
+
+/*
+ * No events are counted, so disabling an SPMU returns zeroed counters, overflow
+ * status and cycles
+ */
+static int model_debug_spmu(struct hl_debug_args *args)
+{
+	struct hl_debug_params_spmu spmu;
+	uint32_t events_num;
+
+	if (args->reg_idx >= model_debug_num_regs(args->op))
+		return -EINVAL;
+
+	if (args->enable) {
+		if (!args->input_ptr || args->input_size < sizeof(spmu))
+			return -EINVAL;
+
+		memcpy(&spmu, (void *) (uintptr_t) args->input_ptr,
+			sizeof(spmu));
+		if (spmu.event_types_num < 3 ||
+			spmu.event_types_num > HLTHUNK_SPMU_MAX_COUNTERS)
+			return -EINVAL;
+
+		return 0;
+	}
+
+	if (!args->output_ptr || args->output_size < 3 * sizeof(uint64_t))
+		return -EINVAL;
+
+	events_num = args->output_size / sizeof(uint64_t) - 2;
+	if (events_num > HLTHUNK_SPMU_MAX_COUNTERS)
+		return -EINVAL;
+
+	memset((void *) (uintptr_t) args->output_ptr, 0,
+		(events_num + 2) * sizeof(uint64_t));
+
+	return 0;
+}
+
+/* The debug mode, the timestamp counter and the trace components are modeled */
+static int model_debug(struct model_dev *dev, struct hl_debug_args *args)
+{
+	int rc = 0;
+
+	pthread_mutex_lock(&dev->lock);
+
+	switch (args->op) {
+	case HL_DEBUG_OP_SET_MODE:
+		dev->debug_mode = !!args->enable;
+		break;
+	case HL_DEBUG_OP_TIMESTAMP:
+		if (!dev->debug_mode) {
+			rc = -EFAULT;
+			break;
+		}
+
+		/* Enabling the counter restarts it from 0 */
+		pthread_mutex_lock(&dev->exec_lock);
+		dev->ts_base = dev->perf.host_time;
+		dev->ts_enabled = !!args->enable;
+		pthread_mutex_unlock(&dev->exec_lock);
+		break;
+	case HL_DEBUG_OP_ETR:
+	case HL_DEBUG_OP_ETF:
+	case HL_DEBUG_OP_STM:
+	case HL_DEBUG_OP_FUNNEL:
+	case HL_DEBUG_OP_BMON:
+		rc = dev->debug_mode ? model_debug_trace(dev, args) : -EFAULT;
+		break;
+	case HL_DEBUG_OP_SPMU:
+		rc = dev->debug_mode ? model_debug_spmu(args) : -EFAULT;
+		break;
+	default:
+		rc = dev->debug_mode ? -EINVAL : -EFAULT;
+		break;
+	}
+
+	pthread_mutex_unlock(&dev->lock);
+
+	return rc ? model_err(-rc) : 0;
+}
+
+static int model_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct model_dev *dev = model_get_dev(fd);
+
+	if (!dev)
+		return model_err(EBADF);
+
+	switch (request) {
+	case HL_IOCTL_INFO:
+		return model_info(dev, arg);
+	case HL_IOCTL_CB:
+		return model_cb(dev, arg);
+	case HL_IOCTL_CS:
+		return model_cs(dev, arg);
+	case HL_IOCTL_WAIT_CS:
+		return model_wait_cs(dev, arg);
+	case HL_IOCTL_MEMORY:
+		return model_memory(dev, arg);
+	case HL_IOCTL_DEBUG:
+		return model_debug(dev, arg);
+	default:
+		return model_err(ENOTTY);
+	}
+}
+
+static void *model_mmap(void *addr, size_t len, int prot, int flags, int fd,
+			off_t offset)
+{
+	struct model_dev *dev = model_get_dev(fd);
+	uint64_t page_size = model_page_size();
+	struct model_cb *cb;
+	khint_t k;
+	int ret;
+
+	if (!dev) {
+		errno = EBADF;
+		return MAP_FAILED;
+	}
+
+	pthread_mutex_lock(&model_lock);
+	pthread_mutex_lock(&dev->lock);
+
+	k = kh_get(model_cb, dev->cbs, offset);
+	if (k == kh_end(dev->cbs))
+		goto err_inval;
+
+	cb = kh_val(dev->cbs, k);
+	if (cb->mapped || ((len + page_size - 1) & ~(page_size - 1)) != cb->size)
+		goto err_inval;
+
+	k = kh_put(model_cb_addr, model_cb_addrs, (uintptr_t) cb->ptr, &ret);
+	if (ret < 0) {
+		errno = ENOMEM;
+		goto err;
+	}
+	kh_val(model_cb_addrs, k) = cb;
+	cb->mapped = true;
+	cb->refcnt++;
+
+	pthread_mutex_unlock(&dev->lock);
+	pthread_mutex_unlock(&model_lock);
+
+	return cb->ptr;
+
+err_inval:
+	errno = EINVAL;
+err:
+	pthread_mutex_unlock(&dev->lock);
+	pthread_mutex_unlock(&model_lock);
+	return MAP_FAILED;
+}
+
+static int model_munmap(void *addr, size_t len)
+{
+	struct model_cb *cb;
+	khint_t k;
+
+	pthread_mutex_lock(&model_lock);
+
+	k = model_cb_addrs ? kh_get(model_cb_addr, model_cb_addrs,
+					(uintptr_t) addr) : 0;
+	if (!model_cb_addrs || k == kh_end(model_cb_addrs)) {
+		pthread_mutex_unlock(&model_lock);
+		return munmap(addr, len);
+	}
+
+	cb = kh_val(model_cb_addrs, k);
+	kh_del(model_cb_addr, model_cb_addrs, k);
+	cb->mapped = false;
+	model_cb_put(cb);
+
+	pthread_mutex_unlock(&model_lock);
+
+	return 0;
+}
+
+const struct hlthunk_backend_ops hlthunk_model_backend = {
+	.name = "model",
+	.open = model_open,
+	.close = model_close,
+	.ioctl = model_ioctl,
+	.mmap = model_mmap,
+	.munmap = model_munmap
+};
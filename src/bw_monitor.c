@@ -0,0 +1,321 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+#include "specs/goya/goya_coresight.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Bus bandwidth measurement with the BMONs. A BMON counts the bytes of the
+ * transactions of its bus that fall in two address ranges, and reports them
+ * at the end of every capture window into the CoreSight trace, under its own
+ * trace ID. The BMONs are attached to a trace of the profiles whose ETFs they
+ * send their reports through, and the reports are read back from the trace
+ * when the monitor stops.
+ *
+ * A report is a message that the driver programs for the BMON: a 32-bit tag
+ * with the trace ID at bit 12 and the kind of the message in the low bits,
+ * followed by a 32-bit count.
+ */
+
+#define BMON_DEFAULT_WINDOW_CYCLES	0x10000
+/* Every capture window is reported */
+#define BMON_WIN_CAPTURE_ALL		1
+
+#define BMON_MSG_SIZE			8
+#define BMON_MSG_ID_SHIFT		12
+#define BMON_MSG_KIND_MASK		0xFFF
+#define BMON_MSG_RANGE0			0xA00
+#define BMON_MSG_WINDOW			0xB00
+#define BMON_MSG_RANGE1			0xC00
+
+#define NS_PER_SEC			1000000000ull
+
+struct bw_monitor {
+	void *trace;
+	uint32_t *bmons;
+	uint32_t num_bmons;
+	uint64_t start_ns;
+	char path[64];
+	int fd;
+	bool tmp_path;
+};
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/* The trace profile whose ETFs pass the reports of a BMON */
+static int bmon_profile(uint32_t bmon)
+{
+	if (bmon >= GOYA_BMON_DMA_CH_0_0 && bmon <= GOYA_BMON_DMA_MACRO_7)
+		return HLTHUNK_TRACE_PROFILE_DMA;
+	if (bmon >= GOYA_BMON_TPC0_EML_0 && bmon <= GOYA_BMON_TPC7_EML_3)
+		return HLTHUNK_TRACE_PROFILE_TPC_EML;
+	if (bmon == GOYA_BMON_MMU_0 || bmon == GOYA_BMON_MMU_1)
+		return HLTHUNK_TRACE_PROFILE_MMU;
+
+	return -EINVAL;
+}
+
+static int config_bmon(int fd, uint32_t bmon, bool enable,
+			const struct hlthunk_bw_monitor_params *params)
+{
+	struct hl_debug_params_bmon input;
+	struct hl_debug_args debug;
+
+	memset(&debug, 0, sizeof(debug));
+	debug.op = HL_DEBUG_OP_BMON;
+	debug.reg_idx = bmon;
+	debug.enable = enable;
+
+	if (enable) {
+		memset(&input, 0, sizeof(input));
+		input.start_addr0 = params->ranges[0].start;
+		input.addr_mask0 = params->ranges[0].mask;
+		input.start_addr1 = params->ranges[1].start;
+		input.addr_mask1 = params->ranges[1].mask;
+		input.bw_win = params->window_cycles ? params->window_cycles :
+						BMON_DEFAULT_WINDOW_CYCLES;
+		input.win_capture = BMON_WIN_CAPTURE_ALL;
+		input.id = HLTHUNK_TRACE_BMON_FIRST_ID + bmon;
+
+		debug.input_ptr = (uint64_t) (uintptr_t) &input;
+		debug.input_size = sizeof(input);
+	}
+
+	return hlthunk_debug(fd, &debug) ? -errno : 0;
+}
+
+static void disable_bmons(struct bw_monitor *mon, uint32_t num)
+{
+	uint32_t i;
+
+	for (i = 0 ; i < num ; i++)
+		config_bmon(mon->fd, mon->bmons[i], false, NULL);
+}
+
+/* Sums the reports of a BMON, window by window */
+static void parse_reports(const struct hlthunk_trace_stream *stream,
+				uint32_t id, uint64_t elapsed_ns,
+				struct hlthunk_bw_monitor_result *result)
+{
+	uint64_t window[HLTHUNK_BW_MONITOR_RANGES] = { 0 };
+	uint32_t tag, count, i, r;
+	uint64_t off;
+
+	for (off = 0 ; off + BMON_MSG_SIZE <= stream->len ;
+						off += BMON_MSG_SIZE) {
+		memcpy(&tag, stream->buf + off, sizeof(tag));
+		memcpy(&count, stream->buf + off + sizeof(tag), sizeof(count));
+
+		if (((tag >> BMON_MSG_ID_SHIFT) & 0x7F) != id) {
+			result->num_errors++;
+			continue;
+		}
+
+		switch (tag & BMON_MSG_KIND_MASK) {
+		case BMON_MSG_RANGE0:
+			window[0] += count;
+			break;
+		case BMON_MSG_RANGE1:
+			window[1] += count;
+			break;
+		case BMON_MSG_WINDOW:
+			for (r = 0 ; r < HLTHUNK_BW_MONITOR_RANGES ; r++) {
+				result->bytes[r] += window[r];
+				if (window[r] > result->max_window_bytes[r])
+					result->max_window_bytes[r] = window[r];
+				window[r] = 0;
+			}
+			result->num_windows++;
+			break;
+		default:
+			result->num_errors++;
+			break;
+		}
+	}
+
+	/* The counts of a window that didn't end before the trace stopped */
+	for (i = 0 ; i < HLTHUNK_BW_MONITOR_RANGES ; i++) {
+		result->bytes[i] += window[i];
+		if (elapsed_ns)
+			result->bandwidth[i] = (double) result->bytes[i] *
+						NS_PER_SEC / elapsed_ns;
+	}
+}
+
+static void free_monitor(struct bw_monitor *mon)
+{
+	if (mon->tmp_path)
+		unlink(mon->path);
+	hlthunk_free(mon->bmons);
+	hlthunk_free(mon);
+}
+
+/**
+ * This function attaches BMONs to their buses and starts counting the bytes
+ * that go through them to two address ranges. It captures a CoreSight trace,
+ * so no other trace should be captured on the device until the monitor stops
+ * @param fd file descriptor of the device
+ * @param params the BMONs, the address ranges and the trace buffering
+ * @return opaque handle of the monitor or NULL in case of error, with errno
+ * set
+ */
+hlthunk_public void *hlthunk_bw_monitor_start(int fd,
+			const struct hlthunk_bw_monitor_params *params)
+{
+	struct hlthunk_trace_params trace_params;
+	struct bw_monitor *mon;
+	uint32_t profile_mask = 0, i;
+	int rc, profile, tmp_fd;
+
+	if (!params || !params->bmons || !params->num_bmons) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	for (i = 0 ; i < params->num_bmons ; i++) {
+		profile = bmon_profile(params->bmons[i]);
+		if (profile < 0) {
+			errno = EINVAL;
+			return NULL;
+		}
+		profile_mask |= 1 << profile;
+	}
+
+	mon = hlthunk_malloc(sizeof(*mon));
+	if (!mon) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	mon->fd = fd;
+	mon->num_bmons = params->num_bmons;
+	mon->bmons = hlthunk_malloc(mon->num_bmons * sizeof(*mon->bmons));
+	if (!mon->bmons) {
+		rc = -ENOMEM;
+		goto free_monitor;
+	}
+	memcpy(mon->bmons, params->bmons, mon->num_bmons * sizeof(*mon->bmons));
+
+	if (params->trace_path) {
+		if (strlen(params->trace_path) >= sizeof(mon->path)) {
+			rc = -ENAMETOOLONG;
+			goto free_monitor;
+		}
+		strcpy(mon->path, params->trace_path);
+	} else {
+		strcpy(mon->path, "/tmp/hlthunk_bmon_XXXXXX");
+		tmp_fd = mkstemp(mon->path);
+		if (tmp_fd < 0) {
+			rc = -errno;
+			goto free_monitor;
+		}
+		close(tmp_fd);
+		mon->tmp_path = true;
+	}
+
+	memset(&trace_params, 0, sizeof(trace_params));
+	trace_params.path = mon->path;
+	trace_params.buffer_size = params->buffer_size;
+
+	mon->trace = hlthunk_trace_start_profiles(fd, &trace_params,
+							profile_mask);
+	if (!mon->trace) {
+		rc = -errno;
+		goto free_monitor;
+	}
+
+	/* The BMONs are the sources, so they are enabled after the trace */
+	for (i = 0 ; i < mon->num_bmons ; i++) {
+		rc = config_bmon(fd, mon->bmons[i], true, params);
+		if (rc)
+			goto disable_bmons;
+	}
+
+	mon->start_ns = monotonic_ns();
+
+	return mon;
+
+disable_bmons:
+	disable_bmons(mon, i);
+	hlthunk_trace_stop(mon->trace, NULL);
+free_monitor:
+	free_monitor(mon);
+	errno = -rc;
+	return NULL;
+}
+
+/**
+ * This function detaches the BMONs of a monitor and sums their reports. The
+ * monitor is destroyed, even if the reports can't be read
+ * @param data the handle returned by hlthunk_bw_monitor_start
+ * @param results returned counts of the BMONs, in the order of the parameters
+ * of the monitor. May be NULL
+ * @param num_results number of entries in the results array
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_bw_monitor_stop(void *data,
+				struct hlthunk_bw_monitor_result *results,
+				uint32_t num_results)
+{
+	struct bw_monitor *mon = (struct bw_monitor *) data;
+	struct hlthunk_trace_stream *streams = NULL;
+	uint64_t elapsed_ns;
+	uint32_t i, id;
+	int rc;
+
+	if (!mon)
+		return -EINVAL;
+
+	disable_bmons(mon, mon->num_bmons);
+	elapsed_ns = monotonic_ns() - mon->start_ns;
+
+	rc = hlthunk_trace_stop(mon->trace, NULL);
+	if (rc || !results || !num_results)
+		goto free_monitor;
+
+	streams = hlthunk_malloc(HLTHUNK_TRACE_MAX_IDS * sizeof(*streams));
+	if (!streams) {
+		rc = -ENOMEM;
+		goto free_monitor;
+	}
+
+	rc = hlthunk_trace_read_streams(mon->path, streams);
+	if (rc)
+		goto free_streams;
+
+	if (num_results > mon->num_bmons)
+		num_results = mon->num_bmons;
+
+	for (i = 0 ; i < num_results ; i++) {
+		memset(&results[i], 0, sizeof(results[i]));
+		results[i].bmon = mon->bmons[i];
+		id = HLTHUNK_TRACE_BMON_FIRST_ID + mon->bmons[i];
+		parse_reports(&streams[id], id, elapsed_ns, &results[i]);
+	}
+
+free_streams:
+	hlthunk_trace_free_streams(streams);
+	hlthunk_free(streams);
+free_monitor:
+	free_monitor(mon);
+
+	return rc;
+}
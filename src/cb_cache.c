@@ -0,0 +1,480 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+#include "khash.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+struct cb_cache_entry {
+	/* Entries whose packets hash to the same value */
+	struct cb_cache_entry *hash_next;
+	/* LRU list, head is the most recently used entry */
+	struct cb_cache_entry *lru_prev;
+	struct cb_cache_entry *lru_next;
+	/* Host copy of the packets, used to verify hits */
+	void *ptr;
+	uint64_t hash;
+	uint64_t cb_handle;
+	/* Sequence of the last CS that used this CB */
+	uint64_t last_seq;
+	uint32_t size;
+	uint32_t alloc_size;
+	uint32_t refcnt;
+	bool external;
+};
+
+KHASH_MAP_INIT_INT64(cb_cache, struct cb_cache_entry *)
+
+struct cb_cache {
+	pthread_mutex_t lock;
+	khash_t(cb_cache) *hash_table;
+	khash_t(cb_cache) *handle_table;
+	struct cb_cache_entry *lru_head;
+	struct cb_cache_entry *lru_tail;
+	struct hlthunk_cb_cache_stats stats;
+	uint32_t max_entries;
+	int fd;
+};
+
+#define HASH_PRIME1	0x9E3779B185EBCA87ull
+#define HASH_PRIME2	0xC2B2AE3D27D4EB4Full
+#define HASH_PRIME3	0x165667B19E3779F9ull
+
+static inline uint64_t hash_rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t val)
+{
+	acc += val * HASH_PRIME2;
+	acc = hash_rotl(acc, 31);
+	return acc * HASH_PRIME1;
+}
+
+/*
+ * Packets are always 8-byte multiples, so the hash consumes the buffer one
+ * qword at a time and only falls back to bytes for odd tails.
+ */
+uint64_t hlthunk_hash_bytes(const void *buf, size_t len)
+{
+	const uint8_t *p = (const uint8_t *) buf;
+	uint64_t h = HASH_PRIME3 + len, val;
+	size_t i;
+
+	for (i = 0 ; i + sizeof(uint64_t) <= len ; i += sizeof(uint64_t)) {
+		memcpy(&val, p + i, sizeof(val));
+		h ^= hash_round(0, val);
+		h = hash_rotl(h, 27) * HASH_PRIME1 + HASH_PRIME2;
+	}
+
+	for ( ; i < len ; i++) {
+		h ^= p[i] * HASH_PRIME3;
+		h = hash_rotl(h, 11) * HASH_PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= HASH_PRIME2;
+	h ^= h >> 29;
+	h *= HASH_PRIME3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+static void lru_unlink(struct cb_cache *cache, struct cb_cache_entry *entry)
+{
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		cache->lru_head = entry->lru_next;
+
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		cache->lru_tail = entry->lru_prev;
+
+	entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push_head(struct cb_cache *cache, struct cb_cache_entry *entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = cache->lru_head;
+
+	if (cache->lru_head)
+		cache->lru_head->lru_prev = entry;
+	else
+		cache->lru_tail = entry;
+
+	cache->lru_head = entry;
+}
+
+static bool entry_cs_completed(struct cb_cache *cache,
+				struct cb_cache_entry *entry)
+{
+	uint32_t status;
+	int rc;
+
+	if (!entry->last_seq)
+		return true;
+
+	rc = hlthunk_wait_for_cs(cache->fd, entry->last_seq, 0, &status);
+
+	/* An aborted or timed-out CS no longer references the CB either */
+	if (rc || status != HL_WAIT_CS_STATUS_BUSY) {
+		entry->last_seq = 0;
+		return true;
+	}
+
+	return false;
+}
+
+static int entry_alloc_cb(struct cb_cache *cache,
+				struct cb_cache_entry *entry, const void *pkts)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	int rc;
+
+	entry->alloc_size = (entry->size + page_size - 1) & ~(page_size - 1);
+
+	if (entry->external) {
+		rc = hlthunk_request_command_buffer(cache->fd, entry->alloc_size,
+							&entry->cb_handle);
+		if (rc)
+			return rc;
+
+		entry->ptr = hlthunk_cb_mmap(cache->fd, entry->alloc_size,
+						entry->cb_handle);
+		if (entry->ptr == MAP_FAILED) {
+			hlthunk_destroy_command_buffer(cache->fd,
+							entry->cb_handle);
+			return -ENOMEM;
+		}
+	} else {
+		/*
+		 * Internal queues fetch the CB through the device MMU, so the
+		 * copy is kept in pinned host memory and the handle is its
+		 * device VA
+		 */
+		if (posix_memalign(&entry->ptr, page_size, entry->alloc_size))
+			return -ENOMEM;
+
+		entry->cb_handle = hlthunk_host_memory_map(cache->fd,
+						entry->ptr, 0,
+						entry->alloc_size);
+		if (!entry->cb_handle) {
+			free(entry->ptr);
+			return -ENOMEM;
+		}
+	}
+
+	memcpy(entry->ptr, pkts, entry->size);
+
+	return 0;
+}
+
+static void entry_free_cb(struct cb_cache *cache,
+				struct cb_cache_entry *entry)
+{
+	if (entry->external) {
+		hlthunk_cb_munmap(entry->ptr, entry->alloc_size);
+		hlthunk_destroy_command_buffer(cache->fd, entry->cb_handle);
+	} else {
+		hlthunk_memory_unmap(cache->fd, entry->cb_handle);
+		free(entry->ptr);
+	}
+}
+
+static void entry_remove(struct cb_cache *cache, struct cb_cache_entry *entry)
+{
+	struct cb_cache_entry **pp;
+	khint_t k;
+
+	k = kh_get(cb_cache, cache->hash_table, entry->hash);
+	if (k != kh_end(cache->hash_table)) {
+		pp = &kh_val(cache->hash_table, k);
+		while (*pp && *pp != entry)
+			pp = &(*pp)->hash_next;
+		if (*pp)
+			*pp = entry->hash_next;
+		if (!kh_val(cache->hash_table, k))
+			kh_del(cb_cache, cache->hash_table, k);
+	}
+
+	k = kh_get(cb_cache, cache->handle_table, entry->cb_handle);
+	if (k != kh_end(cache->handle_table))
+		kh_del(cb_cache, cache->handle_table, k);
+
+	lru_unlink(cache, entry);
+	entry_free_cb(cache, entry);
+	hlthunk_free(entry);
+
+	cache->stats.num_entries--;
+}
+
+/* Evict the least recently used entry that no in-flight CS references */
+static void cache_evict_one(struct cb_cache *cache)
+{
+	struct cb_cache_entry *entry;
+
+	for (entry = cache->lru_tail ; entry ; entry = entry->lru_prev) {
+		if (entry->refcnt || !entry_cs_completed(cache, entry))
+			continue;
+
+		entry_remove(cache, entry);
+		cache->stats.evictions++;
+		return;
+	}
+}
+
+/**
+ * This function creates a cache of command buffers which is keyed by the
+ * content of the CBs, so identical packet streams share a single CB
+ * @param fd file descriptor of the device the CBs will be created on
+ * @param max_entries soft limit on the number of cached CBs. Entries that are
+ * still referenced by the user or by an in-flight CS are never evicted
+ * @return opaque handle of the cache or NULL in case of error
+ */
+hlthunk_public void *hlthunk_cb_cache_create(int fd, uint32_t max_entries)
+{
+	struct cb_cache *cache;
+
+	cache = hlthunk_malloc(sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->hash_table = kh_init(cb_cache);
+	if (!cache->hash_table)
+		goto free_cache;
+
+	cache->handle_table = kh_init(cb_cache);
+	if (!cache->handle_table)
+		goto destroy_hash_table;
+
+	if (pthread_mutex_init(&cache->lock, NULL))
+		goto destroy_handle_table;
+
+	cache->fd = fd;
+	cache->max_entries = max_entries;
+
+	return cache;
+
+destroy_handle_table:
+	kh_destroy(cb_cache, cache->handle_table);
+destroy_hash_table:
+	kh_destroy(cb_cache, cache->hash_table);
+free_cache:
+	hlthunk_free(cache);
+	return NULL;
+}
+
+/**
+ * This function destroys all the CBs of the cache and frees it. The user must
+ * make sure that no CS which uses a cached CB is still running
+ * @param data the cache handle returned by hlthunk_cb_cache_create
+ */
+hlthunk_public void hlthunk_cb_cache_destroy(void *data)
+{
+	struct cb_cache *cache = (struct cb_cache *) data;
+
+	if (!cache)
+		return;
+
+	while (cache->lru_head)
+		entry_remove(cache, cache->lru_head);
+
+	kh_destroy(cb_cache, cache->handle_table);
+	kh_destroy(cb_cache, cache->hash_table);
+	pthread_mutex_destroy(&cache->lock);
+	hlthunk_free(cache);
+}
+
+/**
+ * This function returns a CB which contains the given packets. If an identical
+ * CB already exists in the cache it is reused, otherwise a new CB is created
+ * and filled. Every successful call takes a reference on the CB which must be
+ * released with hlthunk_cb_cache_put
+ * @param data the cache handle returned by hlthunk_cb_cache_create
+ * @param pkts the packets the CB should contain
+ * @param size size of the packets in bytes
+ * @param external true for a CB of an external queue, false for an internal
+ * queue, in which case the returned handle is the device VA of the CB
+ * @param cb_handle returned handle to put in the CS chunk
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_cb_cache_get(void *data, const void *pkts,
+					uint32_t size, bool external,
+					uint64_t *cb_handle)
+{
+	struct cb_cache *cache = (struct cb_cache *) data;
+	struct cb_cache_entry *entry, *head = NULL;
+	uint64_t hash;
+	khint_t k;
+	int rc;
+
+	if (!cache || !pkts || !size || !cb_handle)
+		return -EINVAL;
+
+	hash = hlthunk_hash_bytes(pkts, size);
+
+	pthread_mutex_lock(&cache->lock);
+
+	cache->stats.lookups++;
+
+	k = kh_get(cb_cache, cache->hash_table, hash);
+	if (k != kh_end(cache->hash_table))
+		head = kh_val(cache->hash_table, k);
+
+	for (entry = head ; entry ; entry = entry->hash_next) {
+		if (entry->size != size || entry->external != external ||
+				memcmp(entry->ptr, pkts, size))
+			continue;
+
+		entry->refcnt++;
+		lru_unlink(cache, entry);
+		lru_push_head(cache, entry);
+
+		cache->stats.hits++;
+		cache->stats.bytes_avoided += size;
+		*cb_handle = entry->cb_handle;
+
+		pthread_mutex_unlock(&cache->lock);
+		return 0;
+	}
+
+	cache->stats.misses++;
+
+	if (cache->max_entries &&
+			cache->stats.num_entries >= cache->max_entries) {
+		cache_evict_one(cache);
+
+		/* The eviction may have emptied the bucket we looked up */
+		head = NULL;
+		k = kh_get(cb_cache, cache->hash_table, hash);
+		if (k != kh_end(cache->hash_table))
+			head = kh_val(cache->hash_table, k);
+	}
+
+	entry = hlthunk_malloc(sizeof(*entry));
+	if (!entry) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	entry->hash = hash;
+	entry->size = size;
+	entry->external = external;
+	entry->refcnt = 1;
+
+	rc = entry_alloc_cb(cache, entry, pkts);
+	if (rc)
+		goto free_entry;
+
+	k = kh_put(cb_cache, cache->handle_table, entry->cb_handle, &rc);
+	if (rc < 0)
+		goto free_cb;
+	kh_val(cache->handle_table, k) = entry;
+
+	k = kh_put(cb_cache, cache->hash_table, hash, &rc);
+	if (rc < 0)
+		goto remove_handle;
+	entry->hash_next = head;
+	kh_val(cache->hash_table, k) = entry;
+
+	lru_push_head(cache, entry);
+	cache->stats.num_entries++;
+
+	*cb_handle = entry->cb_handle;
+
+	pthread_mutex_unlock(&cache->lock);
+	return 0;
+
+remove_handle:
+	kh_del(cb_cache, cache->handle_table,
+		kh_get(cb_cache, cache->handle_table, entry->cb_handle));
+free_cb:
+	rc = -ENOMEM;
+	entry_free_cb(cache, entry);
+free_entry:
+	hlthunk_free(entry);
+out:
+	pthread_mutex_unlock(&cache->lock);
+	return rc;
+}
+
+/**
+ * This function releases a reference that was taken by hlthunk_cb_cache_get.
+ * The CB stays in the cache, and is only eligible for eviction once all its
+ * references were released and the last CS that used it has completed
+ * @param data the cache handle returned by hlthunk_cb_cache_create
+ * @param cb_handle the handle returned by hlthunk_cb_cache_get
+ * @param seq sequence of the CS the CB was submitted in, or 0 if it wasn't
+ * submitted
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_cb_cache_put(void *data, uint64_t cb_handle,
+					uint64_t seq)
+{
+	struct cb_cache *cache = (struct cb_cache *) data;
+	struct cb_cache_entry *entry;
+	khint_t k;
+
+	if (!cache)
+		return -EINVAL;
+
+	pthread_mutex_lock(&cache->lock);
+
+	k = kh_get(cb_cache, cache->handle_table, cb_handle);
+	if (k == kh_end(cache->handle_table)) {
+		pthread_mutex_unlock(&cache->lock);
+		return -EINVAL;
+	}
+
+	entry = kh_val(cache->handle_table, k);
+
+	if (!entry->refcnt) {
+		pthread_mutex_unlock(&cache->lock);
+		return -EINVAL;
+	}
+
+	entry->refcnt--;
+	if (seq > entry->last_seq)
+		entry->last_seq = seq;
+
+	pthread_mutex_unlock(&cache->lock);
+
+	return 0;
+}
+
+/**
+ * This function retrieves the counters of the cache
+ * @param data the cache handle returned by hlthunk_cb_cache_create
+ * @param stats pointer to a structure that will be filled with the counters
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_cb_cache_get_stats(void *data,
+					struct hlthunk_cb_cache_stats *stats)
+{
+	struct cb_cache *cache = (struct cb_cache *) data;
+
+	if (!cache || !stats)
+		return -EINVAL;
+
+	pthread_mutex_lock(&cache->lock);
+	*stats = cache->stats;
+	pthread_mutex_unlock(&cache->lock);
+
+	return 0;
+}
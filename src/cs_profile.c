@@ -0,0 +1,477 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+#include "khash.h"
+#include "specs/goya/goya_packets.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * Profiling of command submissions with device timestamps. Every queue of a
+ * profiled CS gets a job before its chunks and a job after them, each with a
+ * MSG_LONG that writes the device timestamp counter to a slot in pinned host
+ * memory. The slots of a CS form a record, which is released when the CS is
+ * waited for.
+ *
+ * The counter is restarted when the profiler is created, and the host time
+ * of the restart maps the device timestamps to CLOCK_MONOTONIC.
+ */
+
+#define CS_PROFILE_TS_INVALID	UINT64_MAX
+
+KHASH_MAP_INIT_INT64(cs_profile, uint32_t)
+
+struct cs_profile_record {
+	uint64_t submit_ns;
+	uint32_t queues[HLTHUNK_CS_PROFILE_MAX_QUEUES];
+	uint32_t num_queues;
+};
+
+struct cs_profiler {
+	pthread_mutex_t lock;
+	khash_t(cs_profile) *inflight;
+	struct cs_profile_record *records;
+	/* Stack of the free records */
+	uint32_t *free_records;
+	uint32_t num_free;
+	uint32_t max_cs;
+	/* Timestamp slots, two per queue of every record */
+	struct hlthunk_host_buf ring;
+	void *cb_cache;
+	uint64_t ts_freq;
+	/* CLOCK_MONOTONIC time at which the counter was restarted */
+	uint64_t ts_base_ns;
+	int fd;
+};
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t slot_index(uint32_t record, uint32_t queue, bool end)
+{
+	return (record * HLTHUNK_CS_PROFILE_MAX_QUEUES + queue) * 2 + end;
+}
+
+static uint64_t *slot_ptr(struct cs_profiler *prof, uint32_t record,
+				uint32_t queue, bool end)
+{
+	return (uint64_t *) prof->ring.host_ptr +
+				slot_index(record, queue, end);
+}
+
+static uint64_t ts_to_ns(struct cs_profiler *prof, uint64_t ts)
+{
+	return prof->ts_base_ns + ts / prof->ts_freq * 1000000000ull +
+			ts % prof->ts_freq * 1000000000ull / prof->ts_freq;
+}
+
+/**
+ * This function creates a profiler of command submissions. It puts the device
+ * in debug mode and restarts its timestamp counter, so only one profiler
+ * should exist per device
+ * @param fd file descriptor of the device
+ * @param max_cs maximum number of profiled CSs that weren't waited for yet
+ * @return opaque handle of the profiler or NULL in case of error, with errno
+ * set
+ */
+hlthunk_public void *hlthunk_cs_profiler_create(int fd, uint32_t max_cs)
+{
+	struct cs_profiler *prof;
+	uint64_t size, before, after;
+	uint32_t i;
+	int rc;
+
+	if (!max_cs) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	prof = hlthunk_malloc(sizeof(*prof));
+	if (!prof) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	prof->fd = fd;
+	prof->max_cs = max_cs;
+
+	rc = hlthunk_get_timestamp_freq(fd, &prof->ts_freq);
+	if (rc)
+		goto free_prof;
+
+	rc = -ENOMEM;
+	prof->records = hlthunk_malloc(max_cs * sizeof(*prof->records));
+	prof->free_records = hlthunk_malloc(max_cs * sizeof(uint32_t));
+	prof->inflight = kh_init(cs_profile);
+	if (!prof->records || !prof->free_records || !prof->inflight)
+		goto free_records;
+
+	for (i = 0 ; i < max_cs ; i++)
+		prof->free_records[i] = max_cs - 1 - i;
+	prof->num_free = max_cs;
+
+	prof->cb_cache = hlthunk_cb_cache_create(fd, 0);
+	if (!prof->cb_cache)
+		goto free_records;
+
+	size = slot_index(max_cs, 0, false) * sizeof(uint64_t);
+	rc = hlthunk_host_alloc(fd, size, HLTHUNK_HOST_ALLOC_NO_1GB,
+				&prof->ring);
+	if (rc)
+		goto destroy_cache;
+
+	before = monotonic_ns();
+	rc = hlthunk_debug_timestamp(fd, true);
+	after = monotonic_ns();
+	if (rc)
+		goto free_ring;
+
+	prof->ts_base_ns = before + (after - before) / 2;
+
+	if (pthread_mutex_init(&prof->lock, NULL)) {
+		rc = -ENOMEM;
+		goto disable_timestamp;
+	}
+
+	return prof;
+
+disable_timestamp:
+	hlthunk_debug_timestamp(fd, false);
+free_ring:
+	hlthunk_host_free(fd, &prof->ring);
+destroy_cache:
+	hlthunk_cb_cache_destroy(prof->cb_cache);
+free_records:
+	if (prof->inflight)
+		kh_destroy(cs_profile, prof->inflight);
+	hlthunk_free(prof->free_records);
+	hlthunk_free(prof->records);
+free_prof:
+	hlthunk_free(prof);
+	errno = -rc;
+	return NULL;
+}
+
+/**
+ * This function destroys a profiler. The CSs that were submitted through it
+ * must have completed
+ * @param data the handle returned by hlthunk_cs_profiler_create
+ */
+hlthunk_public void hlthunk_cs_profiler_destroy(void *data)
+{
+	struct cs_profiler *prof = (struct cs_profiler *) data;
+
+	if (!prof)
+		return;
+
+	hlthunk_debug_timestamp(prof->fd, false);
+	hlthunk_cb_cache_destroy(prof->cb_cache);
+	hlthunk_host_free(prof->fd, &prof->ring);
+	kh_destroy(cs_profile, prof->inflight);
+	hlthunk_free(prof->free_records);
+	hlthunk_free(prof->records);
+	pthread_mutex_destroy(&prof->lock);
+	hlthunk_free(prof);
+}
+
+/* Gets a CB with a single MSG_LONG that writes the timestamp to a slot */
+static int get_stamp_cb(struct cs_profiler *prof, uint32_t record,
+			uint32_t queue, uint32_t queue_index, bool end,
+			struct hl_cs_chunk *chunk)
+{
+	struct packet_msg_long pkt;
+	uint64_t cb_handle;
+	int rc;
+
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.opcode = PACKET_MSG_LONG;
+	pkt.op = 1;
+	pkt.addr = prof->ring.device_virt_addr +
+			slot_index(record, queue, end) * sizeof(uint64_t);
+	/* The end stamp waits for the engine and the chunks' messages */
+	pkt.eng_barrier = end;
+	pkt.msg_barrier = end;
+
+	memset(chunk, 0, sizeof(*chunk));
+	chunk->queue_index = queue_index;
+	chunk->cb_size = sizeof(pkt);
+
+	rc = hlthunk_cb_cache_get(prof->cb_cache, &pkt, sizeof(pkt),
+					queue_index < GOYA_QUEUE_ID_CPU_PQ,
+					&cb_handle);
+	if (rc)
+		return rc;
+
+	chunk->cb_handle = cb_handle;
+
+	return 0;
+}
+
+static void put_stamp_cbs(struct cs_profiler *prof, struct hl_cs_chunk *chunks,
+				uint32_t num_chunks, bool *stamp, uint64_t seq)
+{
+	uint32_t i;
+
+	for (i = 0 ; i < num_chunks ; i++)
+		if (stamp[i] && chunks[i].cb_handle)
+			hlthunk_cb_cache_put(prof->cb_cache,
+						chunks[i].cb_handle, seq);
+}
+
+/*
+ * Builds the chunks of a profiled CS. The chunks of every queue keep their
+ * order and are surrounded by the stamps of the queue.
+ */
+static int build_chunks(struct cs_profiler *prof, uint32_t r,
+			struct hl_cs_chunk *user, uint32_t num_user,
+			struct hl_cs_chunk *chunks, bool *stamp)
+{
+	struct cs_profile_record *rec = &prof->records[r];
+	uint32_t i, j, q, n = 0;
+	int rc;
+
+	rec->num_queues = 0;
+
+	for (i = 0 ; i < num_user ; i++) {
+		for (q = 0 ; q < rec->num_queues ; q++)
+			if (rec->queues[q] == user[i].queue_index)
+				break;
+
+		if (q < rec->num_queues)
+			continue;
+
+		if (q == HLTHUNK_CS_PROFILE_MAX_QUEUES)
+			return -E2BIG;
+		rec->queues[rec->num_queues++] = user[i].queue_index;
+	}
+
+	for (q = 0 ; q < rec->num_queues ; q++) {
+		*slot_ptr(prof, r, q, false) = CS_PROFILE_TS_INVALID;
+		*slot_ptr(prof, r, q, true) = CS_PROFILE_TS_INVALID;
+
+		stamp[n] = true;
+		rc = get_stamp_cb(prof, r, q, rec->queues[q], false,
+					&chunks[n++]);
+		if (rc)
+			return rc;
+
+		for (j = 0 ; j < num_user ; j++) {
+			if (user[j].queue_index != rec->queues[q])
+				continue;
+			stamp[n] = false;
+			chunks[n++] = user[j];
+		}
+
+		stamp[n] = true;
+		rc = get_stamp_cb(prof, r, q, rec->queues[q], true,
+					&chunks[n++]);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+/**
+ * This function submits a CS with timestamps around the execute chunks of
+ * every queue. The profile of the CS is collected by
+ * hlthunk_cs_profiler_wait
+ * @param data the handle returned by hlthunk_cs_profiler_create
+ * @param in the CS, the same as for hlthunk_command_submission
+ * @param out returned sequence and status of the CS
+ * @return 0 for success, -EBUSY if max_cs profiled CSs weren't waited for,
+ * -E2BIG if the CS uses too many queues, negative value for other failures
+ */
+hlthunk_public int hlthunk_cs_profiler_submit(void *data,
+						struct hlthunk_cs_in *in,
+						struct hlthunk_cs_out *out)
+{
+	struct cs_profiler *prof = (struct cs_profiler *) data;
+	struct hl_cs_chunk *user, *chunks = NULL;
+	struct hlthunk_cs_in prof_in;
+	uint32_t r, num_chunks;
+	uint64_t submit_ns;
+	bool *stamp = NULL;
+	khint_t k;
+	int rc, ret;
+
+	if (!prof || !in || !out || !in->num_chunks_execute)
+		return -EINVAL;
+
+	pthread_mutex_lock(&prof->lock);
+	if (!prof->num_free) {
+		pthread_mutex_unlock(&prof->lock);
+		return -EBUSY;
+	}
+	r = prof->free_records[--prof->num_free];
+	pthread_mutex_unlock(&prof->lock);
+
+	user = (struct hl_cs_chunk *) in->chunks_execute;
+	num_chunks = in->num_chunks_execute +
+				2 * HLTHUNK_CS_PROFILE_MAX_QUEUES;
+
+	chunks = hlthunk_malloc(num_chunks * sizeof(*chunks));
+	stamp = hlthunk_malloc(num_chunks * sizeof(*stamp));
+	if (!chunks || !stamp) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	rc = build_chunks(prof, r, user, in->num_chunks_execute, chunks,
+				stamp);
+	if (rc)
+		goto put_cbs;
+
+	prof_in = *in;
+	prof_in.chunks_execute = chunks;
+	prof_in.num_chunks_execute = in->num_chunks_execute +
+					2 * prof->records[r].num_queues;
+
+	submit_ns = monotonic_ns();
+	rc = hlthunk_command_submission(prof->fd, &prof_in, out);
+	if (rc) {
+		rc = -errno;
+		goto put_cbs;
+	}
+
+	prof->records[r].submit_ns = submit_ns;
+
+	pthread_mutex_lock(&prof->lock);
+	k = kh_put(cs_profile, prof->inflight, out->seq, &ret);
+	if (ret >= 0)
+		kh_val(prof->inflight, k) = r;
+	pthread_mutex_unlock(&prof->lock);
+
+	put_stamp_cbs(prof, chunks, prof_in.num_chunks_execute, stamp,
+			out->seq);
+	hlthunk_free(stamp);
+	hlthunk_free(chunks);
+
+	/*
+	 * The CS was submitted but its profile is lost. The record isn't
+	 * reused, as the device may still write its slots.
+	 */
+	return ret < 0 ? -ENOMEM : 0;
+
+put_cbs:
+	put_stamp_cbs(prof, chunks, num_chunks, stamp, 0);
+out:
+	hlthunk_free(stamp);
+	hlthunk_free(chunks);
+	pthread_mutex_lock(&prof->lock);
+	prof->free_records[prof->num_free++] = r;
+	pthread_mutex_unlock(&prof->lock);
+	return rc;
+}
+
+static int fill_profile(struct cs_profiler *prof, uint32_t r, uint64_t seq,
+			uint64_t complete_ns,
+			struct hlthunk_cs_profile *profile)
+{
+	struct cs_profile_record *rec = &prof->records[r];
+	struct hlthunk_cs_profile_queue *pq;
+	uint64_t start, end;
+	uint32_t q;
+
+	memset(profile, 0, sizeof(*profile));
+	profile->seq = seq;
+	profile->submit_ns = rec->submit_ns;
+	profile->complete_ns = complete_ns;
+	profile->num_queues = rec->num_queues;
+
+	for (q = 0 ; q < rec->num_queues ; q++) {
+		start = __atomic_load_n(slot_ptr(prof, r, q, false),
+					__ATOMIC_ACQUIRE);
+		end = __atomic_load_n(slot_ptr(prof, r, q, true),
+					__ATOMIC_ACQUIRE);
+		if (start == CS_PROFILE_TS_INVALID ||
+				end == CS_PROFILE_TS_INVALID || end < start)
+			return -ENODATA;
+
+		start = ts_to_ns(prof, start);
+		end = ts_to_ns(prof, end);
+
+		pq = &profile->queues[q];
+		pq->queue_index = rec->queues[q];
+		pq->queue_delay_ns = (int64_t) (start - rec->submit_ns);
+		pq->exec_ns = end - start;
+		pq->notify_ns = (int64_t) (complete_ns - end);
+	}
+
+	return 0;
+}
+
+/**
+ * This function waits for a CS that was submitted through the profiler, and
+ * retrieves its profile once it completed. All the times are CLOCK_MONOTONIC
+ * times, or derived from them. The notification latency is measured until
+ * this function saw the completion, so it includes any delay in calling it
+ * @param data the handle returned by hlthunk_cs_profiler_create
+ * @param seq sequence of the CS
+ * @param timeout_us timeout of the wait
+ * @param status returned status of the CS, the same as for
+ * hlthunk_wait_for_cs
+ * @param profile returned profile of the CS, only filled when the CS
+ * completed
+ * @return 0 for success, -ENOENT if the CS wasn't profiled, -ENODATA if the
+ * device didn't write all the timestamps, negative value for other failures
+ */
+hlthunk_public int hlthunk_cs_profiler_wait(void *data, uint64_t seq,
+					uint64_t timeout_us, uint32_t *status,
+					struct hlthunk_cs_profile *profile)
+{
+	struct cs_profiler *prof = (struct cs_profiler *) data;
+	uint64_t complete_ns;
+	uint32_t r;
+	khint_t k;
+	int rc;
+
+	if (!prof || !status || !profile)
+		return -EINVAL;
+
+	rc = hlthunk_wait_for_cs(prof->fd, seq, timeout_us, status);
+	complete_ns = monotonic_ns();
+	if (rc)
+		return -errno;
+
+	if (*status == HL_WAIT_CS_STATUS_BUSY)
+		return 0;
+
+	pthread_mutex_lock(&prof->lock);
+
+	k = kh_get(cs_profile, prof->inflight, seq);
+	if (k == kh_end(prof->inflight)) {
+		pthread_mutex_unlock(&prof->lock);
+		return -ENOENT;
+	}
+
+	r = kh_val(prof->inflight, k);
+	kh_del(cs_profile, prof->inflight, k);
+
+	pthread_mutex_unlock(&prof->lock);
+
+	rc = 0;
+	if (*status == HL_WAIT_CS_STATUS_COMPLETED)
+		rc = fill_profile(prof, r, seq, complete_ns, profile);
+
+	pthread_mutex_lock(&prof->lock);
+	prof->free_records[prof->num_free++] = r;
+	pthread_mutex_unlock(&prof->lock);
+
+	return rc;
+}
@@ -0,0 +1,556 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Same as the maximum number of jobs in a CS of the driver */
+#define CS_SUBMITTER_MAX_CHUNKS		64
+/* Far more items than the driver can have in flight */
+#define CS_SUBMITTER_MAX_RING_SIZE	(1u << 20)
+
+struct cs_future {
+	struct cs_submitter *submitter;
+	uint64_t seq;
+	/* Result of the submission, valid once the future is resolved */
+	int rc;
+	uint32_t refcnt;
+	int fd;
+	bool resolved;
+};
+
+/*
+ * Slot of the ring. The sequence number tells the slot's state: it equals the
+ * ring position when the slot is free for that position, and the position + 1
+ * once a producer has filled it.
+ */
+struct cs_submitter_slot {
+	uint64_t seq;
+	uint64_t cb_handle;
+	uint64_t push_ns;
+	struct cs_future *future;
+	uint32_t cb_size;
+	uint32_t queue_index;
+};
+
+struct cs_submitter {
+	pthread_t thread;
+	/* Protects the futures and the stats, and is used to sleep and wake */
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t resolved;
+	struct cs_submitter_slot *ring;
+	uint64_t ring_mask;
+	/* Next position to fill, shared by the producers */
+	uint64_t tail;
+	/* Next position to drain, owned by the submitter thread */
+	uint64_t head;
+	struct hlthunk_cs_submitter_stats stats;
+	uint64_t flush_ns;
+	uint32_t max_chunks;
+	bool sleeping;
+	bool stopping;
+	int fd;
+};
+
+/* An item that was drained from the ring and waits to be submitted */
+struct cs_submitter_item {
+	uint64_t cb_handle;
+	uint64_t push_ns;
+	struct cs_future *future;
+	uint32_t cb_size;
+	uint32_t queue_index;
+};
+
+static uint64_t submitter_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void future_put(struct cs_future *future)
+{
+	if (!__atomic_sub_fetch(&future->refcnt, 1, __ATOMIC_ACQ_REL))
+		hlthunk_free(future);
+}
+
+static bool ring_has_item(struct cs_submitter *sub)
+{
+	struct cs_submitter_slot *slot = &sub->ring[sub->head & sub->ring_mask];
+
+	return __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == sub->head + 1;
+}
+
+static void ring_pop(struct cs_submitter *sub, struct cs_submitter_item *item)
+{
+	struct cs_submitter_slot *slot = &sub->ring[sub->head & sub->ring_mask];
+
+	item->cb_handle = slot->cb_handle;
+	item->cb_size = slot->cb_size;
+	item->queue_index = slot->queue_index;
+	item->push_ns = slot->push_ns;
+	item->future = slot->future;
+
+	/* Free the slot for the producer that fills it on the next lap */
+	__atomic_store_n(&slot->seq, sub->head + sub->ring_mask + 1,
+				__ATOMIC_RELEASE);
+	sub->head++;
+}
+
+static void submitter_flush(struct cs_submitter *sub,
+				struct cs_submitter_item *items, uint32_t num,
+				bool full)
+{
+	struct hl_cs_chunk chunks[CS_SUBMITTER_MAX_CHUNKS];
+	struct hlthunk_cs_in in;
+	struct hlthunk_cs_out out;
+	uint32_t i;
+	int rc;
+
+	memset(chunks, 0, num * sizeof(chunks[0]));
+	for (i = 0 ; i < num ; i++) {
+		chunks[i].cb_handle = items[i].cb_handle;
+		chunks[i].cb_size = items[i].cb_size;
+		chunks[i].queue_index = items[i].queue_index;
+	}
+
+	memset(&in, 0, sizeof(in));
+	in.chunks_execute = chunks;
+	in.num_chunks_execute = num;
+
+	memset(&out, 0, sizeof(out));
+	rc = hlthunk_command_submission(sub->fd, &in, &out);
+	if (rc)
+		rc = -errno;
+	else if (out.status != HL_CS_STATUS_SUCCESS)
+		rc = -EIO;
+
+	pthread_mutex_lock(&sub->lock);
+
+	for (i = 0 ; i < num ; i++) {
+		if (!items[i].future)
+			continue;
+
+		items[i].future->rc = rc;
+		items[i].future->seq = out.seq;
+		__atomic_store_n(&items[i].future->resolved, true,
+					__ATOMIC_RELEASE);
+	}
+
+	sub->stats.items += num;
+	sub->stats.cs++;
+	if (full)
+		sub->stats.full_flushes++;
+	else
+		sub->stats.deadline_flushes++;
+	if (rc)
+		sub->stats.failed_cs++;
+
+	pthread_cond_broadcast(&sub->resolved);
+	pthread_mutex_unlock(&sub->lock);
+
+	for (i = 0 ; i < num ; i++)
+		if (items[i].future)
+			future_put(items[i].future);
+}
+
+/*
+ * Sleeps until a producer pushes an item or until the deadline, 0 meaning no
+ * deadline. The flag and the ring are checked in opposite order to how the
+ * producers set and check them, so a push can't be missed.
+ */
+static void submitter_sleep(struct cs_submitter *sub, uint64_t deadline_ns)
+{
+	struct timespec ts;
+	uint64_t now_ns;
+
+	pthread_mutex_lock(&sub->lock);
+
+	__atomic_store_n(&sub->sleeping, true, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (!ring_has_item(sub) && !sub->stopping) {
+		if (deadline_ns) {
+			now_ns = submitter_now_ns();
+			if (deadline_ns > now_ns) {
+				clock_gettime(CLOCK_REALTIME, &ts);
+				deadline_ns = ts.tv_sec * 1000000000ull +
+						ts.tv_nsec + deadline_ns -
+						now_ns;
+				ts.tv_sec = deadline_ns / 1000000000ull;
+				ts.tv_nsec = deadline_ns % 1000000000ull;
+				pthread_cond_timedwait(&sub->wake, &sub->lock,
+							&ts);
+			}
+		} else {
+			pthread_cond_wait(&sub->wake, &sub->lock);
+		}
+	}
+
+	__atomic_store_n(&sub->sleeping, false, __ATOMIC_RELAXED);
+
+	pthread_mutex_unlock(&sub->lock);
+}
+
+static void *submitter_thread(void *arg)
+{
+	struct cs_submitter *sub = (struct cs_submitter *) arg;
+	struct cs_submitter_item items[CS_SUBMITTER_MAX_CHUNKS];
+	uint32_t num = 0;
+	bool stopping;
+
+	/* Best effort, the thread runs anywhere if the CPUs are unknown */
+	hlthunk_bind_thread_to_device(sub->fd);
+
+	while (true) {
+		while (num < sub->max_chunks && ring_has_item(sub))
+			ring_pop(sub, &items[num++]);
+
+		if (num == sub->max_chunks) {
+			submitter_flush(sub, items, num, true);
+			num = 0;
+			continue;
+		}
+
+		pthread_mutex_lock(&sub->lock);
+		stopping = sub->stopping;
+		pthread_mutex_unlock(&sub->lock);
+
+		/*
+		 * The deadline of the pending items is counted from when the
+		 * oldest of them was pushed
+		 */
+		if (num && (stopping || submitter_now_ns() >=
+					items[0].push_ns + sub->flush_ns)) {
+			submitter_flush(sub, items, num, false);
+			num = 0;
+			continue;
+		}
+
+		if (stopping && !ring_has_item(sub))
+			break;
+
+		submitter_sleep(sub,
+				num ? items[0].push_ns + sub->flush_ns : 0);
+	}
+
+	return NULL;
+}
+
+/**
+ * This function creates an asynchronous submission service. Work items that
+ * are pushed to it from any thread are packed by a dedicated thread into CSs
+ * with multiple chunks, which saves CS ioctls when many threads submit
+ * @param fd file descriptor of the device the CSs are submitted to
+ * @param ring_size maximum number of items that wait to be drained, rounded up
+ * to a power of 2. At most 2^20
+ * @param max_chunks maximum number of chunks in a CS, at most 64. A CS is
+ * submitted as soon as it has that many chunks
+ * @param flush_timeout_us how long an item may wait for more items to join
+ * its CS. 0 submits what is pending as soon as the thread drained it
+ * @return opaque handle of the submitter or NULL in case of error, with errno
+ * set
+ */
+hlthunk_public void *hlthunk_cs_submitter_create(int fd, uint32_t ring_size,
+						uint32_t max_chunks,
+						uint32_t flush_timeout_us)
+{
+	struct cs_submitter *sub;
+	uint64_t size = 1, i;
+	int rc;
+
+	if (!ring_size || ring_size > CS_SUBMITTER_MAX_RING_SIZE ||
+			!max_chunks || max_chunks > CS_SUBMITTER_MAX_CHUNKS) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	while (size < ring_size)
+		size <<= 1;
+
+	sub = hlthunk_malloc(sizeof(*sub));
+	if (!sub) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	sub->ring = calloc(size, sizeof(*sub->ring));
+	if (!sub->ring) {
+		rc = ENOMEM;
+		goto free_sub;
+	}
+
+	for (i = 0 ; i < size ; i++)
+		sub->ring[i].seq = i;
+
+	sub->ring_mask = size - 1;
+	sub->max_chunks = max_chunks;
+	sub->flush_ns = flush_timeout_us * 1000ull;
+	sub->fd = fd;
+
+	rc = pthread_mutex_init(&sub->lock, NULL);
+	if (rc)
+		goto free_ring;
+
+	rc = pthread_cond_init(&sub->wake, NULL);
+	if (rc)
+		goto destroy_lock;
+
+	rc = pthread_cond_init(&sub->resolved, NULL);
+	if (rc)
+		goto destroy_wake;
+
+	rc = pthread_create(&sub->thread, NULL, submitter_thread, sub);
+	if (rc)
+		goto destroy_resolved;
+
+	return sub;
+
+destroy_resolved:
+	pthread_cond_destroy(&sub->resolved);
+destroy_wake:
+	pthread_cond_destroy(&sub->wake);
+destroy_lock:
+	pthread_mutex_destroy(&sub->lock);
+free_ring:
+	hlthunk_free(sub->ring);
+free_sub:
+	hlthunk_free(sub);
+	errno = rc;
+	return NULL;
+}
+
+/**
+ * This function submits all the pushed items, stops the submitter thread and
+ * frees the submitter. Futures that were returned by it stay valid until they
+ * are released. No thread may push or wait on a future of the submitter while
+ * it is destroyed
+ * @param data the submitter handle returned by hlthunk_cs_submitter_create
+ */
+hlthunk_public void hlthunk_cs_submitter_destroy(void *data)
+{
+	struct cs_submitter *sub = (struct cs_submitter *) data;
+
+	if (!sub)
+		return;
+
+	pthread_mutex_lock(&sub->lock);
+	sub->stopping = true;
+	pthread_cond_signal(&sub->wake);
+	pthread_mutex_unlock(&sub->lock);
+
+	pthread_join(sub->thread, NULL);
+
+	pthread_cond_destroy(&sub->resolved);
+	pthread_cond_destroy(&sub->wake);
+	pthread_mutex_destroy(&sub->lock);
+	hlthunk_free(sub->ring);
+	hlthunk_free(sub);
+}
+
+/**
+ * This function pushes a CB to the submitter. It can be called from any
+ * thread without taking a lock, and only waits if the ring is full
+ * @param data the submitter handle returned by hlthunk_cs_submitter_create
+ * @param cb_handle handle of the CB, as in a CS chunk
+ * @param cb_size size of the CB, as in a CS chunk
+ * @param queue_index queue to execute the CB on, as in a CS chunk
+ * @param future if not NULL, returns a future which resolves when the CS that
+ * contains the CB completes. It must be released with hlthunk_cs_future_release
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_cs_submitter_push(void *data, uint64_t cb_handle,
+						uint32_t cb_size,
+						uint32_t queue_index,
+						void **future)
+{
+	struct cs_submitter *sub = (struct cs_submitter *) data;
+	struct cs_submitter_slot *slot;
+	struct cs_future *f = NULL;
+	uint64_t pos, seq;
+
+	if (!sub)
+		return -EINVAL;
+
+	if (future) {
+		f = hlthunk_malloc(sizeof(*f));
+		if (!f)
+			return -ENOMEM;
+
+		f->submitter = sub;
+		f->fd = sub->fd;
+		f->refcnt = 2;
+		*future = f;
+	}
+
+	pos = __atomic_load_n(&sub->tail, __ATOMIC_RELAXED);
+
+	while (true) {
+		slot = &sub->ring[pos & sub->ring_mask];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&sub->tail, &pos,
+					pos + 1, true, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+				break;
+		} else if ((int64_t) (seq - pos) < 0) {
+			/* The ring is full, let the submitter drain it */
+			sched_yield();
+			pos = __atomic_load_n(&sub->tail, __ATOMIC_RELAXED);
+		} else {
+			pos = __atomic_load_n(&sub->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->cb_handle = cb_handle;
+	slot->cb_size = cb_size;
+	slot->queue_index = queue_index;
+	slot->future = f;
+	slot->push_ns = submitter_now_ns();
+
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&sub->sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&sub->lock);
+		pthread_cond_signal(&sub->wake);
+		pthread_mutex_unlock(&sub->lock);
+	}
+
+	return 0;
+}
+
+/**
+ * This function retrieves the counters of the submitter
+ * @param data the submitter handle returned by hlthunk_cs_submitter_create
+ * @param stats pointer to a structure that will be filled with the counters
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_cs_submitter_get_stats(void *data,
+				struct hlthunk_cs_submitter_stats *stats)
+{
+	struct cs_submitter *sub = (struct cs_submitter *) data;
+
+	if (!sub || !stats)
+		return -EINVAL;
+
+	pthread_mutex_lock(&sub->lock);
+	*stats = sub->stats;
+	pthread_mutex_unlock(&sub->lock);
+
+	return 0;
+}
+
+/**
+ * This function waits until the CS of a future completes
+ * @param data the future returned by hlthunk_cs_submitter_push
+ * @param timeout_us how long to wait for the CS to be submitted and then for
+ * it to complete. 0 only polls
+ * @param status returned status, same as of hlthunk_wait_for_cs. It is
+ * HL_WAIT_CS_STATUS_BUSY or HL_WAIT_CS_STATUS_TIMEDOUT if the CS wasn't
+ * submitted yet
+ * @return 0 for success, the error of the submission if it failed, or the
+ * return value of hlthunk_wait_for_cs
+ */
+hlthunk_public int hlthunk_cs_future_wait(void *data, uint64_t timeout_us,
+						uint32_t *status)
+{
+	struct cs_future *future = (struct cs_future *) data;
+	struct cs_submitter *sub;
+	struct timespec ts;
+	uint64_t deadline_ns, start_ns, elapsed_us;
+
+	if (!future || !status)
+		return -EINVAL;
+
+	/* Resolved futures don't touch the submitter, which may be gone */
+	if (__atomic_load_n(&future->resolved, __ATOMIC_ACQUIRE))
+		goto wait_cs;
+
+	sub = future->submitter;
+	start_ns = submitter_now_ns();
+
+	pthread_mutex_lock(&sub->lock);
+
+	if (!future->resolved && timeout_us) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		deadline_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec +
+				timeout_us * 1000ull;
+		ts.tv_sec = deadline_ns / 1000000000ull;
+		ts.tv_nsec = deadline_ns % 1000000000ull;
+
+		while (!future->resolved)
+			if (pthread_cond_timedwait(&sub->resolved, &sub->lock,
+							&ts) == ETIMEDOUT)
+				break;
+	}
+
+	if (!future->resolved) {
+		pthread_mutex_unlock(&sub->lock);
+		*status = timeout_us ? HL_WAIT_CS_STATUS_TIMEDOUT :
+					HL_WAIT_CS_STATUS_BUSY;
+		return 0;
+	}
+
+	pthread_mutex_unlock(&sub->lock);
+
+	elapsed_us = (submitter_now_ns() - start_ns) / 1000;
+	timeout_us = timeout_us > elapsed_us ? timeout_us - elapsed_us : 0;
+
+wait_cs:
+	if (future->rc)
+		return future->rc;
+
+	return hlthunk_wait_for_cs(future->fd, future->seq, timeout_us, status);
+}
+
+/**
+ * This function returns the sequence number of the CS of a future
+ * @param data the future returned by hlthunk_cs_submitter_push
+ * @param seq returned sequence number
+ * @return 0 for success, -EAGAIN if the CS wasn't submitted yet, the error of
+ * the submission if it failed
+ */
+hlthunk_public int hlthunk_cs_future_get_seq(void *data, uint64_t *seq)
+{
+	struct cs_future *future = (struct cs_future *) data;
+
+	if (!future || !seq)
+		return -EINVAL;
+
+	if (!__atomic_load_n(&future->resolved, __ATOMIC_ACQUIRE))
+		return -EAGAIN;
+
+	if (future->rc)
+		return future->rc;
+
+	*seq = future->seq;
+
+	return 0;
+}
+
+/**
+ * This function releases a future. It can be released before it resolves
+ * @param data the future returned by hlthunk_cs_submitter_push
+ */
+hlthunk_public void hlthunk_cs_future_release(void *data)
+{
+	struct cs_future *future = (struct cs_future *) data;
+
+	if (future)
+		future_put(future);
+}
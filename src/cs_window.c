@@ -0,0 +1,397 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+#include "khash.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Same as the maximum number of jobs in a CS of the driver */
+#define CS_WINDOW_MAX_QUEUES_PER_CS	64
+
+/* How long a blocking submission waits on a CS before checking again */
+#define CS_WINDOW_WAIT_TIMEOUT_US	1000000
+
+struct cs_window_queue {
+	/* Ring of the in-flight CSs of the queue, oldest first */
+	uint64_t *seqs;
+	uint32_t capacity;
+	uint32_t head;
+	struct hlthunk_cs_window_stats stats;
+};
+
+KHASH_MAP_INIT_INT(cs_window, struct cs_window_queue *)
+
+struct cs_window {
+	pthread_mutex_t lock;
+	khash_t(cs_window) *queues;
+	uint32_t default_depth;
+	int fd;
+};
+
+static int queue_resize(struct cs_window_queue *q, uint32_t capacity)
+{
+	uint64_t *seqs;
+	uint32_t i;
+
+	seqs = hlthunk_malloc(capacity * sizeof(*seqs));
+	if (!seqs)
+		return -ENOMEM;
+
+	for (i = 0 ; i < q->stats.inflight ; i++)
+		seqs[i] = q->seqs[(q->head + i) % q->capacity];
+
+	hlthunk_free(q->seqs);
+	q->seqs = seqs;
+	q->capacity = capacity;
+	q->head = 0;
+
+	return 0;
+}
+
+static struct cs_window_queue *window_get_queue(struct cs_window *window,
+						uint32_t queue_index,
+						bool create)
+{
+	struct cs_window_queue *q;
+	khint_t k;
+	int rc;
+
+	k = kh_get(cs_window, window->queues, queue_index);
+	if (k != kh_end(window->queues))
+		return kh_val(window->queues, k);
+
+	if (!create)
+		return NULL;
+
+	q = hlthunk_malloc(sizeof(*q));
+	if (!q)
+		return NULL;
+
+	if (queue_resize(q, window->default_depth))
+		goto free_queue;
+
+	q->stats.max_inflight = window->default_depth;
+
+	k = kh_put(cs_window, window->queues, queue_index, &rc);
+	if (rc < 0)
+		goto free_seqs;
+	kh_val(window->queues, k) = q;
+
+	return q;
+
+free_seqs:
+	hlthunk_free(q->seqs);
+free_queue:
+	hlthunk_free(q);
+	return NULL;
+}
+
+/*
+ * Returns the credits of the CSs that completed, in submission order. An
+ * aborted or timed-out CS no longer occupies the queue either. A CS whose
+ * wait failed keeps its credit, as it may still be running.
+ */
+static int queue_reap(struct cs_window *window, struct cs_window_queue *q)
+{
+	uint32_t status;
+	int rc;
+
+	while (q->stats.inflight) {
+		do {
+			rc = hlthunk_wait_for_cs(window->fd, q->seqs[q->head],
+							0, &status);
+		} while (rc && errno == EINTR);
+
+		if (rc)
+			return -errno;
+		if (status == HL_WAIT_CS_STATUS_BUSY)
+			break;
+
+		q->head = (q->head + 1) % q->capacity;
+		q->stats.inflight--;
+		q->stats.completed++;
+	}
+
+	return 0;
+}
+
+static bool queue_has_credit(struct cs_window_queue *q)
+{
+	return q->stats.inflight < q->stats.max_inflight;
+}
+
+static void queue_push(struct cs_window_queue *q, uint64_t seq)
+{
+	q->seqs[(q->head + q->stats.inflight) % q->capacity] = seq;
+	q->stats.inflight++;
+	q->stats.submitted++;
+
+	if (q->stats.inflight > q->stats.peak_inflight)
+		q->stats.peak_inflight = q->stats.inflight;
+}
+
+/* Collects the queues that the CS uses, every queue once */
+static int window_cs_queues(struct cs_window *window, struct hlthunk_cs_in *in,
+				struct cs_window_queue **queues)
+{
+	struct hl_cs_chunk *chunks;
+	struct cs_window_queue *q;
+	uint32_t i, j, num_chunks, num = 0;
+	int pass;
+
+	for (pass = 0 ; pass < 2 ; pass++) {
+		chunks = pass ? in->chunks_execute : in->chunks_restore;
+		num_chunks = pass ? in->num_chunks_execute :
+					in->num_chunks_restore;
+
+		for (i = 0 ; i < num_chunks ; i++) {
+			q = window_get_queue(window, chunks[i].queue_index,
+						true);
+			if (!q)
+				return -ENOMEM;
+
+			for (j = 0 ; j < num ; j++)
+				if (queues[j] == q)
+					break;
+			if (j < num)
+				continue;
+
+			if (num == CS_WINDOW_MAX_QUEUES_PER_CS)
+				return -EINVAL;
+			queues[num++] = q;
+		}
+	}
+
+	return num;
+}
+
+/**
+ * This function creates a submission window, which bounds the number of CSs
+ * that are in flight on every queue. A CS takes a credit on every queue it
+ * uses when it is submitted, and the credit is returned when the CS completes
+ * @param fd file descriptor of the device the CSs are submitted to
+ * @param max_inflight the default maximum number of in-flight CSs per queue
+ * @return opaque handle of the window or NULL in case of error
+ */
+hlthunk_public void *hlthunk_cs_window_create(int fd, uint32_t max_inflight)
+{
+	struct cs_window *window;
+
+	if (!max_inflight)
+		return NULL;
+
+	window = hlthunk_malloc(sizeof(*window));
+	if (!window)
+		return NULL;
+
+	window->queues = kh_init(cs_window);
+	if (!window->queues)
+		goto free_window;
+
+	if (pthread_mutex_init(&window->lock, NULL))
+		goto destroy_queues;
+
+	window->fd = fd;
+	window->default_depth = max_inflight;
+
+	return window;
+
+destroy_queues:
+	kh_destroy(cs_window, window->queues);
+free_window:
+	hlthunk_free(window);
+	return NULL;
+}
+
+/**
+ * This function frees the window. CSs that are still in flight are not
+ * affected
+ * @param data the window handle returned by hlthunk_cs_window_create
+ */
+hlthunk_public void hlthunk_cs_window_destroy(void *data)
+{
+	struct cs_window *window = (struct cs_window *) data;
+	struct cs_window_queue *q;
+
+	if (!window)
+		return;
+
+	kh_foreach_value(window->queues, q, {
+		hlthunk_free(q->seqs);
+		hlthunk_free(q);
+	});
+
+	kh_destroy(cs_window, window->queues);
+	pthread_mutex_destroy(&window->lock);
+	hlthunk_free(window);
+}
+
+/**
+ * This function sets the maximum number of in-flight CSs of a queue. If more
+ * CSs than the new maximum are already in flight, the submissions to the queue
+ * wait until enough of them complete
+ * @param data the window handle returned by hlthunk_cs_window_create
+ * @param queue_index the queue to configure
+ * @param max_inflight the maximum number of in-flight CSs on the queue
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_cs_window_set_depth(void *data, uint32_t queue_index,
+						uint32_t max_inflight)
+{
+	struct cs_window *window = (struct cs_window *) data;
+	struct cs_window_queue *q;
+	uint32_t capacity;
+	int rc = 0;
+
+	if (!window || !max_inflight)
+		return -EINVAL;
+
+	pthread_mutex_lock(&window->lock);
+
+	q = window_get_queue(window, queue_index, true);
+	if (!q) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	capacity = max_inflight > q->stats.inflight ?
+				max_inflight : q->stats.inflight;
+	if (capacity != q->capacity) {
+		rc = queue_resize(q, capacity);
+		if (rc)
+			goto out;
+	}
+
+	q->stats.max_inflight = max_inflight;
+
+out:
+	pthread_mutex_unlock(&window->lock);
+	return rc;
+}
+
+/**
+ * This function submits a CS once all the queues it uses have a free credit.
+ * Credits of completed CSs are returned by polling the oldest in-flight CS of
+ * every queue, so no completion callback is needed
+ * @param data the window handle returned by hlthunk_cs_window_create
+ * @param in the CS, same as for hlthunk_command_submission
+ * @param out the CS result, same as for hlthunk_command_submission
+ * @param block true to wait for credits, false to fail if a queue is full
+ * @return 0 for success, -EAGAIN if a queue is full and block is false, other
+ * negative value for failure
+ */
+hlthunk_public int hlthunk_cs_window_submit(void *data,
+					struct hlthunk_cs_in *in,
+					struct hlthunk_cs_out *out, bool block)
+{
+	struct cs_window *window = (struct cs_window *) data;
+	struct cs_window_queue *queues[CS_WINDOW_MAX_QUEUES_PER_CS], *full;
+	uint64_t seq;
+	uint32_t status;
+	bool blocked = false;
+	int i, num, rc;
+
+	if (!window || !in || !out)
+		return -EINVAL;
+
+	pthread_mutex_lock(&window->lock);
+
+	num = window_cs_queues(window, in, queues);
+	if (num < 0) {
+		rc = num;
+		goto out;
+	}
+
+	while (true) {
+		full = NULL;
+		for (i = 0 ; i < num && !full ; i++) {
+			rc = queue_reap(window, queues[i]);
+			if (rc)
+				goto out;
+			if (!queue_has_credit(queues[i]))
+				full = queues[i];
+		}
+
+		if (!full)
+			break;
+
+		if (!block) {
+			full->stats.rejected++;
+			rc = -EAGAIN;
+			goto out;
+		}
+
+		if (!blocked) {
+			full->stats.blocked++;
+			blocked = true;
+		}
+
+		/*
+		 * Wait for the oldest CS of the full queue without the lock, so
+		 * other threads can submit to the other queues meanwhile
+		 */
+		seq = full->seqs[full->head];
+		pthread_mutex_unlock(&window->lock);
+		hlthunk_wait_for_cs(window->fd, seq, CS_WINDOW_WAIT_TIMEOUT_US,
+					&status);
+		pthread_mutex_lock(&window->lock);
+	}
+
+	/*
+	 * The lock is held across the submission so the CSs enter the rings in
+	 * the order of their sequence numbers
+	 */
+	rc = hlthunk_command_submission(window->fd, in, out);
+	if (rc) {
+		rc = -errno;
+		goto out;
+	}
+
+	for (i = 0 ; i < num ; i++)
+		queue_push(queues[i], out->seq);
+
+out:
+	pthread_mutex_unlock(&window->lock);
+	return rc;
+}
+
+/**
+ * This function retrieves the depth and counters of a queue of the window
+ * @param data the window handle returned by hlthunk_cs_window_create
+ * @param queue_index the queue whose counters are retrieved
+ * @param stats pointer to a structure that will be filled with the counters
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_cs_window_get_stats(void *data, uint32_t queue_index,
+					struct hlthunk_cs_window_stats *stats)
+{
+	struct cs_window *window = (struct cs_window *) data;
+	struct cs_window_queue *q;
+	int rc = 0;
+
+	if (!window || !stats)
+		return -EINVAL;
+
+	pthread_mutex_lock(&window->lock);
+
+	q = window_get_queue(window, queue_index, false);
+	if (q) {
+		rc = queue_reap(window, q);
+		*stats = q->stats;
+	} else {
+		memset(stats, 0, sizeof(*stats));
+		stats->max_inflight = window->default_depth;
+	}
+
+	pthread_mutex_unlock(&window->lock);
+
+	return rc;
+}
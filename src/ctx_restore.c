@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+#include "khash.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Same as the maximum number of jobs in a CS of the driver */
+#define CTX_RESTORE_MAX_CHUNKS	64
+
+struct ctx_restore_entry {
+	uint64_t cb_handle;
+	uint32_t cb_size;
+	bool dirty;
+};
+
+KHASH_MAP_INIT_INT(ctx_restore, struct ctx_restore_entry *)
+
+/*
+ * The driver runs the restore chunks of a CS only on a context switch or when
+ * the CS forces a restore. A device has a single context, which is switched
+ * to on its first CS, so after the restore CBs were run once they only need
+ * to run again when they change or when the device state may have been lost.
+ */
+struct ctx_restore {
+	pthread_mutex_t lock;
+	khash_t(ctx_restore) *entries;
+	struct hlthunk_ctx_restore_stats stats;
+	uint32_t num_dirty;
+	int fd;
+};
+
+static void entry_mark_dirty(struct ctx_restore *ctx,
+				struct ctx_restore_entry *entry)
+{
+	if (!entry->dirty) {
+		entry->dirty = true;
+		ctx->num_dirty++;
+	}
+}
+
+/**
+ * This function creates a context-restore manager, which keeps the restore CB
+ * of every queue and attaches the restore CBs to a CS only when they must run
+ * @param fd file descriptor of the device the CSs are submitted to
+ * @return opaque handle of the manager or NULL in case of error
+ */
+hlthunk_public void *hlthunk_ctx_restore_create(int fd)
+{
+	struct ctx_restore *ctx;
+
+	ctx = hlthunk_malloc(sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	ctx->entries = kh_init(ctx_restore);
+	if (!ctx->entries)
+		goto free_ctx;
+
+	if (pthread_mutex_init(&ctx->lock, NULL))
+		goto destroy_entries;
+
+	ctx->fd = fd;
+
+	return ctx;
+
+destroy_entries:
+	kh_destroy(ctx_restore, ctx->entries);
+free_ctx:
+	hlthunk_free(ctx);
+	return NULL;
+}
+
+/**
+ * This function frees the manager. The registered CBs are not destroyed
+ * @param data the manager handle returned by hlthunk_ctx_restore_create
+ */
+hlthunk_public void hlthunk_ctx_restore_destroy(void *data)
+{
+	struct ctx_restore *ctx = (struct ctx_restore *) data;
+	struct ctx_restore_entry *entry;
+
+	if (!ctx)
+		return;
+
+	kh_foreach_value(ctx->entries, entry, hlthunk_free(entry));
+
+	kh_destroy(ctx_restore, ctx->entries);
+	pthread_mutex_destroy(&ctx->lock);
+	hlthunk_free(ctx);
+}
+
+/**
+ * This function registers the restore CB of a queue, replacing the previous
+ * one. A new CB is dirty, so it runs with the next CS
+ * @param data the manager handle returned by hlthunk_ctx_restore_create
+ * @param queue_index the queue the CB restores
+ * @param cb_handle handle of the CB, as in a CS chunk, or 0 to unregister the
+ * restore CB of the queue
+ * @param cb_size size of the CB, as in a CS chunk
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_ctx_restore_set(void *data, uint32_t queue_index,
+						uint64_t cb_handle,
+						uint32_t cb_size)
+{
+	struct ctx_restore *ctx = (struct ctx_restore *) data;
+	struct ctx_restore_entry *entry;
+	khint_t k;
+	int rc = 0;
+
+	if (!ctx || (cb_handle && !cb_size))
+		return -EINVAL;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	k = kh_get(ctx_restore, ctx->entries, queue_index);
+
+	if (!cb_handle) {
+		if (k != kh_end(ctx->entries)) {
+			entry = kh_val(ctx->entries, k);
+			if (entry->dirty)
+				ctx->num_dirty--;
+			hlthunk_free(entry);
+			kh_del(ctx_restore, ctx->entries, k);
+		}
+		goto out;
+	}
+
+	if (k != kh_end(ctx->entries)) {
+		entry = kh_val(ctx->entries, k);
+	} else {
+		if (kh_size(ctx->entries) == CTX_RESTORE_MAX_CHUNKS) {
+			rc = -ENOSPC;
+			goto out;
+		}
+
+		entry = hlthunk_malloc(sizeof(*entry));
+		if (!entry) {
+			rc = -ENOMEM;
+			goto out;
+		}
+
+		k = kh_put(ctx_restore, ctx->entries, queue_index, &rc);
+		if (rc < 0) {
+			hlthunk_free(entry);
+			rc = -ENOMEM;
+			goto out;
+		}
+		kh_val(ctx->entries, k) = entry;
+		rc = 0;
+	}
+
+	if (entry->cb_handle != cb_handle || entry->cb_size != cb_size) {
+		entry->cb_handle = cb_handle;
+		entry->cb_size = cb_size;
+		entry_mark_dirty(ctx, entry);
+	}
+
+out:
+	pthread_mutex_unlock(&ctx->lock);
+	return rc;
+}
+
+/**
+ * This function marks the restore CB of a queue as dirty, which the user must
+ * do after changing its content
+ * @param data the manager handle returned by hlthunk_ctx_restore_create
+ * @param queue_index the queue whose restore CB changed
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_ctx_restore_mark_dirty(void *data,
+						uint32_t queue_index)
+{
+	struct ctx_restore *ctx = (struct ctx_restore *) data;
+	khint_t k;
+	int rc = 0;
+
+	if (!ctx)
+		return -EINVAL;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	k = kh_get(ctx_restore, ctx->entries, queue_index);
+	if (k != kh_end(ctx->entries))
+		entry_mark_dirty(ctx, kh_val(ctx->entries, k));
+	else
+		rc = -ENOENT;
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return rc;
+}
+
+/**
+ * This function submits a CS and attaches the registered restore CBs to it
+ * when any of them is dirty, together with HL_CS_FLAGS_FORCE_RESTORE. All of
+ * them are attached then, so a context switch at that point still restores
+ * every queue. If the CS fails, the device state is unknown and all the
+ * restore CBs become dirty
+ * @param data the manager handle returned by hlthunk_ctx_restore_create
+ * @param in the CS, same as for hlthunk_command_submission but without restore
+ * chunks. HL_CS_FLAGS_FORCE_RESTORE in its flags forces the restore
+ * @param out the CS result, same as for hlthunk_command_submission
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_ctx_restore_submit(void *data,
+						struct hlthunk_cs_in *in,
+						struct hlthunk_cs_out *out)
+{
+	struct ctx_restore *ctx = (struct ctx_restore *) data;
+	struct hl_cs_chunk chunks[CTX_RESTORE_MAX_CHUNKS];
+	struct ctx_restore_entry *entry;
+	struct hlthunk_cs_in cs_in;
+	uint32_t num = 0, key;
+	bool restore;
+	int rc;
+
+	if (!ctx || !in || !out || in->num_chunks_restore)
+		return -EINVAL;
+
+	cs_in = *in;
+
+	pthread_mutex_lock(&ctx->lock);
+
+	restore = ctx->num_dirty || (in->flags & HL_CS_FLAGS_FORCE_RESTORE);
+
+	if (restore) {
+		kh_foreach(ctx->entries, key, entry, {
+			memset(&chunks[num], 0, sizeof(chunks[num]));
+			chunks[num].cb_handle = entry->cb_handle;
+			chunks[num].cb_size = entry->cb_size;
+			chunks[num].queue_index = key;
+			num++;
+		});
+
+		cs_in.chunks_restore = chunks;
+		cs_in.num_chunks_restore = num;
+		cs_in.flags |= HL_CS_FLAGS_FORCE_RESTORE;
+	}
+
+	rc = hlthunk_command_submission(ctx->fd, &cs_in, out);
+	if (rc)
+		rc = -errno;
+
+	ctx->stats.cs++;
+
+	if (rc || out->status != HL_CS_STATUS_SUCCESS) {
+		kh_foreach_value(ctx->entries, entry,
+					entry_mark_dirty(ctx, entry));
+	} else if (restore) {
+		kh_foreach_value(ctx->entries, entry, entry->dirty = false);
+		ctx->num_dirty = 0;
+		ctx->stats.restore_cs++;
+		ctx->stats.restore_chunks += num;
+	} else {
+		ctx->stats.skipped_chunks += kh_size(ctx->entries);
+	}
+
+	pthread_mutex_unlock(&ctx->lock);
+
+	return rc;
+}
+
+/**
+ * This function retrieves the counters of the manager
+ * @param data the manager handle returned by hlthunk_ctx_restore_create
+ * @param stats pointer to a structure that will be filled with the counters
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_ctx_restore_get_stats(void *data,
+				struct hlthunk_ctx_restore_stats *stats)
+{
+	struct ctx_restore *ctx = (struct ctx_restore *) data;
+
+	if (!ctx || !stats)
+		return -EINVAL;
+
+	pthread_mutex_lock(&ctx->lock);
+	*stats = ctx->stats;
+	pthread_mutex_unlock(&ctx->lock);
+
+	return 0;
+}
@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * Sampling of the utilization of the engines. A thread reads the busy engines
+ * mask of the device at a fixed rate, and counts for every engine the samples
+ * in which it was busy over sliding windows of the latest samples.
+ *
+ * The counts of a window are published under a sequence counter, which is odd
+ * while they are updated. Readers copy the counts and retry if the counter
+ * changed meanwhile, so they never block the sampling thread.
+ */
+
+#define ENGINE_UTIL_DEFAULT_WINDOW_MS	100
+#define NS_PER_SEC			1000000000ull
+
+struct util_window {
+	/* Length of the window in samples */
+	uint64_t len;
+	uint32_t counts[HLTHUNK_ENGINE_UTIL_MAX_ENGINES];
+	/* The published counts */
+	uint32_t seq;
+	uint64_t timestamp_ns;
+	uint32_t num_samples;
+	uint32_t num_missed;
+	uint32_t busy_samples[HLTHUNK_ENGINE_UTIL_MAX_ENGINES];
+};
+
+struct engine_util {
+	pthread_t thread;
+	struct util_window windows[HLTHUNK_ENGINE_UTIL_MAX_WINDOWS];
+	uint32_t num_windows;
+	/* The masks of the latest samples, as many as the longest window */
+	uint32_t *masks;
+	uint64_t num_masks;
+	uint64_t num_samples;
+	uint32_t num_missed;
+	uint64_t period_ns;
+	int fd;
+	int err;
+	bool stop;
+};
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void count_mask(uint32_t *counts, uint32_t mask, int inc)
+{
+	while (mask) {
+		counts[__builtin_ctz(mask)] += inc;
+		mask &= mask - 1;
+	}
+}
+
+static void publish_window(struct engine_util *u, struct util_window *w,
+				uint64_t now)
+{
+	uint32_t i, seq = w->seq;
+
+	__atomic_store_n(&w->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__atomic_store_n(&w->timestamp_ns, now, __ATOMIC_RELAXED);
+	__atomic_store_n(&w->num_samples,
+			u->num_samples < w->len ? u->num_samples : w->len,
+			__ATOMIC_RELAXED);
+	__atomic_store_n(&w->num_missed, u->num_missed, __ATOMIC_RELAXED);
+	for (i = 0 ; i < HLTHUNK_ENGINE_UTIL_MAX_ENGINES ; i++)
+		__atomic_store_n(&w->busy_samples[i], w->counts[i],
+					__ATOMIC_RELAXED);
+
+	__atomic_store_n(&w->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void add_sample(struct engine_util *u, uint32_t mask, uint64_t now)
+{
+	uint64_t slot = u->num_samples % u->num_masks;
+	struct util_window *w;
+	uint32_t i;
+
+	/* The oldest sample of every full window leaves it */
+	for (i = 0 ; i < u->num_windows ; i++) {
+		w = &u->windows[i];
+		if (u->num_samples >= w->len)
+			count_mask(w->counts, u->masks[(u->num_samples -
+					w->len) % u->num_masks], -1);
+		count_mask(w->counts, mask, 1);
+	}
+
+	u->masks[slot] = mask;
+	u->num_samples++;
+
+	for (i = 0 ; i < u->num_windows ; i++)
+		publish_window(u, &u->windows[i], now);
+}
+
+static void *util_thread(void *arg)
+{
+	struct engine_util *u = (struct engine_util *) arg;
+	struct hl_info_hw_idle hw_idle;
+	struct hl_info_args args;
+	uint64_t next, now, missed;
+	struct timespec ts;
+
+	/* A single info request is reused for all of the samples */
+	memset(&args, 0, sizeof(args));
+	args.op = HL_INFO_HW_IDLE;
+	args.return_pointer = (__u64) (uintptr_t) &hw_idle;
+	args.return_size = sizeof(hw_idle);
+
+	next = monotonic_ns();
+
+	while (!__atomic_load_n(&u->stop, __ATOMIC_RELAXED)) {
+		if (hlthunk_get_info(u->fd, &args)) {
+			__atomic_store_n(&u->err, -errno, __ATOMIC_RELAXED);
+			break;
+		}
+
+		now = monotonic_ns();
+		add_sample(u, hw_idle.busy_engines_mask, now);
+
+		/* Ticks that already passed are skipped, not sampled late */
+		next += u->period_ns;
+		if (now > next) {
+			missed = (now - next) / u->period_ns + 1;
+			u->num_missed += missed;
+			next += missed * u->period_ns;
+		}
+
+		ts.tv_sec = next / NS_PER_SEC;
+		ts.tv_nsec = next % NS_PER_SEC;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+
+	return NULL;
+}
+
+/**
+ * This function starts sampling the busy engines of the device from a
+ * background thread
+ * @param fd file descriptor of the device
+ * @param params the sampling rate and the lengths of the windows, of up to
+ * HLTHUNK_ENGINE_UTIL_MAX_WINDOW_MS each. May be NULL for the defaults
+ * @return opaque handle of the sampler or NULL in case of error, with errno
+ * set
+ */
+hlthunk_public void *hlthunk_engine_util_create(int fd,
+			const struct hlthunk_engine_util_params *params)
+{
+	struct engine_util *u;
+	uint32_t rate_hz = HLTHUNK_ENGINE_UTIL_MAX_RATE_HZ, i;
+	uint64_t len;
+
+	if (params && (params->rate_hz > HLTHUNK_ENGINE_UTIL_MAX_RATE_HZ ||
+		params->num_windows > HLTHUNK_ENGINE_UTIL_MAX_WINDOWS)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (params && params->rate_hz)
+		rate_hz = params->rate_hz;
+
+	u = hlthunk_malloc(sizeof(*u));
+	if (!u) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	u->fd = fd;
+	u->period_ns = NS_PER_SEC / rate_hz;
+
+	if (params && params->num_windows) {
+		u->num_windows = params->num_windows;
+		for (i = 0 ; i < u->num_windows ; i++) {
+			if (params->windows_ms[i] >
+					HLTHUNK_ENGINE_UTIL_MAX_WINDOW_MS) {
+				hlthunk_free(u);
+				errno = EINVAL;
+				return NULL;
+			}
+			u->windows[i].len = params->windows_ms[i];
+		}
+	} else {
+		u->num_windows = 1;
+		u->windows[0].len = ENGINE_UTIL_DEFAULT_WINDOW_MS;
+	}
+
+	for (i = 0 ; i < u->num_windows ; i++) {
+		len = u->windows[i].len * rate_hz / 1000;
+		if (!len) {
+			hlthunk_free(u);
+			errno = EINVAL;
+			return NULL;
+		}
+
+		u->windows[i].len = len;
+		if (len > u->num_masks)
+			u->num_masks = len;
+	}
+
+	u->masks = calloc(u->num_masks, sizeof(*u->masks));
+	if (!u->masks) {
+		hlthunk_free(u);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (pthread_create(&u->thread, NULL, util_thread, u)) {
+		hlthunk_free(u->masks);
+		hlthunk_free(u);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return u;
+}
+
+/**
+ * This function stops the sampling and destroys the sampler
+ * @param data the handle returned by hlthunk_engine_util_create
+ */
+hlthunk_public void hlthunk_engine_util_destroy(void *data)
+{
+	struct engine_util *u = (struct engine_util *) data;
+
+	if (!u)
+		return;
+
+	__atomic_store_n(&u->stop, true, __ATOMIC_RELAXED);
+	pthread_join(u->thread, NULL);
+
+	hlthunk_free(u->masks);
+	hlthunk_free(u);
+}
+
+/**
+ * This function retrieves the utilization of the engines over the latest
+ * samples. It doesn't block the sampling and may be called from any thread
+ * @param data the handle returned by hlthunk_engine_util_create
+ * @param window index of the window in the parameters of the sampler
+ * @param util returned utilization of the engines
+ * @return 0 for success, negative value for failure or if the sampling
+ * failed
+ */
+hlthunk_public int hlthunk_engine_util_get(void *data, uint32_t window,
+					struct hlthunk_engine_util *util)
+{
+	struct engine_util *u = (struct engine_util *) data;
+	struct util_window *w;
+	uint32_t seq, i;
+
+	if (!u || !util || window >= u->num_windows)
+		return -EINVAL;
+
+	w = &u->windows[window];
+
+	do {
+		seq = __atomic_load_n(&w->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		util->timestamp_ns = __atomic_load_n(&w->timestamp_ns,
+							__ATOMIC_RELAXED);
+		util->num_samples = __atomic_load_n(&w->num_samples,
+							__ATOMIC_RELAXED);
+		util->num_missed = __atomic_load_n(&w->num_missed,
+							__ATOMIC_RELAXED);
+		for (i = 0 ; i < HLTHUNK_ENGINE_UTIL_MAX_ENGINES ; i++)
+			util->busy_samples[i] =
+				__atomic_load_n(&w->busy_samples[i],
+							__ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) ||
+			seq != __atomic_load_n(&w->seq, __ATOMIC_RELAXED));
+
+	for (i = 0 ; i < HLTHUNK_ENGINE_UTIL_MAX_ENGINES ; i++)
+		util->busy[i] = util->num_samples ?
+			(float) util->busy_samples[i] / util->num_samples : 0;
+
+	return __atomic_load_n(&u->err, __ATOMIC_RELAXED);
+}
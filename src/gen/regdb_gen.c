@@ -0,0 +1,573 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+/*
+ * Generates the register database of an ASIC from its asic_reg headers. The
+ * <block>_regs.h headers give the addresses of the registers of a block and
+ * the prototype of the block, and the <block>_masks.h headers give the fields
+ * of the registers of that prototype.
+ *
+ * Usage: regdb_gen <asic> <asic_reg directory> <output file>
+ */
+
+#include "regdb.h"
+#include "khash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+
+KHASH_MAP_INIT_STR(str, uint32_t)
+
+struct gen_block {
+	char *name;
+	char *proto;
+	char *stem;
+};
+
+struct gen_reg {
+	uint64_t hash;
+	uint32_t addr;
+	uint16_t block;
+	uint16_t tmpl;
+};
+
+struct gen_field {
+	char *name;
+	uint8_t shift;
+	uint8_t width;
+};
+
+struct gen_tmpl {
+	char *name;
+	struct gen_field *fields;
+	uint32_t num_fields;
+	/* The masks header the fields came from */
+	int source;
+};
+
+static struct gen_block *blocks;
+static uint32_t num_blocks;
+static struct gen_reg *regs;
+static uint32_t num_regs;
+static struct gen_tmpl *tmpls;
+static uint32_t num_tmpls;
+
+/* Templates by "<prototype>/<register>" */
+static khash_t(str) *tmpl_map;
+
+/* String pool and the offsets of the strings in it */
+static khash_t(str) *name_map;
+static char *names;
+static uint32_t names_len;
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr) {
+		fprintf(stderr, "regdb_gen: out of memory\n");
+		exit(1);
+	}
+
+	return ptr;
+}
+
+static char *xstrdup(const char *str)
+{
+	size_t len = strlen(str) + 1;
+
+	return memcpy(xrealloc(NULL, len), str, len);
+}
+
+static uint32_t add_name(const char *name)
+{
+	uint32_t off, len = strlen(name) + 1;
+	khint_t k;
+	int ret;
+
+	k = kh_get(str, name_map, name);
+	if (k != kh_end(name_map))
+		return kh_val(name_map, k);
+
+	off = names_len;
+	names = xrealloc(names, names_len + len);
+	memcpy(names + off, name, len);
+	names_len += len;
+
+	k = kh_put(str, name_map, xstrdup(name), &ret);
+	kh_val(name_map, k) = off;
+
+	return off;
+}
+
+static uint32_t get_tmpl(const char *proto, const char *name)
+{
+	char key[256];
+	khint_t k;
+	int ret;
+
+	snprintf(key, sizeof(key), "%s/%s", proto, name);
+
+	k = kh_get(str, tmpl_map, key);
+	if (k != kh_end(tmpl_map))
+		return kh_val(tmpl_map, k);
+
+	tmpls = xrealloc(tmpls, (num_tmpls + 1) * sizeof(*tmpls));
+	memset(&tmpls[num_tmpls], 0, sizeof(*tmpls));
+	tmpls[num_tmpls].name = xstrdup(name);
+	tmpls[num_tmpls].source = -1;
+
+	k = kh_put(str, tmpl_map, xstrdup(key), &ret);
+	kh_val(tmpl_map, k) = num_tmpls;
+
+	return num_tmpls++;
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static int cmp_reg(const void *a, const void *b)
+{
+	const struct gen_reg *ra = a, *rb = b;
+
+	return ra->addr < rb->addr ? -1 : ra->addr > rb->addr;
+}
+
+static FILE *open_header(const char *dir, const char *file)
+{
+	char path[PATH_MAX];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+	f = fopen(path, "r");
+	if (!f)
+		fprintf(stderr, "regdb_gen: failed to open %s\n", path);
+
+	return f;
+}
+
+static int parse_regs(const char *dir, const char *file)
+{
+	char line[512], name[256], block[128], proto[128];
+	struct gen_block *b = NULL;
+	const char *reg_name;
+	unsigned long long addr;
+	size_t block_len;
+	FILE *f;
+
+	f = open_header(dir, file);
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (!b && sscanf(line, " * %127s (Prototype: %127[^)])",
+					block, proto) == 2) {
+			blocks = xrealloc(blocks,
+					(num_blocks + 1) * sizeof(*blocks));
+			b = &blocks[num_blocks++];
+			b->name = xstrdup(block);
+			b->proto = xstrdup(proto);
+			b->stem = xstrdup(file);
+			b->stem[strlen(file) - strlen("_regs.h")] = '\0';
+			continue;
+		}
+
+		if (sscanf(line, "#define mm%255s %llx", name, &addr) != 2)
+			continue;
+
+		regs = xrealloc(regs, (num_regs + 1) * sizeof(*regs));
+
+		reg_name = name;
+		block_len = b ? strlen(b->name) : 0;
+		if (b && !strncmp(name, b->name, block_len) &&
+				name[block_len] == '_') {
+			reg_name = name + block_len + 1;
+			regs[num_regs].block = b - blocks;
+			regs[num_regs].tmpl = get_tmpl(b->proto, reg_name);
+		} else {
+			regs[num_regs].block = REGDB_NO_BLOCK;
+			regs[num_regs].tmpl = get_tmpl("", reg_name);
+		}
+
+		regs[num_regs].addr = addr;
+		regs[num_regs].hash = regdb_hash(name);
+		num_regs++;
+	}
+
+	fclose(f);
+
+	return 0;
+}
+
+static void add_field(struct gen_tmpl *t, const char *name, bool is_shift,
+			long long val)
+{
+	struct gen_field *field = NULL;
+	uint32_t i;
+
+	for (i = 0 ; i < t->num_fields ; i++)
+		if (!strcmp(t->fields[i].name, name))
+			field = &t->fields[i];
+
+	if (!field) {
+		t->fields = xrealloc(t->fields,
+				(t->num_fields + 1) * sizeof(*t->fields));
+		field = &t->fields[t->num_fields++];
+		field->name = xstrdup(name);
+		field->shift = 0;
+		field->width = 0;
+	}
+
+	if (is_shift)
+		field->shift = val;
+	else
+		field->width = __builtin_popcountll(val);
+}
+
+static int parse_masks(const char *dir, const char *file, int source)
+{
+	char line[512], name[256], reg[256] = "", field[256];
+	struct gen_block *b = NULL;
+	struct gen_tmpl *t = NULL;
+	long long val;
+	size_t stem_len = strlen(file) - strlen("_masks.h");
+	size_t block_len, reg_len, len;
+	const char *reg_name;
+	bool is_shift;
+	khint_t k;
+	uint32_t i;
+	FILE *f;
+
+	for (i = 0 ; i < num_blocks ; i++)
+		if (strlen(blocks[i].stem) == stem_len &&
+				!strncmp(blocks[i].stem, file, stem_len))
+			b = &blocks[i];
+
+	if (!b) {
+		fprintf(stderr, "regdb_gen: no registers for %s\n", file);
+		return 0;
+	}
+
+	block_len = strlen(b->name);
+
+	f = open_header(dir, file);
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "/* %255s */", reg) == 1) {
+			t = NULL;
+			if (strncmp(reg, b->name, block_len) ||
+					reg[block_len] != '_')
+				continue;
+
+			reg_name = reg + block_len + 1;
+			snprintf(name, sizeof(name), "%s/%s", b->proto,
+					reg_name);
+
+			/* Another block of the prototype already gave them */
+			k = kh_get(str, tmpl_map, name);
+			if (k != kh_end(tmpl_map)) {
+				t = &tmpls[kh_val(tmpl_map, k)];
+				if (t->source >= 0 && t->source != source)
+					t = NULL;
+				else
+					t->source = source;
+			}
+			continue;
+		}
+
+		/* Shifts are decimal and masks are hex */
+		if (!t || sscanf(line, "#define %255s %lli", name, &val) != 2)
+			continue;
+
+		len = strlen(name);
+		reg_len = strlen(reg);
+		if (len > 6 && !strcmp(name + len - 6, "_SHIFT"))
+			is_shift = true;
+		else if (len > 5 && !strcmp(name + len - 5, "_MASK"))
+			is_shift = false;
+		else
+			continue;
+
+		if (strncmp(name, reg, reg_len) || name[reg_len] != '_')
+			continue;
+
+		snprintf(field, sizeof(field), "%.*s",
+				(int) (len - reg_len - 1 - (is_shift ? 6 : 5)),
+				name + reg_len + 1);
+		add_field(t, field, is_shift, val);
+	}
+
+	fclose(f);
+
+	return 0;
+}
+
+static int list_headers(const char *dir, const char *suffix, char ***files,
+			uint32_t *num)
+{
+	size_t suffix_len = strlen(suffix), len;
+	struct dirent *entry;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d) {
+		fprintf(stderr, "regdb_gen: failed to open %s\n", dir);
+		return -1;
+	}
+
+	*files = NULL;
+	*num = 0;
+
+	while ((entry = readdir(d)) != NULL) {
+		len = strlen(entry->d_name);
+		if (len <= suffix_len)
+			continue;
+		if (strcmp(entry->d_name + len - suffix_len, suffix))
+			continue;
+
+		*files = xrealloc(*files, (*num + 1) * sizeof(char *));
+		(*files)[(*num)++] = xstrdup(entry->d_name);
+	}
+
+	closedir(d);
+
+	/* Sorted, so the output doesn't depend on the directory order */
+	qsort(*files, *num, sizeof(char *), cmp_str);
+
+	return 0;
+}
+
+static int build_hash(uint16_t **disp, uint16_t **slots, uint32_t num_buckets,
+			uint32_t num_slots)
+{
+	uint32_t *bucket_size, *order, *members, *first, i, j, b, s, tries;
+	bool *taken;
+	uint32_t cand[64];
+
+	bucket_size = calloc(num_buckets, sizeof(uint32_t));
+	first = calloc(num_buckets + 1, sizeof(uint32_t));
+	order = calloc(num_buckets, sizeof(uint32_t));
+	members = calloc(num_regs, sizeof(uint32_t));
+	taken = calloc(num_slots, sizeof(bool));
+	*disp = calloc(num_buckets, sizeof(uint16_t));
+	*slots = malloc(num_slots * sizeof(uint16_t));
+	if (!bucket_size || !first || !order || !members || !taken || !*disp ||
+			!*slots)
+		return -1;
+
+	for (i = 0 ; i < num_slots ; i++)
+		(*slots)[i] = REGDB_NO_REG;
+
+	for (i = 0 ; i < num_regs ; i++)
+		bucket_size[regdb_bucket(regs[i].hash, num_buckets)]++;
+
+	for (b = 0 ; b < num_buckets ; b++)
+		first[b + 1] = first[b] + bucket_size[b];
+
+	memset(bucket_size, 0, num_buckets * sizeof(uint32_t));
+	for (i = 0 ; i < num_regs ; i++) {
+		b = regdb_bucket(regs[i].hash, num_buckets);
+		members[first[b] + bucket_size[b]++] = i;
+	}
+
+	/* Place the largest buckets first, while most slots are free */
+	for (b = 0 ; b < num_buckets ; b++)
+		order[b] = b;
+	for (i = 1 ; i < num_buckets ; i++)
+		for (j = i ; j && bucket_size[order[j - 1]] <
+					bucket_size[order[j]] ; j--) {
+			b = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = b;
+		}
+
+	for (i = 0 ; i < num_buckets ; i++) {
+		b = order[i];
+		if (!bucket_size[b])
+			break;
+		if (bucket_size[b] > 64)
+			return -1;
+
+		for (tries = 0 ; tries < REGDB_NO_REG ; tries++) {
+			for (j = 0 ; j < bucket_size[b] ; j++) {
+				s = regdb_slot(regs[members[first[b] + j]].hash,
+						tries, num_slots);
+				if (taken[s])
+					break;
+				taken[s] = true;
+				cand[j] = s;
+			}
+
+			if (j == bucket_size[b])
+				break;
+
+			while (j--)
+				taken[cand[j]] = false;
+		}
+
+		if (tries == REGDB_NO_REG)
+			return -1;
+
+		(*disp)[b] = tries;
+		for (j = 0 ; j < bucket_size[b] ; j++)
+			(*slots)[cand[j]] = members[first[b] + j];
+	}
+
+	free(bucket_size);
+	free(first);
+	free(order);
+	free(members);
+	free(taken);
+
+	return 0;
+}
+
+static void emit_u16(FILE *out, const char *name, const uint16_t *vals,
+			uint32_t num)
+{
+	uint32_t i;
+
+	fprintf(out, "static const uint16_t %s[] = {", name);
+	for (i = 0 ; i < num ; i++)
+		fprintf(out, "%s%u,", i % 12 ? " " : "\n\t", vals[i]);
+	fprintf(out, "\n};\n\n");
+}
+
+static int emit(const char *asic, const char *path, const uint16_t *disp,
+		const uint16_t *slots, uint32_t num_buckets,
+		uint32_t num_slots)
+{
+	uint32_t i, j, num_fields = 0;
+	FILE *out;
+
+	out = fopen(path, "w");
+	if (!out) {
+		fprintf(stderr, "regdb_gen: failed to create %s\n", path);
+		return -1;
+	}
+
+	fprintf(out, "/* Generated by regdb_gen, do not edit */\n\n");
+	fprintf(out, "#include \"regdb.h\"\n\n");
+
+	fprintf(out, "static const uint32_t blocks[] = {");
+	for (i = 0 ; i < num_blocks ; i++)
+		fprintf(out, "%s%u,", i % 8 ? " " : "\n\t",
+			add_name(blocks[i].name));
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static const struct regdb_reg regs[] = {\n");
+	for (i = 0 ; i < num_regs ; i++)
+		fprintf(out, "\t{ 0x%x, %u, %u },\n", regs[i].addr,
+			regs[i].block, regs[i].tmpl);
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "static const struct regdb_tmpl tmpls[] = {\n");
+	for (i = 0 ; i < num_tmpls ; i++) {
+		fprintf(out, "\t{ %u, %u, %u },\n", add_name(tmpls[i].name),
+			num_fields, tmpls[i].num_fields);
+		num_fields += tmpls[i].num_fields;
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "static const struct regdb_field fields[] = {\n");
+	for (i = 0 ; i < num_tmpls ; i++)
+		for (j = 0 ; j < tmpls[i].num_fields ; j++)
+			fprintf(out, "\t{ %u, %u, %u },\n",
+				add_name(tmpls[i].fields[j].name),
+				tmpls[i].fields[j].shift,
+				tmpls[i].fields[j].width);
+	fprintf(out, "\t{ 0, 0, 0 }\n};\n\n");
+
+	emit_u16(out, "disp", disp, num_buckets);
+	emit_u16(out, "slots", slots, num_slots);
+
+	fprintf(out, "static const char names[] =");
+	for (i = 0 ; i < names_len ; i += strlen(names + i) + 1)
+		fprintf(out, "\n\t\"%s\\0\"", names + i);
+	fprintf(out, ";\n\n");
+
+	fprintf(out, "const struct regdb hlthunk_regdb_%s = {\n", asic);
+	fprintf(out, "\t.names = names,\n");
+	fprintf(out, "\t.blocks = blocks,\n");
+	fprintf(out, "\t.regs = regs,\n");
+	fprintf(out, "\t.tmpls = tmpls,\n");
+	fprintf(out, "\t.fields = fields,\n");
+	fprintf(out, "\t.disp = disp,\n");
+	fprintf(out, "\t.slots = slots,\n");
+	fprintf(out, "\t.num_regs = %u,\n", num_regs);
+	fprintf(out, "\t.num_buckets = %u,\n", num_buckets);
+	fprintf(out, "\t.num_slots = %u\n", num_slots);
+	fprintf(out, "};\n");
+
+	if (fclose(out)) {
+		fprintf(stderr, "regdb_gen: failed to write %s\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t num_files, num_buckets, num_slots, num_fields = 0, i;
+	uint16_t *disp, *slots;
+	char **files;
+
+	if (argc != 4) {
+		fprintf(stderr,
+			"usage: regdb_gen <asic> <asic_reg dir> <output>\n");
+		return 1;
+	}
+
+	tmpl_map = kh_init(str);
+	name_map = kh_init(str);
+
+	if (list_headers(argv[2], "_regs.h", &files, &num_files))
+		return 1;
+	for (i = 0 ; i < num_files ; i++)
+		if (parse_regs(argv[2], files[i]))
+			return 1;
+
+	if (list_headers(argv[2], "_masks.h", &files, &num_files))
+		return 1;
+	for (i = 0 ; i < num_files ; i++)
+		if (parse_masks(argv[2], files[i], i))
+			return 1;
+
+	for (i = 0 ; i < num_tmpls ; i++)
+		num_fields += tmpls[i].num_fields;
+
+	if (!num_regs || num_regs >= REGDB_NO_REG ||
+			num_blocks >= REGDB_NO_BLOCK ||
+			num_tmpls > UINT16_MAX || num_fields > UINT16_MAX) {
+		fprintf(stderr, "regdb_gen: %u registers don't fit\n",
+			num_regs);
+		return 1;
+	}
+
+	qsort(regs, num_regs, sizeof(*regs), cmp_reg);
+
+	num_buckets = (num_regs + 3) / 4;
+	num_slots = num_regs + num_regs / 8 + 1;
+
+	if (build_hash(&disp, &slots, num_buckets, num_slots)) {
+		fprintf(stderr, "regdb_gen: failed to build the hash\n");
+		return 1;
+	}
+
+	return emit(argv[1], argv[3], disp, slots, num_buckets, num_slots) ?
+			1 : 0;
+}
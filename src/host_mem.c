@@ -0,0 +1,364 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <linux/mman.h>
+
+#define HOST_MAP_MAX_THREADS	16
+
+#define HOST_PAGE_SIZE_1GB	(1ull << 30)
+#define HOST_PAGE_SIZE_2MB	(1ull << 21)
+
+struct host_map_batch {
+	struct hlthunk_host_map_entry *entries;
+	uint32_t num;
+	/* Next entry to take, shared by the workers */
+	uint32_t next;
+	int fd;
+};
+
+/*
+ * Fault the pages in before the driver pins them, so the map ioctl doesn't
+ * fault them one by one. mlock faults and locks the range in one call. It
+ * fails when the range exceeds RLIMIT_MEMLOCK, in which case the pages are
+ * populated for writing instead, as the driver pins them writable and a read
+ * fault would only map the zero page. A range that isn't writable, e.g. a
+ * read-only buffer for host to device DMA, is populated for reading. The
+ * memory of the caller is never written, so kernels without these advices
+ * only get a readahead hint.
+ */
+void hlthunk_host_prefault(void *ptr, uint64_t size)
+{
+	uint64_t page_size = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t) ptr & ~(page_size - 1);
+	uintptr_t end = (uintptr_t) ptr + size;
+
+	if (!mlock(ptr, size))
+		return;
+
+#ifdef MADV_POPULATE_WRITE
+	if (!madvise((void *) start, end - start, MADV_POPULATE_WRITE))
+		return;
+
+	/* The range isn't writable, or the kernel doesn't know the advice */
+	if (errno != EINVAL)
+		return;
+
+	if (!madvise((void *) start, end - start, MADV_POPULATE_READ))
+		return;
+
+	if (errno != EINVAL)
+		return;
+#endif
+
+	madvise((void *) start, end - start, MADV_WILLNEED);
+}
+
+void hlthunk_host_unprefault(void *ptr, uint64_t size)
+{
+	munlock(ptr, size);
+}
+
+static void host_map_entry(int fd, struct hlthunk_host_map_entry *entry)
+{
+	entry->device_virt_addr = 0;
+
+	if (!entry->host_virt_addr || !entry->size) {
+		entry->rc = -EINVAL;
+		return;
+	}
+
+	hlthunk_host_prefault(entry->host_virt_addr, entry->size);
+
+	errno = 0;
+	entry->device_virt_addr = hlthunk_host_memory_map(fd,
+						entry->host_virt_addr,
+						entry->hint_addr, entry->size);
+	if (!entry->device_virt_addr) {
+		entry->rc = errno ? -errno : -ENOMEM;
+		hlthunk_host_unprefault(entry->host_virt_addr, entry->size);
+		return;
+	}
+
+	entry->rc = 0;
+}
+
+static void *host_map_worker(void *arg)
+{
+	struct host_map_batch *batch = (struct host_map_batch *) arg;
+	uint32_t i;
+
+	while (true) {
+		i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+		if (i >= batch->num)
+			break;
+
+		host_map_entry(batch->fd, &batch->entries[i]);
+	}
+
+	return NULL;
+}
+
+/**
+ * This function maps many host memory areas to the device at once. The areas
+ * are prefaulted and locked, and then mapped, by several threads in parallel
+ * @param fd file descriptor of the device to map the memory to
+ * @param entries the areas to map. For every entry, the device VA and the
+ * result of its mapping are returned in it
+ * @param num number of entries
+ * @param num_threads number of threads to use, 0 for one per online CPU
+ * @return 0 if all the entries were mapped, otherwise the error of the first
+ * entry that failed. The entries that were mapped stay mapped either way
+ */
+hlthunk_public int hlthunk_host_memory_map_batch(int fd,
+					struct hlthunk_host_map_entry *entries,
+					uint32_t num, uint32_t num_threads)
+{
+	pthread_t threads[HOST_MAP_MAX_THREADS];
+	struct host_map_batch batch;
+	uint32_t i, num_started;
+	long num_cpus;
+
+	if (!entries)
+		return -EINVAL;
+
+	if (!num_threads) {
+		num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = num_cpus > 0 ? num_cpus : 1;
+	}
+	if (num_threads > HOST_MAP_MAX_THREADS)
+		num_threads = HOST_MAP_MAX_THREADS;
+	if (num_threads > num)
+		num_threads = num;
+
+	batch.entries = entries;
+	batch.num = num;
+	batch.next = 0;
+	batch.fd = fd;
+
+	/* The calling thread is one of the workers */
+	for (num_started = 0 ; num_started + 1 < num_threads ; num_started++)
+		if (pthread_create(&threads[num_started], NULL,
+					host_map_worker, &batch))
+			break;
+
+	host_map_worker(&batch);
+
+	for (i = 0 ; i < num_started ; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0 ; i < num ; i++)
+		if (entries[i].rc)
+			return entries[i].rc;
+
+	return 0;
+}
+
+/**
+ * This function unmaps the areas that were mapped by
+ * hlthunk_host_memory_map_batch and unlocks their pages. Entries that weren't
+ * mapped are skipped
+ * @param fd file descriptor of the device the memory is mapped to
+ * @param entries the entries that were passed to hlthunk_host_memory_map_batch
+ * @param num number of entries
+ * @return 0 for success, otherwise the error of the first unmap that failed
+ */
+hlthunk_public int hlthunk_host_memory_unmap_batch(int fd,
+					struct hlthunk_host_map_entry *entries,
+					uint32_t num)
+{
+	uint32_t i;
+	int rc, first_rc = 0;
+
+	if (!entries)
+		return -EINVAL;
+
+	for (i = 0 ; i < num ; i++) {
+		if (!entries[i].device_virt_addr)
+			continue;
+
+		rc = hlthunk_memory_unmap(fd, entries[i].device_virt_addr);
+		if (rc && !first_rc)
+			first_rc = -errno;
+
+		hlthunk_host_unprefault(entries[i].host_virt_addr,
+						entries[i].size);
+		entries[i].device_virt_addr = 0;
+	}
+
+	return first_rc;
+}
+
+static void *host_alloc_hugetlb(uint64_t size, uint64_t page_size)
+{
+	int flags = MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB;
+	void *ptr;
+
+	flags |= page_size == HOST_PAGE_SIZE_1GB ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/*
+ * Transparent huge pages back only 2MB-aligned parts of a mapping, so a
+ * larger area is reserved and trimmed to an aligned one
+ */
+static void *host_alloc_thp(uint64_t size)
+{
+	uint64_t addr, aligned, len = size + HOST_PAGE_SIZE_2MB;
+	void *ptr;
+
+	ptr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED)
+		return NULL;
+
+	addr = (uintptr_t) ptr;
+	aligned = (addr + HOST_PAGE_SIZE_2MB - 1) & ~(HOST_PAGE_SIZE_2MB - 1);
+
+	if (aligned > addr)
+		munmap(ptr, aligned - addr);
+	if (addr + len > aligned + size)
+		munmap((void *) (uintptr_t) (aligned + size),
+			addr + len - aligned - size);
+
+	ptr = (void *) (uintptr_t) aligned;
+
+	if (madvise(ptr, size, MADV_HUGEPAGE)) {
+		munmap(ptr, size);
+		return NULL;
+	}
+
+	return ptr;
+}
+
+static void *host_alloc_regular(uint64_t size)
+{
+	void *ptr;
+
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/**
+ * This function allocates host memory with the largest pages available and
+ * maps it to the device. It tries 1GB and then 2MB hugetlbfs pages, then
+ * 2MB-aligned memory for transparent huge pages and last regular pages.
+ * Pages larger than the size are skipped. Larger pages are faster to pin and
+ * take fewer device MMU entries. The memory is placed on the NUMA node of the
+ * device
+ * @param fd file descriptor of the device to map the memory to
+ * @param size how much memory to allocate. It is rounded up to the size of
+ * the pages that are used
+ * @param flags HLTHUNK_HOST_ALLOC_* flags that skip some of the page sizes
+ * @param buf returned host pointer, device VA, size and page size of the
+ * memory. It is passed to hlthunk_host_free to free the memory
+ * @return 0 for success, -ENOMEM if no memory could be allocated with the
+ * allowed pages, other negative value if the mapping failed
+ */
+hlthunk_public int hlthunk_host_alloc(int fd, uint64_t size, uint32_t flags,
+					struct hlthunk_host_buf *buf)
+{
+	uint64_t page_size, len;
+	bool transparent = false;
+	void *ptr = NULL;
+	int rc, node;
+
+	if (!size || !buf)
+		return -EINVAL;
+
+	/*
+	 * Pages that are larger than the request would mostly be wasted, apart
+	 * from the 2MB ones when only huge pages are allowed
+	 */
+	if (size < HOST_PAGE_SIZE_1GB)
+		flags |= HLTHUNK_HOST_ALLOC_NO_1GB;
+	if (size < HOST_PAGE_SIZE_2MB &&
+			!(flags & HLTHUNK_HOST_ALLOC_HUGE_ONLY))
+		flags |= HLTHUNK_HOST_ALLOC_NO_2MB | HLTHUNK_HOST_ALLOC_NO_THP;
+
+	if (!(flags & HLTHUNK_HOST_ALLOC_NO_1GB)) {
+		page_size = HOST_PAGE_SIZE_1GB;
+		len = (size + page_size - 1) & ~(page_size - 1);
+		ptr = host_alloc_hugetlb(len, page_size);
+	}
+
+	if (!ptr && !(flags & HLTHUNK_HOST_ALLOC_NO_2MB)) {
+		page_size = HOST_PAGE_SIZE_2MB;
+		len = (size + page_size - 1) & ~(page_size - 1);
+		ptr = host_alloc_hugetlb(len, page_size);
+	}
+
+	if (!ptr && !(flags & HLTHUNK_HOST_ALLOC_NO_THP)) {
+		page_size = HOST_PAGE_SIZE_2MB;
+		len = (size + page_size - 1) & ~(page_size - 1);
+		ptr = host_alloc_thp(len);
+		transparent = true;
+	}
+
+	if (!ptr && !(flags & HLTHUNK_HOST_ALLOC_HUGE_ONLY)) {
+		transparent = false;
+		page_size = sysconf(_SC_PAGESIZE);
+		len = (size + page_size - 1) & ~(page_size - 1);
+		ptr = host_alloc_regular(len);
+	}
+
+	if (!ptr)
+		return -ENOMEM;
+
+	/* The pages are faulted in when they are pinned, on the device node */
+	if (!hlthunk_get_numa_node(fd, &node))
+		hlthunk_numa_bind_memory(ptr, len, node);
+
+	errno = 0;
+	buf->device_virt_addr = hlthunk_host_memory_map(fd, ptr, 0, len);
+	if (!buf->device_virt_addr) {
+		rc = errno ? -errno : -ENOMEM;
+		munmap(ptr, len);
+		return rc;
+	}
+
+	buf->host_ptr = ptr;
+	buf->size = len;
+	buf->page_size = page_size;
+	buf->transparent = transparent;
+
+	return 0;
+}
+
+/**
+ * This function unmaps memory that was allocated by hlthunk_host_alloc from
+ * the device and frees it
+ * @param fd file descriptor of the device the memory is mapped to
+ * @param buf the memory, as returned by hlthunk_host_alloc
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_host_free(int fd, struct hlthunk_host_buf *buf)
+{
+	if (!buf || !buf->host_ptr)
+		return -EINVAL;
+
+	if (hlthunk_memory_unmap(fd, buf->device_virt_addr))
+		return -errno;
+
+	munmap(buf->host_ptr, buf->size);
+	buf->host_ptr = NULL;
+	buf->device_virt_addr = 0;
+
+	return 0;
+}
@@ -0,0 +1,413 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+#include "khash.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+enum prefetch_state {
+	PREFETCH_QUEUED,
+	PREFETCH_PINNING,
+	PREFETCH_READY,
+	PREFETCH_FAILED
+};
+
+struct prefetch_entry {
+	/* Queue of the entries that wait for the prefetch thread */
+	struct prefetch_entry *next;
+	void *ptr;
+	uint64_t size;
+	uint64_t device_virt_addr;
+	enum prefetch_state state;
+	int rc;
+	/* Released while it was pinned, the thread unmaps it when done */
+	bool released;
+};
+
+KHASH_MAP_INIT_INT64(prefetch, struct prefetch_entry *)
+
+struct host_prefetch {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	/* Signaled when an entry is queued or when pinned memory is released */
+	pthread_cond_t work;
+	/* Signaled when an entry is resolved */
+	pthread_cond_t done;
+	khash_t(prefetch) *entries;
+	struct prefetch_entry *head;
+	struct prefetch_entry *tail;
+	struct hlthunk_host_prefetch_stats stats;
+	uint64_t budget;
+	bool stopping;
+	int node;
+	int fd;
+};
+
+static void prefetch_unpin(struct host_prefetch *pf,
+				struct prefetch_entry *entry)
+{
+	if (entry->state == PREFETCH_READY) {
+		hlthunk_memory_unmap(pf->fd, entry->device_virt_addr);
+		hlthunk_host_unprefault(entry->ptr, entry->size);
+	}
+
+	if (entry->state == PREFETCH_READY || entry->state == PREFETCH_PINNING)
+		pf->stats.pinned_bytes -= entry->size;
+}
+
+static void *prefetch_thread(void *arg)
+{
+	struct host_prefetch *pf = (struct host_prefetch *) arg;
+	struct prefetch_entry *entry;
+	uint64_t va;
+
+	/* Best effort, the thread runs anywhere if the CPUs are unknown */
+	hlthunk_bind_thread_to_device(pf->fd);
+
+	pthread_mutex_lock(&pf->lock);
+
+	while (true) {
+		entry = pf->head;
+
+		/* Pin the entries in order, each once the budget allows it */
+		if (!pf->stopping && (!entry || pf->stats.pinned_bytes +
+						entry->size > pf->budget)) {
+			if (entry)
+				pf->stats.budget_waits++;
+			pthread_cond_wait(&pf->work, &pf->lock);
+			continue;
+		}
+
+		if (pf->stopping)
+			break;
+
+		pf->head = entry->next;
+		if (!pf->head)
+			pf->tail = NULL;
+
+		entry->state = PREFETCH_PINNING;
+		pf->stats.pinned_bytes += entry->size;
+		if (pf->stats.pinned_bytes > pf->stats.peak_pinned_bytes)
+			pf->stats.peak_pinned_bytes = pf->stats.pinned_bytes;
+
+		pthread_mutex_unlock(&pf->lock);
+
+		hlthunk_numa_bind_memory(entry->ptr, entry->size, pf->node);
+		hlthunk_host_prefault(entry->ptr, entry->size);
+		errno = 0;
+		va = hlthunk_host_memory_map(pf->fd, entry->ptr, 0,
+						entry->size);
+
+		pthread_mutex_lock(&pf->lock);
+
+		if (va) {
+			entry->device_virt_addr = va;
+			entry->state = PREFETCH_READY;
+		} else {
+			entry->rc = errno ? -errno : -ENOMEM;
+			hlthunk_host_unprefault(entry->ptr, entry->size);
+			pf->stats.pinned_bytes -= entry->size;
+			entry->state = PREFETCH_FAILED;
+		}
+
+		if (entry->released) {
+			prefetch_unpin(pf, entry);
+			hlthunk_free(entry);
+			pthread_cond_signal(&pf->work);
+		}
+
+		pthread_cond_broadcast(&pf->done);
+	}
+
+	pthread_mutex_unlock(&pf->lock);
+
+	return NULL;
+}
+
+/**
+ * This function creates a prefetcher, whose thread pins and maps host memory
+ * that is about to be used by the device, so it is mapped when a CS needs it
+ * @param fd file descriptor of the device to map the memory to
+ * @param budget maximum number of bytes that the prefetcher keeps pinned.
+ * Prepared ranges wait until the memory that is released makes room for them
+ * @return opaque handle of the prefetcher or NULL in case of error
+ */
+hlthunk_public void *hlthunk_host_prefetch_create(int fd, uint64_t budget)
+{
+	struct host_prefetch *pf;
+
+	if (!budget)
+		return NULL;
+
+	pf = hlthunk_malloc(sizeof(*pf));
+	if (!pf)
+		return NULL;
+
+	pf->entries = kh_init(prefetch);
+	if (!pf->entries)
+		goto free_pf;
+
+	if (pthread_mutex_init(&pf->lock, NULL))
+		goto destroy_entries;
+
+	if (pthread_cond_init(&pf->work, NULL))
+		goto destroy_lock;
+
+	if (pthread_cond_init(&pf->done, NULL))
+		goto destroy_work;
+
+	pf->fd = fd;
+	pf->budget = budget;
+	if (hlthunk_get_numa_node(fd, &pf->node))
+		pf->node = -1;
+
+	if (pthread_create(&pf->thread, NULL, prefetch_thread, pf))
+		goto destroy_done;
+
+	return pf;
+
+destroy_done:
+	pthread_cond_destroy(&pf->done);
+destroy_work:
+	pthread_cond_destroy(&pf->work);
+destroy_lock:
+	pthread_mutex_destroy(&pf->lock);
+destroy_entries:
+	kh_destroy(prefetch, pf->entries);
+free_pf:
+	hlthunk_free(pf);
+	return NULL;
+}
+
+/**
+ * This function stops the prefetcher and unmaps all the memory it mapped
+ * @param data the prefetcher handle returned by hlthunk_host_prefetch_create
+ */
+hlthunk_public void hlthunk_host_prefetch_destroy(void *data)
+{
+	struct host_prefetch *pf = (struct host_prefetch *) data;
+	struct prefetch_entry *entry;
+
+	if (!pf)
+		return;
+
+	pthread_mutex_lock(&pf->lock);
+	pf->stopping = true;
+	pthread_cond_signal(&pf->work);
+	pthread_mutex_unlock(&pf->lock);
+
+	pthread_join(pf->thread, NULL);
+
+	kh_foreach_value(pf->entries, entry, {
+		prefetch_unpin(pf, entry);
+		hlthunk_free(entry);
+	});
+
+	kh_destroy(prefetch, pf->entries);
+	pthread_cond_destroy(&pf->done);
+	pthread_cond_destroy(&pf->work);
+	pthread_mutex_destroy(&pf->lock);
+	hlthunk_free(pf);
+}
+
+/**
+ * This function hints that a host memory range will soon be used by the
+ * device. The range is pinned and mapped in the background, in the order of
+ * the hints. Its pages are moved to the NUMA node of the device first
+ * @param data the prefetcher handle returned by hlthunk_host_prefetch_create
+ * @param ptr start of the range
+ * @param size size of the range
+ * @return 0 for success, -EEXIST if the range was already prepared, -E2BIG if
+ * it is larger than the budget, other negative value for failure
+ */
+hlthunk_public int hlthunk_host_prefetch_prepare(void *data, void *ptr,
+							uint64_t size)
+{
+	struct host_prefetch *pf = (struct host_prefetch *) data;
+	struct prefetch_entry *entry;
+	khint_t k;
+	int rc;
+
+	if (!pf || !ptr || !size)
+		return -EINVAL;
+
+	if (size > pf->budget)
+		return -E2BIG;
+
+	entry = hlthunk_malloc(sizeof(*entry));
+	if (!entry)
+		return -ENOMEM;
+
+	entry->ptr = ptr;
+	entry->size = size;
+	entry->state = PREFETCH_QUEUED;
+
+	pthread_mutex_lock(&pf->lock);
+
+	k = kh_put(prefetch, pf->entries, (uintptr_t) ptr, &rc);
+	if (rc <= 0) {
+		pthread_mutex_unlock(&pf->lock);
+		hlthunk_free(entry);
+		return rc ? -ENOMEM : -EEXIST;
+	}
+	kh_val(pf->entries, k) = entry;
+
+	if (pf->tail)
+		pf->tail->next = entry;
+	else
+		pf->head = entry;
+	pf->tail = entry;
+
+	pf->stats.prepared++;
+
+	pthread_cond_signal(&pf->work);
+	pthread_mutex_unlock(&pf->lock);
+
+	return 0;
+}
+
+/**
+ * This function returns the device VA of a prepared range
+ * @param data the prefetcher handle returned by hlthunk_host_prefetch_create
+ * @param ptr start of the range, as passed to hlthunk_host_prefetch_prepare
+ * @param wait true to wait until the range is mapped
+ * @param device_virt_addr returned device VA of the range
+ * @return 0 for success, -ENOENT if the range wasn't prepared, -EAGAIN if it
+ * isn't mapped yet and wait is false, or the error of its mapping
+ */
+hlthunk_public int hlthunk_host_prefetch_get_va(void *data, void *ptr,
+						bool wait,
+						uint64_t *device_virt_addr)
+{
+	struct host_prefetch *pf = (struct host_prefetch *) data;
+	struct prefetch_entry *entry;
+	bool waited = false;
+	khint_t k;
+	int rc = 0;
+
+	if (!pf || !device_virt_addr)
+		return -EINVAL;
+
+	pthread_mutex_lock(&pf->lock);
+
+	while (true) {
+		k = kh_get(prefetch, pf->entries, (uintptr_t) ptr);
+		if (k == kh_end(pf->entries)) {
+			pf->stats.misses++;
+			rc = -ENOENT;
+			break;
+		}
+
+		entry = kh_val(pf->entries, k);
+
+		if (entry->state == PREFETCH_READY) {
+			*device_virt_addr = entry->device_virt_addr;
+			if (waited)
+				pf->stats.waits++;
+			else
+				pf->stats.hits++;
+			break;
+		}
+
+		if (entry->state == PREFETCH_FAILED) {
+			rc = entry->rc;
+			break;
+		}
+
+		if (!wait) {
+			rc = -EAGAIN;
+			break;
+		}
+
+		waited = true;
+		pthread_cond_wait(&pf->done, &pf->lock);
+	}
+
+	pthread_mutex_unlock(&pf->lock);
+
+	return rc;
+}
+
+/**
+ * This function unmaps a prepared range and returns its memory to the budget.
+ * A range that wasn't mapped yet is dropped
+ * @param data the prefetcher handle returned by hlthunk_host_prefetch_create
+ * @param ptr start of the range, as passed to hlthunk_host_prefetch_prepare
+ * @return 0 for success, -ENOENT if the range wasn't prepared
+ */
+hlthunk_public int hlthunk_host_prefetch_release(void *data, void *ptr)
+{
+	struct host_prefetch *pf = (struct host_prefetch *) data;
+	struct prefetch_entry *entry, **pp;
+	khint_t k;
+
+	if (!pf)
+		return -EINVAL;
+
+	pthread_mutex_lock(&pf->lock);
+
+	k = kh_get(prefetch, pf->entries, (uintptr_t) ptr);
+	if (k == kh_end(pf->entries)) {
+		pthread_mutex_unlock(&pf->lock);
+		return -ENOENT;
+	}
+
+	entry = kh_val(pf->entries, k);
+	kh_del(prefetch, pf->entries, k);
+
+	switch (entry->state) {
+	case PREFETCH_QUEUED:
+		for (pp = &pf->head ; *pp != entry ; pp = &(*pp)->next)
+			;
+		*pp = entry->next;
+		if (pf->tail == entry) {
+			pf->tail = NULL;
+			for (pp = &pf->head ; *pp ; pp = &(*pp)->next)
+				pf->tail = *pp;
+		}
+		hlthunk_free(entry);
+		break;
+	case PREFETCH_PINNING:
+		entry->released = true;
+		break;
+	default:
+		prefetch_unpin(pf, entry);
+		hlthunk_free(entry);
+		break;
+	}
+
+	/* The released memory may let the next entry in */
+	pthread_cond_signal(&pf->work);
+	pthread_mutex_unlock(&pf->lock);
+
+	return 0;
+}
+
+/**
+ * This function retrieves the counters of the prefetcher
+ * @param data the prefetcher handle returned by hlthunk_host_prefetch_create
+ * @param stats pointer to a structure that will be filled with the counters
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_host_prefetch_get_stats(void *data,
+				struct hlthunk_host_prefetch_stats *stats)
+{
+	struct host_prefetch *pf = (struct host_prefetch *) data;
+
+	if (!pf || !stats)
+		return -EINVAL;
+
+	pthread_mutex_lock(&pf->lock);
+	*stats = pf->stats;
+	pthread_mutex_unlock(&pf->lock);
+
+	return 0;
+}
@@ -0,0 +1,371 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * Deltas of the hardware event counters of the driver. The counters count the
+ * events since the driver was loaded and wrap at 32 bits, so the deltas are
+ * taken modulo 2^32.
+ *
+ * The counters may be published in a POSIX shared memory segment, so that
+ * monitoring agents read them without an ioctl of their own. Every update is
+ * written under a sequence counter, which readers check like the
+ * hlthunk_engine_util_get function does.
+ */
+
+#define NS_PER_SEC			1000000000ull
+
+struct hw_events {
+	struct hl_info_args args;
+	uint32_t *counters;
+	uint32_t *prev;
+	uint32_t *deltas;
+	uint64_t *totals;
+	struct hlthunk_hw_events_shm *shm;
+	size_t shm_size;
+	char *shm_name;
+	uint32_t num_events;
+	int fd;
+};
+
+/* The events of the Goya driver, by their ID */
+static const char * const goya_event_names[] = {
+	[33] = "PCIE_IF",
+	[36] = "TPC0_ECC",
+	[39] = "TPC1_ECC",
+	[42] = "TPC2_ECC",
+	[45] = "TPC3_ECC",
+	[48] = "TPC4_ECC",
+	[51] = "TPC5_ECC",
+	[54] = "TPC6_ECC",
+	[57] = "TPC7_ECC",
+	[60] = "MME_ECC",
+	[61] = "MME_ECC_EXT",
+	[63] = "MMU_ECC",
+	[64] = "DMA_MACRO",
+	[66] = "DMA_ECC",
+	[75] = "CPU_IF_ECC",
+	[78] = "PSOC_MEM",
+	[79] = "PSOC_CORESIGHT",
+	[81] = "SRAM0",
+	[82] = "SRAM1",
+	[83] = "SRAM2",
+	[84] = "SRAM3",
+	[85] = "SRAM4",
+	[86] = "SRAM5",
+	[87] = "SRAM6",
+	[88] = "SRAM7",
+	[89] = "SRAM8",
+	[90] = "SRAM9",
+	[91] = "SRAM10",
+	[92] = "SRAM11",
+	[93] = "SRAM12",
+	[94] = "SRAM13",
+	[95] = "SRAM14",
+	[96] = "SRAM15",
+	[97] = "SRAM16",
+	[98] = "SRAM17",
+	[99] = "SRAM18",
+	[100] = "SRAM19",
+	[101] = "SRAM20",
+	[102] = "SRAM21",
+	[103] = "SRAM22",
+	[104] = "SRAM23",
+	[105] = "SRAM24",
+	[106] = "SRAM25",
+	[107] = "SRAM26",
+	[108] = "SRAM27",
+	[109] = "SRAM28",
+	[110] = "SRAM29",
+	[112] = "GIC500",
+	[115] = "PCIE_DEC",
+	[117] = "TPC0_DEC",
+	[120] = "TPC1_DEC",
+	[123] = "TPC2_DEC",
+	[126] = "TPC3_DEC",
+	[129] = "TPC4_DEC",
+	[132] = "TPC5_DEC",
+	[135] = "TPC6_DEC",
+	[138] = "TPC7_DEC",
+	[139] = "AXI_ECC",
+	[140] = "L2_RAM_ECC",
+	[141] = "MME_WACS",
+	[142] = "MME_WACSD",
+	[143] = "PLL0",
+	[144] = "PLL1",
+	[145] = "PLL2",
+	[146] = "PLL3",
+	[147] = "PLL4",
+	[148] = "PLL5",
+	[149] = "PLL6",
+	[150] = "CPU_AXI_SPLITTER",
+	[153] = "PSOC_AXI_DEC",
+	[160] = "PSOC",
+	[280] = "MMU_PAGE_FAULT",
+	[281] = "MMU_WR_PERM"
+};
+
+#define GOYA_NUM_EVENT_NAMES \
+	(sizeof(goya_event_names) / sizeof(goya_event_names[0]))
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static int read_counters(struct hw_events *ev)
+{
+	return hlthunk_get_info(ev->fd, &ev->args) ? -errno : 0;
+}
+
+static void publish(struct hw_events *ev)
+{
+	struct hlthunk_hw_events_shm *shm = ev->shm;
+	uint32_t *counters = (uint32_t *) (shm + 1);
+	uint32_t i, seq = shm->seq;
+
+	__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__atomic_store_n(&shm->timestamp_ns, monotonic_ns(), __ATOMIC_RELAXED);
+	for (i = 0 ; i < ev->num_events ; i++) {
+		__atomic_store_n(&counters[i], ev->counters[i],
+					__ATOMIC_RELAXED);
+		__atomic_store_n(&counters[ev->num_events + i], ev->deltas[i],
+					__ATOMIC_RELAXED);
+	}
+
+	__atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static int create_shm(struct hw_events *ev, const char *name)
+{
+	int shm_fd, rc;
+
+	ev->shm_name = strdup(name);
+	if (!ev->shm_name)
+		return -ENOMEM;
+
+	ev->shm_size = sizeof(*ev->shm) +
+			2 * ev->num_events * sizeof(uint32_t);
+
+	shm_fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (shm_fd < 0)
+		return -errno;
+
+	if (ftruncate(shm_fd, ev->shm_size)) {
+		rc = -errno;
+		goto unlink;
+	}
+
+	ev->shm = mmap(NULL, ev->shm_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, shm_fd, 0);
+	if (ev->shm == MAP_FAILED) {
+		ev->shm = NULL;
+		rc = -errno;
+		goto unlink;
+	}
+
+	close(shm_fd);
+
+	ev->shm->num_events = ev->num_events;
+	publish(ev);
+	/* The magic tells readers that the segment is initialized */
+	__atomic_store_n(&ev->shm->magic, HLTHUNK_HW_EVENTS_SHM_MAGIC,
+				__ATOMIC_RELEASE);
+
+	return 0;
+
+unlink:
+	close(shm_fd);
+	shm_unlink(name);
+	return rc;
+}
+
+/**
+ * This function starts following the hardware event counters of a device.
+ * The first update returns the events since this call
+ * @param fd file descriptor of the device
+ * @param shm_name name of a POSIX shared memory segment to publish the
+ * counters in, which is created or replaced, e.g. "/hlthunk_events". May be
+ * NULL
+ * @return opaque handle of the counters or NULL in case of error, with errno
+ * set
+ */
+hlthunk_public void *hlthunk_hw_events_open(int fd, const char *shm_name)
+{
+	struct hlthunk_hw_ip_info hw_ip;
+	struct hw_events *ev;
+	int rc;
+
+	/* errno is set by the failed ioctl */
+	if (hlthunk_get_hw_ip_info(fd, &hw_ip))
+		return NULL;
+
+	if (!hw_ip.num_of_events) {
+		errno = ENODEV;
+		return NULL;
+	}
+
+	ev = hlthunk_malloc(sizeof(*ev));
+	if (!ev) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	ev->fd = fd;
+	ev->num_events = hw_ip.num_of_events;
+
+	rc = -ENOMEM;
+	ev->counters = hlthunk_malloc(ev->num_events * sizeof(*ev->counters));
+	ev->prev = hlthunk_malloc(ev->num_events * sizeof(*ev->prev));
+	ev->deltas = hlthunk_malloc(ev->num_events * sizeof(*ev->deltas));
+	ev->totals = hlthunk_malloc(ev->num_events * sizeof(*ev->totals));
+	if (!ev->counters || !ev->prev || !ev->deltas || !ev->totals)
+		goto free_events;
+
+	/* The request is built once and reused by every update */
+	ev->args.op = HL_INFO_HW_EVENTS;
+	ev->args.return_pointer = (__u64) (uintptr_t) ev->counters;
+	ev->args.return_size = ev->num_events * sizeof(*ev->counters);
+
+	rc = read_counters(ev);
+	if (rc)
+		goto free_events;
+
+	memcpy(ev->prev, ev->counters, ev->num_events * sizeof(*ev->prev));
+
+	if (shm_name) {
+		rc = create_shm(ev, shm_name);
+		if (rc)
+			goto free_events;
+	}
+
+	return ev;
+
+free_events:
+	hlthunk_hw_events_close(ev);
+	errno = -rc;
+	return NULL;
+}
+
+/**
+ * This function stops following the hardware event counters and removes
+ * their shared memory segment. Readers that mapped it keep their mapping
+ * @param data the handle returned by hlthunk_hw_events_open
+ */
+hlthunk_public void hlthunk_hw_events_close(void *data)
+{
+	struct hw_events *ev = (struct hw_events *) data;
+
+	if (!ev)
+		return;
+
+	if (ev->shm) {
+		munmap(ev->shm, ev->shm_size);
+		shm_unlink(ev->shm_name);
+	}
+
+	free(ev->shm_name);
+	hlthunk_free(ev->totals);
+	hlthunk_free(ev->deltas);
+	hlthunk_free(ev->prev);
+	hlthunk_free(ev->counters);
+	hlthunk_free(ev);
+}
+
+/**
+ * This function reads the hardware event counters and publishes them, if
+ * they have a shared memory segment
+ * @param data the handle returned by hlthunk_hw_events_open
+ * @param deltas returned array of the events since the previous update,
+ * indexed by the event ID. It is valid until the next update
+ * @param num_events returned number of entries in the deltas array. May be
+ * NULL
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_hw_events_update(void *data,
+						const uint32_t **deltas,
+						uint32_t *num_events)
+{
+	struct hw_events *ev = (struct hw_events *) data;
+	uint32_t i;
+	int rc;
+
+	if (!ev || !deltas)
+		return -EINVAL;
+
+	rc = read_counters(ev);
+	if (rc)
+		return rc;
+
+	for (i = 0 ; i < ev->num_events ; i++) {
+		ev->deltas[i] = ev->counters[i] - ev->prev[i];
+		ev->totals[i] += ev->deltas[i];
+		ev->prev[i] = ev->counters[i];
+	}
+
+	if (ev->shm)
+		publish(ev);
+
+	*deltas = ev->deltas;
+	if (num_events)
+		*num_events = ev->num_events;
+
+	return 0;
+}
+
+/**
+ * This function retrieves the number of times an event occurred between the
+ * opening of the counters and their last update
+ * @param data the handle returned by hlthunk_hw_events_open
+ * @param event the ID of the event
+ * @param total returned number of events
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_hw_events_get_total(void *data, uint32_t event,
+						uint64_t *total)
+{
+	struct hw_events *ev = (struct hw_events *) data;
+
+	if (!ev || !total || event >= ev->num_events)
+		return -EINVAL;
+
+	*total = ev->totals[event];
+
+	return 0;
+}
+
+/**
+ * This function retrieves the name of a hardware event
+ * @param device the device the event belongs to
+ * @param event the ID of the event
+ * @return the name of the event, e.g. "MMU_PAGE_FAULT", NULL if the event
+ * isn't known
+ */
+hlthunk_public const char *hlthunk_hw_events_get_name(
+					enum hlthunk_device_name device,
+					uint32_t event)
+{
+	if (device != HLTHUNK_DEVICE_GOYA)
+		return NULL;
+
+	return event < GOYA_NUM_EVENT_NAMES ? goya_event_names[event] : NULL;
+}
@@ -7,17 +7,20 @@
 
 #include "libhlthunk.h"
 #include "specs/pci_ids.h"
+#include "record.h"
 
 #define _GNU_SOURCE
 
 #include <errno.h>
-#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <linux/limits.h>
 
 int hlthunk_debug_level = HLTHUNK_DEBUG_LEVEL_NA;
@@ -29,7 +32,7 @@ static int hlthunk_ioctl(int fd, unsigned long request, void *arg)
 	int ret;
 
 	do {
-		ret = ioctl(fd, request, arg);
+		ret = hlthunk_backend()->ioctl(fd, request, arg);
 	} while (ret == -1 && (errno == EINTR || errno == EAGAIN));
 
 	return ret;
@@ -41,9 +44,11 @@ static int hlthunk_open_minor(int minor, const char *dev_name)
 	int fd;
 
 	sprintf(buf, dev_name, minor);
-	fd = open(buf, O_RDWR | O_CLOEXEC, 0);
-	if (fd >= 0)
+	fd = hlthunk_backend()->open(buf, O_RDWR | O_CLOEXEC);
+	if (fd >= 0) {
+		hlthunk_backend_get();
 		return fd;
+	}
 	return -errno;
 }
 
@@ -116,6 +121,32 @@ static int hlthunk_open_by_busid(const char *busid)
 	return -1;
 }
 
+/**
+ * This function builds the sysfs path of the class device behind a device
+ * file descriptor, e.g. /sys/dev/char/<major>:<minor>, which links to
+ * /sys/class/habanalabs/hlN
+ * @param fd file descriptor of the device
+ * @param path returned path
+ * @param len size of the path buffer
+ * @return 0 for success, -ENODEV if the fd isn't a character device, other
+ * negative value for failure
+ */
+int hlthunk_device_sysfs_path(int fd, char *path, size_t len)
+{
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return -errno;
+
+	if (!S_ISCHR(st.st_mode))
+		return -ENODEV;
+
+	snprintf(path, len, "/sys/dev/char/%u:%u", major(st.st_rdev),
+			minor(st.st_rdev));
+
+	return 0;
+}
+
 hlthunk_public enum hlthunk_device_name hlthunk_get_device_name_from_fd(int fd)
 {
 	enum hl_pci_ids device_id = hlthunk_get_device_id_from_fd(fd);
@@ -175,15 +206,34 @@ hlthunk_public void hlthunk_free(void *pt)
 hlthunk_public int hlthunk_open(enum hlthunk_device_name device_name,
 				const char *busid)
 {
+	const char *record_file;
+	int fd;
+
 	if (busid)
-		return hlthunk_open_by_busid(busid);
+		fd = hlthunk_open_by_busid(busid);
+	else
+		fd = hlthunk_open_device_by_name(device_name);
 
-	return hlthunk_open_device_by_name(device_name);
+	record_file = getenv("HLTHUNK_RECORD_FILE");
+	if (fd >= 0 && record_file && !hlthunk_recording)
+		if (hlthunk_record_start(fd, record_file))
+			pr_warn("Failed to start recording to %s\n",
+				record_file);
+
+	return fd;
 }
 
 hlthunk_public int hlthunk_close(int fd)
 {
-	return close(fd);
+	int rc;
+
+	hlthunk_va_index_remove_fd(fd);
+
+	rc = hlthunk_backend()->close(fd);
+	if (!rc)
+		hlthunk_backend_put();
+
+	return rc;
 }
 
 hlthunk_public int hlthunk_get_hw_ip_info(int fd,
@@ -226,6 +276,50 @@ hlthunk_public int hlthunk_get_hw_ip_info(int fd,
 	return 0;
 }
 
+/* Reference clock of the PSOC PLLs */
+#define PLL_REF_CLK_HZ	50000000ull
+
+/**
+ * This function calculates the output frequency of a PLL from its dividers
+ * and multiplier
+ * @return the frequency in Hz, 0 if the dividers are invalid
+ */
+uint64_t hlthunk_pll_freq(uint32_t nr, uint32_t nf, uint32_t od,
+				uint32_t div_factor)
+{
+	uint64_t div = (uint64_t) (nr + 1) * (od + 1) * (div_factor + 1);
+
+	return PLL_REF_CLK_HZ * (nf + 1) / div;
+}
+
+/**
+ * This function retrieves the frequency of the device timestamp counter,
+ * which the PSOC PCI PLL clocks. This is the rate of the timestamps that
+ * MSG_LONG packets write
+ * @param fd file descriptor of the device
+ * @param freq_hz returned frequency in Hz
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_get_timestamp_freq(int fd, uint64_t *freq_hz)
+{
+	struct hlthunk_hw_ip_info hw_ip;
+	int rc;
+
+	if (!freq_hz)
+		return -EINVAL;
+
+	rc = hlthunk_get_hw_ip_info(fd, &hw_ip);
+	if (rc)
+		return -errno;
+
+	*freq_hz = hlthunk_pll_freq(hw_ip.psoc_pci_pll_nr,
+					hw_ip.psoc_pci_pll_nf,
+					hw_ip.psoc_pci_pll_od,
+					hw_ip.psoc_pci_pll_div_factor);
+
+	return *freq_hz ? 0 : -EINVAL;
+}
+
 hlthunk_public enum hl_device_status hlthunk_get_device_status_info(int fd)
 {
 	struct hl_info_args args;
@@ -309,6 +403,9 @@ hlthunk_public int hlthunk_request_command_buffer(int fd, uint32_t cb_size,
 
 	*cb_handle = args.out.cb_handle;
 
+	if (hlthunk_recording)
+		hlthunk_rec_cb(REC_CB_CREATE, *cb_handle, cb_size);
+
 	return 0;
 }
 
@@ -320,17 +417,53 @@ hlthunk_public int hlthunk_destroy_command_buffer(int fd, uint64_t cb_handle)
 	args.in.op = HL_CB_OP_DESTROY;
 	args.in.cb_handle = cb_handle;
 
+	if (hlthunk_recording)
+		hlthunk_rec_cb(REC_CB_DESTROY, cb_handle, 0);
+
 	return hlthunk_ioctl(fd, HL_IOCTL_CB, &args);
 }
 
+/**
+ * This function maps a command buffer that was created by
+ * hlthunk_request_command_buffer into the user process VA space
+ * @param fd file descriptor of the device that owns the CB
+ * @param len the size of the CB
+ * @param cb_handle the handle returned by hlthunk_request_command_buffer
+ * @return pointer to the CB, or MAP_FAILED upon failure
+ */
+hlthunk_public void *hlthunk_cb_mmap(int fd, size_t len, uint64_t cb_handle)
+{
+	void *addr;
+
+	addr = hlthunk_backend()->mmap(NULL, len, PROT_READ | PROT_WRITE,
+					MAP_SHARED, fd, cb_handle);
+
+	if (hlthunk_recording && addr != MAP_FAILED)
+		hlthunk_rec_cb_mmap(addr, len, cb_handle);
+
+	return addr;
+}
+
+hlthunk_public int hlthunk_cb_munmap(void *addr, size_t len)
+{
+	if (hlthunk_recording)
+		hlthunk_rec_cb_munmap(addr);
+
+	return hlthunk_backend()->munmap(addr, len);
+}
+
 hlthunk_public int hlthunk_command_submission(int fd, struct hlthunk_cs_in *in,
 						struct hlthunk_cs_out *out)
 {
 	union hl_cs_args args;
 	struct hl_cs_in *hl_in;
 	struct hl_cs_out *hl_out;
+	uint64_t start_ns = 0;
 	int rc;
 
+	if (hlthunk_recording)
+		start_ns = hlthunk_rec_now();
+
 	memset(&args, 0, sizeof(args));
 
 	hl_in = &args.in;
@@ -341,14 +474,17 @@ hlthunk_public int hlthunk_command_submission(int fd, struct hlthunk_cs_in *in,
 	hl_in->cs_flags = in->flags;
 
 	rc = hlthunk_ioctl(fd, HL_IOCTL_CS, &args);
-	if (rc)
-		return rc;
 
 	hl_out = &args.out;
-	out->seq = hl_out->seq;
-	out->status = hl_out->status;
+	if (!rc) {
+		out->seq = hl_out->seq;
+		out->status = hl_out->status;
+	}
 
-	return 0;
+	if (hlthunk_recording)
+		hlthunk_rec_cs(in, out, rc, start_ns);
+
+	return rc;
 }
 
 hlthunk_public int hlthunk_wait_for_cs(int fd, uint64_t seq,
@@ -357,8 +493,12 @@ hlthunk_public int hlthunk_wait_for_cs(int fd, uint64_t seq,
 	union hl_wait_cs_args args;
 	struct hl_wait_cs_in *hl_in;
 	struct hl_wait_cs_out *hl_out;
+	uint64_t start_ns = 0;
 	int rc;
 
+	if (hlthunk_recording)
+		start_ns = hlthunk_rec_now();
+
 	memset(&args, 0, sizeof(args));
 
 	hl_in = &args.in;
@@ -370,6 +510,9 @@ hlthunk_public int hlthunk_wait_for_cs(int fd, uint64_t seq,
 	hl_out = &args.out;
 	*status = hl_out->status;
 
+	if (hlthunk_recording)
+		hlthunk_rec_wait_cs(seq, timeout_us, *status, rc, start_ns);
+
 	return rc;
 }
 
@@ -389,6 +532,22 @@ hlthunk_public int hlthunk_get_info(int fd, struct hl_info_args *info)
 	return hlthunk_ioctl(fd, HL_IOCTL_INFO, info);
 }
 
+static void record_mem(uint16_t type, uint64_t handle, uint64_t size,
+			uint64_t host_virt_addr, uint64_t hint_addr,
+			uint64_t device_virt_addr, uint32_t flags)
+{
+	struct hlthunk_rec_mem mem = {
+		.handle = handle,
+		.size = size,
+		.host_virt_addr = host_virt_addr,
+		.hint_addr = hint_addr,
+		.device_virt_addr = device_virt_addr,
+		.flags = flags
+	};
+
+	hlthunk_rec_mem(type, &mem);
+}
+
 /**
  * This function allocates DRAM memory on the device
  * @param fd file descriptor of the device on which to allocate the memory
@@ -417,6 +576,10 @@ hlthunk_public uint64_t hlthunk_device_memory_alloc(int fd, uint64_t size,
 	if (rc)
 		return 0;
 
+	if (hlthunk_recording)
+		record_mem(REC_MEM_ALLOC, ioctl_args.out.handle, size, 0, 0, 0,
+				ioctl_args.in.flags);
+
 	return ioctl_args.out.handle;
 }
 
@@ -435,6 +598,9 @@ hlthunk_public int hlthunk_device_memory_free(int fd, uint64_t handle)
 	ioctl_args.in.free.handle = handle;
 	ioctl_args.in.op = HL_MEM_OP_FREE;
 
+	if (hlthunk_recording)
+		record_mem(REC_MEM_FREE, handle, 0, 0, 0, 0, 0);
+
 	return hlthunk_ioctl(fd, HL_IOCTL_MEMORY, &ioctl_args);
 }
 
@@ -463,9 +629,24 @@ hlthunk_public uint64_t hlthunk_device_memory_map(int fd, uint64_t handle,
 	if (rc)
 		return 0;
 
+	if (hlthunk_recording)
+		record_mem(REC_MAP_DEVICE, handle, 0, 0, hint_addr,
+				ioctl_args.out.device_virt_addr, 0);
+
 	return ioctl_args.out.device_virt_addr;
 }
 
+static int memory_unmap(int fd, uint64_t device_virt_addr)
+{
+	union hl_mem_args ioctl_args;
+
+	memset(&ioctl_args, 0, sizeof(ioctl_args));
+	ioctl_args.in.unmap.device_virt_addr = device_virt_addr;
+	ioctl_args.in.op = HL_MEM_OP_UNMAP;
+
+	return hlthunk_ioctl(fd, HL_IOCTL_MEMORY, &ioctl_args);
+}
+
 /**
  * This function asks the driver to map a previously allocated host memory
  * to the device's MMU and to allocate for it a VA in the device address space
@@ -495,6 +676,20 @@ hlthunk_public uint64_t hlthunk_host_memory_map(int fd, void *host_virt_addr,
 	if (rc)
 		return 0;
 
+	/* The mapping is useless if its address can't be translated */
+	if (hlthunk_va_index_add(fd, host_virt_addr, host_size,
+				ioctl_args.out.device_virt_addr)) {
+		memory_unmap(fd, ioctl_args.out.device_virt_addr);
+		errno = ENOMEM;
+		return 0;
+	}
+
+	if (hlthunk_recording)
+		record_mem(REC_MAP_HOST, 0, host_size,
+				(uint64_t) host_virt_addr, hint_addr,
+				ioctl_args.out.device_virt_addr,
+				HL_MEM_USERPTR);
+
 	return ioctl_args.out.device_virt_addr;
 }
 
@@ -508,16 +703,61 @@ hlthunk_public uint64_t hlthunk_host_memory_map(int fd, void *host_virt_addr,
  */
 hlthunk_public int hlthunk_memory_unmap(int fd, uint64_t device_virt_addr)
 {
-	union hl_mem_args ioctl_args;
-
-	memset(&ioctl_args, 0, sizeof(ioctl_args));
-	ioctl_args.in.unmap.device_virt_addr = device_virt_addr;
-	ioctl_args.in.op = HL_MEM_OP_UNMAP;
+	void *host_virt_addr;
+	uint64_t size;
+	int indexed, rc, err;
+
+	if (hlthunk_recording)
+		record_mem(REC_UNMAP, 0, 0, 0, 0, device_virt_addr, 0);
+
+	/*
+	 * Remove host areas from the index before the driver releases their
+	 * VA, which may be given to another mapping right after
+	 */
+	indexed = hlthunk_va_index_remove(fd, device_virt_addr,
+						&host_virt_addr, &size);
+
+	rc = memory_unmap(fd, device_virt_addr);
+	if (rc && indexed > 0) {
+		err = errno;
+		hlthunk_va_index_add(fd, host_virt_addr, size,
+					device_virt_addr);
+		errno = err;
+	}
 
-	return hlthunk_ioctl(fd, HL_IOCTL_MEMORY, &ioctl_args);
+	return rc;
 }
 
 hlthunk_public int hlthunk_debug(int fd, struct hl_debug_args *debug)
 {
 	return hlthunk_ioctl(fd, HL_IOCTL_DEBUG, debug);
 }
+
+/**
+ * This function puts the device in debug mode and restarts its timestamp
+ * counter, or stops the counter and takes the device out of debug mode
+ * @param fd file descriptor of the device
+ * @param enable true to enable the counter, false to disable it
+ * @return 0 for success, negative value for failure
+ */
+int hlthunk_debug_timestamp(int fd, bool enable)
+{
+	struct hl_debug_args debug;
+
+	memset(&debug, 0, sizeof(debug));
+	debug.op = HL_DEBUG_OP_SET_MODE;
+	debug.enable = enable;
+	if (enable && hlthunk_debug(fd, &debug))
+		return -errno;
+
+	debug.op = HL_DEBUG_OP_TIMESTAMP;
+	if (hlthunk_debug(fd, &debug))
+		return -errno;
+
+	if (!enable) {
+		debug.op = HL_DEBUG_OP_SET_MODE;
+		hlthunk_debug(fd, &debug);
+	}
+
+	return 0;
+}
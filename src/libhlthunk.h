@@ -11,6 +11,8 @@
 #include "hlthunk.h"
 #include "specs/version.h"
 
+#include <stddef.h>
+
 #define _STRINGIFY(x)	#x
 #define STRINGIFY(x)	_STRINGIFY(x)
 
@@ -55,6 +57,71 @@ do { \
 #define pr_debug(fmt, ...) \
 	hlthunk_print(HLTHUNK_DEBUG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
 
+/* Internal helpers shared between the library modules */
+uint64_t hlthunk_hash_bytes(const void *buf, size_t len);
+
+int hlthunk_device_sysfs_path(int fd, char *path, size_t len);
+uint64_t hlthunk_pll_freq(uint32_t nr, uint32_t nf, uint32_t od,
+				uint32_t div_factor);
+int hlthunk_debug_timestamp(int fd, bool enable);
+
+/* CoreSight traces, see trace.c and trace_decode.c */
+#define HLTHUNK_TRACE_MAX_IDS	128
+
+/* The trace of a single trace ID, split out of the formatter frames */
+struct hlthunk_trace_stream {
+	uint8_t *buf;
+	uint64_t len;
+	uint64_t cap;
+};
+
+void *hlthunk_trace_start_profiles(int fd,
+				const struct hlthunk_trace_params *params,
+				uint32_t profile_mask);
+int hlthunk_trace_read_streams(const char *path,
+				struct hlthunk_trace_stream *streams);
+void hlthunk_trace_free_streams(struct hlthunk_trace_stream *streams);
+
+/* Faulting in and locking host memory before it is mapped, see host_mem.c */
+void hlthunk_host_prefault(void *ptr, uint64_t size);
+void hlthunk_host_unprefault(void *ptr, uint64_t size);
+
+/* Index of the mapped host memory, see va_index.c */
+int hlthunk_va_index_add(int fd, void *host_virt_addr, uint64_t size,
+				uint64_t device_virt_addr);
+int hlthunk_va_index_remove(int fd, uint64_t device_virt_addr,
+				void **host_virt_addr, uint64_t *size);
+void hlthunk_va_index_remove_fd(int fd);
+
+/* Register database, see regdb.c */
+int hlthunk_regdb_get_block_regs(enum hlthunk_device_name device,
+					const char *block, uint32_t *addrs,
+					uint32_t max_addrs);
+
+/* Driver backend, see backend.c */
+extern const struct hlthunk_backend_ops hlthunk_kernel_backend;
+extern const struct hlthunk_backend_ops hlthunk_model_backend;
+
+const struct hlthunk_backend_ops *hlthunk_backend(void);
+void hlthunk_backend_get(void);
+void hlthunk_backend_put(void);
+
+/* Recording hooks, see record.c */
+struct hlthunk_rec_mem;
+
+extern bool hlthunk_recording;
+
+uint64_t hlthunk_rec_now(void);
+void hlthunk_rec_cb(uint16_t type, uint64_t cb_handle, uint32_t cb_size);
+void hlthunk_rec_cb_mmap(void *addr, uint64_t len, uint64_t cb_handle);
+void hlthunk_rec_cb_munmap(void *addr);
+void hlthunk_rec_mem(uint16_t type, const struct hlthunk_rec_mem *mem);
+void hlthunk_rec_cs(const struct hlthunk_cs_in *in,
+			const struct hlthunk_cs_out *out, int rc,
+			uint64_t start_ns);
+void hlthunk_rec_wait_cs(uint64_t seq, uint64_t timeout_us, uint32_t status,
+				int rc, uint64_t start_ns);
+
 #undef hlthunk_public
 #define hlthunk_public
 
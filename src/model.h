@@ -0,0 +1,235 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ *
+ */
+
+#ifndef HLTHUNK_MODEL_H
+#define HLTHUNK_MODEL_H
+
+#include "libhlthunk.h"
+#include "khash.h"
+#include "specs/goya/goya.h"
+
+#include <pthread.h>
+
+/* Properties of the device that the model exposes */
+#define MODEL_NUM_DEVICES		1
+#define MODEL_NUM_EVENTS		575
+#define MODEL_DRAM_SIZE			0x400000000ull		/* 16GB */
+#define MODEL_DRAM_USER_BASE		0x20000000ull		/* 512MB */
+#define MODEL_DRAM_PAGE_SIZE		0x200000ull		/* 2MB */
+#define MODEL_MAX_CB_SIZE		0x200000		/* 2MB */
+#define MODEL_MAX_JOBS_PER_CS		64
+#define MODEL_NUM_SOBS			1024
+#define MODEL_NUM_MONITORS		256
+#define MODEL_NUM_FENCES		4
+#define MODEL_PERF_MAX_BUSY		64
+#define MODEL_PERF_CS_HISTORY		4096
+#define MODEL_PCI_PLL_NR		4
+#define MODEL_PCI_PLL_NF		127
+#define MODEL_PCI_PLL_OD		4
+#define MODEL_PCI_PLL_DIV_FACTOR	2
+
+/* Device VA ranges, same as the driver uses for Goya */
+#define MODEL_VA_DRAM_START		0x800000000ull
+#define MODEL_VA_DRAM_END		0x2000000000ull
+#define MODEL_VA_HOST_START		0x1000000000000ull
+#define MODEL_VA_HOST_END		0x2000000000000ull
+
+struct model_cb {
+	uint64_t handle;
+	void *ptr;
+	uint32_t size;
+	uint32_t refcnt;
+	bool mapped;
+	bool destroyed;
+};
+
+struct model_mem {
+	uint64_t handle;
+	uint64_t size;
+	/* Offset of the allocation in the device DRAM */
+	uint64_t phys;
+	uint32_t flags;
+	uint32_t map_cnt;
+};
+
+struct model_map {
+	uint64_t va;
+	uint64_t size;
+	/* Host address for host mappings, NULL for DRAM mappings */
+	void *host_ptr;
+	uint64_t mem_handle;
+	uint64_t phys;
+};
+
+/* Where an address that a packet accesses resides */
+enum model_mem_kind {
+	MODEL_MEM_NONE,
+	MODEL_MEM_HOST,
+	MODEL_MEM_SRAM,
+	MODEL_MEM_DRAM
+};
+
+struct model_cs {
+	uint64_t seq;
+	/* Device model times of the CS, in ns, see model_perf.c */
+	uint64_t submit_time;
+	uint64_t start_time;
+	uint64_t done_time;
+	uint32_t pending_jobs;
+	/* Protected by exec_lock, execute jobs wait for it to drop to 0 */
+	uint32_t pending_restore;
+	uint64_t restore_done_time;
+};
+
+struct model_job {
+	struct model_job *next;
+	struct model_cs *cs;
+	/* The CB of an external queue, NULL for internal queues */
+	struct model_cb *cb;
+	/* Device address of the CB of an internal queue */
+	uint64_t cb_addr;
+	uint32_t cb_size;
+	uint32_t queue;
+	uint64_t start_time;
+	uint64_t end_time;
+	bool restore;
+};
+
+/* Fence counters of the QMAN CP and of the engine's CMDQ CP */
+enum model_cp {
+	MODEL_CP_QMAN,
+	MODEL_CP_CMDQ,
+	MODEL_CP_MAX
+};
+
+struct model_queue {
+	pthread_t thread;
+	struct model_job *head;
+	struct model_job *tail;
+	uint32_t fence[MODEL_CP_MAX][MODEL_NUM_FENCES];
+	/* Model time of the last signal of every fence */
+	uint64_t fence_time[MODEL_CP_MAX][MODEL_NUM_FENCES];
+	/* Model clock and run time of the current job, owned by the worker */
+	uint64_t now;
+	uint64_t run_ns;
+	/* Model time when the last job ended and total execution time */
+	uint64_t time;
+	uint64_t busy_ns;
+	uint32_t engine_id;
+	bool busy;
+	bool started;
+};
+
+struct model_monitor {
+	uint32_t addr_lo;
+	uint32_t addr_hi;
+	uint32_t data;
+	uint16_t sob_id;
+	uint16_t sob_val;
+	bool greater_or_equal;
+	bool armed;
+};
+
+/* Busy intervals of a shared resource, sorted by start time */
+struct model_perf_res {
+	uint64_t start[MODEL_PERF_MAX_BUSY];
+	uint64_t end[MODEL_PERF_MAX_BUSY];
+	uint32_t num;
+};
+
+enum model_perf_res_id {
+	MODEL_PERF_PCIE_H2D,
+	MODEL_PERF_PCIE_D2H,
+	MODEL_PERF_SRAM,
+	MODEL_PERF_DRAM,
+	MODEL_PERF_RES_MAX
+};
+
+struct model_perf_cs {
+	uint64_t seq;
+	uint64_t submit_time;
+	uint64_t start_time;
+	uint64_t done_time;
+};
+
+struct model_perf {
+	struct hlthunk_model_perf_params params;
+	/* Protects the resources */
+	pthread_mutex_t lock;
+	struct model_perf_res res[MODEL_PERF_RES_MAX];
+	struct model_perf_res channels[DMA_MAX_NUM];
+	/* Protected by the device lock */
+	struct model_perf_cs history[MODEL_PERF_CS_HISTORY];
+	uint64_t host_time;
+};
+
+KHASH_MAP_INIT_INT64(model_cb, struct model_cb *)
+KHASH_MAP_INIT_INT64(model_mem, struct model_mem *)
+KHASH_MAP_INIT_INT64(model_map, struct model_map *)
+KHASH_SET_INIT_INT64(model_seq)
+
+struct model_dev {
+	pthread_mutex_t lock;
+	pthread_cond_t cs_done;
+	khash_t(model_cb) *cbs;
+	khash_t(model_mem) *mems;
+	khash_t(model_map) *maps;
+	khash_t(model_seq) *inflight;
+	uint32_t events[MODEL_NUM_EVENTS];
+	/* Execution state, protected by exec_lock, see model_goya.c */
+	pthread_mutex_t exec_lock;
+	pthread_cond_t exec_cond;
+	struct model_queue queues[GOYA_QUEUE_ID_SIZE];
+	struct model_monitor monitors[MODEL_NUM_MONITORS];
+	uint32_t sobs[MODEL_NUM_SOBS];
+	uint64_t sob_time[MODEL_NUM_SOBS];
+	uint8_t *sram;
+	uint8_t *dram;
+	bool stopping;
+	struct model_perf perf;
+	/* Timestamp counter, which counts from the model time ts_base */
+	uint64_t ts_base;
+	uint64_t ts_freq;
+	bool ts_enabled;
+	bool debug_mode;
+	/* The ETR buffer. The model emits no trace, so it stays empty */
+	uint64_t etr_addr;
+	bool etr_enabled;
+	uint64_t next_cb_id;
+	uint64_t next_mem_handle;
+	uint64_t next_dram_va;
+	uint64_t next_host_va;
+	uint64_t next_dram_phys;
+	uint64_t dram_used;
+	uint64_t seq;
+	int minor;
+	int fd;
+};
+
+/* backend_model.c */
+struct model_dev *model_get_dev(int fd);
+void model_job_done(struct model_dev *dev, struct model_job *job);
+void *model_translate(struct model_dev *dev, uint64_t addr, uint64_t size,
+			enum model_mem_kind *kind);
+
+/* model_goya.c */
+int model_goya_init(struct model_dev *dev);
+void model_goya_fini(struct model_dev *dev);
+void model_goya_submit(struct model_dev *dev, struct model_job *jobs);
+uint32_t model_goya_busy_engines(struct model_dev *dev);
+
+/* model_perf.c */
+void model_perf_init(struct model_dev *dev);
+void model_perf_fini(struct model_dev *dev);
+uint64_t model_perf_dma(struct model_dev *dev, uint64_t now,
+			enum model_mem_kind src, enum model_mem_kind dst,
+			uint64_t size);
+void model_perf_cs_submit(struct model_dev *dev, struct model_cs *cs);
+void model_perf_cs_done(struct model_dev *dev, struct model_cs *cs);
+void model_perf_cs_waited(struct model_dev *dev, uint64_t seq);
+
+#endif /* HLTHUNK_MODEL_H */
@@ -0,0 +1,674 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+/*
+ * Goya packet interpreter of the device model. Every queue has a worker thread
+ * that executes the CBs of its jobs in order against the emulated SRAM and
+ * DRAM and the host memory that was mapped to the device. The sync manager's
+ * SOBs and monitors and the CPs' fence counters are modeled, so a FENCE packet
+ * really blocks its queue until another queue signals it.
+ */
+
+#include "model.h"
+#include "specs/goya/goya.h"
+#include "specs/goya/goya_packets.h"
+#include "specs/goya/asic_reg/goya_regs.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Offset of the first fence counter in the block of a QMAN or a CMDQ */
+#define CP_FENCE0_RDATA \
+	(mmDMA_QM_0_CP_FENCE0_RDATA - mmDMA_QM_0_GLBL_CFG0)
+
+#define SOB_VAL_MASK		0x7FFF
+#define SOB_MODE_ADD		(1u << 31)
+
+/* Size of the registers of one kind, e.g. the ADDRL of all the monitors */
+#define MON_REGS_SIZE \
+	(mmSYNC_MNGR_MON_PAY_ADDRH_0 - mmSYNC_MNGR_MON_PAY_ADDRL_0)
+
+#define MON_ARM_SID_MASK	0x3FF
+#define MON_ARM_SOP_SHIFT	15
+#define MON_ARM_SOD_SHIFT	16
+
+/* Event that is raised when a CP hits a packet it can't execute */
+#define MODEL_EVENT_CP_ERROR	0
+
+struct model_queue_regs {
+	uint64_t qman_base;
+	uint64_t cmdq_base;
+	uint64_t engine_base;
+	uint32_t engine_id;
+};
+
+static const struct model_queue_regs queue_regs[GOYA_QUEUE_ID_SIZE] = {
+	[GOYA_QUEUE_ID_DMA_0] = { mmDMA_QM_0_BASE, 0, mmDMA_CH_0_BASE,
+					GOYA_ENGINE_ID_DMA_0 },
+	[GOYA_QUEUE_ID_DMA_1] = { mmDMA_QM_1_BASE, 0, mmDMA_CH_1_BASE,
+					GOYA_ENGINE_ID_DMA_1 },
+	[GOYA_QUEUE_ID_DMA_2] = { mmDMA_QM_2_BASE, 0, mmDMA_CH_2_BASE,
+					GOYA_ENGINE_ID_DMA_2 },
+	[GOYA_QUEUE_ID_DMA_3] = { mmDMA_QM_3_BASE, 0, mmDMA_CH_3_BASE,
+					GOYA_ENGINE_ID_DMA_3 },
+	[GOYA_QUEUE_ID_DMA_4] = { mmDMA_QM_4_BASE, 0, mmDMA_CH_4_BASE,
+					GOYA_ENGINE_ID_DMA_4 },
+	[GOYA_QUEUE_ID_MME] = { mmMME_QM_BASE, mmMME_CMDQ_BASE, mmMME_BASE,
+					GOYA_ENGINE_ID_MME_0 },
+	[GOYA_QUEUE_ID_TPC0] = { mmTPC0_QM_BASE, mmTPC0_CMDQ_BASE,
+					mmTPC0_CFG_BASE, GOYA_ENGINE_ID_TPC_0 },
+	[GOYA_QUEUE_ID_TPC1] = { mmTPC1_QM_BASE, mmTPC1_CMDQ_BASE,
+					mmTPC1_CFG_BASE, GOYA_ENGINE_ID_TPC_1 },
+	[GOYA_QUEUE_ID_TPC2] = { mmTPC2_QM_BASE, mmTPC2_CMDQ_BASE,
+					mmTPC2_CFG_BASE, GOYA_ENGINE_ID_TPC_2 },
+	[GOYA_QUEUE_ID_TPC3] = { mmTPC3_QM_BASE, mmTPC3_CMDQ_BASE,
+					mmTPC3_CFG_BASE, GOYA_ENGINE_ID_TPC_3 },
+	[GOYA_QUEUE_ID_TPC4] = { mmTPC4_QM_BASE, mmTPC4_CMDQ_BASE,
+					mmTPC4_CFG_BASE, GOYA_ENGINE_ID_TPC_4 },
+	[GOYA_QUEUE_ID_TPC5] = { mmTPC5_QM_BASE, mmTPC5_CMDQ_BASE,
+					mmTPC5_CFG_BASE, GOYA_ENGINE_ID_TPC_5 },
+	[GOYA_QUEUE_ID_TPC6] = { mmTPC6_QM_BASE, mmTPC6_CMDQ_BASE,
+					mmTPC6_CFG_BASE, GOYA_ENGINE_ID_TPC_6 },
+	[GOYA_QUEUE_ID_TPC7] = { mmTPC7_QM_BASE, mmTPC7_CMDQ_BASE,
+					mmTPC7_CFG_BASE, GOYA_ENGINE_ID_TPC_7 },
+};
+
+struct model_worker_args {
+	struct model_dev *dev;
+	uint32_t queue;
+};
+
+static void model_raise_event(struct model_dev *dev, uint32_t event)
+{
+	__atomic_add_fetch(&dev->events[event], 1, __ATOMIC_RELAXED);
+}
+
+/* Monitor payloads to host or device memory, written without exec_lock */
+struct model_payloads {
+	uint64_t addr[MODEL_NUM_MONITORS];
+	uint32_t data[MODEL_NUM_MONITORS];
+	uint32_t num;
+};
+
+static void model_write_reg_locked(struct model_dev *dev, uint64_t offset,
+				uint32_t val, uint64_t now,
+				struct model_payloads *pl);
+
+/*
+ * Fire the armed monitors of a SOB whose condition holds. The payload is sent
+ * signal_ns after the later of the SOB update and the arming of the monitor.
+ * Must be called with exec_lock held
+ */
+static void model_check_monitors(struct model_dev *dev, uint32_t sob_id,
+					uint64_t now, struct model_payloads *pl)
+{
+	struct model_monitor *mon;
+	uint64_t addr;
+	uint32_t i;
+	bool fire;
+
+	if (dev->sob_time[sob_id] > now)
+		now = dev->sob_time[sob_id];
+	now += dev->perf.params.signal_ns;
+
+	for (i = 0 ; i < MODEL_NUM_MONITORS ; i++) {
+		mon = &dev->monitors[i];
+		if (!mon->armed || mon->sob_id != sob_id)
+			continue;
+
+		fire = mon->greater_or_equal ?
+				dev->sobs[sob_id] >= mon->sob_val :
+				dev->sobs[sob_id] == mon->sob_val;
+		if (!fire)
+			continue;
+
+		mon->armed = false;
+		addr = ((uint64_t) mon->addr_hi << 32) | mon->addr_lo;
+
+		if (addr >= CFG_BASE && addr < CFG_BASE + CFG_SIZE) {
+			model_write_reg_locked(dev, addr - CFG_BASE, mon->data,
+						now, pl);
+		} else if (pl->num < MODEL_NUM_MONITORS) {
+			pl->addr[pl->num] = addr;
+			pl->data[pl->num++] = mon->data;
+		}
+	}
+}
+
+/* Must be called with exec_lock held */
+static void model_write_fence(struct model_dev *dev, uint64_t offset,
+				uint32_t val, uint64_t now)
+{
+	const struct model_queue_regs *regs;
+	uint64_t base, fence_addr, *fence_time;
+	uint32_t q, id;
+	int cp;
+
+	for (q = 0 ; q < GOYA_QUEUE_ID_SIZE ; q++) {
+		regs = &queue_regs[q];
+
+		for (cp = MODEL_CP_QMAN ; cp < MODEL_CP_MAX ; cp++) {
+			base = cp == MODEL_CP_QMAN ? regs->qman_base :
+							regs->cmdq_base;
+			if (!base)
+				continue;
+
+			fence_addr = base - CFG_BASE + CP_FENCE0_RDATA;
+			if (offset < fence_addr ||
+				offset >= fence_addr + MODEL_NUM_FENCES * 4)
+				continue;
+
+			id = (offset - fence_addr) / 4;
+			dev->queues[q].fence[cp][id] += val;
+			fence_time = &dev->queues[q].fence_time[cp][id];
+			if (now > *fence_time)
+				*fence_time = now;
+			pthread_cond_broadcast(&dev->exec_cond);
+			return;
+		}
+	}
+}
+
+/*
+ * Register writes are a no-op, apart from the sync manager and the fences.
+ * Must be called with exec_lock held
+ */
+static void model_write_reg_locked(struct model_dev *dev, uint64_t offset,
+				uint32_t val, uint64_t now,
+				struct model_payloads *pl)
+{
+	struct model_monitor *mon;
+	uint32_t idx;
+
+	if (offset >= mmSYNC_MNGR_SOB_OBJ_0 &&
+			offset < mmSYNC_MNGR_SOB_OBJ_0 + MODEL_NUM_SOBS * 4) {
+		idx = (offset - mmSYNC_MNGR_SOB_OBJ_0) / 4;
+		if (val & SOB_MODE_ADD)
+			dev->sobs[idx] = (dev->sobs[idx] + val) & SOB_VAL_MASK;
+		else
+			dev->sobs[idx] = val & SOB_VAL_MASK;
+		dev->sob_time[idx] = now;
+		model_check_monitors(dev, idx, now, pl);
+	} else if (offset >= mmSYNC_MNGR_MON_PAY_ADDRL_0 &&
+			offset < mmSYNC_MNGR_MON_STATUS_0) {
+		idx = ((offset - mmSYNC_MNGR_MON_PAY_ADDRL_0) %
+				MON_REGS_SIZE) / 4;
+		mon = &dev->monitors[idx];
+
+		if (offset < mmSYNC_MNGR_MON_PAY_ADDRH_0) {
+			mon->addr_lo = val;
+		} else if (offset < mmSYNC_MNGR_MON_PAY_DATA_0) {
+			mon->addr_hi = val;
+		} else if (offset < mmSYNC_MNGR_MON_ARM_0) {
+			mon->data = val;
+		} else {
+			mon->sob_id = val & MON_ARM_SID_MASK;
+			mon->greater_or_equal =
+					!!(val & (1 << MON_ARM_SOP_SHIFT));
+			mon->sob_val = val >> MON_ARM_SOD_SHIFT;
+			mon->armed = true;
+			model_check_monitors(dev, mon->sob_id, now, pl);
+		}
+	} else {
+		model_write_fence(dev, offset, val, now);
+	}
+}
+
+static void model_write_mem(struct model_dev *dev, uint64_t addr,
+				const void *data, uint32_t size)
+{
+	void *ptr = model_translate(dev, addr, size, NULL);
+
+	if (!ptr) {
+		model_raise_event(dev, MODEL_EVENT_CP_ERROR);
+		return;
+	}
+
+	memcpy(ptr, data, size);
+}
+
+static void model_write_reg(struct model_dev *dev, uint64_t offset,
+				uint32_t val, uint64_t now)
+{
+	struct model_payloads pl;
+	uint32_t i;
+
+	pl.num = 0;
+
+	pthread_mutex_lock(&dev->exec_lock);
+	model_write_reg_locked(dev, offset, val, now, &pl);
+	pthread_mutex_unlock(&dev->exec_lock);
+
+	/* Translating takes the device lock, which is ordered before ours */
+	for (i = 0 ; i < pl.num ; i++)
+		model_write_mem(dev, pl.addr[i], &pl.data[i],
+				sizeof(pl.data[i]));
+}
+
+static void model_write32(struct model_dev *dev, uint64_t addr, uint32_t val,
+				uint64_t now)
+{
+	if (addr >= CFG_BASE && addr < CFG_BASE + CFG_SIZE)
+		model_write_reg(dev, addr - CFG_BASE, val, now);
+	else
+		model_write_mem(dev, addr, &val, sizeof(val));
+}
+
+static int model_lin_dma(struct model_dev *dev, uint32_t queue,
+				const struct packet_lin_dma *pkt)
+{
+	enum model_mem_kind src_kind = MODEL_MEM_NONE, dst_kind;
+	struct model_queue *q = &dev->queues[queue];
+	uint64_t pattern = pkt->src_addr, end;
+	uint8_t *dst;
+	const void *src;
+	uint32_t i;
+
+	if (!pkt->tsize)
+		return 0;
+
+	dst = model_translate(dev, pkt->dst_addr, pkt->tsize, &dst_kind);
+	if (!dst)
+		return -EFAULT;
+
+	if (pkt->memset_mode) {
+		for (i = 0 ; i + sizeof(pattern) <= pkt->tsize ;
+				i += sizeof(pattern))
+			memcpy(dst + i, &pattern, sizeof(pattern));
+		memcpy(dst + i, &pattern, pkt->tsize - i);
+	} else {
+		src = model_translate(dev, pkt->src_addr, pkt->tsize,
+					&src_kind);
+		if (!src)
+			return -EFAULT;
+
+		memmove(dst, src, pkt->tsize);
+	}
+
+	end = model_perf_dma(dev, q->now, src_kind, dst_kind, pkt->tsize);
+	q->run_ns += end - q->now;
+	q->now = end;
+
+	return 0;
+}
+
+static void model_msg_short(struct model_dev *dev, uint32_t queue,
+				const struct packet_msg_short *pkt)
+{
+	uint64_t base;
+
+	switch (pkt->base) {
+	case 0:
+		base = mmSYNC_MNGR_MON_PAY_ADDRL_0;
+		break;
+	case 1:
+		base = mmSYNC_MNGR_SOB_OBJ_0;
+		break;
+	default:
+		/* Bases 2 and 3 are not configured by the driver */
+		model_raise_event(dev, MODEL_EVENT_CP_ERROR);
+		return;
+	}
+
+	model_write_reg(dev, base + pkt->msg_addr_offset, pkt->value,
+			dev->queues[queue].now);
+}
+
+static int model_fence(struct model_dev *dev, uint32_t queue,
+			enum model_cp cp, const struct packet_fence *pkt)
+{
+	struct model_queue *q = &dev->queues[queue];
+	uint32_t *fence = &q->fence[cp][pkt->id];
+	int rc = 0;
+
+	pthread_mutex_lock(&dev->exec_lock);
+
+	while (*fence < pkt->gate_val && !dev->stopping)
+		pthread_cond_wait(&dev->exec_cond, &dev->exec_lock);
+
+	if (dev->stopping) {
+		rc = -EINTR;
+	} else {
+		*fence -= pkt->dec_val;
+		/* The queue resumes when the fence was released */
+		if (q->fence_time[cp][pkt->id] > q->now)
+			q->now = q->fence_time[cp][pkt->id];
+	}
+
+	pthread_mutex_unlock(&dev->exec_lock);
+
+	return rc;
+}
+
+static void model_wreg(struct model_dev *dev, uint32_t queue, bool local,
+			uint16_t reg_offset, const uint32_t *vals, uint32_t num)
+{
+	const struct model_queue_regs *regs = &queue_regs[queue];
+	uint64_t base;
+	uint32_t i;
+
+	base = local && regs->cmdq_base ? regs->cmdq_base : regs->engine_base;
+
+	for (i = 0 ; i < num ; i++)
+		model_write_reg(dev, base - CFG_BASE + reg_offset + i * 4,
+				vals[i], dev->queues[queue].now);
+}
+
+/* The timestamp counter ticks at the PCI PLL rate from the model clock */
+static uint64_t model_timestamp(struct model_dev *dev, uint64_t now)
+{
+	uint64_t ns;
+
+	pthread_mutex_lock(&dev->exec_lock);
+	ns = dev->ts_enabled && now > dev->ts_base ? now - dev->ts_base : 0;
+	pthread_mutex_unlock(&dev->exec_lock);
+
+	return ns / 1000000000ull * dev->ts_freq +
+		ns % 1000000000ull * dev->ts_freq / 1000000000ull;
+}
+
+/*
+ * Execute the packets of a CB. The CB of a queue runs on its QMAN CP, and CBs
+ * that are fetched with CP_DMA run on the engine's CMDQ CP
+ */
+static int model_exec_cb(struct model_dev *dev, uint32_t queue,
+				enum model_cp cp, const uint8_t *cb,
+				uint32_t size)
+{
+	const struct packet_wreg_bulk *wreg_bulk;
+	const struct packet_wreg32 *wreg32;
+	const struct packet_msg_long *msg_long;
+	const struct packet_cp_dma *cp_dma;
+	struct model_queue *q = &dev->queues[queue];
+	uint32_t offset = 0, pkt_size, val, pkt_ns;
+	uint64_t header, ts;
+	const void *pkt;
+	int rc = 0;
+
+	pkt_ns = dev->perf.params.pkt_fetch_ns + dev->perf.params.pkt_exec_ns;
+
+	while (!rc && offset + sizeof(header) <= size) {
+		pkt = cb + offset;
+		memcpy(&header, pkt, sizeof(header));
+		pkt_size = sizeof(header);
+
+		q->now += pkt_ns;
+		q->run_ns += pkt_ns;
+
+		switch ((header & PACKET_HEADER_PACKET_ID_MASK) >>
+				PACKET_HEADER_PACKET_ID_SHIFT) {
+		case PACKET_WREG_32:
+			wreg32 = pkt;
+			val = wreg32->value;
+			model_wreg(dev, queue, wreg32->local,
+					wreg32->reg_offset, &val, 1);
+			break;
+		case PACKET_WREG_BULK:
+			wreg_bulk = pkt;
+			pkt_size += wreg_bulk->size64 * sizeof(uint64_t);
+			if (offset + pkt_size > size)
+				return -EINVAL;
+			model_wreg(dev, queue, false, wreg_bulk->reg_offset,
+					(const uint32_t *) wreg_bulk->values,
+					wreg_bulk->size64 * 2);
+			break;
+		case PACKET_MSG_LONG:
+		case PACKET_MSG_PROT:
+			msg_long = pkt;
+			pkt_size = sizeof(*msg_long);
+			if (offset + pkt_size > size)
+				return -EINVAL;
+			if (msg_long->op == 1) {
+				ts = model_timestamp(dev, q->now);
+				model_write_mem(dev, msg_long->addr, &ts,
+						sizeof(ts));
+			} else
+				model_write32(dev, msg_long->addr,
+						msg_long->value, q->now);
+			break;
+		case PACKET_MSG_SHORT:
+			model_msg_short(dev, queue, pkt);
+			break;
+		case PACKET_CP_DMA:
+			/* CBs fetched by CP_DMA can't fetch others */
+			if (cp == MODEL_CP_CMDQ)
+				return -EINVAL;
+			cp_dma = pkt;
+			pkt_size = sizeof(*cp_dma);
+			if (offset + pkt_size > size)
+				return -EINVAL;
+			pkt = model_translate(dev, cp_dma->src_addr,
+						cp_dma->tsize, NULL);
+			if (!pkt)
+				return -EFAULT;
+			rc = model_exec_cb(dev, queue, MODEL_CP_CMDQ, pkt,
+						cp_dma->tsize);
+			break;
+		case PACKET_FENCE:
+			rc = model_fence(dev, queue, cp, pkt);
+			break;
+		case PACKET_LIN_DMA:
+			pkt_size = sizeof(struct packet_lin_dma);
+			if (offset + pkt_size > size)
+				return -EINVAL;
+			rc = model_lin_dma(dev, queue, pkt);
+			break;
+		case PACKET_NOP:
+			break;
+		case PACKET_STOP:
+			return 0;
+		default:
+			return -EINVAL;
+		}
+
+		offset += pkt_size;
+	}
+
+	return rc;
+}
+
+static void model_exec_job(struct model_dev *dev, struct model_job *job)
+{
+	const void *cb;
+	int rc;
+
+	if (job->cb)
+		cb = job->cb->ptr;
+	else
+		cb = model_translate(dev, job->cb_addr, job->cb_size, NULL);
+
+	rc = cb ? model_exec_cb(dev, job->queue, MODEL_CP_QMAN, cb,
+				job->cb_size) : -EFAULT;
+	if (rc && rc != -EINTR) {
+		pr_debug("model: queue %u failed to execute CB, %d\n",
+			job->queue, rc);
+		model_raise_event(dev, MODEL_EVENT_CP_ERROR);
+	}
+}
+
+static void *model_worker(void *arg)
+{
+	struct model_worker_args *args = arg;
+	struct model_dev *dev = args->dev;
+	struct model_queue *q = &dev->queues[args->queue];
+	struct model_job *job;
+	bool run;
+
+	hlthunk_free(args);
+
+	pthread_mutex_lock(&dev->exec_lock);
+
+	while (!dev->stopping) {
+		job = q->head;
+		if (!job) {
+			pthread_cond_wait(&dev->exec_cond, &dev->exec_lock);
+			continue;
+		}
+
+		q->head = job->next;
+		if (!q->head)
+			q->tail = NULL;
+		q->busy = true;
+
+		while (!job->restore && job->cs->pending_restore &&
+				!dev->stopping)
+			pthread_cond_wait(&dev->exec_cond, &dev->exec_lock);
+		run = !dev->stopping;
+
+		if (q->now < job->cs->submit_time)
+			q->now = job->cs->submit_time;
+		if (!job->restore && q->now < job->cs->restore_done_time)
+			q->now = job->cs->restore_done_time;
+		job->start_time = q->now;
+		q->run_ns = 0;
+
+		pthread_mutex_unlock(&dev->exec_lock);
+
+		if (run)
+			model_exec_job(dev, job);
+
+		/* The engine is idle by the time its CS is seen as completed */
+		pthread_mutex_lock(&dev->exec_lock);
+		q->busy = false;
+		job->end_time = q->now;
+		q->time = q->now;
+		q->busy_ns += q->run_ns;
+		if (job->restore) {
+			if (job->end_time > job->cs->restore_done_time)
+				job->cs->restore_done_time = job->end_time;
+			if (!--job->cs->pending_restore)
+				pthread_cond_broadcast(&dev->exec_cond);
+		}
+		pthread_mutex_unlock(&dev->exec_lock);
+
+		model_job_done(dev, job);
+
+		pthread_mutex_lock(&dev->exec_lock);
+	}
+
+	pthread_mutex_unlock(&dev->exec_lock);
+
+	return NULL;
+}
+
+int model_goya_init(struct model_dev *dev)
+{
+	struct model_worker_args *args;
+	uint32_t q;
+
+	pthread_mutex_init(&dev->exec_lock, NULL);
+	pthread_cond_init(&dev->exec_cond, NULL);
+
+	/* The memories are only backed by host pages when they are touched */
+	dev->sram = mmap(NULL, SRAM_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	dev->dram = mmap(NULL, MODEL_DRAM_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (dev->sram == MAP_FAILED || dev->dram == MAP_FAILED)
+		goto err;
+
+	for (q = 0 ; q < GOYA_QUEUE_ID_SIZE ; q++) {
+		if (q == GOYA_QUEUE_ID_CPU_PQ)
+			continue;
+
+		args = hlthunk_malloc(sizeof(*args));
+		if (!args)
+			goto err;
+
+		args->dev = dev;
+		args->queue = q;
+		dev->queues[q].engine_id = queue_regs[q].engine_id;
+		if (pthread_create(&dev->queues[q].thread, NULL, model_worker,
+					args)) {
+			hlthunk_free(args);
+			goto err;
+		}
+		dev->queues[q].started = true;
+	}
+
+	return 0;
+
+err:
+	model_goya_fini(dev);
+	return -ENOMEM;
+}
+
+void model_goya_fini(struct model_dev *dev)
+{
+	struct model_job *job;
+	uint32_t q;
+
+	pthread_mutex_lock(&dev->exec_lock);
+	dev->stopping = true;
+	pthread_cond_broadcast(&dev->exec_cond);
+	pthread_mutex_unlock(&dev->exec_lock);
+
+	for (q = 0 ; q < GOYA_QUEUE_ID_SIZE ; q++) {
+		if (dev->queues[q].started)
+			pthread_join(dev->queues[q].thread, NULL);
+		dev->queues[q].started = false;
+
+		while ((job = dev->queues[q].head)) {
+			dev->queues[q].head = job->next;
+			model_job_done(dev, job);
+		}
+		dev->queues[q].tail = NULL;
+	}
+
+	if (dev->dram && dev->dram != MAP_FAILED)
+		munmap(dev->dram, MODEL_DRAM_SIZE);
+	if (dev->sram && dev->sram != MAP_FAILED)
+		munmap(dev->sram, SRAM_SIZE);
+	dev->dram = NULL;
+	dev->sram = NULL;
+
+	pthread_cond_destroy(&dev->exec_cond);
+	pthread_mutex_destroy(&dev->exec_lock);
+}
+
+/* Must be called with the device lock held, to keep the CSs in order */
+void model_goya_submit(struct model_dev *dev, struct model_job *jobs)
+{
+	struct model_queue *q;
+	struct model_job *job;
+
+	pthread_mutex_lock(&dev->exec_lock);
+
+	while ((job = jobs)) {
+		jobs = job->next;
+		job->next = NULL;
+
+		q = &dev->queues[job->queue];
+		if (q->tail)
+			q->tail->next = job;
+		else
+			q->head = job;
+		q->tail = job;
+	}
+
+	pthread_cond_broadcast(&dev->exec_cond);
+	pthread_mutex_unlock(&dev->exec_lock);
+}
+
+uint32_t model_goya_busy_engines(struct model_dev *dev)
+{
+	uint32_t q, mask = 0;
+
+	pthread_mutex_lock(&dev->exec_lock);
+
+	for (q = 0 ; q < GOYA_QUEUE_ID_SIZE ; q++)
+		if (queue_regs[q].qman_base &&
+				(dev->queues[q].busy || dev->queues[q].head))
+			mask |= 1 << queue_regs[q].engine_id;
+
+	pthread_mutex_unlock(&dev->exec_lock);
+
+	return mask;
+}
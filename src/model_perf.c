@@ -0,0 +1,416 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+/*
+ * Cycle-approximate performance model of the device model. Next to executing
+ * the packets, every queue advances a model clock by the cost of each packet.
+ * DMA transfers reserve the PCIe link, the memories and a DMA channel for as
+ * long as the slowest of them needs to move the data, so concurrent transfers
+ * share the bandwidth. Signals carry the time of their sender through the SOBs
+ * and monitors to the fences, which lets a queue that waits on a fence resume
+ * at the time it was released. The host has its own clock, which advances by
+ * the submission cost of every CS and jumps to the completion of the CSs that
+ * it waits for.
+ */
+
+#include "model.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Nominal figures of a Goya card on a PCIe Gen4 x16 slot. Run dma_perf on
+ * the device and on the model and adjust them with HLTHUNK_MODEL_PERF or
+ * hlthunk_model_set_perf_params() to calibrate the model
+ */
+static struct hlthunk_model_perf_params perf_params = {
+	.pcie_h2d_bw = 22000000000ull,
+	.pcie_d2h_bw = 20000000000ull,
+	.sram_bw = 200000000000ull,
+	.dram_bw = 40000000000ull,
+	.dma_channel_bw = 25000000000ull,
+	.dma_channels = DMA_MAX_NUM,
+	.dma_setup_ns = 500,
+	.pkt_fetch_ns = 100,
+	.pkt_exec_ns = 20,
+	.cs_submit_ns = 5000,
+	.signal_ns = 200
+};
+
+static pthread_mutex_t perf_params_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool perf_params_loaded;
+
+static bool perf_params_valid(const struct hlthunk_model_perf_params *params)
+{
+	return params->pcie_h2d_bw && params->pcie_d2h_bw && params->sram_bw &&
+		params->dram_bw && params->dma_channel_bw &&
+		params->dma_channels && params->dma_channels <= DMA_MAX_NUM;
+}
+
+/*
+ * Parse HLTHUNK_MODEL_PERF, a comma separated list of name=value pairs, e.g.
+ * "pcie_h2d_bw=12e9,dma_channels=2". Must be called with perf_params_lock held
+ */
+static void perf_params_load_env(void)
+{
+	struct hlthunk_model_perf_params params = perf_params;
+	char *env, *str, *tok, *save = NULL, *val;
+	double num;
+
+	env = getenv("HLTHUNK_MODEL_PERF");
+	if (!env)
+		return;
+
+	str = strdup(env);
+	if (!str)
+		return;
+
+	for (tok = strtok_r(str, ",", &save) ; tok ;
+			tok = strtok_r(NULL, ",", &save)) {
+		val = strchr(tok, '=');
+		if (!val)
+			goto err;
+		*val++ = '\0';
+		num = strtod(val, NULL);
+		if (num < 0)
+			goto err;
+
+		if (!strcmp(tok, "pcie_h2d_bw"))
+			params.pcie_h2d_bw = num;
+		else if (!strcmp(tok, "pcie_d2h_bw"))
+			params.pcie_d2h_bw = num;
+		else if (!strcmp(tok, "sram_bw"))
+			params.sram_bw = num;
+		else if (!strcmp(tok, "dram_bw"))
+			params.dram_bw = num;
+		else if (!strcmp(tok, "dma_channel_bw"))
+			params.dma_channel_bw = num;
+		else if (!strcmp(tok, "dma_channels"))
+			params.dma_channels = num;
+		else if (!strcmp(tok, "dma_setup_ns"))
+			params.dma_setup_ns = num;
+		else if (!strcmp(tok, "pkt_fetch_ns"))
+			params.pkt_fetch_ns = num;
+		else if (!strcmp(tok, "pkt_exec_ns"))
+			params.pkt_exec_ns = num;
+		else if (!strcmp(tok, "cs_submit_ns"))
+			params.cs_submit_ns = num;
+		else if (!strcmp(tok, "signal_ns"))
+			params.signal_ns = num;
+		else
+			goto err;
+	}
+
+	if (!perf_params_valid(&params))
+		goto err;
+
+	perf_params = params;
+	free(str);
+	return;
+
+err:
+	pr_warn("Invalid HLTHUNK_MODEL_PERF, using the default parameters\n");
+	free(str);
+}
+
+void model_perf_init(struct model_dev *dev)
+{
+	pthread_mutex_lock(&perf_params_lock);
+	if (!perf_params_loaded) {
+		perf_params_load_env();
+		perf_params_loaded = true;
+	}
+	dev->perf.params = perf_params;
+	pthread_mutex_unlock(&perf_params_lock);
+
+	pthread_mutex_init(&dev->perf.lock, NULL);
+}
+
+void model_perf_fini(struct model_dev *dev)
+{
+	pthread_mutex_destroy(&dev->perf.lock);
+}
+
+/* Find the earliest time from t on at which the resource is free for d ns */
+static uint64_t perf_res_find(const struct model_perf_res *res, uint64_t t,
+				uint64_t d)
+{
+	uint32_t i;
+
+	for (i = 0 ; i < res->num ; i++) {
+		if (t + d <= res->start[i])
+			return t;
+		if (res->end[i] > t)
+			t = res->end[i];
+	}
+
+	return t;
+}
+
+/*
+ * Mark [t, t + d) as busy. When the table is full the two oldest intervals are
+ * merged, which only makes the past look busier than it was
+ */
+static void perf_res_reserve(struct model_perf_res *res, uint64_t t,
+				uint64_t d)
+{
+	uint32_t i;
+
+	if (res->num == MODEL_PERF_MAX_BUSY) {
+		if (res->end[1] > res->end[0])
+			res->end[0] = res->end[1];
+		memmove(&res->start[1], &res->start[2],
+			(res->num - 2) * sizeof(res->start[0]));
+		memmove(&res->end[1], &res->end[2],
+			(res->num - 2) * sizeof(res->end[0]));
+		res->num--;
+	}
+
+	for (i = res->num ; i && res->start[i - 1] > t ; i--) {
+		res->start[i] = res->start[i - 1];
+		res->end[i] = res->end[i - 1];
+	}
+
+	res->start[i] = t;
+	res->end[i] = t + d;
+	res->num++;
+}
+
+/* Find the earliest time from t on at which all the resources are free */
+static uint64_t perf_res_find_all(struct model_perf_res **res, uint32_t num,
+					uint64_t t, uint64_t d)
+{
+	uint64_t next;
+	bool moved;
+	uint32_t i;
+
+	do {
+		moved = false;
+		for (i = 0 ; i < num ; i++) {
+			next = perf_res_find(res[i], t, d);
+			if (next != t) {
+				t = next;
+				moved = true;
+			}
+		}
+	} while (moved);
+
+	return t;
+}
+
+static void perf_add_mem(struct model_perf *perf, enum model_mem_kind kind,
+			bool read, struct model_perf_res **res, uint32_t *num,
+			uint64_t *bw)
+{
+	enum model_perf_res_id id;
+	uint64_t mem_bw;
+
+	switch (kind) {
+	case MODEL_MEM_HOST:
+		id = read ? MODEL_PERF_PCIE_H2D : MODEL_PERF_PCIE_D2H;
+		mem_bw = read ? perf->params.pcie_h2d_bw :
+				perf->params.pcie_d2h_bw;
+		break;
+	case MODEL_MEM_SRAM:
+		id = MODEL_PERF_SRAM;
+		mem_bw = perf->params.sram_bw;
+		break;
+	case MODEL_MEM_DRAM:
+		id = MODEL_PERF_DRAM;
+		mem_bw = perf->params.dram_bw;
+		break;
+	default:
+		return;
+	}
+
+	res[(*num)++] = &perf->res[id];
+	if (mem_bw < *bw)
+		*bw = mem_bw;
+}
+
+/**
+ * This function estimates when a DMA transfer that a queue starts at a given
+ * time ends, and reserves the resources it uses for that duration
+ * @param dev the device
+ * @param now model time at which the queue starts the transfer
+ * @param src where the source resides, MODEL_MEM_NONE for memset
+ * @param dst where the destination resides
+ * @param size number of bytes to transfer
+ * @return model time at which the transfer ends
+ */
+uint64_t model_perf_dma(struct model_dev *dev, uint64_t now,
+			enum model_mem_kind src, enum model_mem_kind dst,
+			uint64_t size)
+{
+	struct model_perf *perf = &dev->perf;
+	struct model_perf_res *res[3], *best_chan = NULL;
+	uint64_t bw = perf->params.dma_channel_bw, d, t, best = UINT64_MAX;
+	uint32_t i, num = 1;
+
+	perf_add_mem(perf, src, true, res, &num, &bw);
+	perf_add_mem(perf, dst, false, res, &num, &bw);
+
+	d = perf->params.dma_setup_ns + size * 1000000000ull / bw;
+
+	pthread_mutex_lock(&perf->lock);
+
+	for (i = 0 ; i < perf->params.dma_channels ; i++) {
+		res[0] = &perf->channels[i];
+		t = perf_res_find_all(res, num, now, d);
+		if (t < best) {
+			best = t;
+			best_chan = res[0];
+		}
+	}
+
+	res[0] = best_chan;
+	for (i = 0 ; i < num ; i++)
+		perf_res_reserve(res[i], best, d);
+
+	pthread_mutex_unlock(&perf->lock);
+
+	return best + d;
+}
+
+/* Must be called with the device lock held */
+void model_perf_cs_submit(struct model_dev *dev, struct model_cs *cs)
+{
+	dev->perf.host_time += dev->perf.params.cs_submit_ns;
+	cs->submit_time = dev->perf.host_time;
+	cs->start_time = UINT64_MAX;
+}
+
+/* Must be called with the device lock held */
+void model_perf_cs_done(struct model_dev *dev, struct model_cs *cs)
+{
+	struct model_perf_cs *rec =
+			&dev->perf.history[cs->seq % MODEL_PERF_CS_HISTORY];
+
+	rec->seq = cs->seq;
+	rec->submit_time = cs->submit_time;
+	rec->start_time = cs->start_time;
+	rec->done_time = cs->done_time;
+}
+
+/* The host waited for a CS, so it continues when the CS is done */
+void model_perf_cs_waited(struct model_dev *dev, uint64_t seq)
+{
+	struct model_perf_cs *rec =
+			&dev->perf.history[seq % MODEL_PERF_CS_HISTORY];
+
+	if (rec->seq == seq && rec->done_time > dev->perf.host_time)
+		dev->perf.host_time = rec->done_time;
+}
+
+/**
+ * This function returns the parameters of the performance model
+ * @param params pointer to the parameters to fill
+ */
+hlthunk_public void hlthunk_model_get_perf_params(
+				struct hlthunk_model_perf_params *params)
+{
+	pthread_mutex_lock(&perf_params_lock);
+	if (!perf_params_loaded) {
+		perf_params_load_env();
+		perf_params_loaded = true;
+	}
+	*params = perf_params;
+	pthread_mutex_unlock(&perf_params_lock);
+}
+
+/**
+ * This function sets the parameters of the performance model. They apply to
+ * devices that are opened afterwards
+ * @param params the new parameters
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_model_set_perf_params(
+				const struct hlthunk_model_perf_params *params)
+{
+	if (!params || !perf_params_valid(params))
+		return -EINVAL;
+
+	pthread_mutex_lock(&perf_params_lock);
+	perf_params = *params;
+	perf_params_loaded = true;
+	pthread_mutex_unlock(&perf_params_lock);
+
+	return 0;
+}
+
+/**
+ * This function returns the estimated submission, start and completion times
+ * of a CS that was executed by the device model
+ * @param fd file descriptor of a device that was opened with the model backend
+ * @param seq sequence number of the CS
+ * @param times pointer to the times to fill
+ * @return 0 for success, -ENODEV if fd isn't a model device, -ENOENT if the
+ * CS didn't complete yet or is too old to be remembered
+ */
+hlthunk_public int hlthunk_model_get_cs_times(int fd, uint64_t seq,
+				struct hlthunk_model_cs_times *times)
+{
+	struct model_dev *dev = model_get_dev(fd);
+	struct model_perf_cs *rec;
+	int rc = 0;
+
+	if (!dev)
+		return -ENODEV;
+
+	pthread_mutex_lock(&dev->lock);
+
+	rec = &dev->perf.history[seq % MODEL_PERF_CS_HISTORY];
+	if (!seq || rec->seq != seq) {
+		rc = -ENOENT;
+	} else {
+		times->submit_ns = rec->submit_time;
+		times->start_ns = rec->start_time;
+		times->done_ns = rec->done_time;
+	}
+
+	pthread_mutex_unlock(&dev->lock);
+
+	return rc;
+}
+
+/**
+ * This function returns for how long the engines of a model device were busy,
+ * out of the time that the device model has estimated so far
+ * @param fd file descriptor of a device that was opened with the model backend
+ * @param util pointer to the utilization to fill
+ * @return 0 for success, -ENODEV if fd isn't a model device
+ */
+hlthunk_public int hlthunk_model_get_engine_util(int fd,
+				struct hlthunk_model_engine_util *util)
+{
+	struct model_dev *dev = model_get_dev(fd);
+	struct model_queue *q;
+	uint32_t i;
+
+	if (!dev)
+		return -ENODEV;
+
+	memset(util, 0, sizeof(*util));
+
+	pthread_mutex_lock(&dev->exec_lock);
+
+	for (i = 0 ; i < GOYA_QUEUE_ID_SIZE ; i++) {
+		q = &dev->queues[i];
+		if (!q->started)
+			continue;
+
+		util->busy_ns[q->engine_id] += q->busy_ns;
+		if (q->time > util->elapsed_ns)
+			util->elapsed_ns = q->time;
+	}
+
+	pthread_mutex_unlock(&dev->exec_lock);
+
+	return 0;
+}
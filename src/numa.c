@@ -0,0 +1,168 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#define _GNU_SOURCE
+
+#include "libhlthunk.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#define NUMA_MAX_NODES	1024
+
+/*
+ * Reads an attribute of the PCI device behind a device file descriptor. The
+ * character device of the fd leads to its class device in sysfs, whose
+ * "device" link is the PCI device.
+ */
+static int device_sysfs_read(int fd, const char *attr, char *buf, size_t len)
+{
+	char dev_path[64], path[128];
+	ssize_t n;
+	int attr_fd, rc;
+
+	rc = hlthunk_device_sysfs_path(fd, dev_path, sizeof(dev_path));
+	if (rc)
+		return rc;
+
+	snprintf(path, sizeof(path), "%s/device/%s", dev_path, attr);
+
+	attr_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (attr_fd < 0)
+		return -errno;
+
+	n = read(attr_fd, buf, len - 1);
+	if (n < 0) {
+		rc = -errno;
+		goto out;
+	}
+
+	buf[n] = '\0';
+
+out:
+	close(attr_fd);
+	return rc;
+}
+
+/**
+ * This function retrieves the NUMA node the device is attached to
+ * @param fd file descriptor of the device
+ * @param node returned node, or -1 if the device isn't local to any node or
+ * the node is unknown, e.g. for devices that aren't on a PCI bus
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_get_numa_node(int fd, int *node)
+{
+	char buf[16];
+	int rc;
+
+	if (!node)
+		return -EINVAL;
+
+	*node = -1;
+
+	rc = device_sysfs_read(fd, "numa_node", buf, sizeof(buf));
+	if (rc == -ENOENT || rc == -ENODEV)
+		return 0;
+	if (rc)
+		return rc;
+
+	*node = atoi(buf);
+	if (*node >= NUMA_MAX_NODES)
+		*node = -1;
+
+	return 0;
+}
+
+/**
+ * This function sets the memory policy of a host memory area so its pages are
+ * placed on a NUMA node, and moves the pages that were already faulted in.
+ * The node is preferred rather than enforced, so the allocation doesn't fail
+ * when the node runs out of memory
+ * @param ptr start of the area, aligned to a page
+ * @param size size of the area
+ * @param node the node to place the pages on, -1 to leave them as they are
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_numa_bind_memory(void *ptr, uint64_t size, int node)
+{
+	unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+	unsigned long bits = 8 * sizeof(unsigned long);
+
+	if (node < 0)
+		return 0;
+
+	if (!ptr || !size || node >= NUMA_MAX_NODES)
+		return -EINVAL;
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / bits] = 1ul << (node % bits);
+
+	/* The kernel expects the number of bits in the mask plus one */
+	if (syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, mask,
+			NUMA_MAX_NODES + 1, MPOL_MF_MOVE))
+		return -errno;
+
+	return 0;
+}
+
+/**
+ * This function restricts the calling thread to the CPUs that are local to
+ * the device, which keeps the submission and completion paths of the device
+ * off the remote socket
+ * @param fd file descriptor of the device
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_bind_thread_to_device(int fd)
+{
+	char buf[1024], *p, *end;
+	unsigned long first, last, cpu;
+	cpu_set_t set;
+	int rc;
+
+	rc = device_sysfs_read(fd, "local_cpulist", buf, sizeof(buf));
+	if (rc)
+		return rc;
+
+	/* The list is a comma separated list of CPUs and ranges of CPUs */
+	CPU_ZERO(&set);
+
+	for (p = buf ; *p && *p != '\n' ; p = end) {
+		first = strtoul(p, &end, 10);
+		if (end == p)
+			return -EINVAL;
+
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+			if (end == p || last < first)
+				return -EINVAL;
+		}
+
+		for (cpu = first ; cpu <= last && cpu < CPU_SETSIZE ; cpu++)
+			CPU_SET(cpu, &set);
+
+		if (*end == ',')
+			end++;
+	}
+
+	if (!CPU_COUNT(&set))
+		return -EINVAL;
+
+	if (sched_setaffinity(0, sizeof(set), &set))
+		return -errno;
+
+	return 0;
+}
@@ -0,0 +1,505 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+#include "specs/pci_ids.h"
+#include "record.h"
+#include "khash.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+struct rec_cb_map {
+	void *addr;
+	uint64_t len;
+};
+
+struct rec_host_map {
+	uint64_t device_va;
+	void *host_ptr;
+	uint64_t size;
+};
+
+/* The recorded blobs of a hash, whose contents are kept for comparison */
+struct rec_blob_entry {
+	struct rec_blob_entry *next;
+	uint32_t id;
+	uint32_t size;
+	uint8_t data[];
+};
+
+KHASH_MAP_INIT_INT64(rec_cb, struct rec_cb_map)
+KHASH_MAP_INIT_INT64(rec_blob, struct rec_blob_entry *)
+
+struct recorder {
+	pthread_mutex_t lock;
+	FILE *file;
+	khash_t(rec_cb) *cb_maps;
+	/* Sorted by device VA, as the mappings don't overlap */
+	struct rec_host_map *host_maps;
+	uint32_t num_host_maps;
+	uint32_t max_host_maps;
+	khash_t(rec_blob) *blobs;
+	uint64_t start_ns;
+	uint32_t next_blob_id;
+};
+
+bool hlthunk_recording;
+static struct recorder *rec;
+static pthread_mutex_t rec_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t hlthunk_rec_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void rec_write(uint16_t type, uint64_t ts_ns, const void *payload,
+			uint32_t size, const void *data, uint32_t data_size)
+{
+	static const uint8_t zeros[8];
+	struct hlthunk_rec_hdr hdr;
+	uint32_t pad;
+
+	pad = (8 - ((size + data_size) & 7)) & 7;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.type = type;
+	hdr.size = size + data_size + pad;
+	hdr.ts_ns = ts_ns - rec->start_ns;
+
+	fwrite(&hdr, sizeof(hdr), 1, rec->file);
+	fwrite(payload, size, 1, rec->file);
+	if (data_size)
+		fwrite(data, data_size, 1, rec->file);
+	if (pad)
+		fwrite(zeros, pad, 1, rec->file);
+}
+
+/* Index of the first host mapping whose device VA is above va */
+static uint32_t rec_host_map_upper(uint64_t va)
+{
+	uint32_t lo = 0, hi = rec->num_host_maps, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (rec->host_maps[mid].device_va <= va)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Find the host memory behind a device VA, if it was mapped by the user */
+static void *rec_resolve_host_va(uint64_t va, uint32_t size)
+{
+	struct rec_host_map *map;
+	uint32_t i = rec_host_map_upper(va);
+
+	if (!i)
+		return NULL;
+
+	map = &rec->host_maps[i - 1];
+	if (va + size <= map->device_va + map->size)
+		return (uint8_t *) map->host_ptr + (va - map->device_va);
+
+	return NULL;
+}
+
+static void rec_add_host_map(uint64_t va, void *host_ptr, uint64_t size)
+{
+	struct rec_host_map *maps;
+	uint32_t i, max;
+
+	i = rec_host_map_upper(va);
+
+	/* A mapping of the same VA replaces the stale one */
+	if (i && rec->host_maps[i - 1].device_va == va) {
+		rec->host_maps[i - 1].host_ptr = host_ptr;
+		rec->host_maps[i - 1].size = size;
+		return;
+	}
+
+	if (rec->num_host_maps == rec->max_host_maps) {
+		max = rec->max_host_maps ? rec->max_host_maps * 2 : 64;
+		maps = realloc(rec->host_maps, max * sizeof(*maps));
+		if (!maps)
+			return;
+		rec->host_maps = maps;
+		rec->max_host_maps = max;
+	}
+
+	memmove(&rec->host_maps[i + 1], &rec->host_maps[i],
+		(rec->num_host_maps - i) * sizeof(*rec->host_maps));
+	rec->host_maps[i].device_va = va;
+	rec->host_maps[i].host_ptr = host_ptr;
+	rec->host_maps[i].size = size;
+	rec->num_host_maps++;
+}
+
+static void rec_remove_host_map(uint64_t va)
+{
+	uint32_t i = rec_host_map_upper(va);
+
+	if (!i || rec->host_maps[i - 1].device_va != va)
+		return;
+
+	memmove(&rec->host_maps[i - 1], &rec->host_maps[i],
+		(rec->num_host_maps - i) * sizeof(*rec->host_maps));
+	rec->num_host_maps--;
+}
+
+static uint32_t rec_blob(uint64_t cb_handle, uint32_t cb_size, uint64_t ts_ns)
+{
+	struct hlthunk_rec_blob blob;
+	struct rec_blob_entry *entry, *head = NULL;
+	void *content = NULL;
+	uint64_t hash;
+	khint_t k;
+	int ret;
+
+	k = kh_get(rec_cb, rec->cb_maps, cb_handle);
+	if (k != kh_end(rec->cb_maps)) {
+		if (cb_size <= kh_val(rec->cb_maps, k).len)
+			content = kh_val(rec->cb_maps, k).addr;
+	} else {
+		content = rec_resolve_host_va(cb_handle, cb_size);
+	}
+
+	if (!content || !cb_size)
+		return 0;
+
+	hash = hlthunk_hash_bytes(content, cb_size);
+
+	/* The hash only finds the candidates, the contents must match too */
+	k = kh_get(rec_blob, rec->blobs, hash);
+	if (k != kh_end(rec->blobs)) {
+		head = kh_val(rec->blobs, k);
+		for (entry = head ; entry ; entry = entry->next)
+			if (entry->size == cb_size &&
+					!memcmp(entry->data, content, cb_size))
+				return entry->id;
+	}
+
+	entry = malloc(sizeof(*entry) + cb_size);
+	if (!entry)
+		return 0;
+
+	if (k == kh_end(rec->blobs)) {
+		k = kh_put(rec_blob, rec->blobs, hash, &ret);
+		if (ret < 0) {
+			free(entry);
+			return 0;
+		}
+	}
+
+	entry->next = head;
+	entry->id = ++rec->next_blob_id;
+	entry->size = cb_size;
+	memcpy(entry->data, content, cb_size);
+	kh_val(rec->blobs, k) = entry;
+
+	memset(&blob, 0, sizeof(blob));
+	blob.hash = hash;
+	blob.id = entry->id;
+	blob.size = cb_size;
+	rec_write(REC_BLOB, ts_ns, &blob, sizeof(blob), content, cb_size);
+
+	return blob.id;
+}
+
+static void rec_free(struct recorder *r)
+{
+	struct rec_blob_entry *entry, *next;
+	khint_t k;
+
+	if (r->blobs) {
+		for (k = kh_begin(r->blobs) ; k != kh_end(r->blobs) ; k++) {
+			if (!kh_exist(r->blobs, k))
+				continue;
+			entry = kh_val(r->blobs, k);
+			for ( ; entry ; entry = next) {
+				next = entry->next;
+				free(entry);
+			}
+		}
+		kh_destroy(rec_blob, r->blobs);
+	}
+	free(r->host_maps);
+	if (r->cb_maps)
+		kh_destroy(rec_cb, r->cb_maps);
+	pthread_mutex_destroy(&r->lock);
+	hlthunk_free(r);
+}
+
+/**
+ * This function starts recording all the CB, memory, CS and wait-for-CS calls
+ * of the process into a file, which can later be replayed with hlthunk_replay.
+ * Recording can also be enabled by setting the HLTHUNK_RECORD_FILE environment
+ * variable, in which case it starts when the device is opened
+ * @param fd file descriptor of the device that is being recorded
+ * @param path path of the recording file
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_record_start(int fd, const char *path)
+{
+	struct hlthunk_rec_file_hdr file_hdr;
+	struct recorder *r;
+	int rc;
+
+	pthread_mutex_lock(&rec_lock);
+
+	if (rec) {
+		rc = -EBUSY;
+		goto out;
+	}
+
+	r = hlthunk_malloc(sizeof(*r));
+	if (!r) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	pthread_mutex_init(&r->lock, NULL);
+	r->cb_maps = kh_init(rec_cb);
+	r->blobs = kh_init(rec_blob);
+	if (!r->cb_maps || !r->blobs) {
+		rc = -ENOMEM;
+		goto free_rec;
+	}
+
+	r->file = fopen(path, "wb");
+	if (!r->file) {
+		rc = -errno;
+		goto free_rec;
+	}
+
+	memset(&file_hdr, 0, sizeof(file_hdr));
+	file_hdr.magic = HLTHUNK_REC_MAGIC;
+	file_hdr.version = HLTHUNK_REC_VERSION;
+	file_hdr.hdr_size = sizeof(file_hdr);
+	file_hdr.device_id = hlthunk_get_device_id_from_fd(fd);
+	fwrite(&file_hdr, sizeof(file_hdr), 1, r->file);
+
+	r->start_ns = hlthunk_rec_now();
+
+	rec = r;
+	__atomic_store_n(&hlthunk_recording, true, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&rec_lock);
+	return 0;
+
+free_rec:
+	rec_free(r);
+out:
+	pthread_mutex_unlock(&rec_lock);
+	return rc;
+}
+
+/**
+ * This function stops the recording that was started by hlthunk_record_start
+ * and flushes the recording file
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_record_stop(void)
+{
+	struct recorder *r;
+	int rc;
+
+	pthread_mutex_lock(&rec_lock);
+
+	r = rec;
+	if (!r) {
+		pthread_mutex_unlock(&rec_lock);
+		return -EINVAL;
+	}
+
+	__atomic_store_n(&hlthunk_recording, false, __ATOMIC_RELEASE);
+
+	/* Wait for in-progress hooks to finish with the recorder */
+	pthread_mutex_lock(&r->lock);
+	rec = NULL;
+	pthread_mutex_unlock(&r->lock);
+
+	rc = fclose(r->file) ? -errno : 0;
+	rec_free(r);
+
+	pthread_mutex_unlock(&rec_lock);
+
+	return rc;
+}
+
+/*
+ * The hooks below are called by the ioctl wrappers only when hlthunk_recording
+ * is set, so they cost a single branch when recording is disabled
+ */
+
+#define REC_LOCK_OR_RETURN() \
+do { \
+	pthread_mutex_lock(&rec_lock); \
+	if (!rec) { \
+		pthread_mutex_unlock(&rec_lock); \
+		return; \
+	} \
+	pthread_mutex_lock(&rec->lock); \
+	pthread_mutex_unlock(&rec_lock); \
+} while (0)
+
+void hlthunk_rec_cb(uint16_t type, uint64_t cb_handle, uint32_t cb_size)
+{
+	struct hlthunk_rec_cb cb;
+	uint64_t now = hlthunk_rec_now();
+	khint_t k;
+
+	REC_LOCK_OR_RETURN();
+
+	memset(&cb, 0, sizeof(cb));
+	cb.cb_handle = cb_handle;
+	cb.cb_size = cb_size;
+	rec_write(type, now, &cb, sizeof(cb), NULL, 0);
+
+	if (type == REC_CB_DESTROY) {
+		k = kh_get(rec_cb, rec->cb_maps, cb_handle);
+		if (k != kh_end(rec->cb_maps))
+			kh_del(rec_cb, rec->cb_maps, k);
+	}
+
+	pthread_mutex_unlock(&rec->lock);
+}
+
+void hlthunk_rec_cb_mmap(void *addr, uint64_t len, uint64_t cb_handle)
+{
+	khint_t k;
+	int ret;
+
+	REC_LOCK_OR_RETURN();
+
+	k = kh_put(rec_cb, rec->cb_maps, cb_handle, &ret);
+	if (ret >= 0) {
+		kh_val(rec->cb_maps, k).addr = addr;
+		kh_val(rec->cb_maps, k).len = len;
+	}
+
+	pthread_mutex_unlock(&rec->lock);
+}
+
+void hlthunk_rec_cb_munmap(void *addr)
+{
+	khint_t k;
+
+	REC_LOCK_OR_RETURN();
+
+	for (k = kh_begin(rec->cb_maps) ; k != kh_end(rec->cb_maps) ; k++)
+		if (kh_exist(rec->cb_maps, k) &&
+				kh_val(rec->cb_maps, k).addr == addr) {
+			kh_del(rec_cb, rec->cb_maps, k);
+			break;
+		}
+
+	pthread_mutex_unlock(&rec->lock);
+}
+
+void hlthunk_rec_mem(uint16_t type, const struct hlthunk_rec_mem *mem)
+{
+	uint64_t now = hlthunk_rec_now();
+
+	REC_LOCK_OR_RETURN();
+
+	rec_write(type, now, mem, sizeof(*mem), NULL, 0);
+
+	if (type == REC_MAP_HOST && mem->device_virt_addr)
+		rec_add_host_map(mem->device_virt_addr,
+				(void *) (uintptr_t) mem->host_virt_addr,
+				mem->size);
+	else if (type == REC_UNMAP)
+		rec_remove_host_map(mem->device_virt_addr);
+
+	pthread_mutex_unlock(&rec->lock);
+}
+
+static void rec_fill_chunks(struct hlthunk_rec_chunk *rchunks,
+				const struct hl_cs_chunk *chunks, uint32_t num,
+				uint64_t ts_ns)
+{
+	uint32_t i;
+
+	for (i = 0 ; i < num ; i++) {
+		rchunks[i].cb_handle = chunks[i].cb_handle;
+		rchunks[i].queue_index = chunks[i].queue_index;
+		rchunks[i].cb_size = chunks[i].cb_size;
+		rchunks[i].blob_id = rec_blob(chunks[i].cb_handle,
+						chunks[i].cb_size, ts_ns);
+	}
+}
+
+void hlthunk_rec_cs(const struct hlthunk_cs_in *in,
+			const struct hlthunk_cs_out *out, int rc,
+			uint64_t start_ns)
+{
+	struct hlthunk_rec_chunk *rchunks;
+	struct hlthunk_rec_cs cs;
+	uint64_t now = hlthunk_rec_now();
+	uint32_t num_chunks;
+
+	num_chunks = in->num_chunks_restore + in->num_chunks_execute;
+
+	REC_LOCK_OR_RETURN();
+
+	rchunks = hlthunk_malloc(num_chunks * sizeof(*rchunks) + 1);
+	if (!rchunks) {
+		pthread_mutex_unlock(&rec->lock);
+		return;
+	}
+
+	/* The blobs must precede the CS record that refers to them */
+	rec_fill_chunks(rchunks, in->chunks_restore, in->num_chunks_restore,
+			start_ns);
+	rec_fill_chunks(rchunks + in->num_chunks_restore, in->chunks_execute,
+			in->num_chunks_execute, start_ns);
+
+	memset(&cs, 0, sizeof(cs));
+	cs.seq = rc ? 0 : out->seq;
+	cs.duration_ns = now - start_ns;
+	cs.flags = in->flags;
+	cs.num_chunks_restore = in->num_chunks_restore;
+	cs.num_chunks_execute = in->num_chunks_execute;
+	cs.rc = rc;
+	rec_write(REC_CS, start_ns, &cs, sizeof(cs), rchunks,
+			num_chunks * sizeof(*rchunks));
+
+	pthread_mutex_unlock(&rec->lock);
+
+	hlthunk_free(rchunks);
+}
+
+void hlthunk_rec_wait_cs(uint64_t seq, uint64_t timeout_us, uint32_t status,
+				int rc, uint64_t start_ns)
+{
+	struct hlthunk_rec_wait_cs wait;
+	uint64_t now = hlthunk_rec_now();
+
+	REC_LOCK_OR_RETURN();
+
+	memset(&wait, 0, sizeof(wait));
+	wait.seq = seq;
+	wait.timeout_us = timeout_us;
+	wait.duration_ns = now - start_ns;
+	wait.status = status;
+	wait.rc = rc;
+	rec_write(REC_WAIT_CS, start_ns, &wait, sizeof(wait), NULL, 0);
+
+	pthread_mutex_unlock(&rec->lock);
+}
@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ *
+ */
+
+#ifndef HLTHUNK_RECORD_H
+#define HLTHUNK_RECORD_H
+
+#include <stdint.h>
+
+/*
+ * Layout of a command submission recording.
+ *
+ * The file starts with a struct hlthunk_rec_file_hdr, followed by a stream of
+ * records. Every record is a struct hlthunk_rec_hdr followed by a payload of
+ * hdr.size bytes. Payload sizes are always a multiple of 8 bytes, so a reader
+ * can mmap the file and walk the records in place without copying.
+ *
+ * CB contents are stored once per unique content in REC_BLOB records, and the
+ * CS records refer to them by blob id. Blob id 0 means the content of the CB
+ * wasn't visible to the library (e.g. a CB that was DMA'd to SRAM).
+ */
+
+#define HLTHUNK_REC_MAGIC		0x0043524c54484cull	/* "HLTRC" */
+#define HLTHUNK_REC_VERSION		1
+
+enum hlthunk_rec_type {
+	REC_CB_CREATE = 1,
+	REC_CB_DESTROY,
+	REC_MEM_ALLOC,
+	REC_MEM_FREE,
+	REC_MAP_DEVICE,
+	REC_MAP_HOST,
+	REC_UNMAP,
+	REC_BLOB,
+	REC_CS,
+	REC_WAIT_CS
+};
+
+struct hlthunk_rec_file_hdr {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t hdr_size;
+	/* PCI device ID of the device the recording was taken on */
+	uint32_t device_id;
+	uint32_t pad;
+};
+
+struct hlthunk_rec_hdr {
+	uint16_t type;
+	uint16_t pad;
+	uint32_t size;
+	/* Time since the start of the recording */
+	uint64_t ts_ns;
+};
+
+/* REC_CB_CREATE, REC_CB_DESTROY */
+struct hlthunk_rec_cb {
+	uint64_t cb_handle;
+	uint32_t cb_size;
+	uint32_t pad;
+};
+
+/* REC_MEM_ALLOC, REC_MEM_FREE, REC_MAP_DEVICE, REC_MAP_HOST, REC_UNMAP */
+struct hlthunk_rec_mem {
+	uint64_t handle;
+	uint64_t size;
+	uint64_t host_virt_addr;
+	uint64_t hint_addr;
+	uint64_t device_virt_addr;
+	uint32_t flags;
+	uint32_t pad;
+};
+
+/* REC_BLOB, followed by the CB content padded to 8 bytes */
+struct hlthunk_rec_blob {
+	uint64_t hash;
+	uint32_t id;
+	uint32_t size;
+};
+
+struct hlthunk_rec_chunk {
+	uint64_t cb_handle;
+	uint32_t queue_index;
+	uint32_t cb_size;
+	uint32_t blob_id;
+	uint32_t pad;
+};
+
+/* REC_CS, followed by the restore chunks and then the execute chunks */
+struct hlthunk_rec_cs {
+	uint64_t seq;
+	uint64_t duration_ns;
+	uint32_t flags;
+	uint32_t num_chunks_restore;
+	uint32_t num_chunks_execute;
+	int32_t rc;
+};
+
+/* REC_WAIT_CS */
+struct hlthunk_rec_wait_cs {
+	uint64_t seq;
+	uint64_t timeout_us;
+	uint64_t duration_ns;
+	uint32_t status;
+	int32_t rc;
+};
+
+#endif /* HLTHUNK_RECORD_H */
@@ -0,0 +1,381 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define DEBUGFS_ROOT	"/sys/kernel/debug/habanalabs/"
+
+/*
+ * Register access through the debugfs of the driver. A register is accessed
+ * by writing its address to the "addr" file and then reading or writing the
+ * "data32" file. Drivers that have the "data64" file access two consecutive
+ * registers with a single read or write of it, which halves the number of
+ * system calls of range and list accesses.
+ */
+struct reg_access {
+	pthread_mutex_t lock;
+	int addr_fd;
+	int data32_fd;
+	/* -1 if the driver doesn't have the data64 file */
+	int data64_fd;
+};
+
+/* Formats a value as a NUL-terminated hex string and returns its length */
+static size_t format_hex(char *buf, uint64_t val)
+{
+	static const char digits[] = "0123456789abcdef";
+	char tmp[16];
+	size_t i, n = 0;
+
+	do {
+		tmp[n++] = digits[val & 0xf];
+		val >>= 4;
+	} while (val);
+
+	buf[0] = '0';
+	buf[1] = 'x';
+	for (i = 0 ; i < n ; i++)
+		buf[2 + i] = tmp[n - 1 - i];
+	buf[2 + n] = '\0';
+
+	return 2 + n;
+}
+
+static int parse_hex(const char *buf, ssize_t len, uint64_t *val)
+{
+	ssize_t i = 0;
+	uint64_t v = 0;
+	int digits = 0;
+	char c;
+
+	if (len >= 2 && buf[0] == '0' && (buf[1] == 'x' || buf[1] == 'X'))
+		i = 2;
+
+	for ( ; i < len ; i++, digits++) {
+		c = buf[i];
+		if (c >= '0' && c <= '9')
+			v = (v << 4) | (c - '0');
+		else if (c >= 'a' && c <= 'f')
+			v = (v << 4) | (c - 'a' + 10);
+		else if (c >= 'A' && c <= 'F')
+			v = (v << 4) | (c - 'A' + 10);
+		else
+			break;
+	}
+
+	if (!digits)
+		return -EIO;
+
+	*val = v;
+
+	return 0;
+}
+
+/* The driver reads the written string including its terminating NUL */
+static int write_hex(int fd, uint64_t val)
+{
+	char buf[24];
+	size_t len;
+
+	len = format_hex(buf, val) + 1;
+	if (write(fd, buf, len) != (ssize_t) len)
+		return errno ? -errno : -EIO;
+
+	return 0;
+}
+
+static int read_hex(int fd, uint64_t *val)
+{
+	char buf[32];
+	ssize_t len;
+
+	len = pread(fd, buf, sizeof(buf), 0);
+	if (len < 0)
+		return -errno;
+
+	return parse_hex(buf, len, val);
+}
+
+/* Must be called with the lock held */
+static int reg_read_locked(struct reg_access *regs, uint64_t addr, bool pair,
+				uint32_t *vals)
+{
+	uint64_t val;
+	int rc;
+
+	errno = 0;
+	rc = write_hex(regs->addr_fd, addr);
+	if (rc)
+		return rc;
+
+	rc = read_hex(pair ? regs->data64_fd : regs->data32_fd, &val);
+	if (rc)
+		return rc;
+
+	vals[0] = val;
+	if (pair)
+		vals[1] = val >> 32;
+
+	return 0;
+}
+
+static int reg_write_locked(struct reg_access *regs, uint64_t addr, bool pair,
+				const uint32_t *vals)
+{
+	uint64_t val = vals[0];
+	int rc;
+
+	if (pair)
+		val |= (uint64_t) vals[1] << 32;
+
+	errno = 0;
+	rc = write_hex(regs->addr_fd, addr);
+	if (rc)
+		return rc;
+
+	return write_hex(pair ? regs->data64_fd : regs->data32_fd, val);
+}
+
+/* Returns the file descriptor or a negative errno */
+static int open_debugfs_file(const char *dir, const char *name, int flags)
+{
+	char path[128];
+	int len, fd;
+
+	len = snprintf(path, sizeof(path), "%s%s/%s", DEBUGFS_ROOT, dir,
+			name);
+	if (len < 0 || (size_t) len >= sizeof(path))
+		return -ENAMETOOLONG;
+
+	fd = open(path, flags | O_CLOEXEC);
+
+	return fd < 0 ? -errno : fd;
+}
+
+/**
+ * This function opens the debugfs register access of a device. The debugfs
+ * directory is the one named after the device of the fd. The files stay open
+ * until hlthunk_reg_close
+ * @param fd file descriptor of the device
+ * @return opaque handle of the register access or NULL in case of error, with
+ * errno set
+ */
+hlthunk_public void *hlthunk_reg_open(int fd)
+{
+	char dev_path[64], dev_name[32], link[PATH_MAX], *name;
+	struct reg_access *regs;
+	ssize_t len;
+	int rc;
+
+	rc = hlthunk_device_sysfs_path(fd, dev_path, sizeof(dev_path));
+	if (rc) {
+		errno = -rc;
+		return NULL;
+	}
+
+	/* The class device link ends with the device name, e.g. hl0 */
+	len = readlink(dev_path, link, sizeof(link) - 1);
+	if (len < 0)
+		return NULL;
+	link[len] = '\0';
+
+	name = strrchr(link, '/');
+	name = name ? name + 1 : link;
+
+	len = snprintf(dev_name, sizeof(dev_name), "%s", name);
+	if (len < 0 || (size_t) len >= sizeof(dev_name)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	regs = hlthunk_malloc(sizeof(*regs));
+	if (!regs) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	regs->addr_fd = open_debugfs_file(dev_name, "addr", O_WRONLY);
+	if (regs->addr_fd < 0) {
+		rc = regs->addr_fd;
+		goto free_regs;
+	}
+
+	regs->data32_fd = open_debugfs_file(dev_name, "data32", O_RDWR);
+	if (regs->data32_fd < 0) {
+		rc = regs->data32_fd;
+		goto close_addr;
+	}
+
+	regs->data64_fd = open_debugfs_file(dev_name, "data64", O_RDWR);
+
+	rc = pthread_mutex_init(&regs->lock, NULL);
+	if (rc) {
+		rc = -rc;
+		goto close_data;
+	}
+
+	return regs;
+
+close_data:
+	if (regs->data64_fd >= 0)
+		close(regs->data64_fd);
+	close(regs->data32_fd);
+close_addr:
+	close(regs->addr_fd);
+free_regs:
+	hlthunk_free(regs);
+	errno = -rc;
+	return NULL;
+}
+
+/**
+ * This function closes the register access of a device
+ * @param data the handle returned by hlthunk_reg_open
+ */
+hlthunk_public void hlthunk_reg_close(void *data)
+{
+	struct reg_access *regs = (struct reg_access *) data;
+
+	if (!regs)
+		return;
+
+	if (regs->data64_fd >= 0)
+		close(regs->data64_fd);
+	close(regs->data32_fd);
+	close(regs->addr_fd);
+	pthread_mutex_destroy(&regs->lock);
+	hlthunk_free(regs);
+}
+
+/**
+ * This function reads a list of 32-bit registers. Consecutive addresses in the
+ * list are read in pairs when the driver allows it
+ * @param data the handle returned by hlthunk_reg_open
+ * @param addrs the addresses of the registers
+ * @param vals returned values of the registers
+ * @param num number of registers
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_reg_read_list(void *data, const uint64_t *addrs,
+						uint32_t *vals, uint32_t num)
+{
+	struct reg_access *regs = (struct reg_access *) data;
+	uint32_t i;
+	bool pair;
+	int rc = 0;
+
+	if (!regs || !addrs || !vals)
+		return -EINVAL;
+
+	pthread_mutex_lock(&regs->lock);
+
+	for (i = 0 ; i < num && !rc ; i += pair ? 2 : 1) {
+		pair = regs->data64_fd >= 0 && i + 1 < num &&
+				addrs[i + 1] == addrs[i] + 4;
+		rc = reg_read_locked(regs, addrs[i], pair, &vals[i]);
+	}
+
+	pthread_mutex_unlock(&regs->lock);
+
+	return rc;
+}
+
+/**
+ * This function reads a range of consecutive 32-bit registers
+ * @param data the handle returned by hlthunk_reg_open
+ * @param addr the address of the first register
+ * @param vals returned values of the registers
+ * @param num number of registers
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_reg_read_range(void *data, uint64_t addr,
+						uint32_t *vals, uint32_t num)
+{
+	struct reg_access *regs = (struct reg_access *) data;
+	uint32_t i;
+	bool pair;
+	int rc = 0;
+
+	if (!regs || !vals)
+		return -EINVAL;
+
+	pthread_mutex_lock(&regs->lock);
+
+	for (i = 0 ; i < num && !rc ; i += pair ? 2 : 1) {
+		pair = regs->data64_fd >= 0 && i + 1 < num;
+		rc = reg_read_locked(regs, addr + 4ull * i, pair, &vals[i]);
+	}
+
+	pthread_mutex_unlock(&regs->lock);
+
+	return rc;
+}
+
+/**
+ * This function writes a range of consecutive 32-bit registers
+ * @param data the handle returned by hlthunk_reg_open
+ * @param addr the address of the first register
+ * @param vals the values to write
+ * @param num number of registers
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_reg_write_range(void *data, uint64_t addr,
+						const uint32_t *vals,
+						uint32_t num)
+{
+	struct reg_access *regs = (struct reg_access *) data;
+	uint32_t i;
+	bool pair;
+	int rc = 0;
+
+	if (!regs || !vals)
+		return -EINVAL;
+
+	pthread_mutex_lock(&regs->lock);
+
+	for (i = 0 ; i < num && !rc ; i += pair ? 2 : 1) {
+		pair = regs->data64_fd >= 0 && i + 1 < num;
+		rc = reg_write_locked(regs, addr + 4ull * i, pair, &vals[i]);
+	}
+
+	pthread_mutex_unlock(&regs->lock);
+
+	return rc;
+}
+
+/**
+ * This function reads a 32-bit register
+ * @param data the handle returned by hlthunk_reg_open
+ * @param addr the address of the register
+ * @param val returned value of the register
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_reg_read(void *data, uint64_t addr, uint32_t *val)
+{
+	return hlthunk_reg_read_range(data, addr, val, 1);
+}
+
+/**
+ * This function writes a 32-bit register
+ * @param data the handle returned by hlthunk_reg_open
+ * @param addr the address of the register
+ * @param val the value to write
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_reg_write(void *data, uint64_t addr, uint32_t val)
+{
+	return hlthunk_reg_write_range(data, addr, &val, 1);
+}
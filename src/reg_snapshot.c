@@ -0,0 +1,550 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+#include "specs/goya/goya.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define REG_SNAPSHOT_MAGIC	0x53524c48	/* "HLRS" */
+#define REG_SNAPSHOT_VERSION	1
+
+/*
+ * A snapshot is a single buffer that is also its file format: the header,
+ * followed by the offsets of the registers in the configuration space, sorted
+ * and unique, followed by their values.
+ */
+struct reg_snapshot {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t device;
+	uint32_t num_regs;
+	uint32_t pad;
+	uint64_t timestamp_ns;
+	uint32_t data[];
+};
+
+#define SNAP_ADDRS(snap)	((snap)->data)
+#define SNAP_VALS(snap)		((snap)->data + (snap)->num_regs)
+
+struct reg_val {
+	uint32_t addr;
+	uint32_t val;
+};
+
+/* The blocks that are read when the caller doesn't specify any */
+static const char * const goya_default_blocks[] = {
+	"DMA_QM_0", "DMA_QM_1", "DMA_QM_2", "DMA_QM_3", "DMA_QM_4",
+	"DMA_CH_0", "DMA_CH_1", "DMA_CH_2", "DMA_CH_3", "DMA_CH_4",
+	"MME_QM", "MME_CMDQ",
+	"TPC0_QM", "TPC1_QM", "TPC2_QM", "TPC3_QM",
+	"TPC4_QM", "TPC5_QM", "TPC6_QM", "TPC7_QM",
+	"TPC0_CMDQ", "TPC1_CMDQ", "TPC2_CMDQ", "TPC3_CMDQ",
+	"TPC4_CMDQ", "TPC5_CMDQ", "TPC6_CMDQ", "TPC7_CMDQ"
+};
+
+struct snap_block {
+	pthread_t thread;
+	const volatile uint8_t *cfg;
+	struct reg_val *regs;
+	uint32_t num_regs;
+};
+
+static size_t snap_size(uint32_t num_regs)
+{
+	return sizeof(struct reg_snapshot) + 2ull * num_regs * sizeof(uint32_t);
+}
+
+/*
+ * Maps the configuration space of the device through the BAR of the PCI
+ * device in sysfs. The configuration space follows the SRAM in the BAR.
+ */
+static void *map_cfg(int fd)
+{
+	char dev_path[64], path[128];
+	void *cfg;
+	int bar_fd, rc;
+
+	rc = hlthunk_device_sysfs_path(fd, dev_path, sizeof(dev_path));
+	if (rc)
+		return NULL;
+
+	snprintf(path, sizeof(path), "%s/device/resource%d", dev_path,
+			SRAM_CFG_BAR_ID);
+
+	bar_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (bar_fd < 0)
+		return NULL;
+
+	cfg = mmap(NULL, CFG_SIZE, PROT_READ, MAP_SHARED, bar_fd,
+			CFG_BASE - SRAM_BASE_ADDR);
+	close(bar_fd);
+
+	return cfg == MAP_FAILED ? NULL : cfg;
+}
+
+static void *read_block(void *arg)
+{
+	struct snap_block *block = (struct snap_block *) arg;
+	uint32_t i;
+
+	for (i = 0 ; i < block->num_regs ; i++)
+		block->regs[i].val = *(const volatile uint32_t *)
+					(block->cfg + block->regs[i].addr);
+
+	return NULL;
+}
+
+/* Reads every block in its own thread, as the reads don't share any state */
+static int read_mmio(const volatile uint8_t *cfg, struct snap_block *blocks,
+			uint32_t num_blocks)
+{
+	uint32_t i, started;
+	int rc = 0;
+
+	for (started = 0 ; started < num_blocks ; started++) {
+		blocks[started].cfg = cfg;
+		if (pthread_create(&blocks[started].thread, NULL, read_block,
+					&blocks[started])) {
+			rc = -EAGAIN;
+			break;
+		}
+	}
+
+	for (i = 0 ; i < started ; i++)
+		pthread_join(blocks[i].thread, NULL);
+
+	return rc;
+}
+
+/*
+ * The debugfs of the driver has a single address per device, so the blocks
+ * can't be read in parallel through it. Reading all of them in address order
+ * lets the consecutive registers be read in pairs.
+ */
+static int read_debugfs(int fd, struct reg_val *regs, uint32_t num_regs)
+{
+	uint64_t *addrs;
+	uint32_t *vals;
+	void *access;
+	uint32_t i;
+	int rc;
+
+	access = hlthunk_reg_open(fd);
+	if (!access)
+		return -errno;
+
+	addrs = hlthunk_malloc(num_regs * sizeof(uint64_t));
+	vals = hlthunk_malloc(num_regs * sizeof(uint32_t));
+	if (!addrs || !vals) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0 ; i < num_regs ; i++)
+		addrs[i] = CFG_BASE + regs[i].addr;
+
+	rc = hlthunk_reg_read_list(access, addrs, vals, num_regs);
+	if (rc)
+		goto out;
+
+	for (i = 0 ; i < num_regs ; i++)
+		regs[i].val = vals[i];
+
+out:
+	hlthunk_free(vals);
+	hlthunk_free(addrs);
+	hlthunk_reg_close(access);
+	return rc;
+}
+
+static int cmp_reg_val(const void *a, const void *b)
+{
+	const struct reg_val *ra = (const struct reg_val *) a;
+	const struct reg_val *rb = (const struct reg_val *) b;
+
+	return (ra->addr > rb->addr) - (ra->addr < rb->addr);
+}
+
+/* Collects the registers of the blocks, each block in a slice of regs */
+static int collect_regs(const struct hlthunk_reg_snapshot_block *blocks,
+			uint32_t num_blocks, struct snap_block *snap_blocks,
+			struct reg_val **regs, uint32_t *num_regs)
+{
+	uint32_t *addrs = NULL, i, j, num = 0, max = 0;
+	uint64_t addr;
+	int rc;
+
+	for (i = 0 ; i < num_blocks ; i++) {
+		if (blocks[i].addrs) {
+			snap_blocks[i].num_regs = blocks[i].num_regs;
+		} else {
+			rc = hlthunk_regdb_get_block_regs(HLTHUNK_DEVICE_GOYA,
+						blocks[i].name, NULL, 0);
+			if (rc < 0)
+				return rc;
+			snap_blocks[i].num_regs = rc;
+		}
+
+		num += snap_blocks[i].num_regs;
+		if (snap_blocks[i].num_regs > max)
+			max = snap_blocks[i].num_regs;
+	}
+
+	if (!num)
+		return -EINVAL;
+
+	*regs = hlthunk_malloc(num * sizeof(struct reg_val));
+	addrs = hlthunk_malloc(max * sizeof(uint32_t));
+	if (!*regs || !addrs) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0, num = 0 ; i < num_blocks ; i++) {
+		snap_blocks[i].regs = &(*regs)[num];
+
+		if (!blocks[i].addrs)
+			hlthunk_regdb_get_block_regs(HLTHUNK_DEVICE_GOYA,
+							blocks[i].name, addrs,
+							max);
+
+		for (j = 0 ; j < snap_blocks[i].num_regs ; j++) {
+			addr = blocks[i].addrs ? blocks[i].addrs[j] : addrs[j];
+			if (addr >= CFG_BASE)
+				addr -= CFG_BASE;
+
+			if (addr >= CFG_SIZE || addr & 3) {
+				rc = -EINVAL;
+				goto out;
+			}
+
+			snap_blocks[i].regs[j].addr = addr;
+		}
+
+		num += snap_blocks[i].num_regs;
+	}
+
+	*num_regs = num;
+	rc = 0;
+
+out:
+	hlthunk_free(addrs);
+	if (rc) {
+		hlthunk_free(*regs);
+		*regs = NULL;
+	}
+	return rc;
+}
+
+static struct reg_snapshot *build_snapshot(struct reg_val *regs,
+						uint32_t num_regs)
+{
+	struct reg_snapshot *snap;
+	uint32_t i, num = 0;
+
+	qsort(regs, num_regs, sizeof(struct reg_val), cmp_reg_val);
+
+	/* Registers that are listed in more than one block are kept once */
+	for (i = 0 ; i < num_regs ; i++)
+		if (!num || regs[num - 1].addr != regs[i].addr)
+			regs[num++] = regs[i];
+
+	snap = hlthunk_malloc(snap_size(num));
+	if (!snap)
+		return NULL;
+
+	snap->magic = REG_SNAPSHOT_MAGIC;
+	snap->version = REG_SNAPSHOT_VERSION;
+	snap->device = HLTHUNK_DEVICE_GOYA;
+	snap->num_regs = num;
+
+	for (i = 0 ; i < num ; i++) {
+		SNAP_ADDRS(snap)[i] = regs[i].addr;
+		SNAP_VALS(snap)[i] = regs[i].val;
+	}
+
+	return snap;
+}
+
+/**
+ * This function takes a snapshot of the registers of the device engines.
+ * When the configuration space of the device can be mapped, every block is
+ * read by its own thread directly from the BAR, otherwise the registers are
+ * read through debugfs. Both ways require root privileges
+ * @param fd file descriptor of the device
+ * @param blocks the blocks to read, or NULL to read all the registers of the
+ * QMANs, CMDQs and DMA channels
+ * @param num_blocks number of blocks
+ * @return opaque handle of the snapshot or NULL in case of error, with errno
+ * set
+ */
+hlthunk_public void *hlthunk_reg_snapshot_take(int fd,
+			const struct hlthunk_reg_snapshot_block *blocks,
+			uint32_t num_blocks)
+{
+	struct hlthunk_reg_snapshot_block *default_blocks = NULL;
+	struct snap_block *snap_blocks = NULL;
+	struct reg_snapshot *snap = NULL;
+	struct reg_val *regs = NULL;
+	struct timespec ts;
+	uint32_t num_regs, i;
+	void *cfg;
+	int rc;
+
+	if (hlthunk_get_device_name_from_fd(fd) != HLTHUNK_DEVICE_GOYA) {
+		errno = ENODEV;
+		return NULL;
+	}
+
+	if (!blocks) {
+		num_blocks = sizeof(goya_default_blocks) /
+				sizeof(goya_default_blocks[0]);
+		default_blocks = hlthunk_malloc(num_blocks *
+						sizeof(*default_blocks));
+		if (!default_blocks) {
+			errno = ENOMEM;
+			return NULL;
+		}
+
+		for (i = 0 ; i < num_blocks ; i++)
+			default_blocks[i].name = goya_default_blocks[i];
+		blocks = default_blocks;
+	}
+
+	snap_blocks = hlthunk_malloc(num_blocks * sizeof(*snap_blocks));
+	if (!num_blocks || !snap_blocks) {
+		rc = num_blocks ? -ENOMEM : -EINVAL;
+		goto out;
+	}
+
+	rc = collect_regs(blocks, num_blocks, snap_blocks, &regs, &num_regs);
+	if (rc)
+		goto out;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	cfg = map_cfg(fd);
+	if (cfg) {
+		rc = read_mmio(cfg, snap_blocks, num_blocks);
+		munmap(cfg, CFG_SIZE);
+	} else {
+		rc = read_debugfs(fd, regs, num_regs);
+	}
+	if (rc)
+		goto out;
+
+	snap = build_snapshot(regs, num_regs);
+	if (!snap) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	snap->timestamp_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+out:
+	hlthunk_free(regs);
+	hlthunk_free(snap_blocks);
+	hlthunk_free(default_blocks);
+	if (rc)
+		errno = -rc;
+	return snap;
+}
+
+/**
+ * This function frees a snapshot
+ * @param snap the handle returned by hlthunk_reg_snapshot_take or
+ * hlthunk_reg_snapshot_load
+ */
+hlthunk_public void hlthunk_reg_snapshot_free(void *snap)
+{
+	hlthunk_free(snap);
+}
+
+/**
+ * This function saves a snapshot to a file
+ * @param snap the handle of the snapshot
+ * @param path the path of the file
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_reg_snapshot_save(void *snap, const char *path)
+{
+	struct reg_snapshot *s = (struct reg_snapshot *) snap;
+	size_t size;
+	int fd, rc = 0;
+
+	if (!s || !path)
+		return -EINVAL;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	size = snap_size(s->num_regs);
+	if (write(fd, s, size) != (ssize_t) size)
+		rc = errno ? -errno : -EIO;
+
+	close(fd);
+	return rc;
+}
+
+/**
+ * This function loads a snapshot that was saved to a file
+ * @param path the path of the file
+ * @return opaque handle of the snapshot or NULL in case of error, with errno
+ * set
+ */
+hlthunk_public void *hlthunk_reg_snapshot_load(const char *path)
+{
+	struct reg_snapshot hdr, *snap;
+	struct stat st;
+	size_t size;
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	len = pread(fd, &hdr, sizeof(hdr), 0);
+	if (len != sizeof(hdr) || hdr.magic != REG_SNAPSHOT_MAGIC ||
+			hdr.version != REG_SNAPSHOT_VERSION) {
+		errno = len < 0 ? errno : EINVAL;
+		goto close_fd;
+	}
+
+	/* The header must describe the whole file, and nothing more */
+	if (hdr.num_regs > (SIZE_MAX - sizeof(hdr)) / (2 * sizeof(uint32_t))) {
+		errno = EINVAL;
+		goto close_fd;
+	}
+
+	size = snap_size(hdr.num_regs);
+	if (fstat(fd, &st))
+		goto close_fd;
+
+	if (st.st_size < 0 || (uint64_t) st.st_size != size) {
+		errno = EINVAL;
+		goto close_fd;
+	}
+
+	snap = calloc(1, size);
+	if (!snap) {
+		errno = ENOMEM;
+		goto close_fd;
+	}
+
+	len = pread(fd, snap, size, 0);
+	if (len != (ssize_t) size) {
+		errno = len < 0 ? errno : EINVAL;
+		hlthunk_free(snap);
+		goto close_fd;
+	}
+
+	close(fd);
+	return snap;
+
+close_fd:
+	len = errno;
+	close(fd);
+	errno = len;
+	return NULL;
+}
+
+/**
+ * This function retrieves the value of a register in a snapshot
+ * @param snap the handle of the snapshot
+ * @param addr the address of the register, either its offset in the
+ * configuration space or its full address
+ * @param val returned value of the register
+ * @return 0 for success, -ENOENT if the register isn't in the snapshot
+ */
+hlthunk_public int hlthunk_reg_snapshot_get(void *snap, uint64_t addr,
+						uint32_t *val)
+{
+	struct reg_snapshot *s = (struct reg_snapshot *) snap;
+	uint32_t lo = 0, hi, mid;
+
+	if (!s || !val)
+		return -EINVAL;
+
+	if (addr >= CFG_BASE)
+		addr -= CFG_BASE;
+
+	for (hi = s->num_regs ; lo < hi ; ) {
+		mid = lo + (hi - lo) / 2;
+		if (SNAP_ADDRS(s)[mid] < addr) {
+			lo = mid + 1;
+		} else if (SNAP_ADDRS(s)[mid] > addr) {
+			hi = mid;
+		} else {
+			*val = SNAP_VALS(s)[mid];
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * This function compares two snapshots. Only the registers that are in both
+ * snapshots are compared
+ * @param old_snap the handle of the earlier snapshot
+ * @param new_snap the handle of the later snapshot
+ * @param diffs returned registers whose values differ, sorted by address
+ * @param max_diffs number of entries in the diffs array. Only the first
+ * max_diffs differences are returned
+ * @return the number of registers whose values differ, negative value for
+ * failure
+ */
+hlthunk_public int hlthunk_reg_snapshot_diff(void *old_snap, void *new_snap,
+					struct hlthunk_reg_diff *diffs,
+					uint32_t max_diffs)
+{
+	struct reg_snapshot *a = (struct reg_snapshot *) old_snap;
+	struct reg_snapshot *b = (struct reg_snapshot *) new_snap;
+	uint32_t i = 0, j = 0, num = 0;
+
+	if (!a || !b || (max_diffs && !diffs) || a->device != b->device)
+		return -EINVAL;
+
+	/* Both snapshots are sorted by address */
+	while (i < a->num_regs && j < b->num_regs) {
+		if (SNAP_ADDRS(a)[i] < SNAP_ADDRS(b)[j]) {
+			i++;
+			continue;
+		}
+
+		if (SNAP_ADDRS(a)[i] > SNAP_ADDRS(b)[j]) {
+			j++;
+			continue;
+		}
+
+		if (SNAP_VALS(a)[i] != SNAP_VALS(b)[j]) {
+			if (num < max_diffs) {
+				diffs[num].addr = SNAP_ADDRS(a)[i];
+				diffs[num].old_val = SNAP_VALS(a)[i];
+				diffs[num].new_val = SNAP_VALS(b)[j];
+			}
+			num++;
+		}
+
+		i++;
+		j++;
+	}
+
+	return num;
+}
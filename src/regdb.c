@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+#include "regdb.h"
+#include "specs/goya/goya.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+static const struct regdb *get_regdb(enum hlthunk_device_name device)
+{
+	switch (device) {
+	case HLTHUNK_DEVICE_GOYA:
+		return &hlthunk_regdb_goya;
+	default:
+		return NULL;
+	}
+}
+
+/* Registers are listed by their offset in the configuration space */
+static const struct regdb_reg *find_reg(const struct regdb *db, uint64_t addr)
+{
+	uint32_t lo = 0, hi = db->num_regs, mid;
+
+	if (addr >= CFG_BASE)
+		addr -= CFG_BASE;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (db->regs[mid].addr < addr)
+			lo = mid + 1;
+		else if (db->regs[mid].addr > addr)
+			hi = mid;
+		else
+			return &db->regs[mid];
+	}
+
+	return NULL;
+}
+
+static int format_name(const struct regdb *db, const struct regdb_reg *reg,
+			char *name, size_t len)
+{
+	const char *reg_name = db->names + db->tmpls[reg->tmpl].name;
+	int n;
+
+	if (reg->block == REGDB_NO_BLOCK)
+		n = snprintf(name, len, "mm%s", reg_name);
+	else
+		n = snprintf(name, len, "mm%s_%s",
+				db->names + db->blocks[reg->block], reg_name);
+
+	return (n < 0 || (size_t) n >= len) ? -ENOSPC : 0;
+}
+
+/* Compares a name against the name of a register without composing it */
+static bool name_matches(const struct regdb *db, const struct regdb_reg *reg,
+				const char *name)
+{
+	const char *block;
+	size_t len;
+
+	if (reg->block != REGDB_NO_BLOCK) {
+		block = db->names + db->blocks[reg->block];
+		len = strlen(block);
+		if (strncmp(name, block, len) || name[len] != '_')
+			return false;
+		name += len + 1;
+	}
+
+	return !strcmp(name, db->names + db->tmpls[reg->tmpl].name);
+}
+
+/**
+ * This function lists the registers of a block
+ * @param device the device the block belongs to
+ * @param block the name of the block, e.g. TPC0_QM
+ * @param addrs returned offsets of the registers in the configuration space,
+ * sorted. May be NULL to only count the registers
+ * @param max_addrs number of entries in the addrs array
+ * @return the number of registers of the block, -ENOENT if the block isn't
+ * known, negative value for other failures
+ */
+int hlthunk_regdb_get_block_regs(enum hlthunk_device_name device,
+					const char *block, uint32_t *addrs,
+					uint32_t max_addrs)
+{
+	const struct regdb *db = get_regdb(device);
+	const struct regdb_reg *reg;
+	uint32_t i, num = 0;
+
+	if (!db || !block || (max_addrs && !addrs))
+		return -EINVAL;
+
+	for (i = 0 ; i < db->num_regs ; i++) {
+		reg = &db->regs[i];
+		if (reg->block == REGDB_NO_BLOCK)
+			continue;
+		if (strcmp(db->names + db->blocks[reg->block], block))
+			continue;
+
+		if (num < max_addrs)
+			addrs[num] = reg->addr;
+		num++;
+	}
+
+	return num ? (int) num : -ENOENT;
+}
+
+/**
+ * This function retrieves the name of a register
+ * @param device the device the register belongs to
+ * @param addr the address of the register, either its offset in the
+ * configuration space or its full address
+ * @param name returned name of the register, e.g. mmTPC0_QM_GLBL_CFG0
+ * @param len size of the name buffer
+ * @return 0 for success, -ENOENT if the address isn't a known register,
+ * negative value for other failures
+ */
+hlthunk_public int hlthunk_regdb_get_name(enum hlthunk_device_name device,
+						uint64_t addr, char *name,
+						size_t len)
+{
+	const struct regdb *db = get_regdb(device);
+	const struct regdb_reg *reg;
+
+	if (!db || !name || !len)
+		return -EINVAL;
+
+	reg = find_reg(db, addr);
+	if (!reg)
+		return -ENOENT;
+
+	return format_name(db, reg, name, len);
+}
+
+/**
+ * This function retrieves the address of a register by its name
+ * @param device the device the register belongs to
+ * @param name the name of the register, with or without the "mm" prefix
+ * @param addr returned offset of the register in the configuration space
+ * @return 0 for success, -ENOENT if the name isn't a known register,
+ * negative value for other failures
+ */
+hlthunk_public int hlthunk_regdb_get_addr(enum hlthunk_device_name device,
+						const char *name,
+						uint64_t *addr)
+{
+	const struct regdb *db = get_regdb(device);
+	uint64_t hash;
+	uint16_t idx;
+
+	if (!db || !name || !addr)
+		return -EINVAL;
+
+	if (!strncmp(name, "mm", 2))
+		name += 2;
+
+	hash = regdb_hash(name);
+	idx = db->slots[regdb_slot(hash,
+				db->disp[regdb_bucket(hash, db->num_buckets)],
+				db->num_slots)];
+
+	/* The hash is perfect only for the known names */
+	if (idx == REGDB_NO_REG || !name_matches(db, &db->regs[idx], name))
+		return -ENOENT;
+
+	*addr = db->regs[idx].addr;
+
+	return 0;
+}
+
+/**
+ * This function splits the value of a register into its fields
+ * @param device the device the register belongs to
+ * @param addr the address of the register, either its offset in the
+ * configuration space or its full address
+ * @param val the value of the register
+ * @param fields returned fields, ordered as in the register specification.
+ * The names point to static storage
+ * @param max_fields number of entries in the fields array. Only the first
+ * max_fields fields are returned
+ * @return the number of fields of the register, which may be 0, -ENOENT if
+ * the address isn't a known register, negative value for other failures
+ */
+hlthunk_public int hlthunk_regdb_decode(enum hlthunk_device_name device,
+					uint64_t addr, uint32_t val,
+					struct hlthunk_reg_field *fields,
+					uint32_t max_fields)
+{
+	const struct regdb *db = get_regdb(device);
+	const struct regdb_field *field;
+	const struct regdb_tmpl *tmpl;
+	const struct regdb_reg *reg;
+	uint32_t i;
+
+	if (!db || (max_fields && !fields))
+		return -EINVAL;
+
+	reg = find_reg(db, addr);
+	if (!reg)
+		return -ENOENT;
+
+	tmpl = &db->tmpls[reg->tmpl];
+
+	for (i = 0 ; i < tmpl->num_fields && i < max_fields ; i++) {
+		field = &db->fields[tmpl->first_field + i];
+
+		fields[i].name = db->names + field->name;
+		fields[i].shift = field->shift;
+		fields[i].width = field->width;
+		fields[i].value = field->width < 32 ?
+			(val >> field->shift) & ((1u << field->width) - 1) :
+			val;
+	}
+
+	return tmpl->num_fields;
+}
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: MIT
+ *
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ *
+ */
+
+#ifndef REGDB_H
+#define REGDB_H
+
+#include <stdint.h>
+
+/*
+ * Register database of an ASIC, generated at build time from its asic_reg
+ * headers by gen/regdb_gen.c. All the names are offsets in a single pool of
+ * NUL-terminated strings.
+ *
+ * The name of a register is the name of its block, '_' and the name of the
+ * register inside the block. Blocks of the same prototype share the names and
+ * the fields of their registers through templates.
+ *
+ * The registers are sorted by address. Names are looked up through a perfect
+ * hash: the hash of a name selects a bucket, the displacement of the bucket
+ * selects a slot, and the slot holds the index of the register.
+ */
+
+#define REGDB_NO_BLOCK	0xffff
+#define REGDB_NO_REG	0xffff
+
+struct regdb_reg {
+	uint32_t addr;
+	uint16_t block;
+	uint16_t tmpl;
+};
+
+struct regdb_tmpl {
+	uint32_t name;
+	uint16_t first_field;
+	uint16_t num_fields;
+};
+
+struct regdb_field {
+	uint32_t name;
+	uint8_t shift;
+	uint8_t width;
+};
+
+struct regdb {
+	const char *names;
+	const uint32_t *blocks;
+	const struct regdb_reg *regs;
+	const struct regdb_tmpl *tmpls;
+	const struct regdb_field *fields;
+	const uint16_t *disp;
+	const uint16_t *slots;
+	uint32_t num_regs;
+	uint32_t num_buckets;
+	uint32_t num_slots;
+};
+
+static inline uint64_t regdb_hash_update(uint64_t hash, const char *str)
+{
+	while (*str) {
+		hash ^= (uint8_t) *str++;
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static inline uint64_t regdb_hash(const char *str)
+{
+	return regdb_hash_update(0xcbf29ce484222325ull, str);
+}
+
+static inline uint32_t regdb_bucket(uint64_t hash, uint32_t num_buckets)
+{
+	return (hash >> 32) % num_buckets;
+}
+
+static inline uint32_t regdb_slot(uint64_t hash, uint16_t disp,
+					uint32_t num_slots)
+{
+	hash ^= (disp + 1) * 0x9e3779b97f4a7c15ull;
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+
+	return hash % num_slots;
+}
+
+extern const struct regdb hlthunk_regdb_goya;
+
+#endif /* REGDB_H */
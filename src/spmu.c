@@ -0,0 +1,556 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+#include "specs/goya/goya_coresight.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * Sampling of the SPMU performance counters. The driver reads the counters of
+ * an SPMU when it disables it and resets them when it enables it, so every
+ * sample disables the SPMU of an engine and enables it again, and the counts
+ * it returns are the deltas of the interval.
+ *
+ * An SPMU has HLTHUNK_SPMU_MAX_COUNTERS counters. When an engine has more
+ * events, they are split into groups that are enabled in turns, and the
+ * totals of an event are scaled by the part of the time its group was
+ * enabled.
+ *
+ * The sampling thread is the only producer of the ring of samples and
+ * hlthunk_spmu_sampler_read is its only consumer, so the ring needs no lock.
+ */
+
+#define SPMU_DEFAULT_INTERVAL_US	1000
+#define SPMU_DEFAULT_RING_SIZE		4096
+/* The driver requires at least this number of event types */
+#define SPMU_MIN_EVENT_TYPES		3
+#define NS_PER_SEC			1000000000ull
+
+struct spmu_engine {
+	const struct hlthunk_spmu_engine *params;
+	/* Counts and enabled time of every event */
+	uint64_t counts[HLTHUNK_SPMU_MAX_EVENTS];
+	uint64_t active_ns[HLTHUNK_SPMU_MAX_EVENTS];
+	uint64_t enabled_ns;
+	uint32_t num_groups;
+	uint32_t group;
+	bool enabled;
+};
+
+struct spmu_sampler {
+	pthread_t thread;
+	/* Protects the totals of the engines and the stop flag */
+	pthread_mutex_t lock;
+	struct hlthunk_spmu_engine *params;
+	struct spmu_engine *engines;
+	uint32_t num_engines;
+	struct hlthunk_spmu_sample *ring;
+	uint32_t ring_size;
+	/* Written by the producer, read by the consumer, and vice versa */
+	uint64_t head;
+	uint64_t tail;
+	uint64_t dropped;
+	FILE *dump;
+	uint64_t start_ns;
+	uint64_t stop_ns;
+	uint64_t interval_ns;
+	int fd;
+	int err;
+	bool stop;
+	bool stopped;
+};
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static int set_debug_mode(int fd, bool enable)
+{
+	struct hl_debug_args debug;
+
+	memset(&debug, 0, sizeof(debug));
+	debug.op = HL_DEBUG_OP_SET_MODE;
+	debug.enable = enable;
+
+	return hlthunk_debug(fd, &debug) ? -errno : 0;
+}
+
+static void group_range(struct spmu_engine *eng, uint32_t group,
+			uint32_t *first, uint32_t *num)
+{
+	*first = group * HLTHUNK_SPMU_MAX_COUNTERS;
+	*num = eng->params->num_events - *first;
+	if (*num > HLTHUNK_SPMU_MAX_COUNTERS)
+		*num = HLTHUNK_SPMU_MAX_COUNTERS;
+}
+
+/* Small groups are padded with copies of their last event */
+static uint32_t group_num_types(uint32_t num)
+{
+	return num < SPMU_MIN_EVENT_TYPES ? SPMU_MIN_EVENT_TYPES : num;
+}
+
+static int enable_group(struct spmu_sampler *s, struct spmu_engine *eng)
+{
+	struct hl_debug_params_spmu spmu;
+	struct hl_debug_args debug;
+	uint32_t first, num, i;
+
+	group_range(eng, eng->group, &first, &num);
+
+	memset(&spmu, 0, sizeof(spmu));
+	spmu.event_types_num = group_num_types(num);
+	for (i = 0 ; i < spmu.event_types_num ; i++)
+		spmu.event_types[i] =
+			eng->params->events[first + (i < num ? i : num - 1)];
+
+	memset(&debug, 0, sizeof(debug));
+	debug.op = HL_DEBUG_OP_SPMU;
+	debug.reg_idx = eng->params->spmu;
+	debug.enable = 1;
+	debug.input_ptr = (uint64_t) (uintptr_t) &spmu;
+	debug.input_size = sizeof(spmu);
+
+	if (hlthunk_debug(s->fd, &debug))
+		return -errno;
+
+	eng->enabled_ns = monotonic_ns();
+	eng->enabled = true;
+
+	return 0;
+}
+
+/*
+ * Disables the SPMU of an engine, which returns the counters followed by the
+ * overflow status and the cycle counter
+ */
+static int read_group(struct spmu_sampler *s, struct spmu_engine *eng,
+			struct hlthunk_spmu_sample *sample)
+{
+	uint64_t output[HLTHUNK_SPMU_MAX_COUNTERS + 2];
+	struct hl_debug_args debug;
+	uint32_t first, num, num_types, i;
+	uint64_t now;
+
+	group_range(eng, eng->group, &first, &num);
+	num_types = group_num_types(num);
+
+	memset(output, 0, sizeof(output));
+	memset(&debug, 0, sizeof(debug));
+	debug.op = HL_DEBUG_OP_SPMU;
+	debug.reg_idx = eng->params->spmu;
+	debug.output_ptr = (uint64_t) (uintptr_t) output;
+	debug.output_size = (num_types + 2) * sizeof(uint64_t);
+
+	if (hlthunk_debug(s->fd, &debug))
+		return -errno;
+
+	now = monotonic_ns();
+	eng->enabled = false;
+
+	memset(sample, 0, sizeof(*sample));
+	sample->timestamp_ns = now;
+	sample->interval_ns = now - eng->enabled_ns;
+	sample->cycles = output[num_types + 1];
+	sample->engine = eng - s->engines;
+	sample->num_events = num;
+	sample->overflow = output[num_types] & ((1u << num) - 1);
+
+	for (i = 0 ; i < num ; i++) {
+		sample->events[i] = eng->params->events[first + i];
+		sample->deltas[i] = output[i];
+		if (sample->interval_ns)
+			sample->rates[i] = (double) output[i] * NS_PER_SEC /
+						sample->interval_ns;
+	}
+
+	pthread_mutex_lock(&s->lock);
+	for (i = 0 ; i < num ; i++) {
+		eng->counts[first + i] += output[i];
+		eng->active_ns[first + i] += sample->interval_ns;
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	return 0;
+}
+
+static void ring_push(struct spmu_sampler *s,
+			const struct hlthunk_spmu_sample *sample)
+{
+	uint64_t head = s->head;
+
+	if (head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE) ==
+							s->ring_size) {
+		__atomic_add_fetch(&s->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	s->ring[head % s->ring_size] = *sample;
+	__atomic_store_n(&s->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void dump_sample(struct spmu_sampler *s,
+			const struct hlthunk_spmu_sample *sample)
+{
+	uint32_t i;
+
+	for (i = 0 ; i < sample->num_events ; i++)
+		fprintf(s->dump, "%lu,%lu,%u,%u,0x%lx,%lu,%lu,%u\n",
+			sample->timestamp_ns, sample->interval_ns,
+			sample->engine, s->engines[sample->engine].params->spmu,
+			sample->events[i], sample->deltas[i], sample->rates[i],
+			!!(sample->overflow & (1 << i)));
+}
+
+/*
+ * Takes a sample of every engine. The next group of an engine is enabled
+ * unless the sampling stops
+ */
+static int sample_engines(struct spmu_sampler *s, bool next)
+{
+	struct hlthunk_spmu_sample sample;
+	struct spmu_engine *eng;
+	uint32_t i;
+	int rc;
+
+	for (i = 0 ; i < s->num_engines ; i++) {
+		eng = &s->engines[i];
+		if (!eng->enabled)
+			continue;
+
+		rc = read_group(s, eng, &sample);
+		if (rc)
+			return rc;
+
+		ring_push(s, &sample);
+		if (s->dump)
+			dump_sample(s, &sample);
+
+		if (!next)
+			continue;
+
+		eng->group = (eng->group + 1) % eng->num_groups;
+		rc = enable_group(s, eng);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+static void *sampler_thread(void *arg)
+{
+	struct spmu_sampler *s = (struct spmu_sampler *) arg;
+	uint64_t next = s->start_ns;
+	struct timespec ts;
+	bool stop;
+	int rc;
+
+	while (1) {
+		next += s->interval_ns;
+		ts.tv_sec = next / NS_PER_SEC;
+		ts.tv_nsec = next % NS_PER_SEC;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+		pthread_mutex_lock(&s->lock);
+		stop = s->stop;
+		pthread_mutex_unlock(&s->lock);
+
+		if (stop)
+			break;
+
+		rc = sample_engines(s, true);
+		if (rc) {
+			s->err = rc;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static void disable_engines(struct spmu_sampler *s)
+{
+	struct hlthunk_spmu_sample sample;
+	uint32_t i;
+
+	for (i = 0 ; i < s->num_engines ; i++)
+		if (s->engines[i].enabled)
+			read_group(s, &s->engines[i], &sample);
+}
+
+static void free_sampler(struct spmu_sampler *s)
+{
+	if (s->dump)
+		fclose(s->dump);
+	hlthunk_free(s->ring);
+	hlthunk_free(s->engines);
+	hlthunk_free(s->params);
+	pthread_mutex_destroy(&s->lock);
+	hlthunk_free(s);
+}
+
+/**
+ * This function starts sampling the SPMU counters of a set of engines from a
+ * background thread. It puts the device in debug mode
+ * @param fd file descriptor of the device
+ * @param params the engines, their events and the sampling interval
+ * @return opaque handle of the sampler or NULL in case of error, with errno
+ * set
+ */
+hlthunk_public void *hlthunk_spmu_sampler_create(int fd,
+			const struct hlthunk_spmu_sampler_params *params)
+{
+	struct spmu_sampler *s;
+	struct spmu_engine *eng;
+	uint32_t i;
+	int rc;
+
+	if (!params || !params->engines || !params->num_engines) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	for (i = 0 ; i < params->num_engines ; i++)
+		if (params->engines[i].spmu > GOYA_SPMU_LAST ||
+				!params->engines[i].num_events ||
+				params->engines[i].num_events >
+						HLTHUNK_SPMU_MAX_EVENTS) {
+			errno = EINVAL;
+			return NULL;
+		}
+
+	if (hlthunk_get_device_name_from_fd(fd) != HLTHUNK_DEVICE_GOYA) {
+		errno = ENODEV;
+		return NULL;
+	}
+
+	s = hlthunk_malloc(sizeof(*s));
+	if (!s) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&s->lock, NULL)) {
+		hlthunk_free(s);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	s->fd = fd;
+	s->num_engines = params->num_engines;
+	s->interval_ns = (uint64_t) (params->interval_us ?
+			params->interval_us : SPMU_DEFAULT_INTERVAL_US) * 1000;
+	s->ring_size = params->ring_size ? params->ring_size :
+						SPMU_DEFAULT_RING_SIZE;
+
+	rc = -ENOMEM;
+	s->params = hlthunk_malloc(s->num_engines * sizeof(*s->params));
+	s->engines = hlthunk_malloc(s->num_engines * sizeof(*s->engines));
+	s->ring = hlthunk_malloc(s->ring_size * sizeof(*s->ring));
+	if (!s->params || !s->engines || !s->ring)
+		goto free_sampler;
+
+	memcpy(s->params, params->engines,
+		s->num_engines * sizeof(*s->params));
+
+	if (params->dump_path) {
+		s->dump = fopen(params->dump_path, "w");
+		if (!s->dump) {
+			rc = -errno;
+			goto free_sampler;
+		}
+		fputs("timestamp_ns,interval_ns,engine,spmu,event,delta,rate,"
+			"overflow\n", s->dump);
+	}
+
+	rc = set_debug_mode(fd, true);
+	if (rc)
+		goto free_sampler;
+
+	s->start_ns = monotonic_ns();
+
+	for (i = 0 ; i < s->num_engines ; i++) {
+		eng = &s->engines[i];
+		eng->params = &s->params[i];
+		eng->num_groups = (eng->params->num_events +
+					HLTHUNK_SPMU_MAX_COUNTERS - 1) /
+						HLTHUNK_SPMU_MAX_COUNTERS;
+
+		rc = enable_group(s, eng);
+		if (rc)
+			goto disable_engines;
+	}
+
+	if (pthread_create(&s->thread, NULL, sampler_thread, s)) {
+		rc = -ENOMEM;
+		goto disable_engines;
+	}
+
+	return s;
+
+disable_engines:
+	disable_engines(s);
+	set_debug_mode(fd, false);
+free_sampler:
+	free_sampler(s);
+	errno = -rc;
+	return NULL;
+}
+
+/**
+ * This function stops the sampling. The last sample of every engine covers
+ * the time since the previous sample. The samples and the totals stay
+ * available until hlthunk_spmu_sampler_destroy
+ * @param data the handle returned by hlthunk_spmu_sampler_create
+ * @return 0 for success, negative value if the sampling failed
+ */
+hlthunk_public int hlthunk_spmu_sampler_stop(void *data)
+{
+	struct spmu_sampler *s = (struct spmu_sampler *) data;
+	int rc;
+
+	if (!s)
+		return -EINVAL;
+
+	if (s->stopped)
+		return s->err;
+
+	pthread_mutex_lock(&s->lock);
+	s->stop = true;
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(s->thread, NULL);
+
+	rc = sample_engines(s, false);
+	if (rc && !s->err)
+		s->err = rc;
+
+	disable_engines(s);
+	set_debug_mode(s->fd, false);
+
+	if (s->dump && fflush(s->dump) && !s->err)
+		s->err = -EIO;
+
+	pthread_mutex_lock(&s->lock);
+	s->stop_ns = monotonic_ns();
+	s->stopped = true;
+	pthread_mutex_unlock(&s->lock);
+
+	return s->err;
+}
+
+/**
+ * This function stops the sampling if needed and destroys the sampler
+ * @param data the handle returned by hlthunk_spmu_sampler_create
+ */
+hlthunk_public void hlthunk_spmu_sampler_destroy(void *data)
+{
+	struct spmu_sampler *s = (struct spmu_sampler *) data;
+
+	if (!s)
+		return;
+
+	hlthunk_spmu_sampler_stop(s);
+	free_sampler(s);
+}
+
+/**
+ * This function takes the oldest samples out of the ring. It must not be
+ * called from more than one thread at a time
+ * @param data the handle returned by hlthunk_spmu_sampler_create
+ * @param samples returned samples, oldest first
+ * @param max_samples number of entries in the samples array
+ * @return the number of samples returned, negative value for failure
+ */
+hlthunk_public int hlthunk_spmu_sampler_read(void *data,
+					struct hlthunk_spmu_sample *samples,
+					uint32_t max_samples)
+{
+	struct spmu_sampler *s = (struct spmu_sampler *) data;
+	uint64_t tail, head, num, i;
+
+	if (!s || (max_samples && !samples))
+		return -EINVAL;
+
+	tail = s->tail;
+	head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+
+	num = head - tail;
+	if (num > max_samples)
+		num = max_samples;
+
+	for (i = 0 ; i < num ; i++)
+		samples[i] = s->ring[(tail + i) % s->ring_size];
+
+	__atomic_store_n(&s->tail, tail + num, __ATOMIC_RELEASE);
+
+	return num;
+}
+
+/**
+ * This function retrieves the totals of an event since the sampling started
+ * @param data the handle returned by hlthunk_spmu_sampler_create
+ * @param engine index of the engine in the parameters of the sampler
+ * @param event index of the event in the events of the engine
+ * @param total returned totals of the event
+ * @return 0 for success, negative value for failure
+ */
+hlthunk_public int hlthunk_spmu_sampler_get_total(void *data,
+					uint32_t engine, uint32_t event,
+					struct hlthunk_spmu_total *total)
+{
+	struct spmu_sampler *s = (struct spmu_sampler *) data;
+	struct spmu_engine *eng;
+
+	if (!s || !total || engine >= s->num_engines)
+		return -EINVAL;
+
+	eng = &s->engines[engine];
+	if (event >= eng->params->num_events)
+		return -EINVAL;
+
+	memset(total, 0, sizeof(*total));
+
+	pthread_mutex_lock(&s->lock);
+	total->count = eng->counts[event];
+	total->active_ns = eng->active_ns[event];
+	total->elapsed_ns = (s->stopped ? s->stop_ns : monotonic_ns()) -
+								s->start_ns;
+	pthread_mutex_unlock(&s->lock);
+
+	if (total->active_ns) {
+		total->estimate = (double) total->count * total->elapsed_ns /
+							total->active_ns;
+		total->rate = (double) total->count * NS_PER_SEC /
+							total->active_ns;
+	}
+
+	return 0;
+}
+
+/**
+ * This function retrieves the number of samples that were dropped because
+ * the ring was full
+ * @param data the handle returned by hlthunk_spmu_sampler_create
+ * @return the number of dropped samples
+ */
+hlthunk_public uint64_t hlthunk_spmu_sampler_get_dropped(void *data)
+{
+	struct spmu_sampler *s = (struct spmu_sampler *) data;
+
+	return s ? __atomic_load_n(&s->dropped, __ATOMIC_RELAXED) : 0;
+}
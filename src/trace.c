@@ -0,0 +1,664 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+#include "specs/goya/goya.h"
+#include "specs/goya/goya_coresight.h"
+#include "specs/goya/goya_packets.h"
+#include "specs/goya/asic_reg/goya_blocks.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+ * CoreSight trace capture. The STMs of the traced engines emit their hardware
+ * events, which pass through the ETFs next to them and the funnels of the
+ * trace network to the ETR, which writes them to a circular buffer in DRAM.
+ *
+ * While tracing, a thread follows the write pointer of the ETR through the
+ * debugfs register access and copies the new part of the buffer to the file,
+ * with a DMA to pinned host memory. Without debugfs, the buffer is copied
+ * once when the trace is stopped, using the write pointer that the driver
+ * returns when it disables the ETR.
+ */
+
+#define TRACE_DEFAULT_BUFFER_SIZE	(16ull * 1024 * 1024)
+#define TRACE_DEFAULT_POLL_US		10000
+/* Largest copy from the ETR buffer to the host in a single CS */
+#define TRACE_DRAIN_CHUNK		(1024 * 1024)
+#define TRACE_WAIT_TIMEOUT_US		1000000
+
+/* Modes of the CoreSight trace memory controllers */
+#define TRACE_SINK_MODE_CIRCULAR	0
+#define TRACE_SINK_MODE_HW_FIFO		2
+
+#define TRACE_ETR_RWP			(mmPSOC_ETR_BASE + 0x18)
+#define TRACE_ETR_RWPHI			(mmPSOC_ETR_BASE + 0x3C)
+
+#define ARRAY_LEN(a)			(sizeof(a) / sizeof((a)[0]))
+
+struct trace_profile {
+	const char *name;
+	const uint32_t *stms;
+	const uint32_t *etfs;
+	const uint32_t *funnels;
+	uint32_t num_stms;
+	uint32_t num_etfs;
+	uint32_t num_funnels;
+};
+
+static const uint32_t dma_stms[] = {
+	GOYA_STM_DMA_CH_0_CS, GOYA_STM_DMA_CH_1_CS, GOYA_STM_DMA_CH_2_CS,
+	GOYA_STM_DMA_CH_3_CS, GOYA_STM_DMA_CH_4_CS, GOYA_STM_DMA_MACRO_CS
+};
+
+static const uint32_t dma_etfs[] = {
+	GOYA_ETF_DMA_CH_0_CS, GOYA_ETF_DMA_CH_1_CS, GOYA_ETF_DMA_CH_2_CS,
+	GOYA_ETF_DMA_CH_3_CS, GOYA_ETF_DMA_CH_4_CS, GOYA_ETF_DMA_MACRO_CS
+};
+
+static const uint32_t tpc_stms[] = {
+	GOYA_STM_TPC0_EML, GOYA_STM_TPC1_EML, GOYA_STM_TPC2_EML,
+	GOYA_STM_TPC3_EML, GOYA_STM_TPC4_EML, GOYA_STM_TPC5_EML,
+	GOYA_STM_TPC6_EML, GOYA_STM_TPC7_EML
+};
+
+static const uint32_t tpc_etfs[] = {
+	GOYA_ETF_TPC0_EML, GOYA_ETF_TPC1_EML, GOYA_ETF_TPC2_EML,
+	GOYA_ETF_TPC3_EML, GOYA_ETF_TPC4_EML, GOYA_ETF_TPC5_EML,
+	GOYA_ETF_TPC6_EML, GOYA_ETF_TPC7_EML
+};
+
+static const uint32_t tpc_funnels[] = {
+	GOYA_FUNNEL_TPC0_EML, GOYA_FUNNEL_TPC1_EML, GOYA_FUNNEL_TPC2_EML,
+	GOYA_FUNNEL_TPC3_EML, GOYA_FUNNEL_TPC4_EML, GOYA_FUNNEL_TPC5_EML,
+	GOYA_FUNNEL_TPC6_EML, GOYA_FUNNEL_TPC7_EML
+};
+
+static const uint32_t mmu_stms[] = { GOYA_STM_MMU_CS };
+static const uint32_t mmu_etfs[] = { GOYA_ETF_MMU_CS };
+
+static const struct trace_profile profiles[HLTHUNK_TRACE_PROFILE_MAX] = {
+	[HLTHUNK_TRACE_PROFILE_DMA] = {
+		"DMA engines", dma_stms, dma_etfs, NULL,
+		ARRAY_LEN(dma_stms), ARRAY_LEN(dma_etfs), 0
+	},
+	[HLTHUNK_TRACE_PROFILE_TPC_EML] = {
+		"TPC EML", tpc_stms, tpc_etfs, tpc_funnels,
+		ARRAY_LEN(tpc_stms), ARRAY_LEN(tpc_etfs),
+		ARRAY_LEN(tpc_funnels)
+	},
+	[HLTHUNK_TRACE_PROFILE_MMU] = {
+		"MMU", mmu_stms, mmu_etfs, NULL,
+		ARRAY_LEN(mmu_stms), ARRAY_LEN(mmu_etfs), 0
+	}
+};
+
+/*
+ * The funnels that route the trace of the engines towards the ETR. They are
+ * enabled for every profile, as a funnel only passes the trace of its enabled
+ * sources
+ */
+static const uint32_t route_funnels[] = {
+	GOYA_FUNNEL_DMA_CH_6_1, GOYA_FUNNEL_DMA_MACRO_3_1,
+	GOYA_FUNNEL_MME0_RTR, GOYA_FUNNEL_MME1_RTR, GOYA_FUNNEL_MME2_RTR,
+	GOYA_FUNNEL_MME3_RTR, GOYA_FUNNEL_MME4_RTR, GOYA_FUNNEL_MME5_RTR,
+	GOYA_FUNNEL_TPC1_RTR, GOYA_FUNNEL_TPC2_RTR, GOYA_FUNNEL_TPC3_RTR,
+	GOYA_FUNNEL_TPC4_RTR, GOYA_FUNNEL_TPC5_RTR, GOYA_FUNNEL_TPC6_RTR,
+	GOYA_FUNNEL_PCIE, GOYA_FUNNEL_PSOC
+};
+
+struct trace {
+	/* Mask of the traced profiles */
+	uint32_t profiles;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	FILE *file;
+	void *regs;
+	void *cb_cache;
+	/* Pinned host memory the ETR buffer is copied to */
+	struct hlthunk_host_buf staging;
+	uint64_t mem_handle;
+	uint64_t buffer_addr;
+	uint64_t buffer_size;
+	/* Offset in the ETR buffer up to which the trace was written out */
+	uint64_t read_off;
+	uint64_t bytes;
+	uint32_t num_drains;
+	uint32_t poll_interval_us;
+	int fd;
+	int err;
+	bool stop;
+	bool thread_started;
+};
+
+/**
+ * This function looks up a trace profile by its name
+ * @param name the name of the profile, e.g. "TPC EML"
+ * @return the profile, -ENOENT if there is no such profile
+ */
+hlthunk_public int hlthunk_trace_find_profile(const char *name)
+{
+	int i;
+
+	if (!name)
+		return -EINVAL;
+
+	for (i = 0 ; i < HLTHUNK_TRACE_PROFILE_MAX ; i++)
+		if (!strcmp(profiles[i].name, name))
+			return i;
+
+	return -ENOENT;
+}
+
+/**
+ * This function retrieves the name of a trace profile
+ * @param profile the profile
+ * @return the name of the profile, NULL if the profile isn't valid
+ */
+hlthunk_public const char *hlthunk_trace_get_profile_name(
+					enum hlthunk_trace_profile profile)
+{
+	if (profile >= HLTHUNK_TRACE_PROFILE_MAX)
+		return NULL;
+
+	return profiles[profile].name;
+}
+
+static int config_component(int fd, uint32_t op, uint32_t reg_idx,
+				bool enable, void *input, uint32_t input_size)
+{
+	struct hl_debug_args debug;
+
+	memset(&debug, 0, sizeof(debug));
+	debug.op = op;
+	debug.reg_idx = reg_idx;
+	debug.enable = enable;
+	if (enable && input) {
+		debug.input_ptr = (uint64_t) (uintptr_t) input;
+		debug.input_size = input_size;
+	}
+
+	return hlthunk_debug(fd, &debug) ? -errno : 0;
+}
+
+static int config_stms(struct trace *trace, bool enable, uint64_t ts_freq)
+{
+	const struct trace_profile *profile;
+	struct hl_debug_params_stm stm;
+	uint32_t p, i;
+	int rc;
+
+	for (p = 0 ; p < HLTHUNK_TRACE_PROFILE_MAX ; p++) {
+		if (!(trace->profiles & (1 << p)))
+			continue;
+
+		profile = &profiles[p];
+		for (i = 0 ; i < profile->num_stms ; i++) {
+			memset(&stm, 0, sizeof(stm));
+			stm.he_mask = UINT64_MAX;
+			stm.sp_mask = UINT64_MAX;
+			stm.id = HLTHUNK_TRACE_STM_FIRST_ID + profile->stms[i];
+			stm.frequency = ts_freq;
+
+			rc = config_component(trace->fd, HL_DEBUG_OP_STM,
+						profile->stms[i], enable, &stm,
+						sizeof(stm));
+			if (rc && enable)
+				return rc;
+		}
+	}
+
+	return 0;
+}
+
+static int config_etfs(struct trace *trace, bool enable)
+{
+	const struct trace_profile *profile;
+	struct hl_debug_params_etf etf;
+	uint32_t p, i;
+	int rc;
+
+	/* The ETFs only pass the trace on to the funnels */
+	memset(&etf, 0, sizeof(etf));
+	etf.sink_mode = TRACE_SINK_MODE_HW_FIFO;
+
+	for (p = 0 ; p < HLTHUNK_TRACE_PROFILE_MAX ; p++) {
+		if (!(trace->profiles & (1 << p)))
+			continue;
+
+		profile = &profiles[p];
+		for (i = 0 ; i < profile->num_etfs ; i++) {
+			rc = config_component(trace->fd, HL_DEBUG_OP_ETF,
+						profile->etfs[i], enable, &etf,
+						sizeof(etf));
+			if (rc && enable)
+				return rc;
+		}
+	}
+
+	return 0;
+}
+
+static int config_funnels(struct trace *trace, bool enable)
+{
+	const struct trace_profile *profile;
+	uint32_t p, i;
+	int rc;
+
+	for (p = 0 ; p < HLTHUNK_TRACE_PROFILE_MAX ; p++) {
+		if (!(trace->profiles & (1 << p)))
+			continue;
+
+		profile = &profiles[p];
+		for (i = 0 ; i < profile->num_funnels ; i++) {
+			rc = config_component(trace->fd, HL_DEBUG_OP_FUNNEL,
+						profile->funnels[i], enable,
+						NULL, 0);
+			if (rc && enable)
+				return rc;
+		}
+	}
+
+	for (i = 0 ; i < ARRAY_LEN(route_funnels) ; i++) {
+		rc = config_component(trace->fd, HL_DEBUG_OP_FUNNEL,
+					route_funnels[i], enable, NULL, 0);
+		if (rc && enable)
+			return rc;
+	}
+
+	return 0;
+}
+
+static int enable_etr(struct trace *trace)
+{
+	struct hl_debug_params_etr etr;
+
+	memset(&etr, 0, sizeof(etr));
+	etr.buffer_address = trace->buffer_addr;
+	etr.buffer_size = trace->buffer_size;
+	etr.sink_mode = TRACE_SINK_MODE_CIRCULAR;
+
+	return config_component(trace->fd, HL_DEBUG_OP_ETR, 0, true, &etr,
+				sizeof(etr));
+}
+
+/* Disabling the ETR flushes it and returns its final write pointer */
+static int disable_etr(struct trace *trace, uint64_t *rwp)
+{
+	struct hl_debug_args debug;
+
+	memset(&debug, 0, sizeof(debug));
+	debug.op = HL_DEBUG_OP_ETR;
+	debug.output_ptr = (uint64_t) (uintptr_t) rwp;
+	debug.output_size = sizeof(*rwp);
+
+	return hlthunk_debug(trace->fd, &debug) ? -errno : 0;
+}
+
+static void disable_sources(struct trace *trace)
+{
+	config_stms(trace, false, 0);
+	config_etfs(trace, false);
+	config_funnels(trace, false);
+}
+
+/* Copies a part of the ETR buffer to the file */
+static int copy_out(struct trace *trace, uint64_t off, uint64_t size)
+{
+	struct packet_lin_dma pkt;
+	struct hl_cs_chunk chunk;
+	struct hlthunk_cs_in in;
+	struct hlthunk_cs_out out;
+	uint64_t cb_handle, len;
+	uint32_t status;
+	int rc;
+
+	while (size) {
+		len = size < trace->staging.size ? size : trace->staging.size;
+
+		memset(&pkt, 0, sizeof(pkt));
+		pkt.opcode = PACKET_LIN_DMA;
+		pkt.weakly_ordered = 1;
+		pkt.reg_barrier = 1;
+		pkt.msg_barrier = 1;
+		pkt.dma_dir = DMA_DRAM_TO_HOST;
+		pkt.src_addr = trace->buffer_addr + off;
+		pkt.dst_addr = trace->staging.device_virt_addr;
+		pkt.tsize = len;
+
+		rc = hlthunk_cb_cache_get(trace->cb_cache, &pkt, sizeof(pkt),
+						true, &cb_handle);
+		if (rc)
+			return rc;
+
+		memset(&chunk, 0, sizeof(chunk));
+		chunk.cb_handle = cb_handle;
+		chunk.cb_size = sizeof(pkt);
+		chunk.queue_index = GOYA_QUEUE_ID_DMA_2;
+
+		memset(&in, 0, sizeof(in));
+		in.chunks_execute = &chunk;
+		in.num_chunks_execute = 1;
+
+		rc = hlthunk_command_submission(trace->fd, &in, &out);
+		if (rc) {
+			rc = -errno;
+			hlthunk_cb_cache_put(trace->cb_cache, cb_handle, 0);
+			return rc;
+		}
+
+		rc = hlthunk_wait_for_cs(trace->fd, out.seq,
+						TRACE_WAIT_TIMEOUT_US, &status);
+		hlthunk_cb_cache_put(trace->cb_cache, cb_handle, out.seq);
+		if (rc)
+			return -errno;
+		if (status != HL_WAIT_CS_STATUS_COMPLETED)
+			return -ETIMEDOUT;
+
+		if (fwrite(trace->staging.host_ptr, 1, len, trace->file) != len)
+			return -EIO;
+
+		trace->bytes += len;
+		off += len;
+		size -= len;
+	}
+
+	return 0;
+}
+
+/*
+ * Writes out the trace between the last drain and the write pointer. The
+ * trace is assumed to have wrapped around at most once since the last drain
+ */
+static int drain(struct trace *trace, uint64_t rwp)
+{
+	uint64_t write_off = rwp - trace->buffer_addr;
+	int rc = 0;
+
+	if (write_off > trace->buffer_size)
+		return -EFAULT;
+	if (write_off == trace->buffer_size)
+		write_off = 0;
+	if (write_off == trace->read_off)
+		return 0;
+
+	if (write_off < trace->read_off) {
+		rc = copy_out(trace, trace->read_off,
+				trace->buffer_size - trace->read_off);
+		trace->read_off = 0;
+	}
+
+	if (!rc)
+		rc = copy_out(trace, trace->read_off,
+				write_off - trace->read_off);
+	if (rc)
+		return rc;
+
+	trace->read_off = write_off;
+	trace->num_drains++;
+
+	return 0;
+}
+
+static int read_rwp(struct trace *trace, uint64_t *rwp)
+{
+	uint32_t lo, hi;
+	int rc;
+
+	rc = hlthunk_reg_read(trace->regs, TRACE_ETR_RWP, &lo);
+	if (!rc)
+		rc = hlthunk_reg_read(trace->regs, TRACE_ETR_RWPHI, &hi);
+	if (rc)
+		return rc;
+
+	/* The write pointer is 40 bits wide */
+	*rwp = ((uint64_t) (hi & 0xff) << 32) | lo;
+
+	return 0;
+}
+
+static void *drain_thread(void *arg)
+{
+	struct trace *trace = (struct trace *) arg;
+	uint64_t rwp;
+	bool stop;
+	int rc;
+
+	while (1) {
+		pthread_mutex_lock(&trace->lock);
+		stop = trace->stop;
+		pthread_mutex_unlock(&trace->lock);
+
+		if (stop)
+			break;
+
+		rc = read_rwp(trace, &rwp);
+		if (!rc)
+			rc = drain(trace, rwp);
+		if (rc) {
+			trace->err = rc;
+			break;
+		}
+
+		usleep(trace->poll_interval_us);
+	}
+
+	return NULL;
+}
+
+static void free_trace(struct trace *trace)
+{
+	if (trace->buffer_addr)
+		hlthunk_memory_unmap(trace->fd, trace->buffer_addr);
+	if (trace->mem_handle)
+		hlthunk_device_memory_free(trace->fd, trace->mem_handle);
+	if (trace->staging.host_ptr)
+		hlthunk_host_free(trace->fd, &trace->staging);
+	if (trace->cb_cache)
+		hlthunk_cb_cache_destroy(trace->cb_cache);
+	if (trace->regs)
+		hlthunk_reg_close(trace->regs);
+	if (trace->file)
+		fclose(trace->file);
+	pthread_mutex_destroy(&trace->lock);
+	hlthunk_free(trace);
+}
+
+/**
+ * This function starts capturing a CoreSight trace of several groups of
+ * engines at once to a single file, like hlthunk_trace_start does for one.
+ * The trace is stopped by hlthunk_trace_stop
+ * @param fd file descriptor of the device
+ * @param params the file and the buffering of the trace. The profile in it is
+ * ignored
+ * @param profile_mask bitmask of the profiles to trace, where bit N selects
+ * the profile whose value in enum hlthunk_trace_profile is N. It must select
+ * at least one profile and no bits above HLTHUNK_TRACE_PROFILE_MAX - 1
+ * @return opaque handle of the trace or NULL in case of error, with errno set
+ */
+void *hlthunk_trace_start_profiles(int fd,
+				const struct hlthunk_trace_params *params,
+				uint32_t profile_mask)
+{
+	struct trace *trace;
+	uint64_t ts_freq, rwp;
+	int rc;
+
+	if (!params || !params->path || !profile_mask ||
+			profile_mask >= (1 << HLTHUNK_TRACE_PROFILE_MAX)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (hlthunk_get_device_name_from_fd(fd) != HLTHUNK_DEVICE_GOYA) {
+		errno = ENODEV;
+		return NULL;
+	}
+
+	trace = hlthunk_malloc(sizeof(*trace));
+	if (!trace) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&trace->lock, NULL)) {
+		hlthunk_free(trace);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	trace->fd = fd;
+	trace->profiles = profile_mask;
+	trace->buffer_size = params->buffer_size ? params->buffer_size :
+						TRACE_DEFAULT_BUFFER_SIZE;
+	trace->poll_interval_us = params->poll_interval_us ?
+			params->poll_interval_us : TRACE_DEFAULT_POLL_US;
+
+	rc = hlthunk_get_timestamp_freq(fd, &ts_freq);
+	if (rc)
+		goto free_trace;
+
+	trace->file = fopen(params->path, "w");
+	if (!trace->file) {
+		rc = -errno;
+		goto free_trace;
+	}
+
+	rc = -ENOMEM;
+	trace->cb_cache = hlthunk_cb_cache_create(fd, 0);
+	if (!trace->cb_cache)
+		goto free_trace;
+
+	rc = hlthunk_host_alloc(fd, trace->buffer_size < TRACE_DRAIN_CHUNK ?
+					trace->buffer_size : TRACE_DRAIN_CHUNK,
+				HLTHUNK_HOST_ALLOC_NO_1GB, &trace->staging);
+	if (rc)
+		goto free_trace;
+
+	trace->mem_handle = hlthunk_device_memory_alloc(fd,
+						trace->buffer_size, true,
+						false);
+	if (!trace->mem_handle) {
+		rc = -errno;
+		goto free_trace;
+	}
+
+	trace->buffer_addr = hlthunk_device_memory_map(fd, trace->mem_handle,
+							0);
+	if (!trace->buffer_addr) {
+		rc = -errno;
+		goto free_trace;
+	}
+
+	rc = hlthunk_debug_timestamp(fd, true);
+	if (rc)
+		goto free_trace;
+
+	/* The components are enabled from the sink towards the sources */
+	rc = enable_etr(trace);
+	if (rc)
+		goto disable_timestamp;
+
+	rc = config_funnels(trace, true);
+	if (!rc)
+		rc = config_etfs(trace, true);
+	if (!rc)
+		rc = config_stms(trace, true, ts_freq);
+	if (rc)
+		goto disable_sources;
+
+	/* Without debugfs the buffer is drained when the trace is stopped */
+	trace->regs = hlthunk_reg_open(fd);
+	if (trace->regs) {
+		if (!pthread_create(&trace->thread, NULL, drain_thread, trace))
+			trace->thread_started = true;
+	}
+
+	return trace;
+
+disable_sources:
+	disable_sources(trace);
+	disable_etr(trace, &rwp);
+disable_timestamp:
+	hlthunk_debug_timestamp(fd, false);
+free_trace:
+	free_trace(trace);
+	errno = -rc;
+	return NULL;
+}
+
+/**
+ * This function starts capturing a CoreSight trace of a group of engines to
+ * a file. It puts the device in debug mode and restarts its timestamp
+ * counter, so only one trace should be captured per device at a time
+ * @param fd file descriptor of the device
+ * @param params the profile, the file and the buffering of the trace
+ * @return opaque handle of the trace or NULL in case of error, with errno set
+ */
+hlthunk_public void *hlthunk_trace_start(int fd,
+				const struct hlthunk_trace_params *params)
+{
+	if (!params || params->profile >= HLTHUNK_TRACE_PROFILE_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return hlthunk_trace_start_profiles(fd, params, 1 << params->profile);
+}
+
+/**
+ * This function stops capturing a trace, writes out the rest of the trace
+ * and releases the trace components and buffers
+ * @param data the handle returned by hlthunk_trace_start
+ * @param stats returned statistics of the trace. May be NULL
+ * @return 0 for success, negative value if the trace couldn't be written out
+ * completely
+ */
+hlthunk_public int hlthunk_trace_stop(void *data,
+					struct hlthunk_trace_stats *stats)
+{
+	struct trace *trace = (struct trace *) data;
+	uint64_t rwp = 0;
+	int rc;
+
+	if (!trace)
+		return -EINVAL;
+
+	/* The sources are stopped first so the ETR receives all of the trace */
+	disable_sources(trace);
+
+	if (trace->thread_started) {
+		pthread_mutex_lock(&trace->lock);
+		trace->stop = true;
+		pthread_mutex_unlock(&trace->lock);
+		pthread_join(trace->thread, NULL);
+	}
+
+	rc = disable_etr(trace, &rwp);
+	if (!rc)
+		rc = trace->err;
+	if (!rc)
+		rc = drain(trace, rwp);
+	if (!rc && fflush(trace->file))
+		rc = -EIO;
+
+	hlthunk_debug_timestamp(trace->fd, false);
+
+	if (stats) {
+		stats->bytes = trace->bytes;
+		stats->num_drains = trace->num_drains;
+		stats->drained_at_stop_only = !trace->thread_started;
+	}
+
+	free_trace(trace);
+
+	return rc;
+}
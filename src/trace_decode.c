@@ -0,0 +1,778 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+#include "specs/goya/goya_coresight.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Offline decoding of the traces that hlthunk_trace_start captures.
+ *
+ * The ETR writes 16-byte formatter frames, which interleave the trace of the
+ * STMs by their trace ID. The frames are split into a stream per ID, and the
+ * streams are cut at their ASYNC packets. Every segment between two ASYNCs
+ * is decoded on its own, so the segments are spread over the threads. The
+ * STM sends a full timestamp after an ASYNC, so the later timestamps of a
+ * segment, which only update the low nibbles, don't depend on the segments
+ * before it.
+ *
+ * The data packets of the hardware event masters are the event vectors of
+ * the engine of the STM. The busy and idle events of the engine turn them
+ * into busy intervals, which are written as Chrome trace events.
+ */
+
+#define FRAME_SIZE		16
+#define FRAME_FSYNC		0x7FFFFFFF
+
+/* An ASYNC is 21 0xF nibbles followed by a 0x0 nibble */
+#define STP_ASYNC_F_NIBBLES	21
+#define STP_VERSION_GRAY	4
+/* Hardware events are sent by the masters with this bit set */
+#define STP_HW_MASTER		0x80
+
+struct decode_event {
+	uint64_t ts;
+	uint64_t vector;
+};
+
+struct decode_segment {
+	struct decode_event *events;
+	uint64_t num_events;
+	uint64_t max_events;
+	/* Nibble range of the segment in the stream of its ID */
+	uint64_t start;
+	uint64_t end;
+	uint64_t freq;
+	uint32_t id;
+	int err;
+};
+
+struct decode_ctx {
+	pthread_mutex_t lock;
+	struct hlthunk_trace_stream streams[HLTHUNK_TRACE_MAX_IDS];
+	struct decode_segment *segments;
+	uint32_t num_segments;
+	uint32_t max_segments;
+	/* Next segment to decode */
+	uint32_t next;
+};
+
+/* The state of the STP decoder within a segment */
+struct stp_state {
+	const uint8_t *buf;
+	uint64_t pos;
+	uint64_t end;
+	uint64_t ts_raw;
+	uint32_t master;
+	bool ts_known;
+	bool gray;
+};
+
+static const char * const stm_names[GOYA_STM_LAST + 1] = {
+	[GOYA_STM_CPU] = "CPU",
+	[GOYA_STM_DMA_CH_0_CS] = "DMA_CH_0",
+	[GOYA_STM_DMA_CH_1_CS] = "DMA_CH_1",
+	[GOYA_STM_DMA_CH_2_CS] = "DMA_CH_2",
+	[GOYA_STM_DMA_CH_3_CS] = "DMA_CH_3",
+	[GOYA_STM_DMA_CH_4_CS] = "DMA_CH_4",
+	[GOYA_STM_DMA_MACRO_CS] = "DMA_MACRO",
+	[GOYA_STM_MME1_SBA] = "MME1_SBA",
+	[GOYA_STM_MME3_SBB] = "MME3_SBB",
+	[GOYA_STM_MME4_WACS2] = "MME4_WACS2",
+	[GOYA_STM_MME4_WACS] = "MME4_WACS",
+	[GOYA_STM_MMU_CS] = "MMU",
+	[GOYA_STM_PCIE] = "PCIE",
+	[GOYA_STM_PSOC] = "PSOC",
+	[GOYA_STM_TPC0_EML] = "TPC0",
+	[GOYA_STM_TPC1_EML] = "TPC1",
+	[GOYA_STM_TPC2_EML] = "TPC2",
+	[GOYA_STM_TPC3_EML] = "TPC3",
+	[GOYA_STM_TPC4_EML] = "TPC4",
+	[GOYA_STM_TPC5_EML] = "TPC5",
+	[GOYA_STM_TPC6_EML] = "TPC6",
+	[GOYA_STM_TPC7_EML] = "TPC7"
+};
+
+static int stream_append(struct hlthunk_trace_stream *stream, uint8_t byte)
+{
+	uint8_t *buf;
+	uint64_t cap;
+
+	if (stream->len == stream->cap) {
+		cap = stream->cap ? stream->cap * 2 : 4096;
+		buf = realloc(stream->buf, cap);
+		if (!buf)
+			return -ENOMEM;
+		stream->buf = buf;
+		stream->cap = cap;
+	}
+
+	stream->buf[stream->len++] = byte;
+
+	return 0;
+}
+
+/*
+ * Splits the formatter frames into a stream per trace ID. An odd byte of a
+ * frame is data, an even byte is data or an ID change, and the last byte
+ * holds the low bits of the even data bytes and whether an ID change
+ * applies only after the next byte.
+ */
+static int deframe(struct hlthunk_trace_stream *streams, const uint8_t *data,
+			uint64_t size)
+{
+	const uint8_t *frame;
+	uint32_t id = 0, new_id, i, sync;
+	uint64_t off = 0;
+	uint8_t aux, byte;
+	int rc = 0;
+
+	while (off + FRAME_SIZE <= size) {
+		memcpy(&sync, data + off, sizeof(sync));
+		if (sync == FRAME_FSYNC) {
+			off += sizeof(sync);
+			continue;
+		}
+
+		frame = data + off;
+		aux = frame[FRAME_SIZE - 1];
+
+		for (i = 0 ; i < FRAME_SIZE - 1 && !rc ; i += 2) {
+			if (frame[i] & 1) {
+				new_id = frame[i] >> 1;
+				if (!(aux & (1 << (i / 2))))
+					id = new_id;
+				if (i + 1 < FRAME_SIZE - 1 && id)
+					rc = stream_append(&streams[id],
+								frame[i + 1]);
+				id = new_id;
+				continue;
+			}
+
+			byte = (frame[i] & 0xFE) | ((aux >> (i / 2)) & 1);
+			if (id)
+				rc = stream_append(&streams[id], byte);
+			if (!rc && i + 1 < FRAME_SIZE - 1 && id)
+				rc = stream_append(&streams[id],
+							frame[i + 1]);
+		}
+
+		if (rc)
+			return rc;
+
+		off += FRAME_SIZE;
+	}
+
+	return 0;
+}
+
+static uint8_t nibble(const uint8_t *buf, uint64_t pos)
+{
+	return (buf[pos / 2] >> ((pos & 1) * 4)) & 0xF;
+}
+
+static int add_segment(struct decode_ctx *ctx, uint32_t id, uint64_t start,
+			uint64_t end)
+{
+	struct decode_segment *segments;
+	uint32_t max;
+
+	if (ctx->num_segments == ctx->max_segments) {
+		max = ctx->max_segments ? ctx->max_segments * 2 : 64;
+		segments = realloc(ctx->segments, max * sizeof(*segments));
+		if (!segments)
+			return -ENOMEM;
+		ctx->segments = segments;
+		ctx->max_segments = max;
+	}
+
+	memset(&ctx->segments[ctx->num_segments], 0, sizeof(*segments));
+	ctx->segments[ctx->num_segments].id = id;
+	ctx->segments[ctx->num_segments].start = start;
+	ctx->segments[ctx->num_segments].end = end;
+	ctx->num_segments++;
+
+	return 0;
+}
+
+/*
+ * Cuts the stream of an ID at its ASYNCs. A segment starts after an ASYNC
+ * and ends where the next ASYNC starts. The trace before the first ASYNC
+ * can't be decoded and is skipped.
+ */
+static int split_stream(struct decode_ctx *ctx, uint32_t id)
+{
+	struct hlthunk_trace_stream *stream = &ctx->streams[id];
+	uint64_t pos, num_nibbles = stream->len * 2, start = 0;
+	uint32_t run = 0;
+	bool synced = false;
+	uint8_t n;
+	int rc;
+
+	for (pos = 0 ; pos < num_nibbles ; pos++) {
+		n = nibble(stream->buf, pos);
+		if (n == 0xF) {
+			run++;
+			continue;
+		}
+
+		if (n == 0 && run >= STP_ASYNC_F_NIBBLES) {
+			if (synced) {
+				rc = add_segment(ctx, id, start,
+						pos - STP_ASYNC_F_NIBBLES);
+				if (rc)
+					return rc;
+			}
+			synced = true;
+			start = pos + 1;
+		}
+
+		run = 0;
+	}
+
+	return synced ? add_segment(ctx, id, start, num_nibbles) : 0;
+}
+
+static int stp_read(struct stp_state *stp, uint32_t num_nibbles,
+			uint64_t *val)
+{
+	uint32_t i;
+
+	if (stp->pos + num_nibbles > stp->end)
+		return -ENODATA;
+
+	/* The fields are sent from their most significant nibble */
+	*val = 0;
+	for (i = 0 ; i < num_nibbles ; i++)
+		*val = (*val << 4) | nibble(stp->buf, stp->pos++);
+
+	return 0;
+}
+
+/* A timestamp replaces the low nibbles of the previous one */
+static int stp_read_ts(struct stp_state *stp)
+{
+	uint64_t len, val, mask;
+	int rc;
+
+	rc = stp_read(stp, 1, &len);
+	if (rc)
+		return rc;
+
+	if (len == 0xD)
+		len = 14;
+	else if (len == 0xE)
+		len = 16;
+	else if (len == 0xF)
+		return -EINVAL;
+
+	rc = stp_read(stp, len, &val);
+	if (rc)
+		return rc;
+
+	mask = len == 16 ? UINT64_MAX : (1ull << (len * 4)) - 1;
+	stp->ts_raw = (stp->ts_raw & ~mask) | val;
+	stp->ts_known = true;
+
+	return 0;
+}
+
+static uint64_t gray_to_bin(uint64_t gray)
+{
+	uint32_t shift;
+
+	for (shift = 1 ; shift < 64 ; shift <<= 1)
+		gray ^= gray >> shift;
+
+	return gray;
+}
+
+static int add_event(struct decode_segment *seg, struct stp_state *stp,
+			uint64_t vector)
+{
+	struct decode_event *events;
+	uint64_t max;
+
+	/* Events before the first timestamp can't be placed */
+	if (!(stp->master & STP_HW_MASTER) || !stp->ts_known)
+		return 0;
+
+	if (seg->num_events == seg->max_events) {
+		max = seg->max_events ? seg->max_events * 2 : 256;
+		events = realloc(seg->events, max * sizeof(*events));
+		if (!events)
+			return -ENOMEM;
+		seg->events = events;
+		seg->max_events = max;
+	}
+
+	seg->events[seg->num_events].ts = stp->gray ?
+					gray_to_bin(stp->ts_raw) : stp->ts_raw;
+	seg->events[seg->num_events].vector = vector;
+	seg->num_events++;
+
+	return 0;
+}
+
+/* Data packets carry 4, 8, 16, 32 or 64 bits, optionally with a timestamp */
+static int stp_data(struct decode_segment *seg, struct stp_state *stp,
+			uint32_t num_nibbles, bool ts)
+{
+	uint64_t vector;
+	int rc;
+
+	rc = stp_read(stp, num_nibbles, &vector);
+	if (!rc && ts)
+		rc = stp_read_ts(stp);
+	if (!rc)
+		rc = add_event(seg, stp, vector);
+
+	return rc;
+}
+
+static int stp_decode_f0(struct decode_segment *seg, struct stp_state *stp)
+{
+	uint64_t op, val;
+	int rc;
+
+	rc = stp_read(stp, 1, &op);
+	if (rc)
+		return rc;
+
+	switch (op) {
+	case 0x0: /* VERSION */
+		rc = stp_read(stp, 1, &val);
+		if (rc)
+			return rc;
+		stp->gray = val == STP_VERSION_GRAY;
+		stp->master = 0;
+		return 0;
+	case 0x1: /* NULL_TS */
+		return stp_read_ts(stp);
+	case 0x6: /* TRIG */
+		return stp_read(stp, 2, &val);
+	case 0x7: /* TRIG_TS */
+		rc = stp_read(stp, 2, &val);
+		return rc ? rc : stp_read_ts(stp);
+	case 0x8: /* FREQ */
+		rc = stp_read(stp, 8, &val);
+		if (!rc)
+			seg->freq = val;
+		return rc;
+	case 0x9: /* FREQ_TS */
+		rc = stp_read(stp, 8, &val);
+		if (rc)
+			return rc;
+		seg->freq = val;
+		return stp_read_ts(stp);
+	default:
+		return -EINVAL;
+	}
+}
+
+static int stp_decode_f(struct decode_segment *seg, struct stp_state *stp)
+{
+	static const uint32_t data_nibbles[4] = { 2, 4, 8, 16 };
+	uint64_t op, val;
+	int rc;
+
+	rc = stp_read(stp, 1, &op);
+	if (rc)
+		return rc;
+
+	switch (op) {
+	case 0x0:
+		return stp_decode_f0(seg, stp);
+	case 0x2: /* GERR */
+		return stp_read(stp, 2, &val);
+	case 0x3: /* C16 */
+		return stp_read(stp, 4, &val);
+	case 0x4 ... 0x7: /* D8TS to D64TS */
+		return stp_data(seg, stp, data_nibbles[op - 0x4], true);
+	case 0x8 ... 0xB: /* D8M to D64M */
+		return stp_data(seg, stp, data_nibbles[op - 0x8], false);
+	case 0xC: /* D4TS */
+		return stp_data(seg, stp, 1, true);
+	case 0xD: /* D4M */
+		return stp_data(seg, stp, 1, false);
+	case 0xE: /* FLAG */
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int stp_decode(struct decode_segment *seg, struct stp_state *stp)
+{
+	static const uint32_t data_nibbles[4] = { 2, 4, 8, 16 };
+	uint64_t op, val;
+	int rc;
+
+	rc = stp_read(stp, 1, &op);
+	if (rc)
+		return rc;
+
+	switch (op) {
+	case 0x0: /* NULL */
+		return 0;
+	case 0x1: /* M8 */
+		rc = stp_read(stp, 2, &val);
+		if (rc)
+			return rc;
+		stp->master = val;
+		return 0;
+	case 0x2: /* MERR */
+	case 0x3: /* C8 */
+		return stp_read(stp, 2, &val);
+	case 0x4 ... 0x7: /* D8 to D64 */
+		return stp_data(seg, stp, data_nibbles[op - 0x4], false);
+	case 0x8 ... 0xB: /* D8MTS to D64MTS */
+		return stp_data(seg, stp, data_nibbles[op - 0x8], true);
+	case 0xC: /* D4 */
+		return stp_data(seg, stp, 1, false);
+	case 0xD: /* D4MTS */
+		return stp_data(seg, stp, 1, true);
+	case 0xE: /* FLAG_TS */
+		return stp_read_ts(stp);
+	default:
+		return stp_decode_f(seg, stp);
+	}
+}
+
+static void decode_segment(struct decode_ctx *ctx, struct decode_segment *seg)
+{
+	struct stp_state stp;
+	int rc = 0;
+
+	memset(&stp, 0, sizeof(stp));
+	stp.buf = ctx->streams[seg->id].buf;
+	stp.pos = seg->start;
+	stp.end = seg->end;
+
+	while (stp.pos < stp.end && !rc)
+		rc = stp_decode(seg, &stp);
+
+	/* A packet cut by the end of the segment isn't an error */
+	seg->err = rc == -ENODATA ? 0 : rc;
+}
+
+static void *decode_thread(void *arg)
+{
+	struct decode_ctx *ctx = (struct decode_ctx *) arg;
+	uint32_t i;
+
+	while (1) {
+		pthread_mutex_lock(&ctx->lock);
+		i = ctx->next++;
+		pthread_mutex_unlock(&ctx->lock);
+
+		if (i >= ctx->num_segments)
+			break;
+
+		decode_segment(ctx, &ctx->segments[i]);
+	}
+
+	return NULL;
+}
+
+static int decode_parallel(struct decode_ctx *ctx, uint32_t num_threads)
+{
+	pthread_t *threads;
+	uint32_t i, num_started;
+
+	if (!num_threads) {
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (!num_threads)
+			num_threads = 1;
+	}
+
+	if (num_threads > ctx->num_segments)
+		num_threads = ctx->num_segments;
+	if (num_threads <= 1)
+		num_threads = 1;
+
+	/* The calling thread is one of the decoding threads */
+	threads = hlthunk_malloc(num_threads * sizeof(*threads));
+	if (!threads)
+		return -ENOMEM;
+
+	for (num_started = 0 ; num_started < num_threads - 1 ; num_started++)
+		if (pthread_create(&threads[num_started], NULL, decode_thread,
+					ctx))
+			break;
+
+	decode_thread(ctx);
+
+	for (i = 0 ; i < num_started ; i++)
+		pthread_join(threads[i], NULL);
+
+	hlthunk_free(threads);
+
+	return 0;
+}
+
+/* Every event after the process name starts with a separator */
+static void write_source_name(FILE *file, uint32_t id)
+{
+	uint32_t stm = id - HLTHUNK_TRACE_STM_FIRST_ID;
+
+	fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",");
+	fprintf(file, "\"pid\":0,\"tid\":%u,", id);
+
+	if (id >= HLTHUNK_TRACE_STM_FIRST_ID && stm <= GOYA_STM_LAST)
+		fprintf(file, "\"args\":{\"name\":\"%s\"}}", stm_names[stm]);
+	else
+		fprintf(file, "\"args\":{\"name\":\"ID 0x%x\"}}", id);
+}
+
+static void write_interval(FILE *file, uint32_t id, uint64_t start,
+				uint64_t end, uint64_t t0, uint64_t freq)
+{
+	double start_us = (double) (start - t0) * 1000000 / freq;
+	double dur_us = (double) (end - start) * 1000000 / freq;
+
+	fprintf(file, ",\n{\"name\":\"busy\",\"ph\":\"X\",\"pid\":0,");
+	fprintf(file, "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", id, start_us,
+		dur_us);
+}
+
+/*
+ * Turns the events of the segments of an ID, which are in stream order, into
+ * busy intervals. An interval that is still open at the end of the trace
+ * ends at the last event.
+ */
+static uint64_t write_source(FILE *file, struct decode_ctx *ctx, uint32_t id,
+				uint64_t busy_mask, uint64_t idle_mask,
+				uint64_t t0, uint64_t freq)
+{
+	struct decode_segment *seg;
+	struct decode_event *ev;
+	uint64_t start = 0, last = 0, num_intervals = 0, j;
+	bool busy = false, named = false;
+	uint32_t i;
+
+	for (i = 0 ; i < ctx->num_segments ; i++) {
+		seg = &ctx->segments[i];
+		if (seg->id != id)
+			continue;
+
+		for (j = 0 ; j < seg->num_events ; j++) {
+			ev = &seg->events[j];
+			last = ev->ts;
+
+			if (!named) {
+				write_source_name(file, id);
+				named = true;
+			}
+
+			if (busy && (ev->vector & idle_mask)) {
+				write_interval(file, id, start, ev->ts, t0,
+						freq);
+				num_intervals++;
+				busy = false;
+			}
+
+			if (!busy && (ev->vector & busy_mask)) {
+				start = ev->ts;
+				busy = true;
+			}
+		}
+	}
+
+	if (busy) {
+		write_interval(file, id, start, last, t0, freq);
+		num_intervals++;
+	}
+
+	return num_intervals;
+}
+
+static int write_json(struct decode_ctx *ctx,
+			const struct hlthunk_trace_decode_params *params,
+			struct hlthunk_trace_decode_stats *stats)
+{
+	uint64_t t0 = UINT64_MAX, freq = params->ts_freq;
+	struct decode_segment *seg;
+	bool has_events[HLTHUNK_TRACE_MAX_IDS] = { false };
+	uint32_t i;
+	FILE *file;
+	int rc = 0;
+
+	for (i = 0 ; i < ctx->num_segments ; i++) {
+		seg = &ctx->segments[i];
+		if (!freq)
+			freq = seg->freq;
+		if (seg->err)
+			stats->num_errors++;
+		if (!seg->num_events)
+			continue;
+
+		has_events[seg->id] = true;
+		stats->num_events += seg->num_events;
+		if (seg->events[0].ts < t0)
+			t0 = seg->events[0].ts;
+	}
+
+	if (stats->num_events && !freq)
+		return -ENODATA;
+
+	file = fopen(params->json_path, "w");
+	if (!file)
+		return -errno;
+
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,");
+	fprintf(file, "\"args\":{\"name\":\"Goya\"}}");
+
+	for (i = 0 ; i < HLTHUNK_TRACE_MAX_IDS ; i++) {
+		if (!has_events[i])
+			continue;
+
+		stats->num_sources++;
+		stats->num_intervals += write_source(file, ctx, i,
+						1ull << params->busy_event,
+						1ull << params->idle_event,
+						t0, freq);
+	}
+
+	fprintf(file, "\n]}\n");
+
+	if (fclose(file))
+		rc = -EIO;
+
+	return rc;
+}
+
+/*
+ * Splits a trace file into the stream of every trace ID. The streams must be
+ * zeroed and are freed with hlthunk_trace_free_streams, also on failure
+ */
+int hlthunk_trace_read_streams(const char *path,
+				struct hlthunk_trace_stream *streams)
+{
+	struct stat st;
+	void *data;
+	int rc, fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		rc = -errno;
+		close(fd);
+		return rc;
+	}
+
+	if (!st.st_size) {
+		close(fd);
+		return 0;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	rc = data == MAP_FAILED ? -errno : 0;
+	close(fd);
+	if (rc)
+		return rc;
+
+	rc = deframe(streams, data, st.st_size);
+	munmap(data, st.st_size);
+
+	return rc;
+}
+
+void hlthunk_trace_free_streams(struct hlthunk_trace_stream *streams)
+{
+	uint32_t i;
+
+	for (i = 0 ; i < HLTHUNK_TRACE_MAX_IDS ; i++) {
+		free(streams[i].buf);
+		memset(&streams[i], 0, sizeof(streams[i]));
+	}
+}
+
+static void free_ctx(struct decode_ctx *ctx)
+{
+	uint32_t i;
+
+	for (i = 0 ; i < ctx->num_segments ; i++)
+		free(ctx->segments[i].events);
+	hlthunk_trace_free_streams(ctx->streams);
+	free(ctx->segments);
+	pthread_mutex_destroy(&ctx->lock);
+	hlthunk_free(ctx);
+}
+
+/**
+ * This function decodes a trace of the STMs into the busy intervals of their
+ * engines, which it writes in the Chrome trace event format, one timeline per
+ * STM
+ * @param params the trace, the output and the events that mark the engines
+ * busy and idle
+ * @param stats returned statistics of the decoding. May be NULL
+ * @return 0 for success, -ENODATA if the trace has no timestamp frequency and
+ * none was given, negative value for other failures
+ */
+hlthunk_public int hlthunk_trace_decode(
+			const struct hlthunk_trace_decode_params *params,
+			struct hlthunk_trace_decode_stats *stats)
+{
+	struct hlthunk_trace_decode_stats local_stats;
+	struct decode_ctx *ctx;
+	uint32_t i;
+	int rc;
+
+	if (!params || !params->trace_path || !params->json_path ||
+			params->busy_event >= 64 || params->idle_event >= 64 ||
+			params->busy_event == params->idle_event)
+		return -EINVAL;
+
+	if (!stats)
+		stats = &local_stats;
+	memset(stats, 0, sizeof(*stats));
+
+	ctx = hlthunk_malloc(sizeof(*ctx));
+	if (!ctx)
+		return -ENOMEM;
+
+	if (pthread_mutex_init(&ctx->lock, NULL)) {
+		hlthunk_free(ctx);
+		return -ENOMEM;
+	}
+
+	rc = hlthunk_trace_read_streams(params->trace_path, ctx->streams);
+	if (rc)
+		goto free_ctx;
+
+	for (i = 0 ; i < HLTHUNK_TRACE_MAX_IDS && !rc ; i++)
+		if (ctx->streams[i].len)
+			rc = split_stream(ctx, i);
+	if (rc)
+		goto free_ctx;
+
+	stats->num_segments = ctx->num_segments;
+
+	rc = decode_parallel(ctx, params->num_threads);
+	if (rc)
+		goto free_ctx;
+
+	rc = write_json(ctx, params, stats);
+
+free_ctx:
+	free_ctx(ctx);
+
+	return rc;
+}
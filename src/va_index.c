@@ -0,0 +1,876 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "libhlthunk.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * Index of the host memory areas that are mapped to the devices, which
+ * translates any address inside an area between the host and the device.
+ *
+ * The index holds the areas twice, sorted by (fd, host address) and by
+ * (fd, device VA). Every order is split into chunks of up to VA_CHUNK_SIZE
+ * areas, and a snapshot is a directory of the chunks of both orders. Chunks
+ * and snapshots are never modified once they are published, so readers search
+ * the current snapshot without taking a lock. A writer copies only the
+ * directory and the chunks it changes, publishes the new snapshot and retires
+ * the replaced ones.
+ *
+ * Retired objects are reclaimed by later writers, without waiting for the
+ * readers. A reader registers in one of two counters, selected by the current
+ * epoch. The epoch only advances when the counter of the previous epoch is
+ * drained, so readers are always in the current or the previous epoch, and an
+ * object that was retired in an epoch is unused two epochs later. Reclaimed
+ * objects are cached for the next writers, the rest are freed after va_lock
+ * is released.
+ *
+ * The same host area may be mapped more than once, so host areas may overlap.
+ * Every host entry keeps the largest end address of the entries of its fd up
+ * to it in its chunk, and every chunk in the directory keeps the largest end
+ * address of the entries of the fd of its last entry up to its end. Together
+ * they bound how far back a lookup has to look.
+ */
+
+#define VA_CHUNK_SIZE		64
+/* How many free chunks and snapshots are kept for reuse */
+#define VA_CACHE_SIZE		64
+
+enum va_order {
+	VA_BY_HOST,
+	VA_BY_DEV,
+	VA_NUM_ORDERS
+};
+
+/* Link of a retired or free chunk or snapshot */
+struct va_garbage {
+	struct va_garbage *next;
+	uint64_t epoch;
+	bool is_snap;
+};
+
+struct va_range {
+	uint64_t host_addr;
+	uint64_t device_virt_addr;
+	uint64_t size;
+	int fd;
+};
+
+struct va_chunk {
+	struct va_garbage gc;
+	uint32_t num;
+	struct va_range ranges[VA_CHUNK_SIZE];
+	/* Host order only */
+	uint64_t max_end[VA_CHUNK_SIZE];
+};
+
+struct va_dir {
+	struct va_chunk *chunk;
+	/* Host order only */
+	uint64_t max_end;
+};
+
+struct va_snap {
+	struct va_garbage gc;
+	uint32_t num[VA_NUM_ORDERS];
+	uint32_t max_dirs;
+	/* The chunks of the host order and then of the device order */
+	struct va_dir dirs[];
+};
+
+static struct va_snap *va_snap;
+static uint64_t va_epoch;
+static uint32_t va_readers[2];
+static pthread_mutex_t va_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Protected by va_lock */
+static struct va_garbage *va_retired, **va_retired_tail = &va_retired;
+static struct va_garbage *va_free_chunks, *va_free_snaps;
+static uint32_t va_num_free_chunks, va_num_free_snaps;
+
+static uint64_t va_read_lock(void)
+{
+	uint64_t epoch;
+
+	while (true) {
+		epoch = __atomic_load_n(&va_epoch, __ATOMIC_SEQ_CST);
+		__atomic_fetch_add(&va_readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&va_epoch, __ATOMIC_SEQ_CST) == epoch)
+			return epoch;
+		__atomic_fetch_sub(&va_readers[epoch & 1], 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void va_read_unlock(uint64_t epoch)
+{
+	__atomic_fetch_sub(&va_readers[epoch & 1], 1, __ATOMIC_RELEASE);
+}
+
+/* Must be called with va_lock held */
+static void va_retire(struct va_garbage *list)
+{
+	struct va_garbage *next;
+
+	for ( ; list ; list = next) {
+		next = list->next;
+		list->next = NULL;
+		list->epoch = va_epoch;
+		*va_retired_tail = list;
+		va_retired_tail = &list->next;
+	}
+}
+
+/*
+ * Moves to the next epochs whose previous epoch has no readers, and reclaims
+ * the objects that were retired two epochs ago or earlier. Returns the objects
+ * that don't fit in the caches, which are freed without va_lock. Must be
+ * called with va_lock held.
+ */
+static struct va_garbage *va_reclaim(void)
+{
+	struct va_garbage *gc, *garbage = NULL;
+	uint64_t epoch = va_epoch;
+	int i;
+
+	for (i = 0 ; i < 2 ; i++) {
+		if (__atomic_load_n(&va_readers[(epoch + 1) & 1],
+					__ATOMIC_SEQ_CST))
+			break;
+		__atomic_store_n(&va_epoch, ++epoch, __ATOMIC_SEQ_CST);
+	}
+
+	while (va_retired && va_retired->epoch + 2 <= epoch) {
+		gc = va_retired;
+		va_retired = gc->next;
+		if (!va_retired)
+			va_retired_tail = &va_retired;
+
+		if (gc->is_snap && va_num_free_snaps < VA_CACHE_SIZE) {
+			gc->next = va_free_snaps;
+			va_free_snaps = gc;
+			va_num_free_snaps++;
+		} else if (!gc->is_snap && va_num_free_chunks < VA_CACHE_SIZE) {
+			gc->next = va_free_chunks;
+			va_free_chunks = gc;
+			va_num_free_chunks++;
+		} else {
+			gc->next = garbage;
+			garbage = gc;
+		}
+	}
+
+	return garbage;
+}
+
+static void va_write_unlock(void)
+{
+	struct va_garbage *garbage = va_reclaim(), *next;
+
+	pthread_mutex_unlock(&va_lock);
+
+	for ( ; garbage ; garbage = next) {
+		next = garbage->next;
+		free(garbage);
+	}
+}
+
+/* Must be called with va_lock held */
+static struct va_chunk *chunk_get(void)
+{
+	struct va_chunk *chunk;
+
+	if (!va_free_chunks) {
+		chunk = malloc(sizeof(*chunk));
+		if (chunk)
+			chunk->gc.is_snap = false;
+		return chunk;
+	}
+
+	chunk = (struct va_chunk *) va_free_chunks;
+	va_free_chunks = chunk->gc.next;
+	va_num_free_chunks--;
+
+	return chunk;
+}
+
+/* Returns a chunk that was never published. Must be called with va_lock held */
+static void chunk_put(struct va_chunk *chunk)
+{
+	chunk->gc.next = va_free_chunks;
+	va_free_chunks = &chunk->gc;
+	va_num_free_chunks++;
+}
+
+/* Gets num chunks or none of them. Must be called with va_lock held */
+static int chunks_get(struct va_chunk **chunks, uint32_t num)
+{
+	uint32_t i;
+
+	for (i = 0 ; i < num ; i++) {
+		chunks[i] = chunk_get();
+		if (!chunks[i]) {
+			while (i--)
+				chunk_put(chunks[i]);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+/* Must be called with va_lock held */
+static struct va_snap *snap_get(uint32_t max_dirs)
+{
+	struct va_snap *snap = NULL;
+
+	if (va_free_snaps) {
+		snap = (struct va_snap *) va_free_snaps;
+		va_free_snaps = snap->gc.next;
+		va_num_free_snaps--;
+
+		if (snap->max_dirs < max_dirs) {
+			free(snap);
+			snap = NULL;
+		}
+	}
+
+	if (!snap) {
+		/* Leave room for the next chunks, as the index grows */
+		max_dirs += max_dirs / 2 + 8;
+		snap = malloc(sizeof(*snap) + max_dirs * sizeof(struct va_dir));
+		if (!snap)
+			return NULL;
+		snap->gc.is_snap = true;
+		snap->max_dirs = max_dirs;
+	}
+
+	snap->num[VA_BY_HOST] = 0;
+	snap->num[VA_BY_DEV] = 0;
+
+	return snap;
+}
+
+static void snap_put(struct va_snap *snap)
+{
+	snap->gc.next = va_free_snaps;
+	va_free_snaps = &snap->gc;
+	va_num_free_snaps++;
+}
+
+static struct va_dir *snap_dirs(struct va_snap *snap, enum va_order order)
+{
+	return order == VA_BY_HOST ? snap->dirs :
+					snap->dirs + snap->num[VA_BY_HOST];
+}
+
+static uint64_t range_key(const struct va_range *r, enum va_order order)
+{
+	return order == VA_BY_HOST ? r->host_addr : r->device_virt_addr;
+}
+
+static bool range_before(const struct va_range *r, enum va_order order,
+				int fd, uint64_t addr)
+{
+	return r->fd < fd || (r->fd == fd && range_key(r, order) <= addr);
+}
+
+/* Returns the number of chunks whose first entry sorts before or at the key */
+static uint32_t dir_upper_bound(const struct va_dir *dirs, uint32_t num,
+				enum va_order order, int fd, uint64_t addr)
+{
+	uint32_t lo = 0, hi = num, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (range_before(&dirs[mid].chunk->ranges[0], order, fd, addr))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Returns the number of entries that sort before or at the key */
+static uint32_t chunk_upper_bound(const struct va_chunk *chunk,
+					enum va_order order, int fd,
+					uint64_t addr)
+{
+	uint32_t lo = 0, hi = chunk->num, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (range_before(&chunk->ranges[mid], order, fd, addr))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void chunk_fill_max_end(struct va_chunk *chunk)
+{
+	struct va_range *r;
+	uint64_t end;
+	uint32_t i;
+
+	for (i = 0 ; i < chunk->num ; i++) {
+		r = &chunk->ranges[i];
+		end = r->host_addr + r->size;
+
+		if (i && chunk->ranges[i - 1].fd == r->fd &&
+				chunk->max_end[i - 1] > end)
+			end = chunk->max_end[i - 1];
+
+		chunk->max_end[i] = end;
+	}
+}
+
+static void snap_fill_max_end(struct va_snap *snap)
+{
+	struct va_dir *dirs = snap_dirs(snap, VA_BY_HOST);
+	struct va_chunk *chunk, *prev;
+	uint64_t end;
+	uint32_t i;
+
+	for (i = 0 ; i < snap->num[VA_BY_HOST] ; i++) {
+		chunk = dirs[i].chunk;
+		end = chunk->max_end[chunk->num - 1];
+
+		if (i) {
+			prev = dirs[i - 1].chunk;
+			if (prev->ranges[prev->num - 1].fd ==
+					chunk->ranges[chunk->num - 1].fd &&
+					dirs[i - 1].max_end > end)
+				end = dirs[i - 1].max_end;
+		}
+
+		dirs[i].max_end = end;
+	}
+}
+
+/*
+ * Fills an order of a new snapshot with the chunks of the old one, where num
+ * chunks from index first are replaced by the new chunks. The host order must
+ * be filled before the device order.
+ */
+static void snap_splice(struct va_snap *snap, struct va_snap *old,
+			enum va_order order, uint32_t first, uint32_t num,
+			struct va_chunk **chunks, uint32_t num_chunks)
+{
+	struct va_dir *dst = snap_dirs(snap, order), *src;
+	uint32_t i, num_old = old ? old->num[order] : 0;
+
+	if (num_old) {
+		src = snap_dirs(old, order);
+		memcpy(dst, src, first * sizeof(*dst));
+		memcpy(&dst[first + num_chunks], &src[first + num],
+			(num_old - first - num) * sizeof(*dst));
+	}
+
+	for (i = 0 ; i < num_chunks ; i++)
+		dst[first + i].chunk = chunks[i];
+
+	snap->num[order] = num_old - num + num_chunks;
+
+	if (order == VA_BY_HOST)
+		for (i = 0 ; i < num_chunks ; i++)
+			chunk_fill_max_end(chunks[i]);
+}
+
+/* Publishes a snapshot and retires the old one. Must be called with va_lock */
+static void snap_publish(struct va_snap *snap, struct va_snap *old,
+				struct va_garbage *retired)
+{
+	snap_fill_max_end(snap);
+
+	__atomic_store_n(&va_snap, snap, __ATOMIC_SEQ_CST);
+
+	if (old) {
+		old->gc.next = retired;
+		retired = &old->gc;
+	}
+
+	va_retire(retired);
+}
+
+/*
+ * Inserts an area into an order of a new snapshot. A full chunk is split in
+ * two, so the new chunks must have room for two.
+ */
+static uint32_t snap_insert(struct va_snap *snap, struct va_snap *old,
+				enum va_order order,
+				const struct va_range *range,
+				struct va_chunk **chunks,
+				struct va_garbage **retired)
+{
+	struct va_range ranges[VA_CHUNK_SIZE + 1];
+	struct va_chunk *chunk;
+	uint32_t c, i, half, num = old ? old->num[order] : 0;
+	uint64_t key = range_key(range, order);
+
+	if (!num) {
+		chunks[0]->num = 1;
+		chunks[0]->ranges[0] = *range;
+		snap_splice(snap, old, order, 0, 0, chunks, 1);
+		return 1;
+	}
+
+	c = dir_upper_bound(snap_dirs(old, order), num, order, range->fd, key);
+	if (c)
+		c--;
+
+	chunk = snap_dirs(old, order)[c].chunk;
+	i = chunk_upper_bound(chunk, order, range->fd, key);
+
+	memcpy(ranges, chunk->ranges, i * sizeof(*range));
+	ranges[i] = *range;
+	memcpy(&ranges[i + 1], &chunk->ranges[i],
+		(chunk->num - i) * sizeof(*range));
+
+	chunk->gc.next = *retired;
+	*retired = &chunk->gc;
+
+	if (chunk->num < VA_CHUNK_SIZE) {
+		chunks[0]->num = chunk->num + 1;
+		memcpy(chunks[0]->ranges, ranges,
+			chunks[0]->num * sizeof(*range));
+		snap_splice(snap, old, order, c, 1, chunks, 1);
+		return 1;
+	}
+
+	half = (VA_CHUNK_SIZE + 1) / 2;
+	chunks[0]->num = half;
+	memcpy(chunks[0]->ranges, ranges, half * sizeof(*range));
+	chunks[1]->num = VA_CHUNK_SIZE + 1 - half;
+	memcpy(chunks[1]->ranges, &ranges[half],
+		chunks[1]->num * sizeof(*range));
+	snap_splice(snap, old, order, c, 1, chunks, 2);
+
+	return 2;
+}
+
+/**
+ * This function adds a mapped host area to the index
+ * @param fd file descriptor of the device the area is mapped to
+ * @param host_virt_addr start of the area on the host
+ * @param size size of the area
+ * @param device_virt_addr start of the area in the device address space
+ * @return 0 for success, negative value for failure
+ */
+int hlthunk_va_index_add(int fd, void *host_virt_addr, uint64_t size,
+				uint64_t device_virt_addr)
+{
+	struct va_range range = {
+		.host_addr = (uintptr_t) host_virt_addr,
+		.device_virt_addr = device_virt_addr,
+		.size = size,
+		.fd = fd
+	};
+	struct va_chunk *chunks[2 * VA_NUM_ORDERS];
+	struct va_garbage *retired = NULL;
+	struct va_snap *old, *snap;
+	uint32_t used, i;
+	int rc;
+
+	pthread_mutex_lock(&va_lock);
+
+	old = va_snap;
+
+	/* Every order may have its chunk split in two */
+	rc = chunks_get(chunks, 2 * VA_NUM_ORDERS);
+	if (rc)
+		goto out;
+
+	snap = snap_get((old ? old->num[VA_BY_HOST] + old->num[VA_BY_DEV] :
+				0) + VA_NUM_ORDERS);
+	if (!snap) {
+		for (i = 0 ; i < 2 * VA_NUM_ORDERS ; i++)
+			chunk_put(chunks[i]);
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	used = snap_insert(snap, old, VA_BY_HOST, &range, chunks, &retired);
+	for (i = used ; i < 2 ; i++)
+		chunk_put(chunks[i]);
+
+	used = snap_insert(snap, old, VA_BY_DEV, &range, &chunks[2],
+				&retired);
+	for (i = 2 + used ; i < 2 * VA_NUM_ORDERS ; i++)
+		chunk_put(chunks[i]);
+
+	snap_publish(snap, old, retired);
+
+out:
+	va_write_unlock();
+
+	return rc;
+}
+
+/*
+ * Finds the entry of a device VA in both orders. Returns false if the VA isn't
+ * in the index. Must be called with va_lock held.
+ */
+static bool snap_find_va(struct va_snap *snap, int fd, uint64_t va,
+				uint32_t *chunk_idx, uint32_t *entry_idx)
+{
+	struct va_dir *dirs = snap_dirs(snap, VA_BY_DEV);
+	struct va_chunk *chunk;
+	struct va_range *r;
+	uint32_t c, i;
+
+	c = dir_upper_bound(dirs, snap->num[VA_BY_DEV], VA_BY_DEV, fd, va);
+	if (!c)
+		return false;
+
+	chunk = dirs[c - 1].chunk;
+	i = chunk_upper_bound(chunk, VA_BY_DEV, fd, va);
+	r = &chunk->ranges[i - 1];
+	if (r->fd != fd || r->device_virt_addr != va)
+		return false;
+
+	chunk_idx[VA_BY_DEV] = c - 1;
+	entry_idx[VA_BY_DEV] = i - 1;
+
+	/* The entries of the same host area are next to each other */
+	dirs = snap_dirs(snap, VA_BY_HOST);
+	c = dir_upper_bound(dirs, snap->num[VA_BY_HOST], VA_BY_HOST, fd,
+				r->host_addr);
+	chunk = dirs[--c].chunk;
+	i = chunk_upper_bound(chunk, VA_BY_HOST, fd, r->host_addr);
+
+	while (true) {
+		if (!i) {
+			if (!c)
+				return false;
+			chunk = dirs[--c].chunk;
+			i = chunk->num;
+		}
+
+		if (chunk->ranges[i - 1].device_virt_addr == va &&
+				chunk->ranges[i - 1].fd == fd)
+			break;
+		i--;
+	}
+
+	chunk_idx[VA_BY_HOST] = c;
+	entry_idx[VA_BY_HOST] = i - 1;
+
+	return true;
+}
+
+/**
+ * This function removes a mapped host area from the index
+ * @param fd file descriptor of the device the area is mapped to
+ * @param device_virt_addr start of the area in the device address space
+ * @param host_virt_addr returned start of the area on the host
+ * @param size returned size of the area
+ * @return 1 if the area was removed, 0 if it isn't in the index, negative
+ * value for failure
+ */
+int hlthunk_va_index_remove(int fd, uint64_t device_virt_addr,
+				void **host_virt_addr, uint64_t *size)
+{
+	uint32_t chunk_idx[VA_NUM_ORDERS], entry_idx[VA_NUM_ORDERS], i;
+	struct va_chunk *chunks[VA_NUM_ORDERS], *chunk;
+	struct va_garbage *retired = NULL;
+	struct va_snap *old, *snap;
+	struct va_range *removed;
+	int order, rc;
+
+	pthread_mutex_lock(&va_lock);
+
+	old = va_snap;
+	if (!old || !snap_find_va(old, fd, device_virt_addr, chunk_idx,
+					entry_idx)) {
+		rc = 0;
+		goto out;
+	}
+
+	rc = chunks_get(chunks, VA_NUM_ORDERS);
+	if (rc)
+		goto out;
+
+	snap = snap_get(old->num[VA_BY_HOST] + old->num[VA_BY_DEV]);
+	if (!snap) {
+		for (i = 0 ; i < VA_NUM_ORDERS ; i++)
+			chunk_put(chunks[i]);
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	chunk = snap_dirs(old, VA_BY_DEV)[chunk_idx[VA_BY_DEV]].chunk;
+	removed = &chunk->ranges[entry_idx[VA_BY_DEV]];
+	*host_virt_addr = (void *) (uintptr_t) removed->host_addr;
+	*size = removed->size;
+
+	for (order = VA_BY_HOST ; order < VA_NUM_ORDERS ; order++) {
+		chunk = snap_dirs(old, order)[chunk_idx[order]].chunk;
+		i = entry_idx[order];
+
+		chunks[order]->num = chunk->num - 1;
+		memcpy(chunks[order]->ranges, chunk->ranges,
+			i * sizeof(struct va_range));
+		memcpy(&chunks[order]->ranges[i], &chunk->ranges[i + 1],
+			(chunk->num - i - 1) * sizeof(struct va_range));
+
+		/* An empty chunk is dropped from the directory */
+		if (!chunks[order]->num)
+			chunk_put(chunks[order]);
+		snap_splice(snap, old, order, chunk_idx[order], 1,
+				&chunks[order], !!chunks[order]->num);
+
+		chunk->gc.next = retired;
+		retired = &chunk->gc;
+	}
+
+	snap_publish(snap, old, retired);
+	rc = 1;
+
+out:
+	va_write_unlock();
+
+	return rc;
+}
+
+/* Returns the range of the chunks of an order that hold entries of an fd */
+static uint32_t snap_fd_chunks(struct va_snap *snap, enum va_order order,
+				int fd, uint32_t *first)
+{
+	struct va_dir *dirs = snap_dirs(snap, order);
+	struct va_chunk *chunk;
+	uint32_t last, i;
+
+	/* The chunk before the first one that starts with the fd may hold it */
+	*first = dir_upper_bound(dirs, snap->num[order], order, fd - 1,
+					UINT64_MAX);
+	if (*first) {
+		chunk = dirs[*first - 1].chunk;
+		i = chunk_upper_bound(chunk, order, fd - 1, UINT64_MAX);
+		if (i < chunk->num && chunk->ranges[i].fd == fd)
+			(*first)--;
+	}
+	last = dir_upper_bound(dirs, snap->num[order], order, fd, UINT64_MAX);
+
+	return last - *first;
+}
+
+/*
+ * Removes the entries of an fd from an order of a new snapshot. The new chunks
+ * must have room for the chunks that snap_fd_chunks returned
+ */
+static uint32_t snap_remove_fd(struct va_snap *snap, struct va_snap *old,
+				enum va_order order, int fd,
+				struct va_chunk **chunks,
+				struct va_garbage **retired)
+{
+	struct va_chunk *chunk;
+	uint32_t first, num_old, c, i, num = 0;
+
+	num_old = snap_fd_chunks(old, order, fd, &first);
+
+	for (c = first ; c < first + num_old ; c++) {
+		chunk = snap_dirs(old, order)[c].chunk;
+		chunks[num]->num = 0;
+		for (i = 0 ; i < chunk->num ; i++)
+			if (chunk->ranges[i].fd != fd)
+				chunks[num]->ranges[chunks[num]->num++] =
+							chunk->ranges[i];
+
+		chunk->gc.next = *retired;
+		*retired = &chunk->gc;
+
+		/* An empty chunk is dropped from the directory */
+		if (chunks[num]->num)
+			num++;
+	}
+
+	for (c = num ; c < num_old ; c++)
+		chunk_put(chunks[c]);
+
+	snap_splice(snap, old, order, first, num_old, chunks, num);
+
+	return num_old;
+}
+
+/**
+ * This function removes all the areas of a device from the index
+ * @param fd file descriptor of the device
+ */
+void hlthunk_va_index_remove_fd(int fd)
+{
+	struct va_chunk **chunks = NULL;
+	struct va_garbage *retired = NULL;
+	struct va_snap *old, *snap;
+	uint32_t first, num;
+
+	pthread_mutex_lock(&va_lock);
+
+	old = va_snap;
+	if (!old)
+		goto out;
+
+	num = snap_fd_chunks(old, VA_BY_HOST, fd, &first) +
+		snap_fd_chunks(old, VA_BY_DEV, fd, &first);
+	if (!num)
+		goto out;
+
+	chunks = calloc(num, sizeof(*chunks));
+	if (!chunks || chunks_get(chunks, num))
+		goto out;
+
+	snap = snap_get(old->num[VA_BY_HOST] + old->num[VA_BY_DEV]);
+	if (!snap) {
+		while (num--)
+			chunk_put(chunks[num]);
+		goto out;
+	}
+
+	num = snap_remove_fd(snap, old, VA_BY_HOST, fd, chunks, &retired);
+	snap_remove_fd(snap, old, VA_BY_DEV, fd, &chunks[num], &retired);
+
+	snap_publish(snap, old, retired);
+
+out:
+	va_write_unlock();
+	free(chunks);
+}
+
+/**
+ * This function translates a host address inside a mapped host memory area
+ * to the device VA that maps it. It doesn't take any lock
+ * @param fd file descriptor of the device the area is mapped to
+ * @param host_virt_addr the host address, anywhere inside the area
+ * @param device_virt_addr returned device VA of the address
+ * @return 0 for success, -ENOENT if the address isn't mapped to the device
+ */
+hlthunk_public int hlthunk_host_ptr_to_device_va(int fd,
+						const void *host_virt_addr,
+						uint64_t *device_virt_addr)
+{
+	uint64_t addr = (uintptr_t) host_virt_addr, epoch;
+	struct va_chunk *chunk, *prev;
+	struct va_snap *snap;
+	struct va_dir *dirs;
+	struct va_range *r;
+	uint32_t c, i;
+	int rc = -ENOENT;
+
+	if (!device_virt_addr)
+		return -EINVAL;
+
+	epoch = va_read_lock();
+
+	snap = __atomic_load_n(&va_snap, __ATOMIC_ACQUIRE);
+	if (!snap)
+		goto out;
+
+	dirs = snap_dirs(snap, VA_BY_HOST);
+	c = dir_upper_bound(dirs, snap->num[VA_BY_HOST], VA_BY_HOST, fd, addr);
+	if (!c)
+		goto out;
+
+	chunk = dirs[--c].chunk;
+	i = chunk_upper_bound(chunk, VA_BY_HOST, fd, addr);
+
+	/* Walk back from the last area that starts at or before the address */
+	while (true) {
+		if (!i) {
+			if (!c)
+				break;
+			prev = dirs[c - 1].chunk;
+			if (prev->ranges[prev->num - 1].fd != fd ||
+					dirs[c - 1].max_end <= addr)
+				break;
+			chunk = prev;
+			i = chunk->num;
+			c--;
+		}
+
+		r = &chunk->ranges[i - 1];
+		if (r->fd != fd)
+			break;
+
+		/* No area up to this one in the chunk is long enough */
+		if (chunk->max_end[i - 1] <= addr) {
+			i = 0;
+			continue;
+		}
+
+		if (addr < r->host_addr + r->size) {
+			*device_virt_addr = r->device_virt_addr +
+						(addr - r->host_addr);
+			rc = 0;
+			break;
+		}
+
+		i--;
+	}
+
+out:
+	va_read_unlock(epoch);
+	return rc;
+}
+
+/**
+ * This function translates a device VA inside a mapped host memory area to
+ * the host address it maps. It doesn't take any lock
+ * @param fd file descriptor of the device the area is mapped to
+ * @param device_virt_addr the device VA, anywhere inside the area
+ * @param host_virt_addr returned host address
+ * @return 0 for success, -ENOENT if the VA doesn't map host memory
+ */
+hlthunk_public int hlthunk_device_va_to_host_ptr(int fd,
+						uint64_t device_virt_addr,
+						void **host_virt_addr)
+{
+	struct va_chunk *chunk;
+	struct va_snap *snap;
+	struct va_dir *dirs;
+	struct va_range *r;
+	uint64_t epoch;
+	uint32_t c, i;
+	int rc = -ENOENT;
+
+	if (!host_virt_addr)
+		return -EINVAL;
+
+	epoch = va_read_lock();
+
+	snap = __atomic_load_n(&va_snap, __ATOMIC_ACQUIRE);
+	if (!snap)
+		goto out;
+
+	dirs = snap_dirs(snap, VA_BY_DEV);
+	c = dir_upper_bound(dirs, snap->num[VA_BY_DEV], VA_BY_DEV, fd,
+				device_virt_addr);
+	if (!c)
+		goto out;
+
+	/* Device areas don't overlap, only the last one before the VA fits */
+	chunk = dirs[c - 1].chunk;
+	i = chunk_upper_bound(chunk, VA_BY_DEV, fd, device_virt_addr);
+	if (i) {
+		r = &chunk->ranges[i - 1];
+		if (r->fd == fd && device_virt_addr <
+				r->device_virt_addr + r->size) {
+			*host_virt_addr = (void *) (uintptr_t)
+					(r->host_addr + device_virt_addr -
+						r->device_virt_addr);
+			rc = 0;
+		}
+	}
+
+out:
+	va_read_unlock(epoch);
+	return rc;
+}
@@ -73,6 +73,70 @@ void test_cb_skip_unmap_and_destroy(void **state)
 	cb_create_mmap_unmap_destroy(state, 92517, false, false);
 }
 
+void test_cb_cache_dedup(void **state)
+{
+	struct hltests_state *tests_state = (struct hltests_state *) *state;
+	struct hlthunk_cb_cache_stats stats;
+	struct hl_cs_chunk execute_arr[1];
+	struct hlthunk_cs_in cs_in;
+	struct hlthunk_cs_out cs_out;
+	uint64_t cb_handle, cb_handle2;
+	uint32_t pkts_size = 0, i;
+	uint8_t pkts[0x100];
+	void *cache;
+	int rc, fd = tests_state->fd;
+
+	cache = hlthunk_cb_cache_create(fd, 16);
+	assert_non_null(cache);
+
+	for (i = 0 ; i < 4 ; i++)
+		pkts_size = hltests_add_nop_pkt(fd, pkts, pkts_size,
+						EB_FALSE, i == 3);
+
+	rc = hlthunk_cb_cache_get(cache, pkts, pkts_size, true, &cb_handle);
+	assert_int_equal(rc, 0);
+
+	memset(execute_arr, 0, sizeof(execute_arr));
+	execute_arr[0].cb_handle = cb_handle;
+	execute_arr[0].cb_size = pkts_size;
+	execute_arr[0].queue_index =
+			hltests_get_dma_down_qid(fd, DCORE0, STREAM0);
+
+	memset(&cs_in, 0, sizeof(cs_in));
+	cs_in.chunks_execute = execute_arr;
+	cs_in.num_chunks_execute = 1;
+
+	memset(&cs_out, 0, sizeof(cs_out));
+	rc = hlthunk_command_submission(fd, &cs_in, &cs_out);
+	assert_int_equal(rc, 0);
+	assert_int_equal(cs_out.status, HL_CS_STATUS_SUCCESS);
+
+	rc = hlthunk_cb_cache_put(cache, cb_handle, cs_out.seq);
+	assert_int_equal(rc, 0);
+
+	/* Identical packets must be served from the cache */
+	rc = hlthunk_cb_cache_get(cache, pkts, pkts_size, true, &cb_handle2);
+	assert_int_equal(rc, 0);
+	assert_int_equal(cb_handle, cb_handle2);
+
+	rc = hlthunk_cb_cache_put(cache, cb_handle2, 0);
+	assert_int_equal(rc, 0);
+
+	rc = hltests_wait_for_cs_until_not_busy(fd, cs_out.seq);
+	assert_int_equal(rc, HL_WAIT_CS_STATUS_COMPLETED);
+
+	rc = hlthunk_cb_cache_get_stats(cache, &stats);
+	assert_int_equal(rc, 0);
+	assert_int_equal(stats.hits, 1);
+	assert_int_equal(stats.misses, 1);
+	assert_int_equal(stats.bytes_avoided, pkts_size);
+
+	printf("CB cache hit rate %.2f, %lu bytes avoided\n",
+		(double) stats.hits / stats.lookups, stats.bytes_avoided);
+
+	hlthunk_cb_cache_destroy(cache);
+}
+
 const struct CMUnitTest cb_tests[] = {
 	cmocka_unit_test_setup(test_cb_mmap,
 				hltests_ensure_device_operational),
@@ -86,6 +150,8 @@ const struct CMUnitTest cb_tests[] = {
 				hltests_ensure_device_operational),
 	cmocka_unit_test_setup(test_cb_skip_unmap_and_destroy,
 				hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_cb_cache_dedup,
+				hltests_ensure_device_operational),
 };
 
 static const char *const usage[] = {
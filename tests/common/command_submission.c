@@ -7,6 +7,7 @@
 
 #include "hlthunk.h"
 #include "hlthunk_tests.h"
+#include "record.h"
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -17,6 +18,10 @@
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 void test_cs_nop(void **state)
 {
@@ -198,6 +203,639 @@ void test_cs_two_streams_with_fence(void **state)
 	assert_int_equal(rc, 0);
 }
 
+#define CS_RECORD_MAX_RECORDS		16
+
+void test_cs_record(void **state)
+{
+	struct hltests_state *tests_state =
+			(struct hltests_state *) *state;
+	static const uint16_t expected_types[] = {
+		REC_CB_CREATE, REC_BLOB, REC_CS, REC_WAIT_CS, REC_CB_DESTROY
+	};
+	const struct hlthunk_rec_file_hdr *file_hdr;
+	const struct hlthunk_rec_chunk *chunk;
+	const struct hlthunk_rec_hdr *hdr;
+	const struct hlthunk_rec_cs *cs;
+	uint16_t types[CS_RECORD_MAX_RECORDS];
+	char path[] = "/tmp/hlthunk_record_XXXXXX";
+	uint32_t cb_size = 0, queue_index, num_types = 0, i;
+	uint64_t offset;
+	off_t file_size;
+	uint8_t *buf;
+	void *cb;
+	int rc, tmp_fd, fd = tests_state->fd;
+
+	queue_index = hltests_get_dma_down_qid(fd, DCORE0, STREAM0);
+
+	tmp_fd = mkstemp(path);
+	assert_in_range(tmp_fd, 0, INT_MAX);
+
+	rc = hlthunk_record_start(fd, path);
+	assert_int_equal(rc, 0);
+
+	rc = hlthunk_record_start(fd, path);
+	assert_int_equal(rc, -EBUSY);
+
+	cb = hltests_create_cb(fd, getpagesize(), EXTERNAL, 0);
+	assert_non_null(cb);
+
+	cb_size = hltests_add_nop_pkt(fd, cb, cb_size, EB_FALSE, MB_FALSE);
+
+	hltests_submit_and_wait_cs(fd, cb, cb_size, queue_index,
+				DESTROY_CB_TRUE, HL_WAIT_CS_STATUS_COMPLETED);
+
+	rc = hlthunk_record_stop();
+	assert_int_equal(rc, 0);
+
+	file_size = lseek(tmp_fd, 0, SEEK_END);
+	assert_true(file_size >= (off_t) sizeof(*file_hdr));
+
+	buf = malloc(file_size);
+	assert_non_null(buf);
+	assert_int_equal(pread(tmp_fd, buf, file_size, 0), file_size);
+
+	file_hdr = (const struct hlthunk_rec_file_hdr *) buf;
+	assert_int_equal(file_hdr->magic, HLTHUNK_REC_MAGIC);
+	assert_int_equal(file_hdr->version, HLTHUNK_REC_VERSION);
+	assert_true(file_hdr->hdr_size <= file_size);
+
+	/* The records of the CB, its content, the CS and its wait */
+	for (offset = file_hdr->hdr_size ; offset < (uint64_t) file_size ;
+			offset += sizeof(*hdr) + hdr->size) {
+		assert_true(offset + sizeof(*hdr) <= (uint64_t) file_size);
+		hdr = (const struct hlthunk_rec_hdr *) (buf + offset);
+		assert_true(offset + sizeof(*hdr) + hdr->size <=
+				(uint64_t) file_size);
+
+		assert_true(num_types < CS_RECORD_MAX_RECORDS);
+		types[num_types++] = hdr->type;
+
+		if (hdr->type != REC_CS)
+			continue;
+
+		cs = (const struct hlthunk_rec_cs *) (hdr + 1);
+		assert_int_equal(cs->rc, 0);
+		assert_int_equal(cs->num_chunks_restore, 0);
+		assert_int_equal(cs->num_chunks_execute, 1);
+		assert_true(hdr->size >= sizeof(*cs) + sizeof(*chunk));
+
+		chunk = (const struct hlthunk_rec_chunk *) (cs + 1);
+		assert_int_equal(chunk->queue_index, queue_index);
+		assert_int_equal(chunk->cb_size, cb_size);
+		assert_int_not_equal(chunk->blob_id, 0);
+	}
+
+	assert_int_equal(num_types,
+			sizeof(expected_types) / sizeof(expected_types[0]));
+	for (i = 0 ; i < num_types ; i++)
+		assert_int_equal(types[i], expected_types[i]);
+
+	free(buf);
+	close(tmp_fd);
+	unlink(path);
+}
+
+#define CS_WINDOW_NUM_CS		64
+#define CS_WINDOW_DEPTH		4
+
+void test_cs_window(void **state)
+{
+	struct hltests_state *tests_state =
+			(struct hltests_state *) *state;
+	struct hlthunk_cs_window_stats stats;
+	struct hl_cs_chunk execute_arr[1];
+	struct hlthunk_cs_in cs_in;
+	struct hlthunk_cs_out cs_out;
+	uint64_t cb_handle;
+	uint32_t pkts_size, queue_index, i;
+	uint8_t pkts[0x100];
+	void *cache, *window;
+	int rc, fd = tests_state->fd;
+
+	queue_index = hltests_get_dma_down_qid(fd, DCORE0, STREAM0);
+
+	cache = hlthunk_cb_cache_create(fd, 1);
+	assert_non_null(cache);
+
+	pkts_size = hltests_add_nop_pkt(fd, pkts, 0, EB_FALSE, MB_FALSE);
+	rc = hlthunk_cb_cache_get(cache, pkts, pkts_size, true, &cb_handle);
+	assert_int_equal(rc, 0);
+
+	window = hlthunk_cs_window_create(fd, CS_WINDOW_DEPTH * 2);
+	assert_non_null(window);
+
+	rc = hlthunk_cs_window_set_depth(window, queue_index, CS_WINDOW_DEPTH);
+	assert_int_equal(rc, 0);
+
+	memset(execute_arr, 0, sizeof(execute_arr));
+	execute_arr[0].cb_handle = cb_handle;
+	execute_arr[0].cb_size = pkts_size;
+	execute_arr[0].queue_index = queue_index;
+
+	memset(&cs_in, 0, sizeof(cs_in));
+	cs_in.chunks_execute = execute_arr;
+	cs_in.num_chunks_execute = 1;
+
+	for (i = 0 ; i < CS_WINDOW_NUM_CS ; i++) {
+		rc = hlthunk_cs_window_submit(window, &cs_in, &cs_out, true);
+		assert_int_equal(rc, 0);
+	}
+
+	rc = hltests_wait_for_cs_until_not_busy(fd, cs_out.seq);
+	assert_int_equal(rc, HL_WAIT_CS_STATUS_COMPLETED);
+
+	rc = hlthunk_cs_window_get_stats(window, queue_index, &stats);
+	assert_int_equal(rc, 0);
+	assert_int_equal(stats.submitted, CS_WINDOW_NUM_CS);
+	assert_int_equal(stats.completed, CS_WINDOW_NUM_CS);
+	assert_int_equal(stats.inflight, 0);
+	assert_int_equal(stats.max_inflight, CS_WINDOW_DEPTH);
+	assert_in_range(stats.peak_inflight, 1, CS_WINDOW_DEPTH);
+
+	printf("Peak queue depth %u, %lu submissions waited for a credit\n",
+		stats.peak_inflight, stats.blocked);
+
+	hlthunk_cs_window_destroy(window);
+
+	rc = hlthunk_cb_cache_put(cache, cb_handle, cs_out.seq);
+	assert_int_equal(rc, 0);
+	hlthunk_cb_cache_destroy(cache);
+}
+
+#define CS_SUBMITTER_NUM_THREADS	4
+#define CS_SUBMITTER_NUM_ITEMS		64
+
+struct cs_submitter_thread_params {
+	void *submitter;
+	void *futures[CS_SUBMITTER_NUM_ITEMS];
+	uint64_t cb_handle;
+	uint32_t cb_size;
+	uint32_t queue_index;
+	int rc;
+};
+
+static void *cs_submitter_thread(void *args)
+{
+	struct cs_submitter_thread_params *params =
+			(struct cs_submitter_thread_params *) args;
+	int i;
+
+	for (i = 0 ; i < CS_SUBMITTER_NUM_ITEMS ; i++) {
+		params->rc = hlthunk_cs_submitter_push(params->submitter,
+					params->cb_handle, params->cb_size,
+					params->queue_index,
+					&params->futures[i]);
+		if (params->rc)
+			break;
+	}
+
+	return NULL;
+}
+
+void test_cs_submitter(void **state)
+{
+	struct hltests_state *tests_state =
+			(struct hltests_state *) *state;
+	struct cs_submitter_thread_params params[CS_SUBMITTER_NUM_THREADS];
+	pthread_t threads[CS_SUBMITTER_NUM_THREADS];
+	struct hlthunk_cs_submitter_stats stats;
+	uint64_t cb_handle, seq;
+	uint32_t pkts_size, status;
+	uint8_t pkts[0x100];
+	void *cache, *submitter;
+	int i, j, rc, fd = tests_state->fd;
+
+	cache = hlthunk_cb_cache_create(fd, 1);
+	assert_non_null(cache);
+
+	pkts_size = hltests_add_nop_pkt(fd, pkts, 0, EB_FALSE, MB_FALSE);
+	rc = hlthunk_cb_cache_get(cache, pkts, pkts_size, true, &cb_handle);
+	assert_int_equal(rc, 0);
+
+	submitter = hlthunk_cs_submitter_create(fd, UINT32_MAX, 16, 100);
+	assert_null(submitter);
+	assert_int_equal(errno, EINVAL);
+
+	submitter = hlthunk_cs_submitter_create(fd, 128, 16, 100);
+	assert_non_null(submitter);
+
+	for (i = 0 ; i < CS_SUBMITTER_NUM_THREADS ; i++) {
+		memset(&params[i], 0, sizeof(params[i]));
+		params[i].submitter = submitter;
+		params[i].cb_handle = cb_handle;
+		params[i].cb_size = pkts_size;
+		params[i].queue_index =
+			hltests_get_dma_down_qid(fd, DCORE0, STREAM0);
+
+		rc = pthread_create(&threads[i], NULL, cs_submitter_thread,
+					&params[i]);
+		assert_int_equal(rc, 0);
+	}
+
+	for (i = 0 ; i < CS_SUBMITTER_NUM_THREADS ; i++) {
+		pthread_join(threads[i], NULL);
+		assert_int_equal(params[i].rc, 0);
+	}
+
+	for (i = 0 ; i < CS_SUBMITTER_NUM_THREADS ; i++) {
+		for (j = 0 ; j < CS_SUBMITTER_NUM_ITEMS ; j++) {
+			rc = hlthunk_cs_future_wait(params[i].futures[j],
+					WAIT_FOR_CS_DEFAULT_TIMEOUT, &status);
+			assert_int_equal(rc, 0);
+			assert_int_equal(status, HL_WAIT_CS_STATUS_COMPLETED);
+
+			rc = hlthunk_cs_future_get_seq(params[i].futures[j],
+							&seq);
+			assert_int_equal(rc, 0);
+
+			hlthunk_cs_future_release(params[i].futures[j]);
+		}
+	}
+
+	rc = hlthunk_cs_submitter_get_stats(submitter, &stats);
+	assert_int_equal(rc, 0);
+	assert_int_equal(stats.items,
+			CS_SUBMITTER_NUM_THREADS * CS_SUBMITTER_NUM_ITEMS);
+	assert_in_range(stats.cs, 1, stats.items);
+	assert_int_equal(stats.failed_cs, 0);
+
+	printf("%lu items were submitted in %lu CSs\n", stats.items,
+		stats.cs);
+
+	hlthunk_cs_submitter_destroy(submitter);
+
+	rc = hlthunk_cb_cache_put(cache, cb_handle, seq);
+	assert_int_equal(rc, 0);
+	hlthunk_cb_cache_destroy(cache);
+}
+
+static uint32_t ctx_restore_read_sram(int fd, uint64_t sram_addr,
+					uint32_t *host_ptr)
+{
+	uint64_t host_addr = hltests_get_device_va_for_host_ptr(fd, host_ptr);
+
+	hltests_dma_transfer(fd, hltests_get_dma_up_qid(fd, DCORE0, STREAM0),
+				EB_FALSE, MB_TRUE, sram_addr, host_addr,
+				sizeof(uint32_t), GOYA_DMA_SRAM_TO_HOST);
+
+	return *host_ptr;
+}
+
+static void ctx_restore_submit_nop(int fd, void *ctx, uint64_t cb_handle,
+					uint32_t cb_size, uint32_t queue_index)
+{
+	struct hl_cs_chunk execute_arr[1];
+	struct hlthunk_cs_in cs_in;
+	struct hlthunk_cs_out cs_out;
+	int rc;
+
+	memset(execute_arr, 0, sizeof(execute_arr));
+	execute_arr[0].cb_handle = cb_handle;
+	execute_arr[0].cb_size = cb_size;
+	execute_arr[0].queue_index = queue_index;
+
+	memset(&cs_in, 0, sizeof(cs_in));
+	cs_in.chunks_execute = execute_arr;
+	cs_in.num_chunks_execute = 1;
+
+	rc = hlthunk_ctx_restore_submit(ctx, &cs_in, &cs_out);
+	assert_int_equal(rc, 0);
+
+	rc = hltests_wait_for_cs_until_not_busy(fd, cs_out.seq);
+	assert_int_equal(rc, HL_WAIT_CS_STATUS_COMPLETED);
+}
+
+void test_cs_ctx_restore(void **state)
+{
+	struct hltests_state *tests_state =
+			(struct hltests_state *) *state;
+	struct hlthunk_ctx_restore_stats stats;
+	struct hlthunk_hw_ip_info hw_ip;
+	struct hltests_pkt_info pkt_info;
+	uint64_t sram_addr, restore_handle, nop_handle;
+	uint32_t restore_size, nop_size, clear_size, queue_index, *host_ptr;
+	uint8_t restore_pkts[0x100], nop_pkts[0x100];
+	void *cache, *ctx, *clear_cb;
+	int rc, fd = tests_state->fd;
+
+	rc = hlthunk_get_hw_ip_info(fd, &hw_ip);
+	assert_int_equal(rc, 0);
+
+	sram_addr = hw_ip.sram_base_address + 0x2000;
+	queue_index = hltests_get_dma_down_qid(fd, DCORE0, STREAM0);
+
+	host_ptr = hltests_allocate_host_mem(fd, getpagesize(), NOT_HUGE);
+	assert_non_null(host_ptr);
+
+	cache = hlthunk_cb_cache_create(fd, 2);
+	assert_non_null(cache);
+
+	/* The restore CB writes a known value that the CSs can't write */
+	memset(&pkt_info, 0, sizeof(pkt_info));
+	pkt_info.eb = EB_FALSE;
+	pkt_info.mb = MB_TRUE;
+	pkt_info.msg_long.address = sram_addr;
+	pkt_info.msg_long.value = 0xc0ffee;
+	restore_size = hltests_add_msg_long_pkt(fd, restore_pkts, 0,
+						&pkt_info);
+	rc = hlthunk_cb_cache_get(cache, restore_pkts, restore_size, true,
+					&restore_handle);
+	assert_int_equal(rc, 0);
+
+	nop_size = hltests_add_nop_pkt(fd, nop_pkts, 0, EB_FALSE, MB_FALSE);
+	rc = hlthunk_cb_cache_get(cache, nop_pkts, nop_size, true,
+					&nop_handle);
+	assert_int_equal(rc, 0);
+
+	ctx = hlthunk_ctx_restore_create(fd);
+	assert_non_null(ctx);
+
+	rc = hlthunk_ctx_restore_set(ctx, queue_index, restore_handle,
+					restore_size);
+	assert_int_equal(rc, 0);
+
+	/* A new restore CB is dirty, so the first CS runs it */
+	ctx_restore_submit_nop(fd, ctx, nop_handle, nop_size, queue_index);
+	assert_int_equal(ctx_restore_read_sram(fd, sram_addr, host_ptr),
+				0xc0ffee);
+
+	/* Overwrite the restored value, the next CS must not restore it */
+	clear_cb = hltests_create_cb(fd, getpagesize(), EXTERNAL, 0);
+	assert_non_null(clear_cb);
+	pkt_info.msg_long.value = 0;
+	clear_size = hltests_add_msg_long_pkt(fd, clear_cb, 0, &pkt_info);
+	hltests_submit_and_wait_cs(fd, clear_cb, clear_size, queue_index,
+				DESTROY_CB_TRUE, HL_WAIT_CS_STATUS_COMPLETED);
+
+	ctx_restore_submit_nop(fd, ctx, nop_handle, nop_size, queue_index);
+	assert_int_equal(ctx_restore_read_sram(fd, sram_addr, host_ptr), 0);
+
+	rc = hlthunk_ctx_restore_mark_dirty(ctx, queue_index);
+	assert_int_equal(rc, 0);
+
+	ctx_restore_submit_nop(fd, ctx, nop_handle, nop_size, queue_index);
+	assert_int_equal(ctx_restore_read_sram(fd, sram_addr, host_ptr),
+				0xc0ffee);
+
+	rc = hlthunk_ctx_restore_get_stats(ctx, &stats);
+	assert_int_equal(rc, 0);
+	assert_int_equal(stats.cs, 3);
+	assert_int_equal(stats.restore_cs, 2);
+	assert_int_equal(stats.restore_chunks, 2);
+	assert_int_equal(stats.skipped_chunks, 1);
+
+	hlthunk_ctx_restore_destroy(ctx);
+
+	rc = hlthunk_cb_cache_put(cache, nop_handle, 0);
+	assert_int_equal(rc, 0);
+	rc = hlthunk_cb_cache_put(cache, restore_handle, 0);
+	assert_int_equal(rc, 0);
+	hlthunk_cb_cache_destroy(cache);
+
+	rc = hltests_free_host_mem(fd, host_ptr);
+	assert_int_equal(rc, 0);
+}
+
+#define CS_PROFILER_DMA_SIZE	0x100000
+#define CS_PROFILER_NUM_CS	4
+
+void test_cs_profiler(void **state)
+{
+	struct hltests_state *tests_state =
+			(struct hltests_state *) *state;
+	struct hlthunk_cs_profile profile;
+	struct hlthunk_hw_ip_info hw_ip;
+	struct hltests_pkt_info pkt_info;
+	struct hl_cs_chunk execute_arr[2];
+	struct hlthunk_cs_in cs_in;
+	struct hlthunk_cs_out cs_out;
+	uint64_t dma_handle, nop_handle, seqs[CS_PROFILER_NUM_CS];
+	uint32_t dma_size, nop_size, status, i, q;
+	uint8_t dma_pkts[0x100], nop_pkts[0x100];
+	void *cache, *prof, *host_ptr;
+	int rc, fd = tests_state->fd;
+
+	rc = hlthunk_get_hw_ip_info(fd, &hw_ip);
+	assert_int_equal(rc, 0);
+
+	host_ptr = hltests_allocate_host_mem(fd, CS_PROFILER_DMA_SIZE,
+						NOT_HUGE);
+	assert_non_null(host_ptr);
+
+	cache = hlthunk_cb_cache_create(fd, 2);
+	assert_non_null(cache);
+
+	memset(&pkt_info, 0, sizeof(pkt_info));
+	pkt_info.eb = EB_FALSE;
+	pkt_info.mb = MB_TRUE;
+	pkt_info.dma.src_addr = hltests_get_device_va_for_host_ptr(fd,
+								host_ptr);
+	pkt_info.dma.dst_addr = hw_ip.sram_base_address;
+	pkt_info.dma.size = CS_PROFILER_DMA_SIZE;
+	pkt_info.dma.dma_dir = GOYA_DMA_HOST_TO_SRAM;
+	dma_size = hltests_add_dma_pkt(fd, dma_pkts, 0, &pkt_info);
+	rc = hlthunk_cb_cache_get(cache, dma_pkts, dma_size, true,
+					&dma_handle);
+	assert_int_equal(rc, 0);
+
+	/* An internal queue, whose stamps are fetched through the MMU */
+	nop_size = hltests_add_nop_pkt(fd, nop_pkts, 0, EB_FALSE, MB_FALSE);
+	rc = hlthunk_cb_cache_get(cache, nop_pkts, nop_size, false,
+					&nop_handle);
+	assert_int_equal(rc, 0);
+
+	memset(execute_arr, 0, sizeof(execute_arr));
+	execute_arr[0].cb_handle = dma_handle;
+	execute_arr[0].cb_size = dma_size;
+	execute_arr[0].queue_index = hltests_get_dma_down_qid(fd, DCORE0,
+								STREAM0);
+	execute_arr[1].cb_handle = nop_handle;
+	execute_arr[1].cb_size = nop_size;
+	execute_arr[1].queue_index = hltests_get_tpc_qid(fd, DCORE0, 0,
+								STREAM0);
+
+	memset(&cs_in, 0, sizeof(cs_in));
+	cs_in.chunks_execute = execute_arr;
+	cs_in.num_chunks_execute = 2;
+
+	prof = hlthunk_cs_profiler_create(fd, CS_PROFILER_NUM_CS);
+	assert_non_null(prof);
+
+	for (i = 0 ; i < CS_PROFILER_NUM_CS ; i++) {
+		rc = hlthunk_cs_profiler_submit(prof, &cs_in, &cs_out);
+		assert_int_equal(rc, 0);
+		seqs[i] = cs_out.seq;
+	}
+
+	/* Every profiled CS holds its record until it is waited for */
+	rc = hlthunk_cs_profiler_submit(prof, &cs_in, &cs_out);
+	assert_int_equal(rc, -EBUSY);
+
+	for (i = 0 ; i < CS_PROFILER_NUM_CS ; i++) {
+		rc = hlthunk_cs_profiler_wait(prof, seqs[i],
+						WAIT_FOR_CS_DEFAULT_TIMEOUT,
+						&status, &profile);
+		assert_int_equal(rc, 0);
+		assert_int_equal(status, HL_WAIT_CS_STATUS_COMPLETED);
+		assert_int_equal(profile.seq, seqs[i]);
+		assert_int_equal(profile.num_queues, 2);
+		assert_true(profile.complete_ns >= profile.submit_ns);
+
+		for (q = 0 ; q < profile.num_queues ; q++)
+			assert_int_equal(profile.queues[q].queue_index,
+						execute_arr[q].queue_index);
+
+		/* Moving the data takes time, unlike a NOP */
+		assert_true(profile.queues[0].exec_ns > 0);
+	}
+
+	rc = hlthunk_cs_profiler_wait(prof, seqs[0],
+					WAIT_FOR_CS_DEFAULT_TIMEOUT, &status,
+					&profile);
+	assert_int_equal(rc, -ENOENT);
+
+	hlthunk_cs_profiler_destroy(prof);
+
+	rc = hlthunk_cb_cache_put(cache, nop_handle, 0);
+	assert_int_equal(rc, 0);
+	rc = hlthunk_cb_cache_put(cache, dma_handle, 0);
+	assert_int_equal(rc, 0);
+	hlthunk_cb_cache_destroy(cache);
+
+	rc = hltests_free_host_mem(fd, host_ptr);
+	assert_int_equal(rc, 0);
+}
+
+void test_engine_util(void **state)
+{
+	struct hltests_state *tests_state =
+			(struct hltests_state *) *state;
+	struct hlthunk_engine_util_params params;
+	struct hlthunk_engine_util util;
+	uint32_t w, i, cb_size, lens[2] = { 100, 500 };
+	void *sampler, *cb;
+	int rc, fd = tests_state->fd;
+
+	memset(&params, 0, sizeof(params));
+	params.rate_hz = HLTHUNK_ENGINE_UTIL_MAX_RATE_HZ * 2;
+	sampler = hlthunk_engine_util_create(fd, &params);
+	assert_null(sampler);
+	assert_int_equal(errno, EINVAL);
+
+	params.rate_hz = HLTHUNK_ENGINE_UTIL_MAX_RATE_HZ;
+	params.windows_ms[0] = UINT32_MAX;
+	params.num_windows = 1;
+	sampler = hlthunk_engine_util_create(fd, &params);
+	assert_null(sampler);
+	assert_int_equal(errno, EINVAL);
+
+	/* Windows of 10ms and 50ms at 10kHz */
+	params.windows_ms[0] = 10;
+	params.windows_ms[1] = 50;
+	params.num_windows = 2;
+	sampler = hlthunk_engine_util_create(fd, &params);
+	assert_non_null(sampler);
+
+	cb = hltests_create_cb(fd, getpagesize(), EXTERNAL, 0);
+	assert_non_null(cb);
+	cb_size = hltests_add_nop_pkt(fd, cb, 0, EB_FALSE, MB_FALSE);
+
+	for (i = 0 ; i < 10 ; i++) {
+		hltests_submit_and_wait_cs(fd, cb, cb_size,
+				hltests_get_dma_down_qid(fd, DCORE0, STREAM0),
+				DESTROY_CB_FALSE, HL_WAIT_CS_STATUS_COMPLETED);
+		usleep(5000);
+	}
+
+	rc = hltests_destroy_cb(fd, cb);
+	assert_int_equal(rc, 0);
+
+	for (w = 0 ; w < 2 ; w++) {
+		rc = hlthunk_engine_util_get(sampler, w, &util);
+		assert_int_equal(rc, 0);
+		assert_true(util.num_samples > 0);
+		assert_true(util.num_samples <= lens[w]);
+		assert_true(util.timestamp_ns > 0);
+
+		for (i = 0 ; i < HLTHUNK_ENGINE_UTIL_MAX_ENGINES ; i++) {
+			assert_true(util.busy_samples[i] <= util.num_samples);
+			assert_true(util.busy[i] >= 0 && util.busy[i] <= 1);
+		}
+	}
+
+	rc = hlthunk_engine_util_get(sampler, 2, &util);
+	assert_int_equal(rc, -EINVAL);
+
+	hlthunk_engine_util_destroy(sampler);
+}
+
+void test_hw_events(void **state)
+{
+	struct hltests_state *tests_state =
+			(struct hltests_state *) *state;
+	struct hlthunk_hw_events_shm *shm;
+	struct hlthunk_hw_ip_info hw_ip;
+	const uint32_t *deltas, *counters;
+	uint32_t num_events, i;
+	uint64_t total;
+	char name[64];
+	size_t size;
+	void *events;
+	int rc, shm_fd, fd = tests_state->fd;
+
+	rc = hlthunk_get_hw_ip_info(fd, &hw_ip);
+	assert_int_equal(rc, 0);
+
+	snprintf(name, sizeof(name), "/hlthunk_events_%d", getpid());
+	events = hlthunk_hw_events_open(fd, name);
+	assert_non_null(events);
+
+	rc = hlthunk_hw_events_update(events, &deltas, &num_events);
+	assert_int_equal(rc, 0);
+	assert_int_equal(num_events, hw_ip.num_of_events);
+
+	for (i = 0 ; i < num_events ; i++) {
+		rc = hlthunk_hw_events_get_total(events, i, &total);
+		assert_int_equal(rc, 0);
+		assert_int_equal(total, deltas[i]);
+	}
+
+	rc = hlthunk_hw_events_get_total(events, num_events, &total);
+	assert_int_equal(rc, -EINVAL);
+
+	/* A reader of the segment sees the deltas of the update */
+	size = sizeof(*shm) + 2 * num_events * sizeof(uint32_t);
+	shm_fd = shm_open(name, O_RDONLY, 0);
+	assert_true(shm_fd >= 0);
+	shm = mmap(NULL, size, PROT_READ, MAP_SHARED, shm_fd, 0);
+	assert_true(shm != MAP_FAILED);
+	close(shm_fd);
+
+	assert_int_equal(shm->magic, HLTHUNK_HW_EVENTS_SHM_MAGIC);
+	assert_int_equal(shm->num_events, num_events);
+	assert_int_equal(shm->seq % 2, 0);
+	counters = (const uint32_t *) (shm + 1);
+	for (i = 0 ; i < num_events ; i++)
+		assert_int_equal(counters[num_events + i], deltas[i]);
+
+	munmap(shm, size);
+
+	hlthunk_hw_events_close(events);
+
+	/* The segment is removed with the counters */
+	shm_fd = shm_open(name, O_RDONLY, 0);
+	assert_int_equal(shm_fd, -1);
+	assert_int_equal(errno, ENOENT);
+
+	if (hlthunk_get_device_name_from_fd(fd) == HLTHUNK_DEVICE_GOYA) {
+		assert_string_equal(hlthunk_hw_events_get_name(
+					HLTHUNK_DEVICE_GOYA, 280),
+					"MMU_PAGE_FAULT");
+		assert_null(hlthunk_hw_events_get_name(HLTHUNK_DEVICE_GOYA,
+							0));
+	}
+}
+
 const struct CMUnitTest cs_tests[] = {
 	cmocka_unit_test_setup(test_cs_nop, hltests_ensure_device_operational),
 	cmocka_unit_test_setup(test_cs_msg_long,
@@ -206,6 +844,20 @@ const struct CMUnitTest cs_tests[] = {
 					hltests_ensure_device_operational),
 	cmocka_unit_test_setup(test_cs_two_streams_with_fence,
 					hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_cs_record,
+					hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_cs_window,
+					hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_cs_submitter,
+					hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_cs_ctx_restore,
+					hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_cs_profiler,
+					hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_engine_util,
+					hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_hw_events,
+					hltests_ensure_device_operational),
 };
 
 static const char *const usage[] = {
@@ -7,14 +7,17 @@
 
 #include "hlthunk.h"
 #include "hlthunk_tests.h"
+#include "ini.h"
 
 #include <stddef.h>
 #include <limits.h>
 #include <cmocka.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/mman.h>
 
 /*
  * Accessing the elements of the "perf_outcomes" array is done using Goya's
@@ -29,6 +32,28 @@
 #define DMA_SRAM_TO_DRAM	GOYA_DMA_SRAM_TO_DRAM
 #define DMA_SRAM_TO_HOST	GOYA_DMA_SRAM_TO_HOST
 #define DMA_DRAM_TO_HOST	GOYA_DMA_DRAM_TO_HOST
+#define DMA_DRAM_TO_DRAM	GOYA_DMA_DRAM_TO_DRAM
+#define DMA_SRAM_TO_SRAM	GOYA_DMA_SRAM_TO_SRAM
+
+#define SWEEP_HIST_BUCKETS	40
+
+/*
+ * On the device model, the elapsed time is the model's estimate of how long
+ * the CSs take on a device rather than how long it took to emulate them
+ */
+static double hltests_model_time_diff(int fd, uint64_t first_seq,
+					uint64_t last_seq)
+{
+	struct hlthunk_model_cs_times first, last;
+	int rc;
+
+	rc = hlthunk_model_get_cs_times(fd, first_seq, &first);
+	assert_int_equal(rc, 0);
+	rc = hlthunk_model_get_cs_times(fd, last_seq, &last);
+	assert_int_equal(rc, 0);
+
+	return (last.done_ns - first.submit_ns) / 1000000000.0;
+}
 
 static double hltests_transfer_perf(int fd, uint32_t queue_index,
 			uint64_t src_addr, uint64_t dst_addr,
@@ -39,13 +64,17 @@ static double hltests_transfer_perf(int fd, uint32_t queue_index,
 	struct timespec begin, end;
 	struct hltests_cs_chunk execute_arr[1];
 	struct hltests_pkt_info pkt_info;
-	uint64_t seq = 0;
+	uint64_t seq = 0, first_seq = 0;
 	int rc;
 	uint64_t num_of_transfers, i;
 	double time_diff;
 
-	num_of_transfers = hltests_is_simulator(fd) ? 5 :
-					(0x400000000ull / size);
+	if (hltests_is_simulator(fd))
+		num_of_transfers = 5;
+	else if (hltests_is_model(fd))
+		num_of_transfers = 64;
+	else
+		num_of_transfers = 0x400000000ull / size;
 
 	cb = hltests_create_cb(fd, getpagesize(), EXTERNAL, 0);
 	assert_non_null(cb);
@@ -70,6 +99,8 @@ static double hltests_transfer_perf(int fd, uint32_t queue_index,
 		rc = hltests_submit_cs(fd, NULL, 0, execute_arr,
 						1, FORCE_RESTORE_FALSE, &seq);
 		assert_int_equal(rc, 0);
+		if (!i)
+			first_seq = seq;
 	}
 
 	rc = hltests_wait_for_cs_until_not_busy(fd, seq);
@@ -78,6 +109,8 @@ static double hltests_transfer_perf(int fd, uint32_t queue_index,
 	clock_gettime(CLOCK_MONOTONIC_RAW, &end);
 	time_diff = (end.tv_nsec - begin.tv_nsec) / 1000000000.0 +
 						(end.tv_sec  - begin.tv_sec);
+	if (hltests_is_model(fd))
+		time_diff = hltests_model_time_diff(fd, first_seq, seq);
 
 	/* return value in GB/Sec */
 	return ((double)(size) * num_of_transfers / time_diff)
@@ -330,6 +363,8 @@ static double indirect_transfer_perf_test(int fd, uint32_t queue_index,
 	clock_gettime(CLOCK_MONOTONIC_RAW, &end);
 	time_diff = (end.tv_nsec - begin.tv_nsec) / 1000000000.0 +
 						(end.tv_sec  - begin.tv_sec);
+	if (hltests_is_model(fd))
+		time_diff = hltests_model_time_diff(fd, seq, seq);
 	hltests_destroy_cb(fd, cp_dma_cb);
 	hltests_destroy_cb(fd, cb);
 
@@ -411,6 +446,584 @@ void hltest_dram_sram_transfer_perf(void **state)
 	hltests_free_device_mem(fd, dram_addr);
 }
 
+struct dma_sweep_cfg {
+	uint64_t min_size;
+	uint64_t max_size;
+	/* Bytes to transfer per size, bounded by the number of transfers */
+	uint64_t total_size;
+	uint32_t min_transfers;
+	uint32_t max_transfers;
+	char *csv_file;
+	char *json_file;
+};
+
+/* Latencies in ns of the CSs of one size */
+struct dma_sweep_stats {
+	uint64_t *submit;
+	uint64_t *latency;
+	uint64_t *device;
+	uint32_t hist[SWEEP_HIST_BUCKETS];
+	uint32_t num;
+};
+
+struct dma_sweep_result {
+	enum hltests_goya_dma_direction dir;
+	uint64_t size;
+	uint32_t num;
+	double bw;
+	/* Average submit cost and percentiles of latency and device time */
+	double submit_avg;
+	uint64_t submit_p50;
+	uint64_t submit_p99;
+	uint64_t lat_p[4];
+	uint64_t dev_p50;
+	uint64_t dev_p99;
+	uint32_t hist[SWEEP_HIST_BUCKETS];
+};
+
+static const char * const sweep_dir_names[GOYA_DMA_ENUM_MAX] = {
+	[GOYA_DMA_HOST_TO_DRAM] = "HOST->DRAM",
+	[GOYA_DMA_HOST_TO_SRAM] = "HOST->SRAM",
+	[GOYA_DMA_DRAM_TO_SRAM] = "DRAM->SRAM",
+	[GOYA_DMA_SRAM_TO_DRAM] = "SRAM->DRAM",
+	[GOYA_DMA_SRAM_TO_HOST] = "SRAM->HOST",
+	[GOYA_DMA_DRAM_TO_HOST] = "DRAM->HOST",
+	[GOYA_DMA_DRAM_TO_DRAM] = "DRAM->DRAM",
+	[GOYA_DMA_SRAM_TO_SRAM] = "SRAM->SRAM",
+};
+
+/* Percentiles reported for the submit-to-complete latency, in 1/10 % */
+static const uint32_t sweep_lat_pct[4] = { 500, 900, 990, 999 };
+
+static int dma_sweep_parsing_handler(void *user, const char *section,
+					const char *name, const char *value)
+{
+	struct dma_sweep_cfg *cfg = (struct dma_sweep_cfg *) user;
+
+	if (MATCH("dma_perf_sweep", "min_size"))
+		cfg->min_size = strtoul(value, NULL, 0);
+	else if (MATCH("dma_perf_sweep", "max_size"))
+		cfg->max_size = strtoul(value, NULL, 0);
+	else if (MATCH("dma_perf_sweep", "total_size"))
+		cfg->total_size = strtoul(value, NULL, 0);
+	else if (MATCH("dma_perf_sweep", "min_transfers"))
+		cfg->min_transfers = strtoul(value, NULL, 0);
+	else if (MATCH("dma_perf_sweep", "max_transfers"))
+		cfg->max_transfers = strtoul(value, NULL, 0);
+	else if (MATCH("dma_perf_sweep", "csv_file"))
+		cfg->csv_file = strdup(value);
+	else if (MATCH("dma_perf_sweep", "json_file"))
+		cfg->json_file = strdup(value);
+	else
+		return 0; /* unknown section/name, error */
+
+	return 1;
+}
+
+static uint64_t sweep_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int sweep_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of a sorted array, pct is in 1/10 % */
+static uint64_t sweep_percentile(const uint64_t *sorted, uint32_t num,
+					uint32_t pct)
+{
+	uint64_t rank = ((uint64_t) num * pct + 999) / 1000;
+
+	return sorted[rank ? rank - 1 : 0];
+}
+
+static uint32_t sweep_hist_bucket(uint64_t ns)
+{
+	uint32_t bucket = 0;
+
+	while (ns > 1 && bucket < SWEEP_HIST_BUCKETS - 1) {
+		ns >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+/*
+ * Runs the transfers of one size twice. First back to back, waiting only on
+ * the last CS, which gives the bandwidth. Then one CS at a time, which gives
+ * the submit-to-complete latency of every CS without the time it waits
+ * behind the previous ones. The submit cost is the time that
+ * hlthunk_command_submission takes, and the device time is the rest of the
+ * latency, which includes the completion notification. On the device model,
+ * the three are taken from the model's estimates instead.
+ */
+static void dma_sweep_one(int fd, uint32_t queue_index, uint64_t src_addr,
+			uint64_t dst_addr, uint64_t size, uint32_t num,
+			enum hltests_goya_dma_direction dma_dir,
+			struct dma_sweep_stats *stats, double *bw)
+{
+	struct hlthunk_model_perf_params params;
+	struct hlthunk_model_cs_times times;
+	struct hltests_cs_chunk execute_arr[1];
+	struct hltests_pkt_info pkt_info;
+	uint64_t seq = 0, first_seq = 0, begin, submitted, end;
+	bool model = hltests_is_model(fd);
+	uint32_t offset, i;
+	double time_diff;
+	void *cb;
+	int rc;
+
+	if (model)
+		hlthunk_model_get_perf_params(&params);
+
+	cb = hltests_create_cb(fd, getpagesize(), EXTERNAL, 0);
+	assert_non_null(cb);
+
+	memset(&pkt_info, 0, sizeof(pkt_info));
+	pkt_info.eb = EB_FALSE;
+	pkt_info.mb = MB_FALSE;
+	pkt_info.dma.src_addr = src_addr;
+	pkt_info.dma.dst_addr = dst_addr;
+	pkt_info.dma.size = size;
+	pkt_info.dma.dma_dir = dma_dir;
+	offset = hltests_add_dma_pkt(fd, cb, 0, &pkt_info);
+
+	execute_arr[0].cb_ptr = cb;
+	execute_arr[0].cb_size = offset;
+	execute_arr[0].queue_index = queue_index;
+
+	begin = sweep_now_ns();
+
+	for (i = 0 ; i < num ; i++) {
+		rc = hltests_submit_cs(fd, NULL, 0, execute_arr, 1,
+					FORCE_RESTORE_FALSE, &seq);
+		assert_int_equal(rc, 0);
+		if (!i)
+			first_seq = seq;
+	}
+
+	rc = hltests_wait_for_cs_until_not_busy(fd, seq);
+	assert_int_equal(rc, HL_WAIT_CS_STATUS_COMPLETED);
+
+	time_diff = (sweep_now_ns() - begin) / 1000000000.0;
+	if (model)
+		time_diff = hltests_model_time_diff(fd, first_seq, seq);
+
+	*bw = ((double) size * num / time_diff) / 1024 / 1024 / 1024;
+
+	memset(stats->hist, 0, sizeof(stats->hist));
+	stats->num = num;
+
+	for (i = 0 ; i < num ; i++) {
+		begin = sweep_now_ns();
+		rc = hltests_submit_cs(fd, NULL, 0, execute_arr, 1,
+					FORCE_RESTORE_FALSE, &seq);
+		submitted = sweep_now_ns();
+		assert_int_equal(rc, 0);
+
+		rc = hltests_wait_for_cs_until_not_busy(fd, seq);
+		end = sweep_now_ns();
+		assert_int_equal(rc, HL_WAIT_CS_STATUS_COMPLETED);
+
+		/* The model's submit time is when the submission returned */
+		if (model) {
+			rc = hlthunk_model_get_cs_times(fd, seq, &times);
+			assert_int_equal(rc, 0);
+			begin = times.submit_ns - params.cs_submit_ns;
+			submitted = times.submit_ns;
+			end = times.done_ns;
+		}
+
+		stats->submit[i] = submitted - begin;
+		stats->latency[i] = end - begin;
+		stats->device[i] = end - submitted;
+		stats->hist[sweep_hist_bucket(stats->latency[i])]++;
+	}
+
+	hltests_destroy_cb(fd, cb);
+}
+
+static void dma_sweep_summarize(struct dma_sweep_stats *stats,
+				struct dma_sweep_result *res)
+{
+	uint64_t sum = 0;
+	uint32_t i;
+
+	for (i = 0 ; i < stats->num ; i++)
+		sum += stats->submit[i];
+
+	qsort(stats->submit, stats->num, sizeof(uint64_t), sweep_cmp_u64);
+	qsort(stats->latency, stats->num, sizeof(uint64_t), sweep_cmp_u64);
+	qsort(stats->device, stats->num, sizeof(uint64_t), sweep_cmp_u64);
+
+	res->num = stats->num;
+	res->submit_avg = (double) sum / stats->num;
+	res->submit_p50 = sweep_percentile(stats->submit, stats->num, 500);
+	res->submit_p99 = sweep_percentile(stats->submit, stats->num, 990);
+	for (i = 0 ; i < 4 ; i++)
+		res->lat_p[i] = sweep_percentile(stats->latency, stats->num,
+							sweep_lat_pct[i]);
+	res->dev_p50 = sweep_percentile(stats->device, stats->num, 500);
+	res->dev_p99 = sweep_percentile(stats->device, stats->num, 990);
+	memcpy(res->hist, stats->hist, sizeof(res->hist));
+}
+
+static void dma_sweep_print(struct dma_sweep_result *res, uint32_t num_res,
+				FILE *csv, FILE *json)
+{
+	struct dma_sweep_result *r;
+	uint32_t i, j, last;
+
+	printf("\n%-10s %10s %6s %9s %9s %9s %9s %9s %9s %9s %9s\n",
+		"direction", "size", "CSs", "GB/s", "submit", "lat p50",
+		"lat p90", "lat p99", "lat p99.9", "dev p50", "dev p99");
+	printf("%-10s %10s %6s %9s %9s %9s %9s %9s %9s %9s %9s\n",
+		"", "", "", "", "(us)", "(us)", "(us)", "(us)", "(us)", "(us)",
+		"(us)");
+
+	fprintf(csv, "direction,size,num_cs,bw_gbps,submit_avg_ns,"
+		"submit_p50_ns,submit_p99_ns,lat_p50_ns,lat_p90_ns,lat_p99_ns,"
+		"lat_p999_ns,dev_p50_ns,dev_p99_ns\n");
+	fprintf(json, "{\n  \"dma_perf_sweep\": [");
+
+	for (i = 0 ; i < num_res ; i++) {
+		r = &res[i];
+
+		printf("%-10s %10lu %6u %9.3lf %9.2lf %9.2lf %9.2lf %9.2lf "
+			"%9.2lf %9.2lf %9.2lf\n",
+			sweep_dir_names[r->dir], r->size, r->num, r->bw,
+			r->submit_avg / 1000.0, r->lat_p[0] / 1000.0,
+			r->lat_p[1] / 1000.0, r->lat_p[2] / 1000.0,
+			r->lat_p[3] / 1000.0, r->dev_p50 / 1000.0,
+			r->dev_p99 / 1000.0);
+
+		fprintf(csv, "%s,%lu,%u,%.4lf,%.1lf,%lu,%lu,%lu,%lu,%lu,%lu,"
+			"%lu,%lu\n", sweep_dir_names[r->dir], r->size, r->num,
+			r->bw, r->submit_avg, r->submit_p50, r->submit_p99,
+			r->lat_p[0], r->lat_p[1], r->lat_p[2], r->lat_p[3],
+			r->dev_p50, r->dev_p99);
+
+		fprintf(json, "%s\n    {\"direction\": \"%s\", \"size\": %lu, "
+			"\"num_cs\": %u, \"bw_gbps\": %.4lf, "
+			"\"submit_ns\": {\"avg\": %.1lf, \"p50\": %lu, "
+			"\"p99\": %lu}, \"latency_ns\": {\"p50\": %lu, "
+			"\"p90\": %lu, \"p99\": %lu, \"p99.9\": %lu}, "
+			"\"device_ns\": {\"p50\": %lu, \"p99\": %lu}, "
+			"\"latency_hist_log2_ns\": [", i ? "," : "",
+			sweep_dir_names[r->dir], r->size, r->num, r->bw,
+			r->submit_avg, r->submit_p50, r->submit_p99,
+			r->lat_p[0], r->lat_p[1], r->lat_p[2], r->lat_p[3],
+			r->dev_p50, r->dev_p99);
+
+		/* Bucket n counts the latencies in [2^n, 2^(n+1)) ns */
+		for (last = SWEEP_HIST_BUCKETS ; last > 1 ; last--)
+			if (r->hist[last - 1])
+				break;
+		for (j = 0 ; j < last ; j++)
+			fprintf(json, "%s%u", j ? ", " : "", r->hist[j]);
+		fprintf(json, "]}");
+	}
+
+	fprintf(json, "\n  ]\n}\n");
+}
+
+static void *sweep_alloc_host(int fd, uint64_t size)
+{
+	void *ptr;
+
+	ptr = hltests_allocate_host_mem(fd, size, HUGE);
+	if (!ptr) {
+		printf("Falling back to regular pages for the host buffer\n");
+		ptr = hltests_allocate_host_mem(fd, size, NOT_HUGE);
+	}
+	assert_non_null(ptr);
+
+	return ptr;
+}
+
+/*
+ * Sweeps the transfer size in powers of two in every DMA direction. The sizes
+ * are limited by where the transfers go: SRAM directions are limited to the
+ * size of the SRAM (half of it for SRAM to SRAM), and DRAM directions to the
+ * DRAM that is free. The parameters can be changed in the [dma_perf_sweep]
+ * section of the configuration file.
+ */
+void hltest_dma_perf_sweep(void **state)
+{
+	struct hltests_state *tests_state = (struct hltests_state *) *state;
+	const char *config_filename = hltests_get_config_filename();
+	struct hlthunk_hw_ip_info hw_ip;
+	struct dma_sweep_result *res;
+	struct dma_sweep_stats stats;
+	struct dma_sweep_cfg cfg;
+	enum hltests_goya_dma_direction dir;
+	uint64_t size, max_size, host_size, dram_size, sram_addr, host_addr;
+	uint64_t dram_addr, src_base, dst_base;
+	void *host_ptr = NULL, *dram_ptr = NULL;
+	uint32_t queue_index, num, num_res = 0, max_res;
+	bool src_host, dst_host, src_dram, dst_dram, src_sram, dst_sram;
+	FILE *csv, *json;
+	int rc, fd = tests_state->fd;
+
+	if (!hltests_get_parser_run_disabled_tests()) {
+		printf("Test is skipped because it runs only with -d\n");
+		skip();
+	}
+
+	rc = hlthunk_get_hw_ip_info(fd, &hw_ip);
+	assert_int_equal(rc, 0);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.min_size = 4 * 1024;
+	cfg.max_size = 1024 * 1024 * 1024;
+	cfg.min_transfers = 8;
+	cfg.max_transfers = 1000;
+	if (hltests_is_simulator(fd)) {
+		cfg.total_size = 0;
+		cfg.min_transfers = 2;
+	} else if (hltests_is_model(fd)) {
+		cfg.total_size = 0x10000000ull;
+		cfg.max_size = 64 * 1024 * 1024;
+	} else {
+		cfg.total_size = 0x100000000ull;
+	}
+
+	if (config_filename &&
+		ini_parse(config_filename, dma_sweep_parsing_handler, &cfg) < 0)
+		fail_msg("Can't load %s\n", config_filename);
+
+	assert_in_range(cfg.min_size, 1, cfg.max_size);
+	assert_in_range(cfg.min_transfers, 1, cfg.max_transfers);
+
+	/* The LIN_DMA transfer size is 32 bits */
+	max_size = cfg.max_size;
+	if (max_size > UINT_MAX)
+		max_size = 1ull << 31;
+
+	host_size = max_size;
+	dram_size = 0;
+	if (hw_ip.dram_enabled) {
+		dram_size = max_size * 2;
+		while (dram_size > hw_ip.dram_size - 0x1000000ull &&
+				dram_size > cfg.min_size * 2)
+			dram_size /= 2;
+		dram_ptr = hltests_allocate_device_mem(fd, dram_size,
+							NOT_CONTIGUOUS);
+		assert_non_null(dram_ptr);
+	}
+	host_ptr = sweep_alloc_host(fd, host_size);
+
+	host_addr = hltests_get_device_va_for_host_ptr(fd, host_ptr);
+	dram_addr = (uint64_t) (uintptr_t) dram_ptr;
+	sram_addr = hw_ip.sram_base_address;
+
+	max_res = GOYA_DMA_ENUM_MAX * 64;
+	res = hlthunk_malloc(max_res * sizeof(*res));
+	stats.submit = hlthunk_malloc(cfg.max_transfers * sizeof(uint64_t));
+	stats.latency = hlthunk_malloc(cfg.max_transfers * sizeof(uint64_t));
+	stats.device = hlthunk_malloc(cfg.max_transfers * sizeof(uint64_t));
+	assert_non_null(res);
+	assert_non_null(stats.submit);
+	assert_non_null(stats.latency);
+	assert_non_null(stats.device);
+
+	for (dir = 0 ; dir < GOYA_DMA_ENUM_MAX ; dir++) {
+		src_host = dir == DMA_HOST_TO_DRAM || dir == DMA_HOST_TO_SRAM;
+		dst_host = dir == DMA_SRAM_TO_HOST || dir == DMA_DRAM_TO_HOST;
+		src_dram = dir == DMA_DRAM_TO_SRAM || dir == DMA_DRAM_TO_HOST ||
+				dir == DMA_DRAM_TO_DRAM;
+		dst_dram = dir == DMA_HOST_TO_DRAM || dir == DMA_SRAM_TO_DRAM ||
+				dir == DMA_DRAM_TO_DRAM;
+		src_sram = !src_host && !src_dram;
+		dst_sram = !dst_host && !dst_dram;
+
+		if ((src_dram || dst_dram) && !dram_ptr) {
+			printf("Skipping %s because DRAM is disabled\n",
+				sweep_dir_names[dir]);
+			continue;
+		}
+
+		/* Copies within the same memory use its two halves */
+		src_base = src_host ? host_addr :
+				src_dram ? dram_addr : sram_addr;
+		dst_base = dst_host ? host_addr :
+				dst_dram ? dram_addr : sram_addr;
+		if (src_dram && dst_dram)
+			dst_base += dram_size / 2;
+		else if (src_sram && dst_sram)
+			dst_base += hw_ip.sram_size / 2;
+
+		if (src_host)
+			queue_index = hltests_get_dma_down_qid(fd, DCORE0,
+								STREAM0);
+		else if (dst_host)
+			queue_index = hltests_get_dma_up_qid(fd, DCORE0,
+								STREAM0);
+		else if (dst_sram)
+			queue_index = hltests_get_dma_dram_to_sram_qid(fd,
+							DCORE0, STREAM0);
+		else
+			queue_index = hltests_get_dma_sram_to_dram_qid(fd,
+							DCORE0, STREAM0);
+
+		for (size = cfg.min_size ; size <= max_size ; size *= 2) {
+			if ((src_sram || dst_sram) && size >
+					(src_sram && dst_sram ?
+					hw_ip.sram_size / 2 : hw_ip.sram_size))
+				break;
+			if ((src_dram || dst_dram) && size >
+					(src_dram && dst_dram ?
+					dram_size / 2 : dram_size))
+				break;
+			if (num_res == max_res)
+				break;
+
+			num = cfg.total_size / size;
+			if (num < cfg.min_transfers)
+				num = cfg.min_transfers;
+			if (num > cfg.max_transfers)
+				num = cfg.max_transfers;
+
+			res[num_res].dir = dir;
+			res[num_res].size = size;
+			dma_sweep_one(fd, queue_index, src_base, dst_base,
+					size, num, dir, &stats,
+					&res[num_res].bw);
+			dma_sweep_summarize(&stats, &res[num_res]);
+			num_res++;
+		}
+	}
+
+	csv = fopen(cfg.csv_file ? cfg.csv_file : "dma_perf_sweep.csv", "w");
+	assert_non_null(csv);
+	json = fopen(cfg.json_file ? cfg.json_file : "dma_perf_sweep.json",
+			"w");
+	assert_non_null(json);
+
+	dma_sweep_print(res, num_res, csv, json);
+
+	fclose(json);
+	fclose(csv);
+
+	hlthunk_free(stats.device);
+	hlthunk_free(stats.latency);
+	hlthunk_free(stats.submit);
+	hlthunk_free(res);
+	free(cfg.json_file);
+	free(cfg.csv_file);
+
+	hltests_free_host_mem(fd, host_ptr);
+	if (dram_ptr)
+		hltests_free_device_mem(fd, dram_ptr);
+}
+
+/* Returns the first online NUMA node other than the given one, or -1 */
+static int numa_remote_node(int local)
+{
+	char buf[256], *p, *end;
+	long first, last;
+	FILE *f;
+
+	f = fopen("/sys/devices/system/node/online", "r");
+	if (!f)
+		return -1;
+
+	p = fgets(buf, sizeof(buf), f);
+	fclose(f);
+	if (!p)
+		return -1;
+
+	while (*p && *p != '\n') {
+		first = strtol(p, &end, 10);
+		if (end == p)
+			break;
+
+		last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+
+		if (first != local)
+			return first;
+		if (last > local)
+			return local + 1;
+
+		p = *end == ',' ? end + 1 : end;
+	}
+
+	return -1;
+}
+
+/*
+ * Measures transfers between the SRAM and host memory on the NUMA node of the
+ * device, and then with host memory on another node
+ */
+void hltest_host_numa_transfer_perf(void **state)
+{
+	struct hltests_state *tests_state = (struct hltests_state *) *state;
+	struct hlthunk_hw_ip_info hw_ip;
+	double to_sram, from_sram;
+	uint64_t sram_addr, host_addr;
+	uint32_t size = 4 * 1024 * 1024;
+	int i, rc, nodes[2], fd = tests_state->fd;
+	void *ptr;
+
+	rc = hlthunk_get_numa_node(fd, &nodes[0]);
+	assert_int_equal(rc, 0);
+
+	if (nodes[0] < 0) {
+		printf("Test is skipped because the NUMA node is unknown\n");
+		skip();
+	}
+
+	nodes[1] = numa_remote_node(nodes[0]);
+	if (nodes[1] < 0) {
+		printf("Test is skipped because there is a single NUMA node\n");
+		skip();
+	}
+
+	rc = hlthunk_get_hw_ip_info(fd, &hw_ip);
+	assert_int_equal(rc, 0);
+	sram_addr = hw_ip.sram_base_address;
+
+	for (i = 0 ; i < 2 ; i++) {
+		ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		assert_ptr_not_equal(ptr, MAP_FAILED);
+
+		rc = hlthunk_numa_bind_memory(ptr, size, nodes[i]);
+		assert_int_equal(rc, 0);
+
+		host_addr = hlthunk_host_memory_map(fd, ptr, 0, size);
+		assert_int_not_equal(host_addr, 0);
+
+		to_sram = hltests_transfer_perf(fd,
+				hltests_get_dma_down_qid(fd, DCORE0, STREAM0),
+				host_addr, sram_addr, size,
+				GOYA_DMA_HOST_TO_SRAM);
+		from_sram = hltests_transfer_perf(fd,
+				hltests_get_dma_up_qid(fd, DCORE0, STREAM0),
+				sram_addr, host_addr, size,
+				GOYA_DMA_SRAM_TO_HOST);
+
+		printf("%s node %d: HOST->SRAM %lf GB/Sec, ",
+			i ? "Remote" : "Local", nodes[i], to_sram);
+		printf("SRAM->HOST %lf GB/Sec\n", from_sram);
+
+		rc = hlthunk_memory_unmap(fd, host_addr);
+		assert_int_equal(rc, 0);
+		munmap(ptr, size);
+	}
+}
+
 static int hltests_perf_teardown(void **state)
 {
 	struct hltests_state *tests_state = (struct hltests_state *) *state;
@@ -446,6 +1059,10 @@ const struct CMUnitTest dma_perf_tests[] = {
 				hltests_ensure_device_operational),
 	cmocka_unit_test_setup(hltest_dram_sram_transfer_perf,
 				hltests_ensure_device_operational),
+	cmocka_unit_test_setup(hltest_dma_perf_sweep,
+				hltests_ensure_device_operational),
+	cmocka_unit_test_setup(hltest_host_numa_transfer_perf,
+				hltests_ensure_device_operational),
 };
 
 static const char *const usage[] = {
@@ -17,6 +17,10 @@
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
 /**
  * This test checks that a mapping of more than 4GB is successful. This big size
@@ -162,12 +166,487 @@ void test_alloc_device_mem_until_full_contiguous(void **state)
 	allocate_device_mem_until_full(state, CONTIGUOUS);
 }
 
+#define MAP_BATCH_NUM		32
+#define MAP_BATCH_SIZE		0x10000
+#define MAP_BATCH_INVALID	5
+
+/**
+ * This test maps many host buffers with a single batch call, one of them
+ * invalid, and checks that the batch reports the error of that entry only and
+ * that the other mappings work by copying between two of them through SRAM.
+ * @param state contains the open file descriptor.
+ */
+void test_map_host_batch(void **state)
+{
+	struct hltests_state *tests_state = (struct hltests_state *) *state;
+	struct hlthunk_host_map_entry entries[MAP_BATCH_NUM];
+	struct hlthunk_hw_ip_info hw_ip;
+	uint64_t sram_addr;
+	int i, j, rc, fd = tests_state->fd;
+
+	rc = hlthunk_get_hw_ip_info(fd, &hw_ip);
+	assert_int_equal(rc, 0);
+	sram_addr = hw_ip.sram_base_address;
+
+	memset(entries, 0, sizeof(entries));
+	for (i = 0 ; i < MAP_BATCH_NUM ; i++) {
+		if (i == MAP_BATCH_INVALID)
+			continue;
+
+		rc = posix_memalign(&entries[i].host_virt_addr, getpagesize(),
+					MAP_BATCH_SIZE);
+		assert_int_equal(rc, 0);
+		entries[i].size = MAP_BATCH_SIZE;
+	}
+
+	rc = hlthunk_host_memory_map_batch(fd, entries, MAP_BATCH_NUM, 4);
+	assert_int_equal(rc, -EINVAL);
+
+	for (i = 0 ; i < MAP_BATCH_NUM ; i++) {
+		if (i == MAP_BATCH_INVALID) {
+			assert_int_equal(entries[i].rc, -EINVAL);
+			assert_int_equal(entries[i].device_virt_addr, 0);
+			continue;
+		}
+
+		assert_int_equal(entries[i].rc, 0);
+		assert_int_not_equal(entries[i].device_virt_addr, 0);
+		for (j = 0 ; j < i ; j++)
+			assert_int_not_equal(entries[i].device_virt_addr,
+						entries[j].device_virt_addr);
+	}
+
+	hltests_fill_rand_values(entries[0].host_virt_addr, MAP_BATCH_SIZE);
+	memset(entries[1].host_virt_addr, 0, MAP_BATCH_SIZE);
+
+	hltests_dma_transfer(fd, hltests_get_dma_down_qid(fd, DCORE0, STREAM0),
+				EB_FALSE, MB_TRUE, entries[0].device_virt_addr,
+				sram_addr, MAP_BATCH_SIZE,
+				GOYA_DMA_HOST_TO_SRAM);
+	hltests_dma_transfer(fd, hltests_get_dma_up_qid(fd, DCORE0, STREAM0),
+				EB_FALSE, MB_TRUE, sram_addr,
+				entries[1].device_virt_addr, MAP_BATCH_SIZE,
+				GOYA_DMA_SRAM_TO_HOST);
+
+	rc = hltests_mem_compare(entries[0].host_virt_addr,
+				entries[1].host_virt_addr, MAP_BATCH_SIZE);
+	assert_int_equal(rc, 0);
+
+	rc = hlthunk_host_memory_unmap_batch(fd, entries, MAP_BATCH_NUM);
+	assert_int_equal(rc, 0);
+
+	for (i = 0 ; i < MAP_BATCH_NUM ; i++)
+		free(entries[i].host_virt_addr);
+}
+
+/**
+ * This test maps a read-only file mapping with a batch call, while mlock can't
+ * lock it, and checks that the device reads its content. The library must not
+ * write to the buffer while prefaulting it.
+ * @param state contains the open file descriptor.
+ */
+void test_map_host_batch_read_only(void **state)
+{
+	struct hltests_state *tests_state = (struct hltests_state *) *state;
+	struct hlthunk_host_map_entry entries[2];
+	struct hlthunk_hw_ip_info hw_ip;
+	char path[] = "/tmp/hlthunk_ro_XXXXXX";
+	struct rlimit memlock, no_memlock;
+	uint64_t sram_addr;
+	void *src = NULL, *dst = NULL;
+	int rc, tmp_fd, fd = tests_state->fd;
+
+	rc = hlthunk_get_hw_ip_info(fd, &hw_ip);
+	assert_int_equal(rc, 0);
+	sram_addr = hw_ip.sram_base_address;
+
+	rc = posix_memalign(&src, getpagesize(), MAP_BATCH_SIZE);
+	assert_int_equal(rc, 0);
+	hltests_fill_rand_values(src, MAP_BATCH_SIZE);
+
+	tmp_fd = mkstemp(path);
+	assert_true(tmp_fd >= 0);
+	unlink(path);
+	assert_int_equal(write(tmp_fd, src, MAP_BATCH_SIZE), MAP_BATCH_SIZE);
+	free(src);
+
+	src = mmap(NULL, MAP_BATCH_SIZE, PROT_READ, MAP_PRIVATE, tmp_fd, 0);
+	assert_true(src != MAP_FAILED);
+	close(tmp_fd);
+
+	rc = posix_memalign(&dst, getpagesize(), MAP_BATCH_SIZE);
+	assert_int_equal(rc, 0);
+	memset(dst, 0, MAP_BATCH_SIZE);
+
+	/* Unless the process may lock any amount, mlock fails */
+	rc = getrlimit(RLIMIT_MEMLOCK, &memlock);
+	assert_int_equal(rc, 0);
+	no_memlock.rlim_cur = 0;
+	no_memlock.rlim_max = memlock.rlim_max;
+	rc = setrlimit(RLIMIT_MEMLOCK, &no_memlock);
+	assert_int_equal(rc, 0);
+
+	memset(entries, 0, sizeof(entries));
+	entries[0].host_virt_addr = src;
+	entries[0].size = MAP_BATCH_SIZE;
+	entries[1].host_virt_addr = dst;
+	entries[1].size = MAP_BATCH_SIZE;
+
+	rc = hlthunk_host_memory_map_batch(fd, entries, 2, 2);
+	assert_int_equal(rc, 0);
+
+	rc = setrlimit(RLIMIT_MEMLOCK, &memlock);
+	assert_int_equal(rc, 0);
+
+	hltests_dma_transfer(fd, hltests_get_dma_down_qid(fd, DCORE0, STREAM0),
+				EB_FALSE, MB_TRUE, entries[0].device_virt_addr,
+				sram_addr, MAP_BATCH_SIZE,
+				GOYA_DMA_HOST_TO_SRAM);
+	hltests_dma_transfer(fd, hltests_get_dma_up_qid(fd, DCORE0, STREAM0),
+				EB_FALSE, MB_TRUE, sram_addr,
+				entries[1].device_virt_addr, MAP_BATCH_SIZE,
+				GOYA_DMA_SRAM_TO_HOST);
+
+	rc = hltests_mem_compare(src, dst, MAP_BATCH_SIZE);
+	assert_int_equal(rc, 0);
+
+	rc = hlthunk_host_memory_unmap_batch(fd, entries, 2);
+	assert_int_equal(rc, 0);
+
+	munmap(src, MAP_BATCH_SIZE);
+	free(dst);
+}
+
+#define HOST_ALLOC_SIZE		0x300000
+
+void test_host_alloc(void **state)
+{
+	struct hltests_state *tests_state = (struct hltests_state *) *state;
+	struct hlthunk_host_buf src, dst;
+	struct hlthunk_hw_ip_info hw_ip;
+	uint64_t sram_addr;
+	int rc, fd = tests_state->fd;
+
+	rc = hlthunk_get_hw_ip_info(fd, &hw_ip);
+	assert_int_equal(rc, 0);
+	sram_addr = hw_ip.sram_base_address;
+
+	/* Take the largest pages available */
+	rc = hlthunk_host_alloc(fd, HOST_ALLOC_SIZE, 0, &src);
+	assert_int_equal(rc, 0);
+	assert_true(src.size >= HOST_ALLOC_SIZE);
+	assert_int_equal(src.size % src.page_size, 0);
+	assert_int_equal((uintptr_t) src.host_ptr % src.page_size, 0);
+	assert_int_not_equal(src.device_virt_addr, 0);
+
+	/* Regular pages only */
+	rc = hlthunk_host_alloc(fd, HOST_ALLOC_SIZE, HLTHUNK_HOST_ALLOC_NO_1GB |
+				HLTHUNK_HOST_ALLOC_NO_2MB |
+				HLTHUNK_HOST_ALLOC_NO_THP, &dst);
+	assert_int_equal(rc, 0);
+	assert_int_equal(dst.page_size, getpagesize());
+	assert_false(dst.transparent);
+
+	rc = hlthunk_host_alloc(fd, HOST_ALLOC_SIZE, HLTHUNK_HOST_ALLOC_NO_1GB |
+				HLTHUNK_HOST_ALLOC_NO_2MB |
+				HLTHUNK_HOST_ALLOC_NO_THP |
+				HLTHUNK_HOST_ALLOC_HUGE_ONLY, &dst);
+	assert_int_equal(rc, -ENOMEM);
+
+	hltests_fill_rand_values(src.host_ptr, HOST_ALLOC_SIZE);
+	memset(dst.host_ptr, 0, HOST_ALLOC_SIZE);
+
+	hltests_dma_transfer(fd, hltests_get_dma_down_qid(fd, DCORE0, STREAM0),
+				EB_FALSE, MB_TRUE, src.device_virt_addr,
+				sram_addr, HOST_ALLOC_SIZE,
+				GOYA_DMA_HOST_TO_SRAM);
+	hltests_dma_transfer(fd, hltests_get_dma_up_qid(fd, DCORE0, STREAM0),
+				EB_FALSE, MB_TRUE, sram_addr,
+				dst.device_virt_addr, HOST_ALLOC_SIZE,
+				GOYA_DMA_SRAM_TO_HOST);
+
+	rc = hltests_mem_compare(src.host_ptr, dst.host_ptr, HOST_ALLOC_SIZE);
+	assert_int_equal(rc, 0);
+
+	rc = hlthunk_host_free(fd, &src);
+	assert_int_equal(rc, 0);
+	rc = hlthunk_host_free(fd, &dst);
+	assert_int_equal(rc, 0);
+
+	/* Pages larger than the size aren't used */
+	rc = hlthunk_host_alloc(fd, getpagesize(), 0, &src);
+	assert_int_equal(rc, 0);
+	assert_int_equal(src.page_size, getpagesize());
+	assert_int_equal(src.size, getpagesize());
+
+	rc = hlthunk_host_free(fd, &src);
+	assert_int_equal(rc, 0);
+}
+
+#define VA_INDEX_SIZE		0x10000
+#define VA_INDEX_READERS	2
+#define VA_INDEX_ITERATIONS	64
+#define VA_INDEX_AREAS		200
+
+struct va_index_reader {
+	void *ptr;
+	uint64_t va;
+	int fd;
+	bool stop;
+	bool failed;
+};
+
+static void *va_index_reader_thread(void *arg)
+{
+	struct va_index_reader *reader = (struct va_index_reader *) arg;
+	uint64_t off, va;
+	void *ptr;
+
+	/* The buffer stays mapped while other areas come and go */
+	for (off = 0 ; !__atomic_load_n(&reader->stop, __ATOMIC_RELAXED) ;
+			off = (off + 0x40) % VA_INDEX_SIZE) {
+		if (hlthunk_host_ptr_to_device_va(reader->fd,
+					(uint8_t *) reader->ptr + off, &va) ||
+				va != reader->va + off ||
+				hlthunk_device_va_to_host_ptr(reader->fd, va,
+								&ptr) ||
+				ptr != (uint8_t *) reader->ptr + off) {
+			reader->failed = true;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+void test_host_va_index(void **state)
+{
+	struct hltests_state *tests_state = (struct hltests_state *) *state;
+	struct va_index_reader reader;
+	pthread_t threads[VA_INDEX_READERS];
+	uint64_t va, other_va, second_va, *area_vas;
+	uint8_t *buf = NULL, *other = NULL, *areas = NULL;
+	size_t page_size = getpagesize();
+	void *ptr;
+	int i, rc, fd = tests_state->fd;
+
+	rc = posix_memalign((void **) &buf, getpagesize(), VA_INDEX_SIZE);
+	assert_int_equal(rc, 0);
+	rc = posix_memalign((void **) &other, getpagesize(), VA_INDEX_SIZE);
+	assert_int_equal(rc, 0);
+
+	va = hlthunk_host_memory_map(fd, buf, 0, VA_INDEX_SIZE);
+	assert_int_not_equal(va, 0);
+
+	/* Interior pointers translate both ways */
+	rc = hlthunk_host_ptr_to_device_va(fd, buf + 0x1234, &other_va);
+	assert_int_equal(rc, 0);
+	assert_int_equal(other_va, va + 0x1234);
+
+	rc = hlthunk_device_va_to_host_ptr(fd, va + VA_INDEX_SIZE - 1, &ptr);
+	assert_int_equal(rc, 0);
+	assert_ptr_equal(ptr, buf + VA_INDEX_SIZE - 1);
+
+	rc = hlthunk_host_ptr_to_device_va(fd, buf + VA_INDEX_SIZE, &other_va);
+	assert_int_equal(rc, -ENOENT);
+
+	/* A second mapping of the same area doesn't hide the first one */
+	second_va = hlthunk_host_memory_map(fd, buf + 0x1000, 0, 0x1000);
+	assert_int_not_equal(second_va, 0);
+
+	rc = hlthunk_host_ptr_to_device_va(fd, buf + 0x2000, &other_va);
+	assert_int_equal(rc, 0);
+	assert_int_equal(other_va, va + 0x2000);
+
+	rc = hlthunk_memory_unmap(fd, second_va);
+	assert_int_equal(rc, 0);
+
+	/* Many areas at once, each a page of its own */
+	rc = posix_memalign((void **) &areas, page_size,
+				VA_INDEX_AREAS * page_size);
+	assert_int_equal(rc, 0);
+	area_vas = malloc(VA_INDEX_AREAS * sizeof(*area_vas));
+	assert_non_null(area_vas);
+
+	for (i = 0 ; i < VA_INDEX_AREAS ; i++) {
+		area_vas[i] = hlthunk_host_memory_map(fd,
+					areas + i * page_size, 0, page_size);
+		assert_int_not_equal(area_vas[i], 0);
+	}
+
+	for (i = 0 ; i < VA_INDEX_AREAS ; i++) {
+		rc = hlthunk_host_ptr_to_device_va(fd,
+				areas + i * page_size + 0x10, &other_va);
+		assert_int_equal(rc, 0);
+		assert_int_equal(other_va, area_vas[i] + 0x10);
+
+		rc = hlthunk_device_va_to_host_ptr(fd, area_vas[i], &ptr);
+		assert_int_equal(rc, 0);
+		assert_ptr_equal(ptr, areas + i * page_size);
+	}
+
+	/* Every other area is unmapped first, then the rest */
+	for (i = 0 ; i < VA_INDEX_AREAS ; i += 2) {
+		rc = hlthunk_memory_unmap(fd, area_vas[i]);
+		assert_int_equal(rc, 0);
+	}
+
+	for (i = 1 ; i < VA_INDEX_AREAS ; i += 2) {
+		rc = hlthunk_host_ptr_to_device_va(fd, areas + i * page_size,
+							&other_va);
+		assert_int_equal(rc, 0);
+		assert_int_equal(other_va, area_vas[i]);
+
+		rc = hlthunk_host_ptr_to_device_va(fd,
+				areas + (i - 1) * page_size, &other_va);
+		assert_int_equal(rc, -ENOENT);
+
+		rc = hlthunk_memory_unmap(fd, area_vas[i]);
+		assert_int_equal(rc, 0);
+	}
+
+	free(area_vas);
+	free(areas);
+
+	reader.ptr = buf;
+	reader.va = va;
+	reader.fd = fd;
+	reader.stop = false;
+	reader.failed = false;
+
+	for (i = 0 ; i < VA_INDEX_READERS ; i++) {
+		rc = pthread_create(&threads[i], NULL, va_index_reader_thread,
+					&reader);
+		assert_int_equal(rc, 0);
+	}
+
+	for (i = 0 ; i < VA_INDEX_ITERATIONS ; i++) {
+		other_va = hlthunk_host_memory_map(fd, other, 0,
+							VA_INDEX_SIZE);
+		assert_int_not_equal(other_va, 0);
+
+		rc = hlthunk_memory_unmap(fd, other_va);
+		assert_int_equal(rc, 0);
+	}
+
+	__atomic_store_n(&reader.stop, true, __ATOMIC_RELAXED);
+
+	for (i = 0 ; i < VA_INDEX_READERS ; i++)
+		pthread_join(threads[i], NULL);
+
+	assert_false(reader.failed);
+
+	rc = hlthunk_host_ptr_to_device_va(fd, other, &other_va);
+	assert_int_equal(rc, -ENOENT);
+
+	rc = hlthunk_memory_unmap(fd, va);
+	assert_int_equal(rc, 0);
+
+	rc = hlthunk_host_ptr_to_device_va(fd, buf, &va);
+	assert_int_equal(rc, -ENOENT);
+
+	free(buf);
+	free(other);
+}
+
+#define PREFETCH_NUM		4
+#define PREFETCH_SIZE		0x10000
+
+void test_host_prefetch(void **state)
+{
+	struct hltests_state *tests_state = (struct hltests_state *) *state;
+	struct hlthunk_host_prefetch_stats stats;
+	struct hlthunk_hw_ip_info hw_ip;
+	uint64_t va[PREFETCH_NUM], sram_addr;
+	void *buf[PREFETCH_NUM], *pf;
+	int i, rc, fd = tests_state->fd;
+
+	rc = hlthunk_get_hw_ip_info(fd, &hw_ip);
+	assert_int_equal(rc, 0);
+	sram_addr = hw_ip.sram_base_address;
+
+	/* Only two of the buffers fit in the budget at a time */
+	pf = hlthunk_host_prefetch_create(fd, 2 * PREFETCH_SIZE);
+	assert_non_null(pf);
+
+	for (i = 0 ; i < PREFETCH_NUM ; i++) {
+		rc = posix_memalign(&buf[i], getpagesize(), PREFETCH_SIZE);
+		assert_int_equal(rc, 0);
+
+		rc = hlthunk_host_prefetch_prepare(pf, buf[i], PREFETCH_SIZE);
+		assert_int_equal(rc, 0);
+	}
+
+	rc = hlthunk_host_prefetch_prepare(pf, buf[0], PREFETCH_SIZE);
+	assert_int_equal(rc, -EEXIST);
+
+	for (i = 0 ; i < 2 ; i++) {
+		rc = hlthunk_host_prefetch_get_va(pf, buf[i], true, &va[i]);
+		assert_int_equal(rc, 0);
+		assert_int_not_equal(va[i], 0);
+	}
+
+	rc = hlthunk_host_prefetch_get_va(pf, buf[2], false, &va[2]);
+	assert_int_equal(rc, -EAGAIN);
+
+	hltests_fill_rand_values(buf[0], PREFETCH_SIZE);
+	memset(buf[1], 0, PREFETCH_SIZE);
+
+	hltests_dma_transfer(fd, hltests_get_dma_down_qid(fd, DCORE0, STREAM0),
+				EB_FALSE, MB_TRUE, va[0], sram_addr,
+				PREFETCH_SIZE, GOYA_DMA_HOST_TO_SRAM);
+	hltests_dma_transfer(fd, hltests_get_dma_up_qid(fd, DCORE0, STREAM0),
+				EB_FALSE, MB_TRUE, sram_addr, va[1],
+				PREFETCH_SIZE, GOYA_DMA_SRAM_TO_HOST);
+
+	rc = hltests_mem_compare(buf[0], buf[1], PREFETCH_SIZE);
+	assert_int_equal(rc, 0);
+
+	/* Releasing the first buffers lets the others in */
+	for (i = 0 ; i < 2 ; i++) {
+		rc = hlthunk_host_prefetch_release(pf, buf[i]);
+		assert_int_equal(rc, 0);
+	}
+
+	for (i = 2 ; i < PREFETCH_NUM ; i++) {
+		rc = hlthunk_host_prefetch_get_va(pf, buf[i], true, &va[i]);
+		assert_int_equal(rc, 0);
+		assert_int_not_equal(va[i], 0);
+	}
+
+	rc = hlthunk_host_prefetch_get_va(pf, buf[0], true, &va[0]);
+	assert_int_equal(rc, -ENOENT);
+
+	rc = hlthunk_host_prefetch_get_stats(pf, &stats);
+	assert_int_equal(rc, 0);
+	assert_int_equal(stats.prepared, PREFETCH_NUM);
+	assert_int_equal(stats.hits + stats.waits, PREFETCH_NUM);
+	assert_int_equal(stats.misses, 1);
+	assert_int_equal(stats.pinned_bytes, 2 * PREFETCH_SIZE);
+	assert_int_equal(stats.peak_pinned_bytes, 2 * PREFETCH_SIZE);
+
+	hlthunk_host_prefetch_destroy(pf);
+
+	for (i = 0 ; i < PREFETCH_NUM ; i++)
+		free(buf[i]);
+}
+
 const struct CMUnitTest memory_tests[] = {
 	cmocka_unit_test_setup(test_map_bigger_than_4GB,
 				hltests_ensure_device_operational),
 	cmocka_unit_test_setup(test_alloc_device_mem_until_full,
 				hltests_ensure_device_operational),
 	cmocka_unit_test_setup(test_alloc_device_mem_until_full_contiguous,
+				hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_map_host_batch,
+				hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_map_host_batch_read_only,
+				hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_host_prefetch,
+				hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_host_alloc,
+				hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_host_va_index,
 				hltests_ensure_device_operational)
 };
 
@@ -34,8 +34,32 @@ void test_open_by_busid(void **state)
 	hltests_teardown(state);
 }
 
+void test_set_backend_while_open(void **state)
+{
+	const struct hlthunk_backend_ops *ops = hlthunk_get_backend();
+	int rc;
+
+	assert_non_null(ops);
+	assert_non_null(hlthunk_get_backend_by_name("kernel"));
+	assert_non_null(hlthunk_get_backend_by_name("model"));
+	assert_null(hlthunk_get_backend_by_name("no_such_backend"));
+
+	if (hltests_setup(state)) {
+		printf("Failed to open device\n");
+		return;
+	}
+
+	/* Open fds belong to the current backend, so it can't be replaced */
+	rc = hlthunk_set_backend(hlthunk_get_backend_by_name("model"));
+	assert_int_equal(rc, -EBUSY);
+	assert_ptr_equal(hlthunk_get_backend(), ops);
+
+	hltests_teardown(state);
+}
+
 const struct CMUnitTest open_close_tests[] = {
 	cmocka_unit_test(test_open_by_busid),
+	cmocka_unit_test(test_set_backend_while_open),
 };
 
 static const char *const usage[] = {
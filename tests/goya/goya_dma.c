@@ -7,6 +7,7 @@
 
 #include "hlthunk.h"
 #include "hlthunk_tests.h"
+#include "goya/goya_coresight.h"
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -17,6 +18,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/stat.h>
 
 void test_dma_4_queues(void **state)
 {
@@ -253,8 +255,318 @@ void test_dma_4_queues(void **state)
 	assert_int_equal(rc, 0);
 }
 
+void test_trace_dma(void **state)
+{
+	struct hltests_state *tests_state = (struct hltests_state *) *state;
+	struct hlthunk_trace_params params;
+	struct hlthunk_trace_stats stats;
+	char path[] = "/tmp/hlthunk_trace_XXXXXX";
+	uint64_t host_src_device_va, dma_size = 0x100000;
+	void *host_src, *dram_addr, *trace;
+	struct stat st;
+	int rc, tmp_fd, fd = tests_state->fd;
+
+	host_src = hltests_allocate_host_mem(fd, dma_size, NOT_HUGE);
+	assert_non_null(host_src);
+	host_src_device_va = hltests_get_device_va_for_host_ptr(fd, host_src);
+
+	dram_addr = hltests_allocate_device_mem(fd, dma_size, NOT_CONTIGUOUS);
+	assert_non_null(dram_addr);
+
+	tmp_fd = mkstemp(path);
+	assert_true(tmp_fd >= 0);
+	close(tmp_fd);
+
+	memset(&params, 0, sizeof(params));
+	params.profile = hlthunk_trace_find_profile("DMA engines");
+	assert_int_equal(params.profile, HLTHUNK_TRACE_PROFILE_DMA);
+	params.path = path;
+	params.buffer_size = 0x100000;
+
+	trace = hlthunk_trace_start(fd, &params);
+	assert_non_null(trace);
+
+	hltests_dma_transfer(fd, hltests_get_dma_down_qid(fd, DCORE0, STREAM0),
+				EB_FALSE, MB_TRUE, host_src_device_va,
+				(uint64_t) (uintptr_t) dram_addr, dma_size,
+				GOYA_DMA_HOST_TO_DRAM);
+
+	rc = hlthunk_trace_stop(trace, &stats);
+	assert_int_equal(rc, 0);
+
+	/* Everything the ETR wrote is in the file */
+	rc = stat(path, &st);
+	assert_int_equal(rc, 0);
+	assert_int_equal(st.st_size, stats.bytes);
+	unlink(path);
+
+	/* The trace components are released */
+	trace = hlthunk_trace_start(fd, &params);
+	assert_non_null(trace);
+	rc = hlthunk_trace_stop(trace, NULL);
+	assert_int_equal(rc, 0);
+	unlink(path);
+
+	rc = hltests_free_device_mem(fd, dram_addr);
+	assert_int_equal(rc, 0);
+	rc = hltests_free_host_mem(fd, host_src);
+	assert_int_equal(rc, 0);
+}
+
+void test_spmu_sampler(void **state)
+{
+	struct hltests_state *tests_state = (struct hltests_state *) *state;
+	struct hlthunk_spmu_sampler_params params;
+	struct hlthunk_spmu_sample samples[64];
+	struct hlthunk_spmu_engine engine;
+	struct hlthunk_spmu_total total;
+	int i, rc, num, fd = tests_state->fd;
+	void *sampler;
+
+	/* Two groups of events, which take turns on the counters */
+	memset(&engine, 0, sizeof(engine));
+	engine.spmu = GOYA_SPMU_DMA_CH_1_CS;
+	engine.num_events = 8;
+	for (i = 0 ; i < 8 ; i++)
+		engine.events[i] = i;
+
+	memset(&params, 0, sizeof(params));
+	params.engines = &engine;
+	params.num_engines = 1;
+	params.interval_us = 2000;
+
+	sampler = hlthunk_spmu_sampler_create(fd, &params);
+	assert_non_null(sampler);
+
+	usleep(20000);
+
+	rc = hlthunk_spmu_sampler_stop(sampler);
+	assert_int_equal(rc, 0);
+
+	num = hlthunk_spmu_sampler_read(sampler, samples, 64);
+	assert_true(num >= 2);
+
+	for (i = 0 ; i < num ; i++) {
+		assert_int_equal(samples[i].engine, 0);
+		assert_int_equal(samples[i].num_events, i % 2 ? 2 : 6);
+		assert_int_equal(samples[i].events[0], i % 2 ? 6 : 0);
+	}
+
+	assert_int_equal(hlthunk_spmu_sampler_read(sampler, samples, 64), 0);
+	assert_int_equal(hlthunk_spmu_sampler_get_dropped(sampler), 0);
+
+	for (i = 0 ; i < 8 ; i++) {
+		rc = hlthunk_spmu_sampler_get_total(sampler, 0, i, &total);
+		assert_int_equal(rc, 0);
+		assert_true(total.active_ns > 0);
+		assert_true(total.active_ns <= total.elapsed_ns);
+	}
+
+	rc = hlthunk_spmu_sampler_get_total(sampler, 0, 8, &total);
+	assert_int_equal(rc, -EINVAL);
+
+	hlthunk_spmu_sampler_destroy(sampler);
+}
+
+void test_bw_monitor(void **state)
+{
+	struct hltests_state *tests_state = (struct hltests_state *) *state;
+	struct hlthunk_bw_monitor_result results[2];
+	struct hlthunk_bw_monitor_params params;
+	uint32_t bmons[2] = { GOYA_BMON_DMA_CH_1_0, GOYA_BMON_DMA_CH_1_1 };
+	uint64_t host_src_device_va, dma_size = 0x100000;
+	void *host_src, *dram_addr, *monitor;
+	int i, rc, fd = tests_state->fd;
+
+	host_src = hltests_allocate_host_mem(fd, dma_size, NOT_HUGE);
+	assert_non_null(host_src);
+	host_src_device_va = hltests_get_device_va_for_host_ptr(fd, host_src);
+
+	dram_addr = hltests_allocate_device_mem(fd, dma_size, NOT_CONTIGUOUS);
+	assert_non_null(dram_addr);
+
+	/* The PCIe BMONs aren't routed by any trace profile */
+	memset(&params, 0, sizeof(params));
+	bmons[0] = GOYA_BMON_PCIE_MSTR_RD;
+	params.bmons = bmons;
+	params.num_bmons = 2;
+	monitor = hlthunk_bw_monitor_start(fd, &params);
+	assert_null(monitor);
+	assert_int_equal(errno, EINVAL);
+	bmons[0] = GOYA_BMON_DMA_CH_1_0;
+
+	/* The source buffer and the destination buffer */
+	params.ranges[0].start = host_src_device_va;
+	params.ranges[0].mask = ~(dma_size - 1);
+	params.ranges[1].start = (uint64_t) (uintptr_t) dram_addr;
+	params.ranges[1].mask = ~(dma_size - 1);
+
+	monitor = hlthunk_bw_monitor_start(fd, &params);
+	assert_non_null(monitor);
+
+	hltests_dma_transfer(fd, hltests_get_dma_down_qid(fd, DCORE0, STREAM0),
+				EB_FALSE, MB_TRUE, host_src_device_va,
+				(uint64_t) (uintptr_t) dram_addr, dma_size,
+				GOYA_DMA_HOST_TO_DRAM);
+
+	rc = hlthunk_bw_monitor_stop(monitor, results, 2);
+	assert_int_equal(rc, 0);
+
+	for (i = 0 ; i < 2 ; i++) {
+		assert_int_equal(results[i].bmon, bmons[i]);
+		assert_int_equal(results[i].num_errors, 0);
+		assert_true(results[i].bytes[0] <= dma_size * 2);
+		assert_true(results[i].bytes[1] <= dma_size * 2);
+	}
+
+	rc = hltests_free_device_mem(fd, dram_addr);
+	assert_int_equal(rc, 0);
+	rc = hltests_free_host_mem(fd, host_src);
+	assert_int_equal(rc, 0);
+}
+
+struct stp_writer {
+	uint8_t buf[256];
+	uint32_t pos;
+};
+
+static void stp_put(struct stp_writer *w, uint64_t val, uint32_t num_nibbles)
+{
+	uint32_t i, n;
+
+	for (i = num_nibbles ; i > 0 ; i--, w->pos++) {
+		n = (val >> ((i - 1) * 4)) & 0xF;
+		w->buf[w->pos / 2] |= n << ((w->pos & 1) * 4);
+	}
+}
+
+/*
+ * ASYNC, VERSION, FREQ of 1GHz and the hardware event master. The frequency
+ * may be sent by FREQ_TS, with a full timestamp
+ */
+static void stp_put_sync(struct stp_writer *w, bool freq_ts, uint64_t ts)
+{
+	stp_put(w, 0xFFFFFFFFFFFFFFFFull, 16);
+	stp_put(w, 0xFFFFF0, 6);
+	stp_put(w, 0xF003, 4);
+	stp_put(w, freq_ts ? 0xF09 : 0xF08, 3);
+	stp_put(w, 1000000000, 8);
+	if (freq_ts) {
+		stp_put(w, 0xE, 1);
+		stp_put(w, ts, 16);
+	}
+	stp_put(w, 0x180, 3);
+}
+
+/* D32MTS with a full timestamp */
+static void stp_put_event(struct stp_writer *w, uint32_t vector, uint64_t ts)
+{
+	stp_put(w, 0xA, 1);
+	stp_put(w, vector, 8);
+	stp_put(w, 0xE, 1);
+	stp_put(w, ts, 16);
+}
+
+/* Frames of 14 data bytes, each starting with the ID */
+static void put_frames(FILE *file, uint32_t id, struct stp_writer *w)
+{
+	uint8_t frame[16];
+	uint32_t off, i;
+
+	for (off = 0 ; off < (w->pos + 1) / 2 ; off += 14) {
+		memset(frame, 0, sizeof(frame));
+		frame[0] = (id << 1) | 1;
+		for (i = 1 ; i < 15 && off + i - 1 < sizeof(w->buf) ; i++) {
+			frame[i] = w->buf[off + i - 1];
+			if (!(i & 1)) {
+				frame[15] |= (frame[i] & 1) << (i / 2);
+				frame[i] &= 0xFE;
+			}
+		}
+		fwrite(frame, 1, sizeof(frame), file);
+	}
+}
+
+void test_trace_decode(void **state)
+{
+	struct hlthunk_trace_decode_params params;
+	struct hlthunk_trace_decode_stats stats;
+	char trace_path[] = "/tmp/hlthunk_trace_XXXXXX";
+	char json_path[] = "/tmp/hlthunk_trace_json_XXXXXX";
+	struct stp_writer dma, tpc;
+	char json[4096];
+	size_t len;
+	FILE *file;
+	int rc, tmp_fd;
+
+	/* Busy is event 0 and idle is event 1 */
+	memset(&dma, 0, sizeof(dma));
+	stp_put_sync(&dma, false, 0);
+	stp_put_event(&dma, 1, 1000);
+	/* The busy interval goes on into the next segment */
+	stp_put_sync(&dma, false, 0);
+	stp_put_event(&dma, 2, 3000);
+	stp_put_event(&dma, 1, 5000);
+	stp_put_event(&dma, 2, 6000);
+
+	memset(&tpc, 0, sizeof(tpc));
+	stp_put_sync(&tpc, true, 1500);
+	stp_put_event(&tpc, 1, 2000);
+	stp_put_event(&tpc, 2, 2500);
+
+	tmp_fd = mkstemp(trace_path);
+	assert_true(tmp_fd >= 0);
+	file = fdopen(tmp_fd, "w");
+	assert_non_null(file);
+	put_frames(file, HLTHUNK_TRACE_STM_FIRST_ID + GOYA_STM_DMA_CH_0_CS,
+			&dma);
+	put_frames(file, HLTHUNK_TRACE_STM_FIRST_ID + GOYA_STM_TPC0_EML, &tpc);
+	fclose(file);
+
+	tmp_fd = mkstemp(json_path);
+	assert_true(tmp_fd >= 0);
+	close(tmp_fd);
+
+	memset(&params, 0, sizeof(params));
+	params.trace_path = trace_path;
+	params.json_path = json_path;
+	params.busy_event = 0;
+	params.idle_event = 1;
+	params.num_threads = 2;
+
+	rc = hlthunk_trace_decode(&params, &stats);
+	assert_int_equal(rc, 0);
+	assert_int_equal(stats.num_sources, 2);
+	assert_int_equal(stats.num_segments, 3);
+	assert_int_equal(stats.num_events, 6);
+	assert_int_equal(stats.num_intervals, 3);
+	assert_int_equal(stats.num_errors, 0);
+
+	file = fopen(json_path, "r");
+	assert_non_null(file);
+	len = fread(json, 1, sizeof(json) - 1, file);
+	json[len] = '\0';
+	fclose(file);
+
+	assert_non_null(strstr(json, "\"name\":\"DMA_CH_0\""));
+	assert_non_null(strstr(json, "\"name\":\"TPC0\""));
+	assert_non_null(strstr(json, "\"ts\":0.000,\"dur\":2.000"));
+	assert_non_null(strstr(json, "\"ts\":4.000,\"dur\":1.000"));
+	assert_non_null(strstr(json, "\"ts\":1.000,\"dur\":0.500"));
+
+	unlink(json_path);
+	unlink(trace_path);
+}
+
 const struct CMUnitTest goya_dma_tests[] = {
 	cmocka_unit_test_setup(test_dma_4_queues,
+				hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_trace_dma,
+				hltests_ensure_device_operational),
+	cmocka_unit_test(test_trace_decode),
+	cmocka_unit_test_setup(test_spmu_sampler,
+				hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_bw_monitor,
 				hltests_ensure_device_operational)
 };
 
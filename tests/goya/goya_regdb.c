@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+#include "hlthunk.h"
+#include "hlthunk_tests.h"
+#include "goya/goya.h"
+#include "goya/asic_reg/goya_regs.h"
+#include "goya/asic_reg/tpc0_qm_masks.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <limits.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#define REGDB_MAX_FIELDS	32
+
+static const struct {
+	const char *name;
+	uint64_t addr;
+} regdb_regs[] = {
+	{ "mmTPC0_QM_GLBL_CFG0", mmTPC0_QM_GLBL_CFG0 },
+	{ "mmTPC7_QM_GLBL_CFG0", mmTPC7_QM_GLBL_CFG0 },
+	{ "mmDMA_QM_3_PQ_PI", mmDMA_QM_3_PQ_PI },
+	{ "mmMME_ARCH_STATUS", mmMME_ARCH_STATUS },
+	{ "mmPSOC_GLOBAL_CONF_SCRATCHPAD_0", mmPSOC_GLOBAL_CONF_SCRATCHPAD_0 }
+};
+
+void test_regdb_lookup(void **state)
+{
+	char name[64];
+	uint64_t addr;
+	uint32_t i;
+	int rc;
+
+	for (i = 0 ; i < sizeof(regdb_regs) / sizeof(regdb_regs[0]) ; i++) {
+		rc = hlthunk_regdb_get_name(HLTHUNK_DEVICE_GOYA,
+						regdb_regs[i].addr, name,
+						sizeof(name));
+		assert_int_equal(rc, 0);
+		assert_string_equal(name, regdb_regs[i].name);
+
+		/* The full address of a register has the same name */
+		rc = hlthunk_regdb_get_name(HLTHUNK_DEVICE_GOYA,
+					CFG_BASE + regdb_regs[i].addr, name,
+					sizeof(name));
+		assert_int_equal(rc, 0);
+		assert_string_equal(name, regdb_regs[i].name);
+
+		rc = hlthunk_regdb_get_addr(HLTHUNK_DEVICE_GOYA,
+						regdb_regs[i].name, &addr);
+		assert_int_equal(rc, 0);
+		assert_int_equal(addr, regdb_regs[i].addr);
+
+		/* The "mm" prefix is optional */
+		rc = hlthunk_regdb_get_addr(HLTHUNK_DEVICE_GOYA,
+						regdb_regs[i].name + 2, &addr);
+		assert_int_equal(rc, 0);
+		assert_int_equal(addr, regdb_regs[i].addr);
+	}
+
+	rc = hlthunk_regdb_get_addr(HLTHUNK_DEVICE_GOYA, "mmTPC8_QM_GLBL_CFG0",
+					&addr);
+	assert_int_equal(rc, -ENOENT);
+
+	rc = hlthunk_regdb_get_name(HLTHUNK_DEVICE_GOYA,
+					mmTPC0_QM_GLBL_CFG0 + 2, name,
+					sizeof(name));
+	assert_int_equal(rc, -ENOENT);
+
+	rc = hlthunk_regdb_get_name(HLTHUNK_DEVICE_GOYA, mmTPC0_QM_GLBL_CFG0,
+					name, 8);
+	assert_int_equal(rc, -ENOSPC);
+}
+
+void test_regdb_decode(void **state)
+{
+	struct hlthunk_reg_field fields[REGDB_MAX_FIELDS];
+	uint32_t val, i;
+	int num, num_tpc7;
+
+	val = TPC0_QM_GLBL_CFG0_PQF_EN_MASK | TPC0_QM_GLBL_CFG0_DMA_EN_MASK;
+
+	num = hlthunk_regdb_decode(HLTHUNK_DEVICE_GOYA, mmTPC0_QM_GLBL_CFG0,
+					val, fields, REGDB_MAX_FIELDS);
+	assert_in_range(num, 2, REGDB_MAX_FIELDS);
+
+	for (i = 0 ; i < (uint32_t) num ; i++) {
+		if (!strcmp(fields[i].name, "PQF_EN")) {
+			assert_int_equal(fields[i].shift,
+					TPC0_QM_GLBL_CFG0_PQF_EN_SHIFT);
+			assert_int_equal(fields[i].width, 1);
+			assert_int_equal(fields[i].value, 1);
+		} else if (!strcmp(fields[i].name, "DMA_EN")) {
+			assert_int_equal(fields[i].value, 1);
+		} else {
+			assert_int_equal(fields[i].value, 0);
+		}
+	}
+
+	/* Blocks of the same prototype share the fields of their registers */
+	num_tpc7 = hlthunk_regdb_decode(HLTHUNK_DEVICE_GOYA,
+					mmTPC7_QM_GLBL_CFG0, val, fields,
+					REGDB_MAX_FIELDS);
+	assert_int_equal(num_tpc7, num);
+
+	/* Only the number of fields is returned when there is no room */
+	num = hlthunk_regdb_decode(HLTHUNK_DEVICE_GOYA, mmTPC0_QM_GLBL_CFG0,
+					val, NULL, 0);
+	assert_int_equal(num, num_tpc7);
+}
+
+const struct CMUnitTest goya_regdb_tests[] = {
+	cmocka_unit_test(test_regdb_lookup),
+	cmocka_unit_test(test_regdb_decode)
+};
+
+static const char *const usage[] = {
+	"goya_regdb [options]",
+	NULL,
+};
+
+int main(int argc, const char **argv)
+{
+	int num_tests = sizeof(goya_regdb_tests) /
+				sizeof((goya_regdb_tests)[0]);
+
+	hltests_parser(argc, argv, usage, HLTHUNK_DEVICE_GOYA,
+			goya_regdb_tests, num_tests);
+
+	return hltests_run_group_tests("goya_regdb", goya_regdb_tests,
+					num_tests, hltests_setup,
+					hltests_teardown);
+}
@@ -178,6 +178,99 @@ void test_debugfs_sram_read_write(void **state)
 	assert_int_equal(0x12345678, val);
 }
 
+#define DEBUGFS_RANGE_NUM	17
+
+void test_debugfs_sram_range_read_write(void **state)
+{
+	struct hltests_state *tests_state =
+					(struct hltests_state *) *state;
+	uint32_t vals[DEBUGFS_RANGE_NUM], read_vals[DEBUGFS_RANGE_NUM];
+	uint64_t base = SRAM_BASE_ADDR + 0x200000, addrs[DEBUGFS_RANGE_NUM];
+	void *regs = hltests_get_regs(tests_state->fd);
+	int i, rc;
+
+	for (i = 0 ; i < DEBUGFS_RANGE_NUM ; i++)
+		vals[i] = 0x12340000 | i;
+
+	/* An odd number of registers covers both the paired and single paths */
+	rc = hlthunk_reg_write_range(regs, base, vals, DEBUGFS_RANGE_NUM);
+	assert_int_equal(rc, 0);
+
+	rc = hlthunk_reg_read_range(regs, base, read_vals, DEBUGFS_RANGE_NUM);
+	assert_int_equal(rc, 0);
+	assert_memory_equal(vals, read_vals, sizeof(vals));
+
+	/* The list goes backwards, so no two registers are read together */
+	for (i = 0 ; i < DEBUGFS_RANGE_NUM ; i++)
+		addrs[i] = base + 4 * (DEBUGFS_RANGE_NUM - 1 - i);
+
+	rc = hlthunk_reg_read_list(regs, addrs, read_vals, DEBUGFS_RANGE_NUM);
+	assert_int_equal(rc, 0);
+	for (i = 0 ; i < DEBUGFS_RANGE_NUM ; i++)
+		assert_int_equal(read_vals[i], vals[DEBUGFS_RANGE_NUM - 1 - i]);
+}
+
+void test_reg_snapshot_diff(void **state)
+{
+	struct hltests_state *tests_state = (struct hltests_state *) *state;
+	uint64_t addrs[] = { mmPSOC_GLOBAL_CONF_SCRATCHPAD_10,
+				mmPSOC_GLOBAL_CONF_SCRATCHPAD_11 };
+	struct hlthunk_reg_snapshot_block blocks[] = {
+		{ .name = "TPC0_QM" },
+		{ .name = "PSOC_GLOBAL_CONF", .addrs = addrs, .num_regs = 2 }
+	};
+	char path[] = "/tmp/hlthunk_reg_snapshot_XXXXXX";
+	struct hlthunk_reg_diff diffs[4];
+	void *old_snap, *new_snap, *loaded;
+	uint32_t val;
+	int rc, tmp_fd, fd = tests_state->fd;
+
+	hltests_debugfs_write(fd, CFG_BASE + addrs[0], 0x11111111);
+	hltests_debugfs_write(fd, CFG_BASE + addrs[1], 0x22222222);
+
+	old_snap = hlthunk_reg_snapshot_take(fd, blocks, 2);
+	assert_non_null(old_snap);
+
+	hltests_debugfs_write(fd, CFG_BASE + addrs[1], 0x33333333);
+
+	new_snap = hlthunk_reg_snapshot_take(fd, blocks, 2);
+	assert_non_null(new_snap);
+
+	rc = hlthunk_reg_snapshot_get(new_snap, addrs[0], &val);
+	assert_int_equal(rc, 0);
+	assert_int_equal(val, 0x11111111);
+
+	/* The QMAN of an idle TPC doesn't change between the snapshots */
+	rc = hlthunk_reg_snapshot_diff(old_snap, new_snap, diffs, 4);
+	assert_int_equal(rc, 1);
+	assert_int_equal(diffs[0].addr, addrs[1]);
+	assert_int_equal(diffs[0].old_val, 0x22222222);
+	assert_int_equal(diffs[0].new_val, 0x33333333);
+
+	tmp_fd = mkstemp(path);
+	assert_true(tmp_fd >= 0);
+	close(tmp_fd);
+
+	rc = hlthunk_reg_snapshot_save(new_snap, path);
+	assert_int_equal(rc, 0);
+
+	loaded = hlthunk_reg_snapshot_load(path);
+	assert_non_null(loaded);
+	unlink(path);
+
+	rc = hlthunk_reg_snapshot_diff(new_snap, loaded, NULL, 0);
+	assert_int_equal(rc, 0);
+
+	hlthunk_reg_snapshot_free(loaded);
+	hlthunk_reg_snapshot_free(new_snap);
+	hlthunk_reg_snapshot_free(old_snap);
+
+	/* All the engines */
+	new_snap = hlthunk_reg_snapshot_take(fd, NULL, 0);
+	assert_non_null(new_snap);
+	hlthunk_reg_snapshot_free(new_snap);
+}
+
 void test_write_to_cfg_space(void **state)
 {
 	struct hltests_state *tests_state = (struct hltests_state *) *state;
@@ -265,6 +358,10 @@ void test_write_to_mmTPC_PLL_CLK_RLX_0_from_qman(void **state)
 const struct CMUnitTest goya_root_tests[] = {
 	cmocka_unit_test_setup(test_debugfs_sram_read_write,
 					hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_debugfs_sram_range_read_write,
+					hltests_ensure_device_operational),
+	cmocka_unit_test_setup(test_reg_snapshot_diff,
+					hltests_ensure_device_operational),
 	cmocka_unit_test_setup(test_write_to_cfg_space,
 					hltests_ensure_device_operational),
 	cmocka_unit_test_setup(test_tpc_qman_write_to_protected_register,
@@ -309,6 +309,9 @@ int hltests_open(const char *busid)
 
 	hdev->device_id = hlthunk_get_device_id_from_fd(fd);
 
+	if (hlthunk_get_numa_node(fd, &hdev->numa_node))
+		hdev->numa_node = -1;
+
 	switch (actual_asic_type) {
 	case HLTHUNK_DEVICE_GOYA:
 		goya_tests_set_asic_funcs(hdev);
@@ -321,8 +324,7 @@ int hltests_open(const char *busid)
 
 	hdev->asic_funcs->dram_pool_init(hdev);
 
-	hdev->debugfs_addr_fd = -1;
-	hdev->debugfs_data_fd = -1;
+	hdev->regs = NULL;
 
 	rc = create_mem_maps(hdev);
 	if (rc)
@@ -385,41 +387,28 @@ int hltests_close(int fd)
 
 void *hltests_cb_mmap(int fd, size_t length, off_t offset)
 {
-	return mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
-			offset);
+	return hlthunk_cb_mmap(fd, length, offset);
 }
 
 int hltests_cb_munmap(void *addr, size_t length)
 {
-	return munmap(addr, length);
+	return hlthunk_cb_munmap(addr, length);
 }
 
 static int debugfs_open(int fd)
 {
 	struct hltests_device *hdev;
-	int debugfs_addr_fd, debugfs_data_fd;
 
 	hdev = get_hdev_from_fd(fd);
 	if (!hdev)
 		return -ENODEV;
 
-	debugfs_addr_fd =
-		open("//sys/kernel/debug/habanalabs/hl0/addr", O_WRONLY);
-	debugfs_data_fd =
-		open("//sys/kernel/debug/habanalabs/hl0/data32", O_RDWR);
-
-	if ((debugfs_addr_fd == -1) || (debugfs_data_fd == -1)) {
-		if (debugfs_addr_fd >= 0)
-			close(debugfs_addr_fd);
-		else if (debugfs_data_fd >= 0)
-			close(debugfs_data_fd);
+	hdev->regs = hlthunk_reg_open(fd);
+	if (!hdev->regs) {
 		printf("Failed to open DebugFS (Didn't run with sudo ?)\n");
 		return -EPERM;
 	}
 
-	hdev->debugfs_addr_fd = debugfs_addr_fd;
-	hdev->debugfs_data_fd = debugfs_data_fd;
-
 	return 0;
 }
 
@@ -431,13 +420,11 @@ static int debugfs_close(int fd)
 	if (!hdev)
 		return -ENODEV;
 
-	if ((hdev->debugfs_addr_fd == -1) || (hdev->debugfs_data_fd == -1))
+	if (!hdev->regs)
 		return -EFAULT;
 
-	close(hdev->debugfs_addr_fd);
-	close(hdev->debugfs_data_fd);
-	hdev->debugfs_addr_fd = -1;
-	hdev->debugfs_data_fd = -1;
+	hlthunk_reg_close(hdev->regs);
+	hdev->regs = NULL;
 
 	return 0;
 }
@@ -445,48 +432,45 @@ static int debugfs_close(int fd)
 uint32_t hltests_debugfs_read(int fd, uint64_t full_address)
 {
 	struct hltests_device *hdev;
-	char addr_str[64] = "", value[64] = "";
-	ssize_t size;
+	uint32_t val;
+	int rc;
 
 	hdev = get_hdev_from_fd(fd);
 	if (!hdev)
 		return -1;
 
-	sprintf(addr_str, "0x%lx", full_address);
-
-	size = write(hdev->debugfs_addr_fd, addr_str, strlen(addr_str) + 1);
-	if (size < 0)
-		printf("Failed to write to debugfs address fd [rc %zd]\n",
-				size);
-
-	size = pread(hdev->debugfs_data_fd, value, sizeof(value), 0);
-	if (size < 0)
-		printf("Failed to read from debugfs data fd [rc %zd]\n", size);
+	rc = hlthunk_reg_read(hdev->regs, full_address, &val);
+	if (rc) {
+		printf("Failed to read from debugfs [rc %d]\n", rc);
+		return -1;
+	}
 
-	return strtoul(value, NULL, 16);
+	return val;
 }
 
 void hltests_debugfs_write(int fd, uint64_t full_address, uint32_t val)
 {
 	struct hltests_device *hdev;
-	char addr_str[64] = "", val_str[64] = "";
-	ssize_t size;
+	int rc;
 
 	hdev = get_hdev_from_fd(fd);
 	if (!hdev)
 		return;
 
-	sprintf(addr_str, "0x%lx", full_address);
-	sprintf(val_str, "0x%x", val);
+	rc = hlthunk_reg_write(hdev->regs, full_address, val);
+	if (rc)
+		printf("Failed to write to debugfs [rc %d]\n", rc);
+}
 
-	size = write(hdev->debugfs_addr_fd, addr_str, strlen(addr_str) + 1);
-	if (size < 0)
-		printf("Failed to write to debugfs address fd [rc %zd]\n",
-				size);
+void *hltests_get_regs(int fd)
+{
+	struct hltests_device *hdev;
 
-	size = write(hdev->debugfs_data_fd, val_str, strlen(val_str) + 1);
-	if (size < 0)
-		printf("Failed to write to debugfs data fd [rc %zd]\n", size);
+	hdev = get_hdev_from_fd(fd);
+	if (!hdev)
+		return NULL;
+
+	return hdev->regs;
 }
 
 static int is_param_enabled(enum hltests_kmd_param param, bool *val)
@@ -618,34 +602,20 @@ int hltests_root_teardown(void **state)
 	return hltests_teardown(state);
 }
 
-static void *allocate_huge_mem(uint64_t size)
-{
-	int mmapFlags = MAP_HUGE_2MB | MAP_HUGETLB | MAP_SHARED | MAP_ANONYMOUS;
-	int prot = PROT_READ | PROT_WRITE;
-	void *vaddr;
-
-	vaddr = mmap(0, size, prot, mmapFlags, -1, 0);
-
-	if (vaddr == MAP_FAILED) {
-		printf("Failed to allocate %lu host memory with huge pages\n",
-			size);
-		return NULL;
-	}
-
-	return vaddr;
-}
-
 /**
  * This function allocates memory on the host and will map it to the device
  * virtual address space
  * @param fd file descriptor of the device to which the function will map
  *           the memory
  * @param size how much memory to allocate
- * @param huge whether to use huge pages for the memory allocation
+ * @param huge whether to use 2MB huge pages for the memory allocation. The
+ *             allocation fails if there are no huge pages available. Either
+ *             way the memory is placed on the NUMA node of the device
  * @return pointer to the host memory. NULL is returned upon failure
  */
 void *hltests_allocate_host_mem(int fd, uint64_t size, enum hltests_huge huge)
 {
+	struct hlthunk_host_buf buf;
 	struct hltests_device *hdev;
 	struct hltests_memory *mem;
 	khint_t k;
@@ -663,16 +633,31 @@ void *hltests_allocate_host_mem(int fd, uint64_t size, enum hltests_huge huge)
 	mem->is_huge = huge;
 	mem->size = size;
 
-	if (mem->is_huge)
-		mem->host_ptr = allocate_huge_mem(size);
-	else
-		mem->host_ptr = malloc(size);
+	if (mem->is_huge) {
+		rc = hlthunk_host_alloc(fd, size, HLTHUNK_HOST_ALLOC_NO_1GB |
+						HLTHUNK_HOST_ALLOC_NO_THP |
+						HLTHUNK_HOST_ALLOC_HUGE_ONLY,
+					&buf);
+		if (rc) {
+			printf("Failed to allocate %lu bytes of host memory\n",
+				size);
+			goto free_mem_struct;
+		}
+
+		mem->host_ptr = buf.host_ptr;
+		mem->device_virt_addr = buf.device_virt_addr;
+		mem->size = buf.size;
+		goto add_mem;
+	}
 
-	if (!mem->host_ptr) {
+	if (posix_memalign(&mem->host_ptr, getpagesize(), size)) {
 		printf("Failed to allocate %lu bytes of host memory\n", size);
 		goto free_mem_struct;
 	}
 
+	/* Place the pages on the device node before they are first touched */
+	hlthunk_numa_bind_memory(mem->host_ptr, size, hdev->numa_node);
+
 	mem->device_virt_addr = hlthunk_host_memory_map(fd, mem->host_ptr, 0,
 							size);
 
@@ -681,6 +666,7 @@ void *hltests_allocate_host_mem(int fd, uint64_t size, enum hltests_huge huge)
 		goto free_allocation;
 	}
 
+add_mem:
 	pthread_mutex_lock(&hdev->mem_table_host_lock);
 
 	k = kh_put(ptr64, hdev->mem_table_host, (uintptr_t) mem->host_ptr, &rc);
@@ -691,10 +677,7 @@ void *hltests_allocate_host_mem(int fd, uint64_t size, enum hltests_huge huge)
 	return (void *) mem->host_ptr;
 
 free_allocation:
-	if (mem->is_huge)
-		munmap(mem->host_ptr, size);
-	else
-		free(mem->host_ptr);
+	free(mem->host_ptr);
 free_mem_struct:
 	hlthunk_free(mem);
 	return NULL;
@@ -782,6 +765,7 @@ free_mem_struct:
  */
 int hltests_free_host_mem(int fd, void *vaddr)
 {
+	struct hlthunk_host_buf buf;
 	struct hltests_device *hdev;
 	struct hltests_memory *mem;
 	khint_t k;
@@ -804,17 +788,23 @@ int hltests_free_host_mem(int fd, void *vaddr)
 
 	pthread_mutex_unlock(&hdev->mem_table_host_lock);
 
-	rc = hlthunk_memory_unmap(fd, mem->device_virt_addr);
+	if (mem->is_huge) {
+		buf.host_ptr = mem->host_ptr;
+		buf.device_virt_addr = mem->device_virt_addr;
+		buf.size = mem->size;
+
+		rc = hlthunk_host_free(fd, &buf);
+	} else {
+		rc = hlthunk_memory_unmap(fd, mem->device_virt_addr);
+		if (!rc)
+			free(mem->host_ptr);
+	}
+
 	if (rc) {
 		printf("Failed to unmap host memory\n");
 		return rc;
 	}
 
-	if (mem->is_huge)
-		munmap(mem->host_ptr, mem->size);
-	else
-		free(mem->host_ptr);
-
 	hlthunk_free(mem);
 
 	return 0;
@@ -876,33 +866,18 @@ int hltests_free_device_mem(int fd, void *vaddr)
  * This function retrieves the device VA for a host memory area that was mapped
  * to the device
  * @param fd file descriptor of the device that the host memory is mapped to
- * @param vaddr host pointer that points to the memory area
- * @return virtual address in the device VA space representing this host memory
- * area. 0 for failure
+ * @param vaddr host pointer that points anywhere inside the memory area
+ * @return virtual address in the device VA space representing this host
+ * pointer. 0 for failure
  */
 uint64_t hltests_get_device_va_for_host_ptr(int fd, void *vaddr)
 {
-	struct hltests_device *hdev;
-	struct hltests_memory *mem;
-	khint_t k;
-
-	hdev = get_hdev_from_fd(fd);
-	if (!hdev)
-		return 0;
+	uint64_t device_virt_addr;
 
-	pthread_mutex_lock(&hdev->mem_table_host_lock);
-
-	k = kh_get(ptr64, hdev->mem_table_host, (uintptr_t) vaddr);
-	if (k == kh_end(hdev->mem_table_host)) {
-		pthread_mutex_unlock(&hdev->mem_table_host_lock);
+	if (hlthunk_host_ptr_to_device_va(fd, vaddr, &device_virt_addr))
 		return 0;
-	}
-
-	mem = kh_val(hdev->mem_table_host, k);
 
-	pthread_mutex_unlock(&hdev->mem_table_host_lock);
-
-	return mem->device_virt_addr;
+	return device_virt_addr;
 }
 
 /**
@@ -1010,14 +985,6 @@ int hltests_destroy_cb(int fd, void *ptr)
 	return 0;
 }
 
-uint32_t hltests_add_packet_to_cb(void *ptr, uint32_t offset, void *pkt,
-					uint32_t pkt_size)
-{
-	memcpy((uint8_t *) ptr + offset, pkt, pkt_size);
-
-	return offset + pkt_size;
-}
-
 static int fill_cs_chunk(struct hltests_device *hdev,
 		struct hl_cs_chunk *chunk, void *cb_ptr, uint32_t cb_size,
 		uint32_t queue_index)
@@ -1731,6 +1698,11 @@ bool hltests_is_simulator(int fd)
 	return false;
 }
 
+bool hltests_is_model(int fd)
+{
+	return !strcmp(hlthunk_get_backend()->name, "model");
+}
+
 bool hltests_is_goya(int fd)
 {
 	struct hltests_device *hdev = get_hdev_from_fd(fd);
@@ -16,11 +16,18 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <stdbool.h>
+#include <string.h>
 
+/* The tools that build the packet encoders of the tests don't use CMocka */
+#ifndef HLTHUNK_TESTS_NO_CMOCKA
 #include <stdarg.h>
 #include <stddef.h>
 #include <setjmp.h>
 #include <cmocka.h>
+#else
+struct CMUnitTest;
+typedef int (*CMFixtureFunction)(void **state);
+#endif
 
 #define WAIT_FOR_CS_DEFAULT_TIMEOUT	5000000 /* 5 sec */
 
@@ -164,8 +171,8 @@ struct hltests_device {
 	void *priv;
 	int fd;
 	int refcnt;
-	int debugfs_addr_fd;
-	int debugfs_data_fd;
+	void *regs;
+	int numa_node;
 	enum hl_pci_ids device_id;
 };
 
@@ -315,6 +322,7 @@ const char *hltests_get_parser_pciaddr(void);
 const char *hltests_get_config_filename(void);
 int hltests_get_parser_run_disabled_tests(void);
 bool hltests_is_simulator(int fd);
+bool hltests_is_model(int fd);
 bool hltests_is_goya(int fd);
 
 int hltests_run_group_tests(const char *group_name,
@@ -333,6 +341,7 @@ int hltests_debugfs_open(int fd);
 int hltests_debugfs_close(int fd);
 uint32_t hltests_debugfs_read(int fd, uint64_t full_address);
 void hltests_debugfs_write(int fd, uint64_t full_address, uint32_t val);
+void *hltests_get_regs(int fd);
 
 void *hltests_allocate_host_mem(int fd, uint64_t size, enum hltests_huge huge);
 void *hltests_allocate_device_mem(int fd, uint64_t size,
@@ -345,8 +354,14 @@ void *hltests_create_cb(int fd, uint32_t cb_size,
 				enum hltests_is_external is_external,
 				uint64_t cb_internal_sram_address);
 int hltests_destroy_cb(int fd, void *ptr);
-uint32_t hltests_add_packet_to_cb(void *ptr, uint32_t offset, void *pkt,
-					uint32_t pkt_size);
+
+static inline uint32_t hltests_add_packet_to_cb(void *ptr, uint32_t offset,
+						void *pkt, uint32_t pkt_size)
+{
+	memcpy((uint8_t *) ptr + offset, pkt, pkt_size);
+
+	return offset + pkt_size;
+}
 
 int hltests_submit_cs(int fd, struct hltests_cs_chunk *restore_arr,
 				uint32_t restore_arr_size,
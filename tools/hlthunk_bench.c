@@ -0,0 +1,532 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+/*
+ * hlthunk_bench - measures what the library itself costs per call.
+ *
+ * By default the library runs on a stub backend whose ioctls complete
+ * immediately without doing any work, so the results reflect only the
+ * user-space path: argument marshalling, bookkeeping and allocations. The
+ * model and kernel backends can be selected as well. The results are printed
+ * as JSON, one entry per benchmark with its ns/op and allocations/op.
+ */
+
+#include "hlthunk.h"
+#include "hlthunk_tests.h"
+#include "specs/pci_ids.h"
+#include "argparse.h"
+#include "goya/goya_packets.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_CB_SIZE		0x1000
+#define BENCH_HOST_MEM_SIZE	0x200000
+#define BENCH_DEVICE_MEM_SIZE	0x200000
+#define BENCH_PKT_BUF_SIZE	0x10000
+/* The largest packet that is encoded */
+#define BENCH_PKT_MAX_SIZE	sizeof(struct packet_lin_dma)
+
+/*
+ * Allocations are counted by interposing the allocator, the library resolves
+ * malloc and friends to these definitions
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t num_allocs;
+
+__attribute__((visibility("default"))) void *malloc(size_t size)
+{
+	__atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+__attribute__((visibility("default"))) void *calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(nmemb, size);
+}
+
+__attribute__((visibility("default"))) void *realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&num_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+__attribute__((visibility("default"))) void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+/* Stub backend, every ioctl succeeds without touching any state */
+
+static uint64_t stub_next_handle;
+
+static int stub_open(const char *path, int flags)
+{
+	int minor;
+
+	if (sscanf(path, HLTHUNK_DEV_NAME_PRIMARY, &minor) != 1 || minor) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	return open("/dev/null", O_RDWR | (flags & O_CLOEXEC));
+}
+
+static int stub_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct hl_info_hw_ip_info *hw_ip;
+	struct hl_info_args *info;
+	union hl_wait_cs_args *wait;
+	union hl_mem_args *mem;
+	union hl_cs_args *cs;
+	union hl_cb_args *cb;
+
+	switch (request) {
+	case HL_IOCTL_INFO:
+		info = arg;
+		if (info->op == HL_INFO_HW_IP_INFO) {
+			hw_ip = (struct hl_info_hw_ip_info *) (uintptr_t)
+							info->return_pointer;
+			memset(hw_ip, 0, info->return_size);
+			hw_ip->device_id = PCI_IDS_GOYA;
+		} else {
+			memset((void *) (uintptr_t) info->return_pointer, 0,
+				info->return_size);
+		}
+		return 0;
+	case HL_IOCTL_CB:
+		cb = arg;
+		if (cb->in.op == HL_CB_OP_CREATE)
+			cb->out.cb_handle = ++stub_next_handle * getpagesize();
+		return 0;
+	case HL_IOCTL_CS:
+		cs = arg;
+		memset(&cs->out, 0, sizeof(cs->out));
+		cs->out.seq = ++stub_next_handle;
+		cs->out.status = HL_CS_STATUS_SUCCESS;
+		return 0;
+	case HL_IOCTL_WAIT_CS:
+		wait = arg;
+		memset(&wait->out, 0, sizeof(wait->out));
+		wait->out.status = HL_WAIT_CS_STATUS_COMPLETED;
+		return 0;
+	case HL_IOCTL_MEMORY:
+		mem = arg;
+		if (mem->in.op == HL_MEM_OP_ALLOC)
+			mem->out.handle = ++stub_next_handle;
+		else if (mem->in.op == HL_MEM_OP_MAP)
+			mem->out.device_virt_addr =
+					++stub_next_handle * 0x200000ull;
+		return 0;
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+}
+
+static void *stub_mmap(void *addr, size_t len, int prot, int flags, int fd,
+			off_t offset)
+{
+	return mmap(addr, len, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+}
+
+static const struct hlthunk_backend_ops stub_backend = {
+	.name = "stub",
+	.open = stub_open,
+	.close = close,
+	.ioctl = stub_ioctl,
+	.mmap = stub_mmap,
+	.munmap = munmap
+};
+
+struct bench_ctx {
+	int fd;
+	uint64_t cb_handle;
+	void *cb_ptr;
+	uint32_t cb_size;
+	uint64_t seq;
+	/* A CS that is known to have completed */
+	uint64_t done_seq;
+	uint64_t mem_handle;
+	void *host_mem;
+	const struct hltests_asic_funcs *asic_funcs;
+	uint8_t *pkt_buf;
+	uint32_t pkt_off;
+};
+
+struct bench {
+	const char *name;
+	int (*run)(struct bench_ctx *ctx);
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bench_command_submission(struct bench_ctx *ctx)
+{
+	struct hl_cs_chunk chunk;
+	struct hlthunk_cs_in in;
+	struct hlthunk_cs_out out;
+	int rc;
+
+	memset(&chunk, 0, sizeof(chunk));
+	chunk.cb_handle = ctx->cb_handle;
+	chunk.cb_size = ctx->cb_size;
+	chunk.queue_index = GOYA_QUEUE_ID_DMA_0;
+
+	memset(&in, 0, sizeof(in));
+	in.chunks_execute = &chunk;
+	in.num_chunks_execute = 1;
+
+	rc = hlthunk_command_submission(ctx->fd, &in, &out);
+	if (!rc)
+		ctx->seq = out.seq;
+
+	return rc;
+}
+
+static int bench_wait_for_cs(struct bench_ctx *ctx)
+{
+	uint32_t status;
+	int rc;
+
+	rc = hlthunk_wait_for_cs(ctx->fd, ctx->done_seq, 0, &status);
+	if (rc)
+		return rc;
+
+	return status == HL_WAIT_CS_STATUS_COMPLETED ? 0 : -EBUSY;
+}
+
+static int bench_get_hw_ip_info(struct bench_ctx *ctx)
+{
+	struct hlthunk_hw_ip_info hw_ip;
+
+	return hlthunk_get_hw_ip_info(ctx->fd, &hw_ip);
+}
+
+static int bench_host_memory_map(struct bench_ctx *ctx)
+{
+	uint64_t va;
+
+	va = hlthunk_host_memory_map(ctx->fd, ctx->host_mem, 0,
+					BENCH_HOST_MEM_SIZE);
+	if (!va)
+		return -ENOMEM;
+
+	return hlthunk_memory_unmap(ctx->fd, va);
+}
+
+static int bench_device_memory_map(struct bench_ctx *ctx)
+{
+	uint64_t va;
+
+	va = hlthunk_device_memory_map(ctx->fd, ctx->mem_handle, 0);
+	if (!va)
+		return -ENOMEM;
+
+	return hlthunk_memory_unmap(ctx->fd, va);
+}
+
+static int bench_cb_create(struct bench_ctx *ctx)
+{
+	uint64_t handle;
+	int rc;
+
+	rc = hlthunk_request_command_buffer(ctx->fd, BENCH_CB_SIZE, &handle);
+	if (rc)
+		return rc;
+
+	return hlthunk_destroy_command_buffer(ctx->fd, handle);
+}
+
+/*
+ * The packet encoders are the ones of the tests library, whose Goya source is
+ * built into the tool, as the library itself depends on CMocka
+ */
+static uint32_t bench_pkt_off(struct bench_ctx *ctx)
+{
+	if (ctx->pkt_off + BENCH_PKT_MAX_SIZE > BENCH_PKT_BUF_SIZE)
+		ctx->pkt_off = 0;
+
+	return ctx->pkt_off;
+}
+
+static int bench_encode_nop(struct bench_ctx *ctx)
+{
+	ctx->pkt_off = ctx->asic_funcs->add_nop_pkt(ctx->pkt_buf,
+					bench_pkt_off(ctx), EB_FALSE, MB_TRUE);
+
+	return 0;
+}
+
+static int bench_encode_msg_long(struct bench_ctx *ctx)
+{
+	struct hltests_pkt_info pkt_info;
+
+	memset(&pkt_info, 0, sizeof(pkt_info));
+	pkt_info.mb = MB_TRUE;
+	pkt_info.msg_long.address = 0x1000;
+	pkt_info.msg_long.value = ctx->pkt_off;
+
+	ctx->pkt_off = ctx->asic_funcs->add_msg_long_pkt(ctx->pkt_buf,
+					bench_pkt_off(ctx), &pkt_info);
+
+	return 0;
+}
+
+static int bench_encode_fence(struct bench_ctx *ctx)
+{
+	struct hltests_pkt_info pkt_info;
+
+	memset(&pkt_info, 0, sizeof(pkt_info));
+	pkt_info.mb = MB_TRUE;
+	pkt_info.fence.dec_val = 1;
+	pkt_info.fence.gate_val = 1;
+
+	ctx->pkt_off = ctx->asic_funcs->add_fence_pkt(ctx->pkt_buf,
+					bench_pkt_off(ctx), &pkt_info);
+
+	return 0;
+}
+
+static int bench_encode_lin_dma(struct bench_ctx *ctx)
+{
+	struct hltests_pkt_info pkt_info;
+
+	memset(&pkt_info, 0, sizeof(pkt_info));
+	pkt_info.mb = MB_TRUE;
+	pkt_info.dma.src_addr = 0x1000;
+	pkt_info.dma.dst_addr = 0x2000;
+	pkt_info.dma.size = 0x1000;
+	pkt_info.dma.dma_dir = GOYA_DMA_HOST_TO_SRAM;
+
+	ctx->pkt_off = ctx->asic_funcs->add_dma_pkt(ctx->pkt_buf,
+					bench_pkt_off(ctx), &pkt_info);
+
+	return 0;
+}
+
+static const struct bench benches[] = {
+	{ "command_submission", bench_command_submission },
+	{ "wait_for_cs_completed", bench_wait_for_cs },
+	{ "get_hw_ip_info", bench_get_hw_ip_info },
+	{ "host_memory_map_unmap", bench_host_memory_map },
+	{ "device_memory_map_unmap", bench_device_memory_map },
+	{ "cb_create_destroy", bench_cb_create },
+	{ "encode_nop", bench_encode_nop },
+	{ "encode_msg_long", bench_encode_msg_long },
+	{ "encode_fence", bench_encode_fence },
+	{ "encode_lin_dma", bench_encode_lin_dma },
+};
+
+static int bench_setup(struct bench_ctx *ctx)
+{
+	struct hltests_device hdev;
+	struct packet_nop nop;
+	uint32_t status;
+	int rc;
+
+	memset(&hdev, 0, sizeof(hdev));
+	goya_tests_set_asic_funcs(&hdev);
+	ctx->asic_funcs = hdev.asic_funcs;
+
+	rc = hlthunk_request_command_buffer(ctx->fd, BENCH_CB_SIZE,
+						&ctx->cb_handle);
+	if (rc)
+		return rc;
+
+	ctx->cb_size = sizeof(struct packet_nop);
+	ctx->host_mem = mmap(NULL, BENCH_HOST_MEM_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	ctx->pkt_buf = mmap(NULL, BENCH_PKT_BUF_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ctx->host_mem == MAP_FAILED || ctx->pkt_buf == MAP_FAILED)
+		return -ENOMEM;
+
+	ctx->mem_handle = hlthunk_device_memory_alloc(ctx->fd,
+					BENCH_DEVICE_MEM_SIZE, false, false);
+	if (!ctx->mem_handle)
+		return -ENOMEM;
+
+	ctx->cb_ptr = hlthunk_cb_mmap(ctx->fd, BENCH_CB_SIZE, ctx->cb_handle);
+	if (ctx->cb_ptr == MAP_FAILED) {
+		ctx->cb_ptr = NULL;
+		return -ENOMEM;
+	}
+
+	memset(&nop, 0, sizeof(nop));
+	nop.opcode = PACKET_NOP;
+	memcpy(ctx->cb_ptr, &nop, sizeof(nop));
+
+	/* wait_for_cs is measured on a CS that has already completed */
+	rc = bench_command_submission(ctx);
+	if (rc)
+		return rc;
+
+	rc = hlthunk_wait_for_cs(ctx->fd, ctx->seq, 10000000, &status);
+	if (rc)
+		return rc;
+	if (status != HL_WAIT_CS_STATUS_COMPLETED)
+		return -ETIMEDOUT;
+
+	ctx->done_seq = ctx->seq;
+
+	return 0;
+}
+
+static void bench_teardown(struct bench_ctx *ctx)
+{
+	uint32_t status;
+
+	if (ctx->seq)
+		hlthunk_wait_for_cs(ctx->fd, ctx->seq, 10000000, &status);
+	if (ctx->mem_handle)
+		hlthunk_device_memory_free(ctx->fd, ctx->mem_handle);
+	if (ctx->pkt_buf && ctx->pkt_buf != MAP_FAILED)
+		munmap(ctx->pkt_buf, BENCH_PKT_BUF_SIZE);
+	if (ctx->host_mem && ctx->host_mem != MAP_FAILED)
+		munmap(ctx->host_mem, BENCH_HOST_MEM_SIZE);
+	if (ctx->cb_ptr)
+		hlthunk_cb_munmap(ctx->cb_ptr, BENCH_CB_SIZE);
+	if (ctx->cb_handle)
+		hlthunk_destroy_command_buffer(ctx->fd, ctx->cb_handle);
+}
+
+static const char *const usage[] = {
+	"hlthunk_bench [options]",
+	NULL,
+};
+
+int main(int argc, const char **argv)
+{
+	const char *backend = "stub", *filter = NULL, *output = NULL;
+	const struct hlthunk_backend_ops *ops;
+	uint64_t start, elapsed, allocs;
+	struct argparse argparse;
+	struct bench_ctx ctx;
+	int iterations = 100000, i, rc = 0;
+	bool first = true;
+	size_t b;
+	FILE *out;
+
+	struct argparse_option options[] = {
+		OPT_HELP(),
+		OPT_GROUP("Basic options"),
+		OPT_STRING('b', "backend", &backend,
+			"stub (default), model or kernel"),
+		OPT_INTEGER('n', "iterations", &iterations,
+			"iterations per benchmark"),
+		OPT_STRING('f', "filter", &filter,
+			"run only benchmarks whose name contains this"),
+		OPT_STRING('o', "output", &output,
+			"write the JSON results to a file instead of stdout"),
+		OPT_END(),
+	};
+
+	argparse_init(&argparse, options, usage, 0);
+	argparse_describe(&argparse,
+		"\nMeasure the per-call cost of the library", NULL);
+	argc = argparse_parse(&argparse, argc, argv);
+	if (argc || iterations <= 0) {
+		argparse_usage(&argparse);
+		return 1;
+	}
+
+	ops = strcmp(backend, "stub") ? hlthunk_get_backend_by_name(backend) :
+					&stub_backend;
+	if (!ops || hlthunk_set_backend(ops)) {
+		fprintf(stderr, "Unknown backend %s\n", backend);
+		return 1;
+	}
+
+	out = output ? fopen(output, "w") : stdout;
+	if (!out) {
+		fprintf(stderr, "Failed to open %s: %s\n", output,
+			strerror(errno));
+		return 1;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.fd = hlthunk_open(HLTHUNK_DEVICE_DONT_CARE, NULL);
+	if (ctx.fd < 0) {
+		fprintf(stderr, "Failed to open device\n");
+		rc = ctx.fd;
+		goto close_out;
+	}
+
+	rc = bench_setup(&ctx);
+	if (rc) {
+		fprintf(stderr, "Failed to set up benchmarks: %d\n", rc);
+		goto teardown;
+	}
+
+	fprintf(out, "{\n  \"backend\": \"%s\",\n  \"iterations\": %d,\n"
+		"  \"results\": [", backend, iterations);
+
+	for (b = 0 ; b < sizeof(benches) / sizeof(benches[0]) ; b++) {
+		if (filter && !strstr(benches[b].name, filter))
+			continue;
+
+		/* Warm up caches and lazily allocated state */
+		for (i = 0 ; i < iterations / 10 + 1 ; i++)
+			benches[b].run(&ctx);
+
+		allocs = __atomic_load_n(&num_allocs, __ATOMIC_RELAXED);
+		start = now_ns();
+
+		for (i = 0 ; i < iterations ; i++) {
+			rc = benches[b].run(&ctx);
+			if (rc)
+				break;
+		}
+
+		elapsed = now_ns() - start;
+		allocs = __atomic_load_n(&num_allocs, __ATOMIC_RELAXED) -
+									allocs;
+
+		if (rc) {
+			fprintf(stderr, "Benchmark %s failed: %d\n",
+				benches[b].name, rc);
+			break;
+		}
+
+		fprintf(out, "%s\n    { \"name\": \"%s\", \"ns_per_op\": %.1f, "
+			"\"allocs_per_op\": %.3f }", first ? "" : ",",
+			benches[b].name, (double) elapsed / iterations,
+			(double) allocs / iterations);
+		first = false;
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+
+teardown:
+	bench_teardown(&ctx);
+	hlthunk_close(ctx.fd);
+close_out:
+	if (output)
+		fclose(out);
+
+	return rc ? 1 : 0;
+}
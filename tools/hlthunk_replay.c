@@ -0,0 +1,825 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+/*
+ * hlthunk_replay - replays a command submission recording that was taken with
+ * hlthunk_record_start() or with the HLTHUNK_RECORD_FILE environment variable.
+ *
+ * CBs and device/host memory are re-created on the target device, and every
+ * address inside the recorded CBs that points into a recorded mapping is
+ * patched to the new mapping before the CS is submitted. Only the CB contents
+ * are part of the recording, so host data buffers are replayed zeroed.
+ */
+
+#include "hlthunk.h"
+#include "record.h"
+#include "specs/pci_ids.h"
+#include "khash.h"
+#include "argparse.h"
+#include "goya/goya_packets.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLAY_WAIT_TIMEOUT_US	10000000
+#define REPLAY_MAX_CHUNKS	64
+
+struct replay_cb {
+	uint64_t handle;
+	void *ptr;
+	uint32_t size;
+};
+
+struct replay_seq {
+	uint64_t seq;
+	uint64_t submit_ns;
+};
+
+/* A recorded device VA range and where it lives in the replay */
+struct replay_range {
+	uint64_t old_va;
+	uint64_t new_va;
+	uint64_t size;
+	void *host_ptr;
+};
+
+struct replay_latencies {
+	uint64_t *ns;
+	uint64_t num;
+	uint64_t max;
+};
+
+KHASH_MAP_INIT_INT64(replay_cb, struct replay_cb)
+KHASH_MAP_INIT_INT64(replay_u64, uint64_t)
+KHASH_MAP_INIT_INT64(replay_seq, struct replay_seq)
+
+struct replay {
+	int fd;
+	bool fast;
+	khash_t(replay_cb) *cbs;
+	khash_t(replay_u64) *mem_handles;
+	khash_t(replay_u64) *mem_sizes;
+	khash_t(replay_seq) *seqs;
+	/* The last CS submitted to every queue, 0 if there is none */
+	uint64_t last_seqs[GOYA_QUEUE_ID_SIZE];
+	struct replay_range *ranges;
+	uint32_t num_ranges;
+	uint32_t max_ranges;
+	const struct hlthunk_rec_blob **blobs;
+	uint32_t max_blobs;
+	struct replay_latencies latencies;
+	/* CS latencies that the device model estimates */
+	struct replay_latencies model_latencies;
+	bool model;
+	uint64_t start_ns;
+	uint64_t num_cs;
+	uint64_t num_failed;
+	uint64_t num_patched;
+};
+
+static const char *const usage[] = {
+	"hlthunk_replay [options] <recording>",
+	NULL,
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void pace(struct replay *r, uint64_t ts_ns)
+{
+	struct timespec ts;
+	uint64_t elapsed;
+
+	if (r->fast)
+		return;
+
+	elapsed = now_ns() - r->start_ns;
+	if (elapsed >= ts_ns)
+		return;
+
+	ts.tv_sec = (ts_ns - elapsed) / 1000000000ull;
+	ts.tv_nsec = (ts_ns - elapsed) % 1000000000ull;
+	nanosleep(&ts, NULL);
+}
+
+static struct replay_range *find_range(struct replay *r, uint64_t va)
+{
+	uint32_t i;
+
+	for (i = 0 ; i < r->num_ranges ; i++)
+		if (va >= r->ranges[i].old_va &&
+				va < r->ranges[i].old_va + r->ranges[i].size)
+			return &r->ranges[i];
+
+	return NULL;
+}
+
+static int add_range(struct replay *r, uint64_t old_va, uint64_t new_va,
+			uint64_t size, void *host_ptr)
+{
+	struct replay_range *ranges;
+
+	if (r->num_ranges == r->max_ranges) {
+		r->max_ranges = r->max_ranges ? r->max_ranges * 2 : 64;
+		ranges = realloc(r->ranges,
+				r->max_ranges * sizeof(*ranges));
+		if (!ranges)
+			return -ENOMEM;
+		r->ranges = ranges;
+	}
+
+	r->ranges[r->num_ranges].old_va = old_va;
+	r->ranges[r->num_ranges].new_va = new_va;
+	r->ranges[r->num_ranges].size = size;
+	r->ranges[r->num_ranges].host_ptr = host_ptr;
+	r->num_ranges++;
+
+	return 0;
+}
+
+static void del_range(struct replay *r, uint64_t old_va)
+{
+	uint32_t i;
+
+	for (i = 0 ; i < r->num_ranges ; i++) {
+		if (r->ranges[i].old_va != old_va)
+			continue;
+
+		hlthunk_memory_unmap(r->fd, r->ranges[i].new_va);
+		free(r->ranges[i].host_ptr);
+		r->ranges[i] = r->ranges[--r->num_ranges];
+		return;
+	}
+}
+
+static uint64_t translate(struct replay *r, uint64_t va)
+{
+	struct replay_range *range = find_range(r, va);
+
+	if (!range)
+		return va;
+
+	r->num_patched++;
+
+	return va - range->old_va + range->new_va;
+}
+
+/*
+ * Patch all the device addresses inside a copy of a recorded CB. Addresses
+ * that are outside the recorded mappings (SRAM, registers) stay as-is.
+ */
+static void patch_cb(struct replay *r, void *cb, uint32_t size)
+{
+	uint32_t offset = 0, pkt_size;
+	uint64_t header;
+	void *pkt;
+
+	while (offset + sizeof(uint64_t) <= size) {
+		pkt = (uint8_t *) cb + offset;
+		memcpy(&header, pkt, sizeof(header));
+
+		switch ((header & PACKET_HEADER_PACKET_ID_MASK) >>
+				PACKET_HEADER_PACKET_ID_SHIFT) {
+		case PACKET_LIN_DMA: {
+			struct packet_lin_dma *lin_dma = pkt;
+
+			pkt_size = sizeof(*lin_dma);
+			if (offset + pkt_size > size)
+				return;
+			/* In memset mode the source is the fill pattern */
+			if (!lin_dma->memset_mode)
+				lin_dma->src_addr = translate(r,
+							lin_dma->src_addr);
+			lin_dma->dst_addr = translate(r, lin_dma->dst_addr);
+			break;
+		}
+		case PACKET_CP_DMA: {
+			struct packet_cp_dma *cp_dma = pkt;
+
+			pkt_size = sizeof(*cp_dma);
+			if (offset + pkt_size > size)
+				return;
+			cp_dma->src_addr = translate(r, cp_dma->src_addr);
+			break;
+		}
+		case PACKET_MSG_LONG:
+		case PACKET_MSG_PROT: {
+			struct packet_msg_long *msg_long = pkt;
+
+			pkt_size = sizeof(*msg_long);
+			if (offset + pkt_size > size)
+				return;
+			msg_long->addr = translate(r, msg_long->addr);
+			break;
+		}
+		case PACKET_WREG_BULK: {
+			struct packet_wreg_bulk *wreg_bulk = pkt;
+
+			pkt_size = sizeof(*wreg_bulk) +
+					wreg_bulk->size64 * sizeof(uint64_t);
+			break;
+		}
+		case PACKET_WREG_32:
+		case PACKET_MSG_SHORT:
+		case PACKET_FENCE:
+		case PACKET_NOP:
+		case PACKET_STOP:
+			pkt_size = sizeof(uint64_t);
+			break;
+		default:
+			/* Unknown packet, leave the rest of the CB untouched */
+			return;
+		}
+
+		offset += pkt_size;
+	}
+}
+
+static int replay_cb_create(struct replay *r, const struct hlthunk_rec_cb *rcb)
+{
+	struct replay_cb cb;
+	khint_t k;
+	int rc, ret;
+
+	rc = hlthunk_request_command_buffer(r->fd, rcb->cb_size, &cb.handle);
+	if (rc)
+		return rc;
+
+	cb.size = rcb->cb_size;
+	cb.ptr = hlthunk_cb_mmap(r->fd, cb.size, cb.handle);
+	if (cb.ptr == MAP_FAILED) {
+		hlthunk_destroy_command_buffer(r->fd, cb.handle);
+		return -errno;
+	}
+
+	k = kh_put(replay_cb, r->cbs, rcb->cb_handle, &ret);
+	if (ret < 0) {
+		hlthunk_cb_munmap(cb.ptr, cb.size);
+		hlthunk_destroy_command_buffer(r->fd, cb.handle);
+		return -ENOMEM;
+	}
+	kh_val(r->cbs, k) = cb;
+
+	return 0;
+}
+
+static void replay_cb_destroy(struct replay *r, uint64_t old_handle)
+{
+	struct replay_cb *cb;
+	khint_t k;
+
+	k = kh_get(replay_cb, r->cbs, old_handle);
+	if (k == kh_end(r->cbs))
+		return;
+
+	cb = &kh_val(r->cbs, k);
+	hlthunk_cb_munmap(cb->ptr, cb->size);
+	hlthunk_destroy_command_buffer(r->fd, cb->handle);
+	kh_del(replay_cb, r->cbs, k);
+}
+
+static int replay_mem(struct replay *r, uint16_t type,
+			const struct hlthunk_rec_mem *mem)
+{
+	uint64_t handle, va, size;
+	void *host_ptr;
+	khint_t k;
+	int ret;
+
+	switch (type) {
+	case REC_MEM_ALLOC:
+		handle = hlthunk_device_memory_alloc(r->fd, mem->size,
+				!!(mem->flags & HL_MEM_CONTIGUOUS),
+				!!(mem->flags & HL_MEM_SHARED));
+		if (!handle)
+			return -ENOMEM;
+
+		k = kh_put(replay_u64, r->mem_handles, mem->handle, &ret);
+		if (ret >= 0)
+			kh_val(r->mem_handles, k) = handle;
+		k = kh_put(replay_u64, r->mem_sizes, mem->handle, &ret);
+		if (ret >= 0)
+			kh_val(r->mem_sizes, k) = mem->size;
+		break;
+
+	case REC_MEM_FREE:
+		k = kh_get(replay_u64, r->mem_handles, mem->handle);
+		if (k == kh_end(r->mem_handles))
+			break;
+		hlthunk_device_memory_free(r->fd, kh_val(r->mem_handles, k));
+		kh_del(replay_u64, r->mem_handles, k);
+		k = kh_get(replay_u64, r->mem_sizes, mem->handle);
+		if (k != kh_end(r->mem_sizes))
+			kh_del(replay_u64, r->mem_sizes, k);
+		break;
+
+	case REC_MAP_DEVICE:
+		k = kh_get(replay_u64, r->mem_handles, mem->handle);
+		if (k == kh_end(r->mem_handles))
+			return -EINVAL;
+		handle = kh_val(r->mem_handles, k);
+
+		k = kh_get(replay_u64, r->mem_sizes, mem->handle);
+		size = k != kh_end(r->mem_sizes) ? kh_val(r->mem_sizes, k) : 0;
+
+		va = hlthunk_device_memory_map(r->fd, handle, mem->hint_addr);
+		if (!va)
+			return -ENOMEM;
+
+		return add_range(r, mem->device_virt_addr, va, size, NULL);
+
+	case REC_MAP_HOST:
+		if (posix_memalign(&host_ptr, sysconf(_SC_PAGESIZE),
+					mem->size))
+			return -ENOMEM;
+		memset(host_ptr, 0, mem->size);
+
+		va = hlthunk_host_memory_map(r->fd, host_ptr, mem->hint_addr,
+						mem->size);
+		if (!va) {
+			free(host_ptr);
+			return -ENOMEM;
+		}
+
+		ret = add_range(r, mem->device_virt_addr, va, mem->size,
+				host_ptr);
+		if (ret) {
+			hlthunk_memory_unmap(r->fd, va);
+			free(host_ptr);
+		}
+		return ret;
+
+	case REC_UNMAP:
+		del_range(r, mem->device_virt_addr);
+		break;
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int replay_blob(struct replay *r, const struct hlthunk_rec_blob *blob)
+{
+	const struct hlthunk_rec_blob **blobs;
+	uint32_t max_blobs;
+
+	if (blob->id >= r->max_blobs) {
+		max_blobs = (blob->id + 1) * 2;
+		blobs = realloc(r->blobs, max_blobs * sizeof(*blobs));
+		if (!blobs)
+			return -ENOMEM;
+		memset(blobs + r->max_blobs, 0,
+			(max_blobs - r->max_blobs) * sizeof(*blobs));
+		r->blobs = blobs;
+		r->max_blobs = max_blobs;
+	}
+
+	r->blobs[blob->id] = blob;
+
+	return 0;
+}
+
+/*
+ * Translate a recorded chunk to the replay device, and refresh the content of
+ * the CB from the recording. CBs that the recording doesn't know about (e.g. a
+ * CB in SRAM) are submitted with their original handle.
+ */
+static void translate_chunk(struct replay *r,
+				const struct hlthunk_rec_chunk *rchunk,
+				struct hl_cs_chunk *chunk)
+{
+	const struct hlthunk_rec_blob *blob = NULL;
+	struct replay_range *range;
+	void *ptr = NULL;
+	khint_t k;
+
+	memset(chunk, 0, sizeof(*chunk));
+	chunk->queue_index = rchunk->queue_index;
+	chunk->cb_size = rchunk->cb_size;
+	chunk->cb_handle = rchunk->cb_handle;
+
+	k = kh_get(replay_cb, r->cbs, rchunk->cb_handle);
+	if (k != kh_end(r->cbs)) {
+		chunk->cb_handle = kh_val(r->cbs, k).handle;
+		if (rchunk->cb_size <= kh_val(r->cbs, k).size)
+			ptr = kh_val(r->cbs, k).ptr;
+	} else {
+		range = find_range(r, rchunk->cb_handle);
+		if (range) {
+			chunk->cb_handle = rchunk->cb_handle - range->old_va +
+						range->new_va;
+			if (range->host_ptr && rchunk->cb_size <= range->size -
+					(rchunk->cb_handle - range->old_va))
+				ptr = (uint8_t *) range->host_ptr +
+					(rchunk->cb_handle - range->old_va);
+		}
+	}
+
+	if (rchunk->blob_id && rchunk->blob_id < r->max_blobs)
+		blob = r->blobs[rchunk->blob_id];
+
+	if (!ptr || !blob || blob->size != rchunk->cb_size)
+		return;
+
+	memcpy(ptr, blob + 1, blob->size);
+	patch_cb(r, ptr, blob->size);
+}
+
+static int replay_cs(struct replay *r, const struct hlthunk_rec_cs *rcs)
+{
+	const struct hlthunk_rec_chunk *rchunks =
+				(const struct hlthunk_rec_chunk *) (rcs + 1);
+	struct hl_cs_chunk chunks[REPLAY_MAX_CHUNKS];
+	struct hlthunk_cs_in in;
+	struct hlthunk_cs_out out;
+	struct replay_seq *seq;
+	uint32_t i, num_chunks;
+	khint_t k;
+	int rc, ret;
+
+	/* CSs that failed during the recording are not replayed */
+	if (rcs->rc)
+		return 0;
+
+	num_chunks = rcs->num_chunks_restore + rcs->num_chunks_execute;
+	if (num_chunks > REPLAY_MAX_CHUNKS)
+		return -E2BIG;
+
+	for (i = 0 ; i < num_chunks ; i++)
+		translate_chunk(r, &rchunks[i], &chunks[i]);
+
+	memset(&in, 0, sizeof(in));
+	in.chunks_restore = chunks;
+	in.num_chunks_restore = rcs->num_chunks_restore;
+	in.chunks_execute = chunks + rcs->num_chunks_restore;
+	in.num_chunks_execute = rcs->num_chunks_execute;
+	in.flags = rcs->flags;
+
+	memset(&out, 0, sizeof(out));
+	rc = hlthunk_command_submission(r->fd, &in, &out);
+	r->num_cs++;
+	if (rc || out.status != HL_CS_STATUS_SUCCESS) {
+		r->num_failed++;
+		return 0;
+	}
+
+	for (i = 0 ; i < num_chunks ; i++)
+		if (chunks[i].queue_index < GOYA_QUEUE_ID_SIZE)
+			r->last_seqs[chunks[i].queue_index] = out.seq;
+
+	k = kh_put(replay_seq, r->seqs, rcs->seq, &ret);
+	if (ret < 0)
+		return -ENOMEM;
+
+	seq = &kh_val(r->seqs, k);
+	seq->seq = out.seq;
+	seq->submit_ns = now_ns();
+
+	return 0;
+}
+
+static int add_latency(struct replay_latencies *lat, uint64_t ns)
+{
+	uint64_t *latencies;
+
+	if (lat->num == lat->max) {
+		lat->max = lat->max ? lat->max * 2 : 1024;
+		latencies = realloc(lat->ns, lat->max * sizeof(*latencies));
+		if (!latencies)
+			return -ENOMEM;
+		lat->ns = latencies;
+	}
+
+	lat->ns[lat->num++] = ns;
+
+	return 0;
+}
+
+static int replay_wait_cs(struct replay *r,
+				const struct hlthunk_rec_wait_cs *rwait)
+{
+	struct hlthunk_model_cs_times times;
+	struct replay_seq seq;
+	uint32_t status;
+	khint_t k;
+	int rc;
+
+	k = kh_get(replay_seq, r->seqs, rwait->seq);
+	if (k == kh_end(r->seqs))
+		return 0;
+
+	seq = kh_val(r->seqs, k);
+
+	rc = hlthunk_wait_for_cs(r->fd, seq.seq, REPLAY_WAIT_TIMEOUT_US,
+					&status);
+	if (rc || status != HL_WAIT_CS_STATUS_COMPLETED) {
+		r->num_failed++;
+		return 0;
+	}
+
+	kh_del(replay_seq, r->seqs, k);
+
+	if (r->model && !hlthunk_model_get_cs_times(r->fd, seq.seq, &times)) {
+		rc = add_latency(&r->model_latencies,
+					times.done_ns - times.submit_ns);
+		if (rc)
+			return rc;
+	}
+
+	return add_latency(&r->latencies, now_ns() - seq.submit_ns);
+}
+
+/* Checks that the payload of a record holds everything its type refers to */
+static bool record_fits(const struct hlthunk_rec_hdr *hdr)
+{
+	const struct hlthunk_rec_blob *blob =
+				(const struct hlthunk_rec_blob *) (hdr + 1);
+	const struct hlthunk_rec_cs *cs =
+				(const struct hlthunk_rec_cs *) (hdr + 1);
+	uint64_t size;
+
+	switch (hdr->type) {
+	case REC_CB_CREATE:
+	case REC_CB_DESTROY:
+		return hdr->size >= sizeof(struct hlthunk_rec_cb);
+	case REC_MEM_ALLOC:
+	case REC_MEM_FREE:
+	case REC_MAP_DEVICE:
+	case REC_MAP_HOST:
+	case REC_UNMAP:
+		return hdr->size >= sizeof(struct hlthunk_rec_mem);
+	case REC_BLOB:
+		return hdr->size >= sizeof(*blob) &&
+			blob->size <= hdr->size - sizeof(*blob);
+	case REC_CS:
+		if (hdr->size < sizeof(*cs))
+			return false;
+		size = ((uint64_t) cs->num_chunks_restore +
+				cs->num_chunks_execute) *
+				sizeof(struct hlthunk_rec_chunk);
+		return size <= hdr->size - sizeof(*cs);
+	case REC_WAIT_CS:
+		return hdr->size >= sizeof(struct hlthunk_rec_wait_cs);
+	default:
+		return true;
+	}
+}
+
+static int replay_record(struct replay *r, const struct hlthunk_rec_hdr *hdr)
+{
+	const void *payload = hdr + 1;
+
+	if (!record_fits(hdr))
+		return -EINVAL;
+
+	switch (hdr->type) {
+	case REC_CB_CREATE:
+		return replay_cb_create(r, payload);
+	case REC_CB_DESTROY:
+		replay_cb_destroy(r, ((const struct hlthunk_rec_cb *)
+					payload)->cb_handle);
+		return 0;
+	case REC_MEM_ALLOC:
+	case REC_MEM_FREE:
+	case REC_MAP_DEVICE:
+	case REC_MAP_HOST:
+	case REC_UNMAP:
+		return replay_mem(r, hdr->type, payload);
+	case REC_BLOB:
+		return replay_blob(r, payload);
+	case REC_CS:
+		pace(r, hdr->ts_ns);
+		return replay_cs(r, payload);
+	case REC_WAIT_CS:
+		return replay_wait_cs(r, payload);
+	default:
+		/* Skip records of newer versions */
+		return 0;
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_latencies(const char *name, struct replay_latencies *lat)
+{
+	uint64_t n = lat->num;
+
+	if (!n)
+		return;
+
+	qsort(lat->ns, n, sizeof(*lat->ns), cmp_u64);
+
+	printf("%s [us]: p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n", name,
+		lat->ns[n * 50 / 100] / 1e3,
+		lat->ns[n * 90 / 100] / 1e3,
+		lat->ns[n * 99 / 100] / 1e3,
+		lat->ns[n - 1] / 1e3);
+}
+
+/* The device model estimates how the replay would perform on a device */
+static void print_model_stats(struct replay *r)
+{
+	struct hlthunk_model_engine_util util;
+	uint32_t i;
+
+	if (hlthunk_model_get_engine_util(r->fd, &util) || !util.elapsed_ns)
+		return;
+
+	printf("Model: device time %.3f ms\n", util.elapsed_ns / 1e6);
+	print_latencies("Model: CS latency", &r->model_latencies);
+
+	printf("Model: engine utilization [%%]:");
+	for (i = 0 ; i < GOYA_ENGINE_ID_SIZE ; i++)
+		printf(" %.1f", util.busy_ns[i] * 100.0 / util.elapsed_ns);
+	printf("\n");
+}
+
+static void print_stats(struct replay *r, uint64_t elapsed_ns)
+{
+	printf("Replayed %" PRIu64 " CSs (%" PRIu64 " failed) in %.3f ms, %.1f CS/s\n",
+		r->num_cs, r->num_failed, elapsed_ns / 1e6,
+		elapsed_ns ? r->num_cs * 1e9 / elapsed_ns : 0);
+	printf("Patched %" PRIu64 " device addresses\n", r->num_patched);
+
+	print_latencies("CS latency", &r->latencies);
+
+	if (r->model)
+		print_model_stats(r);
+}
+
+/* The CBs and the memory of CSs that are still in flight must stay */
+static void replay_drain(struct replay *r)
+{
+	uint32_t status, i;
+
+	for (i = 0 ; i < GOYA_QUEUE_ID_SIZE ; i++)
+		if (r->last_seqs[i])
+			hlthunk_wait_for_cs(r->fd, r->last_seqs[i],
+					REPLAY_WAIT_TIMEOUT_US, &status);
+}
+
+static void replay_cleanup(struct replay *r)
+{
+	khint_t k;
+
+	replay_drain(r);
+
+	for (k = kh_begin(r->cbs) ; k != kh_end(r->cbs) ; k++)
+		if (kh_exist(r->cbs, k)) {
+			hlthunk_cb_munmap(kh_val(r->cbs, k).ptr,
+						kh_val(r->cbs, k).size);
+			hlthunk_destroy_command_buffer(r->fd,
+						kh_val(r->cbs, k).handle);
+		}
+
+	while (r->num_ranges)
+		del_range(r, r->ranges[0].old_va);
+
+	for (k = kh_begin(r->mem_handles) ; k != kh_end(r->mem_handles) ; k++)
+		if (kh_exist(r->mem_handles, k))
+			hlthunk_device_memory_free(r->fd,
+						kh_val(r->mem_handles, k));
+
+	kh_destroy(replay_cb, r->cbs);
+	kh_destroy(replay_u64, r->mem_handles);
+	kh_destroy(replay_u64, r->mem_sizes);
+	kh_destroy(replay_seq, r->seqs);
+	free(r->ranges);
+	free(r->blobs);
+	free(r->latencies.ns);
+	free(r->model_latencies.ns);
+}
+
+int main(int argc, const char **argv)
+{
+	const struct hlthunk_rec_file_hdr *file_hdr;
+	const struct hlthunk_rec_hdr *hdr;
+	const char *pciaddr = NULL;
+	struct argparse argparse;
+	struct replay r;
+	struct stat st;
+	uint64_t offset;
+	void *trace;
+	int fast = 0, trace_fd, rc;
+
+	struct argparse_option options[] = {
+		OPT_HELP(),
+		OPT_GROUP("Basic options"),
+		OPT_STRING('p', "pciaddr", &pciaddr, "pci address of device"),
+		OPT_BOOLEAN('f', "fast", &fast,
+			"submit as fast as possible instead of recorded pace"),
+		OPT_END(),
+	};
+
+	argparse_init(&argparse, options, usage, 0);
+	argparse_describe(&argparse,
+		"\nReplay a command submission recording", NULL);
+	argc = argparse_parse(&argparse, argc, argv);
+	if (argc != 1) {
+		argparse_usage(&argparse);
+		return 1;
+	}
+
+	trace_fd = open(argv[0], O_RDONLY);
+	if (trace_fd < 0 || fstat(trace_fd, &st)) {
+		fprintf(stderr, "Failed to open %s: %s\n", argv[0],
+			strerror(errno));
+		return 1;
+	}
+
+	if (st.st_size < (off_t) sizeof(*file_hdr)) {
+		fprintf(stderr, "%s is not a recording\n", argv[0]);
+		close(trace_fd);
+		return 1;
+	}
+
+	trace = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, trace_fd, 0);
+	close(trace_fd);
+	if (trace == MAP_FAILED) {
+		fprintf(stderr, "Failed to map %s\n", argv[0]);
+		return 1;
+	}
+
+	file_hdr = trace;
+	if (file_hdr->magic != HLTHUNK_REC_MAGIC ||
+			file_hdr->version != HLTHUNK_REC_VERSION ||
+			file_hdr->hdr_size > st.st_size) {
+		fprintf(stderr, "%s is not a valid recording\n", argv[0]);
+		rc = -EINVAL;
+		goto unmap_trace;
+	}
+
+	memset(&r, 0, sizeof(r));
+	r.fast = fast;
+	r.model = !strcmp(hlthunk_get_backend()->name, "model");
+	r.fd = hlthunk_open(HLTHUNK_DEVICE_DONT_CARE, pciaddr);
+	if (r.fd < 0) {
+		fprintf(stderr, "Failed to open device\n");
+		rc = r.fd;
+		goto unmap_trace;
+	}
+
+	if (hlthunk_get_device_id_from_fd(r.fd) != file_hdr->device_id)
+		fprintf(stderr,
+			"Warning: recording was taken on device id 0x%x\n",
+			file_hdr->device_id);
+
+	r.cbs = kh_init(replay_cb);
+	r.mem_handles = kh_init(replay_u64);
+	r.mem_sizes = kh_init(replay_u64);
+	r.seqs = kh_init(replay_seq);
+
+	r.start_ns = now_ns();
+	rc = 0;
+
+	for (offset = file_hdr->hdr_size ;
+			offset + sizeof(*hdr) <= (uint64_t) st.st_size ;
+			offset += sizeof(*hdr) + hdr->size) {
+		hdr = (const struct hlthunk_rec_hdr *)
+				((const uint8_t *) trace + offset);
+		if (offset + sizeof(*hdr) + hdr->size > (uint64_t) st.st_size)
+			break;
+
+		rc = replay_record(&r, hdr);
+		if (rc) {
+			fprintf(stderr,
+				"Failed to replay record %u at offset %" PRIu64 ": %d\n",
+				hdr->type, offset, rc);
+			break;
+		}
+	}
+
+	print_stats(&r, now_ns() - r.start_ns);
+
+	replay_cleanup(&r);
+	hlthunk_close(r.fd);
+unmap_trace:
+	munmap(trace, st.st_size);
+
+	return rc ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: MIT
+
+/*
+ * Copyright 2019 HabanaLabs, Ltd.
+ * All Rights Reserved.
+ */
+
+/*
+ * hlthunk_trace_decode - decodes a CoreSight trace that was captured with
+ * hlthunk_trace_start() into the busy intervals of the traced engines. The
+ * output is in the Chrome trace event format, which chrome://tracing and
+ * Perfetto display as a timeline per engine.
+ */
+
+#include "hlthunk.h"
+#include "argparse.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const usage[] = {
+	"hlthunk_trace_decode [options] <trace>",
+	NULL,
+};
+
+int main(int argc, const char **argv)
+{
+	struct hlthunk_trace_decode_params params;
+	struct hlthunk_trace_decode_stats stats;
+	const char *json_path = "trace.json", *freq = NULL;
+	struct argparse argparse;
+	int busy_event = 0, idle_event = 1, num_threads = 0, rc;
+
+	struct argparse_option options[] = {
+		OPT_HELP(),
+		OPT_GROUP("Basic options"),
+		OPT_STRING('o', "output", &json_path,
+			"output file, trace.json by default"),
+		OPT_STRING('f', "freq", &freq,
+			"timestamp frequency in Hz, if the trace has none"),
+		OPT_INTEGER('b', "busy", &busy_event,
+			"hardware event that marks an engine busy"),
+		OPT_INTEGER('i', "idle", &idle_event,
+			"hardware event that marks an engine idle"),
+		OPT_INTEGER('j', "threads", &num_threads,
+			"number of decoding threads"),
+		OPT_END(),
+	};
+
+	argparse_init(&argparse, options, usage, 0);
+	argparse_describe(&argparse,
+		"\nDecode a CoreSight trace into engine timelines", NULL);
+	argc = argparse_parse(&argparse, argc, argv);
+	if (argc != 1 || busy_event < 0 || idle_event < 0 || num_threads < 0) {
+		argparse_usage(&argparse);
+		return 1;
+	}
+
+	memset(&params, 0, sizeof(params));
+	params.trace_path = argv[0];
+	params.json_path = json_path;
+	params.ts_freq = freq ? strtoull(freq, NULL, 0) : 0;
+	params.busy_event = busy_event;
+	params.idle_event = idle_event;
+	params.num_threads = num_threads;
+
+	rc = hlthunk_trace_decode(&params, &stats);
+	if (rc) {
+		fprintf(stderr, "Failed to decode %s: %s\n", argv[0],
+			strerror(-rc));
+		return 1;
+	}
+
+	printf("%u engines, %u segments, %lu events, %lu busy intervals\n",
+		stats.num_sources, stats.num_segments, stats.num_events,
+		stats.num_intervals);
+	if (stats.num_errors)
+		printf("%u segments had invalid packets\n", stats.num_errors);
+
+	return 0;
+}